@@ -1,8 +1,8 @@
 /* ----------------------------------------------------------------------------
  * Name    : diceserv.cpp
  * Author  : Naram Qashat (CyberBotX)
- * Version : 3.0.4
- * Date    : (Last modified) August 26, 2017
+ * Version : 3.1.0
+ * Date    : (Last modified) October 18, 2026
  * ----------------------------------------------------------------------------
  * The following applies to the non-Anope-derived portions of the code
  * (excluding the RNG):
@@ -49,6 +49,97 @@ SOFTWARE.
  * ----------------------------------------------------------------------------
  * Changelog:
  *
+ * 3.1.0 - The command modules now hold a resolved handle to DiceServ's
+ *           services that is only refreshed on module load/unload by the
+ *           DiceServModule base they share, and DiceServData no longer
+ *           resolves the core service on every roll.
+ *       - Expressions that only use + - * % and dice on integers are now
+ *           evaluated with checked 64-bit integer arithmetic.
+ *       - Dice results now keep a 64-bit sum along with their lowest and
+ *           highest faces, computed with SIMD kernels, so large pools no
+ *           longer overflow and don't need to be summed more than once.
+ *       - Repeated integer-only sets (such as 25~4d6+2) are evaluated
+ *           several at a time when no extended output is needed.
+ *       - Added a BULKROLL command which rolls the same dice many times and
+ *           only keeps a running summary of the results.
+ *       - Added an ODDS command which works out the exact distribution of
+ *           the results of an expression (using FFT convolution for large
+ *           pools of dice), falling back to estimating it by rolling.
+ *       - Added a SIMULATE command which allows larger bulk rolls and shows
+ *           a confidence interval of the mean. Both it and BULKROLL split
+ *           their rolls between a work-stealing pool of threads, each with
+ *           its own generator.
+ *       - Added an AVG mode to ROLL and CALC which works out the mean,
+ *           standard deviation and range of an expression analytically,
+ *           without rolling it. The same summary is used to refuse rolls
+ *           that can only overflow and to skip starting threads for small
+ *           simulations.
+ *       - Added keep/drop highest/lowest (kh, kl, dh, dl), reroll (r) and
+ *           explode (!) modifiers for dice, with dropped dice shown in
+ *           reverse in extended output. DND3ECHAR and EARTHDAWN now use
+ *           them instead of adjusting their results afterwards.
+ *       - Dice can count successes (such as 12d10>=8), optionally with
+ *           doubled successes and botches, using a single-pass SIMD kernel.
+ *           Successes are shown in bold in extended output.
+ *       - Dice can have custom faces (such as 4d{-1,0,0,1}), which are
+ *           rolled as normal dice and looked up in the list of faces.
+ *       - Added a TABLE command which draws from weighted tables, either
+ *           from the configuration or set on channels with SET TABLE. Tables
+ *           are compiled into alias tables, with any tables they refer to
+ *           flattened into them, so each draw takes constant time.
+ *       - Added a DECK command which keeps a deck of cards for each channel,
+ *           shuffled a card at a time as cards are drawn so that shuffling
+ *           the whole deck back in takes constant time.
+ *       - Added an INIT command which keeps a sorted initiative order for
+ *           each channel. Characters that use the same dice are rolled
+ *           together, with the dice only parsed once for all of them.
+ *       - Added a MACRO command which sets named dice expressions on accounts
+ *           and channels, rolled by giving @name. A macro is parsed when it
+ *           is set, and rolling it reuses that instead of parsing it again.
+ *       - Added a STAT command which sets named whole numbers on accounts,
+ *           used in dice by giving $name. Stats are given slots when dice
+ *           are parsed, so rolling loads them by index and a parsed macro
+ *           stays valid when the stats it uses change.
+ *       - Dice can be bound to names at the start of an expression (such as
+ *           $x=1d20;$x+$x), the dice being rolled once into a register that
+ *           each use of the name reads from.
+ *       - Added a DEFINE command which sets functions that can be called in
+ *           any dice, such as adv(5). A call is inlined into the dice when
+ *           they are parsed, and a function can't call itself.
+ *       - Fixed a crash when a function taking any number of arguments (min
+ *           or max) was given as an argument to another function.
+ *       - Added comparison (< <= > >= == !=), boolean (&& || !) and
+ *           conditional (?: and if) operators. They are worked out without
+ *           branching, also for repeated integer-only rolls, except that the
+ *           dice of a branch that isn't used aren't rolled.
+ *       - Added a SET INLINE option which rolls dice given as [[dice]] in a
+ *           channel's messages. Messages are scanned for [[ before anything
+ *           else is looked at, with SSE2 where the compiler targets it, so
+ *           messages without dice cost next to nothing.
+ *       - Added a MULTIROLL command which rolls a list of dice separated by ;
+ *           at once. The checks on the user and the channel are only done
+ *           once, dice that are the same are parsed once and rolled as sets,
+ *           and the results are packed into as few lines as will fit.
+ *       - The core keeps a list of each kind of object that is ignored, so
+ *           LIST IGNORE only goes over what is ignored instead of every
+ *           channel and nick, and the ignored objects can be counted in
+ *           constant time.
+ *       - Fixed LIST refusing REG as its last parameter.
+ *       - LIST compiles its mask once instead of matching it from scratch
+ *           against every name, and has LIMIT and FROM to page through long
+ *           lists. It stops looking once it has found one more match than it
+ *           shows, and the totals it shows come from the sizes of the lists.
+ *       - STATUS uses the list of users logged into an account instead of
+ *           going over every user online, and can be given more than one
+ *           channel or nick at once. Ignoring an account ignores all of the
+ *           users logged into it, and a user is ignored when they identify
+ *           to an ignored account, not only when they connect or change
+ *           nicks.
+ *       - Rolls check for ignores by going by the list of ignored objects
+ *           of each kind first, so when nothing of a kind is ignored the
+ *           check needs no lookup, and the channel's quiet list is only
+ *           matched against last. STATUS without a channel or nick shows
+ *           how often this happens and about how much time it has saved.
  * 3.0.4 - Replaced Agner Fog's SFMT+MOA RNG with a dSFMT RNG by the authors
  *           of the Mersenne Twister RNG, mainly due to concerns over the RNG
  *           not producing unbiased results.
@@ -146,17 +237,34 @@ SOFTWARE.
 #include <functional>
 #include <cctype>
 #include <cmath>
+#include <complex>
 #include <cstdlib>
 #include <ctime>
+#include <deque>
+#include <map>
+#include <set>
 #include "diceserv.h"
 #ifdef _MSC_VER
 # include <float.h>
 #endif
+#ifndef _WIN32
+# include <sys/time.h>
+#endif
 #include <emmintrin.h>
+#ifdef __AVX2__
+# include <immintrin.h>
+#endif
 
 static const int DICE_MAX_TIMES = 25;
 static const unsigned DICE_MAX_DICE = 99999;
 static const unsigned DICE_MAX_SIDES = 99999;
+/** The number of repetitions of an expression that EvaluatePostfixLanes evaluates together */
+static const int DICE_LANES = 8;
+/** The most possible results that ODDS will keep track of for a single distribution */
+static const size_t DICE_MAX_DISTRIBUTION = 1 << 18;
+
+/** The core service itself, set while the core module is loaded so DiceServData can call into it without looking it up. */
+static DiceServService *diceServCore = NULL;
 
 /** Determine if the double-precision floating point value is infinite or not.
  * @param num The double-precision floating point value to check
@@ -444,12 +552,203 @@ public:
 	{
 		return static_cast<int>(std::floor(this->genrand_close_open() * (max - min + 1)) + min);
 	}
+
+	/** Generate a random number within [0, 1).
+	 * @return A number in the interval 0 <= x < 1
+	 */
+	double Random()
+	{
+		return this->genrand_close_open();
+	}
 };
 
 const dSFMT216091::X128I_T dSFMT216091::sse2_param_mask = { { DSFMT_MSK1, DSFMT_MSK2 } };
 
 static dSFMT216091 sfmtRNG(static_cast<uint32_t>(std::time(NULL)));
 
+/* dSFMT216091 isn't thread-safe, so each of a bulk roll's threads is given its own generator while it is running. */
+#ifdef _MSC_VER
+# define DICE_THREAD_LOCAL __declspec(thread)
+#else
+# define DICE_THREAD_LOCAL __thread
+#endif
+static DICE_THREAD_LOCAL dSFMT216091 *threadRNG = NULL;
+
+/** Get the random number generator for the current thread.
+ * @return The thread's own generator if it was given one, otherwise the main generator
+ */
+static inline dSFMT216091 &RNG()
+{
+	return threadRNG ? *threadRNG : sfmtRNG;
+}
+
+/** Reduce a block of dice faces to their sum, lowest and highest values in a single pass.
+ * @param faces Pointer to the first face
+ * @param count Number of faces, must be at least 1
+ * @param sum Reference to store the 64-bit sum of the faces in
+ * @param lowest Reference to store the lowest face in
+ * @param highest Reference to store the highest face in
+ *
+ * Uses AVX2 when DiceServ is compiled with it enabled, and SSE2 otherwise. Faces are never larger than DICE_MAX_SIDES, so the signed 32-bit
+ * comparisons of SSE2 are safe to use on them.
+ */
+static void SummarizeFaces(const unsigned *faces, size_t count, uint64_t &sum, unsigned &lowest, unsigned &highest)
+{
+	size_t i = 0;
+	sum = 0;
+	lowest = highest = faces[0];
+#ifdef __AVX2__
+	if (count >= 8)
+	{
+		__m256i vsum = _mm256_setzero_si256(), vmin = _mm256_set1_epi32(static_cast<int>(faces[0])), vmax = vmin;
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(faces + i));
+			vsum = _mm256_add_epi64(vsum, _mm256_add_epi64(_mm256_cvtepu32_epi64(_mm256_castsi256_si128(v)), _mm256_cvtepu32_epi64(_mm256_extracti128_si256(v, 1))));
+			vmin = _mm256_min_epu32(vmin, v);
+			vmax = _mm256_max_epu32(vmax, v);
+		}
+		uint64_t sums[4];
+		unsigned mins[8], maxs[8];
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(sums), vsum);
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(mins), vmin);
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(maxs), vmax);
+		sum = sums[0] + sums[1] + sums[2] + sums[3];
+		for (unsigned j = 0; j < 8; ++j)
+		{
+			lowest = std::min(lowest, mins[j]);
+			highest = std::max(highest, maxs[j]);
+		}
+	}
+#else
+	if (count >= 4)
+	{
+		__m128i zero = _mm_setzero_si128(), vsum = zero, vmin = _mm_set1_epi32(static_cast<int>(faces[0])), vmax = vmin;
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(faces + i));
+			vsum = _mm_add_epi64(vsum, _mm_add_epi64(_mm_unpacklo_epi32(v, zero), _mm_unpackhi_epi32(v, zero)));
+			__m128i lt = _mm_cmplt_epi32(v, vmin), gt = _mm_cmpgt_epi32(v, vmax);
+			vmin = _mm_or_si128(_mm_and_si128(lt, v), _mm_andnot_si128(lt, vmin));
+			vmax = _mm_or_si128(_mm_and_si128(gt, v), _mm_andnot_si128(gt, vmax));
+		}
+		uint64_t sums[2];
+		unsigned mins[4], maxs[4];
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(sums), vsum);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(mins), vmin);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(maxs), vmax);
+		sum = sums[0] + sums[1];
+		for (unsigned j = 0; j < 4; ++j)
+		{
+			lowest = std::min(lowest, mins[j]);
+			highest = std::max(highest, maxs[j]);
+		}
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		sum += faces[i];
+		lowest = std::min(lowest, faces[i]);
+		highest = std::max(highest, faces[i]);
+	}
+}
+
+/** Count how many dice faces in a block are at or above a threshold.
+ * @param faces Pointer to the first face
+ * @param count Number of faces
+ * @param threshold The value a face must be at or above to be counted
+ * @return The number of faces that are at or above the threshold
+ */
+static size_t CountFacesAtLeast(const unsigned *faces, size_t count, unsigned threshold)
+{
+	if (!threshold)
+		return count;
+	// No face is ever this large, and it would not fit in the signed comparisons below
+	if (threshold > static_cast<unsigned>(std::numeric_limits<int>::max()))
+		return 0;
+	size_t i = 0, counted = 0;
+#ifdef __AVX2__
+	__m256i vthreshold = _mm256_set1_epi32(static_cast<int>(threshold - 1)), vcount = _mm256_setzero_si256();
+	for (; i + 8 <= count; i += 8)
+		// Each comparison gives -1 in the lanes that pass, so subtracting it counts them
+		vcount = _mm256_sub_epi32(vcount, _mm256_cmpgt_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(faces + i)), vthreshold));
+	unsigned counts[8];
+	_mm256_storeu_si256(reinterpret_cast<__m256i *>(counts), vcount);
+	for (unsigned j = 0; j < 8; ++j)
+		counted += counts[j];
+#else
+	__m128i vthreshold = _mm_set1_epi32(static_cast<int>(threshold - 1)), vcount = _mm_setzero_si128();
+	for (; i + 4 <= count; i += 4)
+		// Each comparison gives -1 in the lanes that pass, so subtracting it counts them
+		vcount = _mm_sub_epi32(vcount, _mm_cmpgt_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(faces + i)), vthreshold));
+	unsigned counts[4];
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(counts), vcount);
+	for (unsigned j = 0; j < 4; ++j)
+		counted += counts[j];
+#endif
+	for (; i < count; ++i)
+		if (faces[i] >= threshold)
+			++counted;
+	return counted;
+}
+
+/** Count the successes in a block of dice faces in a single pass.
+ * @param faces Pointer to the first face
+ * @param count Number of faces
+ * @param low The value a face must be at or above to be a success
+ * @param high The value a face must be at or below to be a success
+ * @param doubled A face that counts as two successes when it is a success, 0 for none
+ * @param botch The value a face must be at or below to take away a success, 0 for none
+ * @return The number of successes, which is negative if there were more botches than successes
+ *
+ * Like CountFacesAtLeast, each comparison gives -1 in the lanes that pass, so the successes, the doubled successes and the botches are all
+ * tallied with one load per block of faces. All of the values are at most DICE_MAX_SIDES + 1, which fits in the signed comparisons.
+ */
+static int64_t CountSuccessFaces(const unsigned *faces, size_t count, unsigned low, unsigned high, unsigned doubled, unsigned botch)
+{
+	size_t i = 0;
+	int64_t counted = 0;
+#ifdef __AVX2__
+	__m256i vlow = _mm256_set1_epi32(static_cast<int>(low) - 1), vhigh = _mm256_set1_epi32(static_cast<int>(high) + 1),
+		vdoubled = _mm256_set1_epi32(static_cast<int>(doubled)), vbotch = _mm256_set1_epi32(static_cast<int>(botch) + 1), vcount = _mm256_setzero_si256();
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(faces + i));
+		__m256i success = _mm256_and_si256(_mm256_cmpgt_epi32(v, vlow), _mm256_cmpgt_epi32(vhigh, v));
+		vcount = _mm256_sub_epi32(vcount, success);
+		vcount = _mm256_sub_epi32(vcount, _mm256_and_si256(success, _mm256_cmpeq_epi32(v, vdoubled)));
+		vcount = _mm256_add_epi32(vcount, _mm256_cmpgt_epi32(vbotch, v));
+	}
+	int counts[8];
+	_mm256_storeu_si256(reinterpret_cast<__m256i *>(counts), vcount);
+	for (unsigned j = 0; j < 8; ++j)
+		counted += counts[j];
+#else
+	__m128i vlow = _mm_set1_epi32(static_cast<int>(low) - 1), vhigh = _mm_set1_epi32(static_cast<int>(high) + 1),
+		vdoubled = _mm_set1_epi32(static_cast<int>(doubled)), vbotch = _mm_set1_epi32(static_cast<int>(botch) + 1), vcount = _mm_setzero_si128();
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(faces + i));
+		__m128i success = _mm_and_si128(_mm_cmpgt_epi32(v, vlow), _mm_cmplt_epi32(v, vhigh));
+		vcount = _mm_sub_epi32(vcount, success);
+		vcount = _mm_sub_epi32(vcount, _mm_and_si128(success, _mm_cmpeq_epi32(v, vdoubled)));
+		vcount = _mm_add_epi32(vcount, _mm_cmplt_epi32(v, vbotch));
+	}
+	int counts[4];
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(counts), vcount);
+	for (unsigned j = 0; j < 4; ++j)
+		counted += counts[j];
+#endif
+	for (; i < count; ++i)
+	{
+		if (faces[i] >= low && faces[i] <= high)
+			counted += faces[i] == doubled ? 2 : 1;
+		if (faces[i] <= botch)
+			--counted;
+	}
+	return counted;
+}
+
 /** Determine if the given character is a number.
  * @param chr Character to check
  * @return true if the character is a number, false otherwise
@@ -487,13 +786,57 @@ static inline bool is_plusmin(char chr)
 	return chr == '+' || chr == '-';
 }
 
+/** Determine if the given character is a success counting modifier for dice, after FixInfix has rewritten it.
+ * @param chr Character to check
+ * @return true if the character is one of S, G, M, N, X or B, false otherwise
+ */
+static inline bool is_success_modifier(char chr)
+{
+	return chr == 'S' || chr == 'G' || chr == 'M' || chr == 'N' || chr == 'X' || chr == 'B';
+}
+
+/** Determine if the given character is a dice modifier, after FixInfix has rewritten it.
+ * @param chr Character to check
+ * @return true if the character is one of K, L, H, D, R, ! or a success counting modifier, false otherwise
+ */
+static inline bool is_dice_modifier(char chr)
+{
+	return chr == 'K' || chr == 'L' || chr == 'H' || chr == 'D' || chr == 'R' || chr == '!' || is_success_modifier(chr);
+}
+
+/** Determine if a token of a parsed equation is the dice operator with modifiers attached to it.
+ * @param str Token to check
+ * @return true if the token is a d followed only by modifiers and their numbers, false otherwise (such as for deg or dice with custom faces)
+ */
+static inline bool is_modified_dice(const Anope::string &str)
+{
+	if (str.length() < 2 || str[0] != 'd')
+		return false;
+	for (unsigned x = 1, len = str.length(); x < len; ++x)
+		if (!is_dice_modifier(str[x]) && (str[x] < '0' || str[x] > '9'))
+			return false;
+	return true;
+}
+
+/** Determine if the given character is a comparison, boolean or conditional operator, after FixInfix has rewritten it.
+ * @param chr Character to check
+ * @return true if the character is one of < [ > ] = # & | ~ ? or :, false otherwise
+ *
+ * [ is <=, ] is >=, # is != and ~ is the unary ! (not), see is_logic_operator_str.
+ */
+static inline bool is_logic_operator(char chr)
+{
+	return chr == '<' || chr == '[' || chr == '>' || chr == ']' || chr == '=' || chr == '#' || chr == '&' || chr == '|' || chr == '~' || chr == '?' ||
+		chr == ':';
+}
+
 /** Determine if the given character is an operator of any sort, except for parentheses.
  * @param chr Character to check
  * @return true if the character is a non-parenthesis operator, false otherwise
  */
 static inline bool is_op_noparen(char chr)
 {
-	return is_plusmin(chr) || is_muldiv(chr) || chr == '^' || chr == 'd';
+	return is_plusmin(chr) || is_muldiv(chr) || chr == '^' || chr == 'd' || is_dice_modifier(chr) || is_logic_operator(chr);
 }
 
 /** Determine if the given character is an operator of any sort.
@@ -505,12 +848,14 @@ static inline bool is_operator(char chr)
 	return chr == '(' || chr == ')' || is_op_noparen(chr);
 }
 
-/** Determine if the substring portion of the given string is a function.
+static unsigned is_user_function(const Anope::string &str, unsigned pos);
+
+/** Determine if the substring portion of the given string is a built-in function.
  * @param str String to check
  * @param pos Starting position of the substring to check, defaults to 0
- * @return 0 if the string isn't a function, or a number corresponding to the length of the function name
+ * @return 0 if the string isn't a built-in function, or a number corresponding to the length of the function name
  */
-static inline unsigned is_function(const Anope::string &str, unsigned pos = 0)
+static inline unsigned is_builtin_function(const Anope::string &str, unsigned pos = 0)
 {
 	// We only need a 5 character substring as that's the largest substring we will be looking at
 	Anope::string func = str.substr(pos, 5);
@@ -530,13 +875,147 @@ static inline unsigned is_function(const Anope::string &str, unsigned pos = 0)
 		func_3.equals_ci("log") || func_3.equals_ci("max") || func_3.equals_ci("min") || func_3.equals_ci("rad") || func_3.equals_ci("sin") ||
 		func_3.equals_ci("tan"))
 		return 3;
+	// if, which InfixToPostfix turns into a select instead of a call
+	if (func.substr(0, 2).equals_ci("if"))
+		return 2;
 	// None of the above
 	return 0;
 }
 
+/** Determine if the substring portion of the given string is a function, either one defined with DEFINE or a built-in one.
+ * @param str String to check
+ * @param pos Starting position of the substring to check, defaults to 0
+ * @return 0 if the string isn't a function, or a number corresponding to the length of the function name
+ *
+ * Functions defined with DEFINE are checked first, so that one can start with the name of a built-in function.
+ */
+static inline unsigned is_function(const Anope::string &str, unsigned pos = 0)
+{
+	unsigned func = is_user_function(str, pos);
+	return func ? func : is_builtin_function(str, pos);
+}
+
+/** Determine what the end of a partially fixed infix notation equation is, for dice modifiers that only apply right after dice.
+ * @param str The infix notation equation fixed so far
+ * @return 0 if the equation doesn't end with dice, 'd' if it ends with dice (and possibly modifiers), or 'c' if it ends with dice that count
+ * successes
+ */
+static inline char dice_chain_state(const Anope::string &str)
+{
+	bool counting = false;
+	for (size_t pos = str.length(); pos;)
+	{
+		while (pos && str[pos - 1] >= '0' && str[pos - 1] <= '9')
+			--pos;
+		if (!pos)
+			break;
+		char chr = str[--pos];
+		if (chr == 'd')
+			return counting ? 'c' : 'd';
+		if (!is_dice_modifier(chr))
+			break;
+		if (is_success_modifier(chr))
+			counting = true;
+	}
+	return 0;
+}
+
+/** Determine if the substring portion of the given string is a dice modifier.
+ * @param str String to check
+ * @param pos Starting position of the substring to check
+ * @param chain What the fixed equation ends with, from dice_chain_state
+ * @param modifier Reference to store the character the modifier is rewritten to
+ * @return 0 if the string isn't a dice modifier, or a number corresponding to the length of the modifier's name
+ *
+ * kh (or k on its own) becomes K, kl becomes L, dh becomes H, dl becomes D, r becomes R and ! right after dice stays as !. Right after dice, >= becomes S,
+ * > becomes G, <= becomes M and < becomes N, and right after one of those, = becomes X and a - followed by a number becomes B. Everything
+ * else is lowercased by FixInfix, so the uppercase characters can only come from a dice modifier. Functions have to be checked for before
+ * this is called.
+ */
+static inline unsigned is_dice_modifier_str(const Anope::string &str, unsigned pos, char chain, char &modifier)
+{
+	char curr = static_cast<char>(std::tolower(str[pos])), next = pos + 1 < str.length() ? static_cast<char>(std::tolower(str[pos + 1])) : 0;
+	switch (curr)
+	{
+		case 'k':
+			modifier = next == 'l' ? 'L' : 'K';
+			return next == 'h' || next == 'l' ? 2 : 1;
+		case 'd':
+			// A d on its own is the dice operator
+			if ((next != 'h' && next != 'l') || is_function(str, pos + 1))
+				return 0;
+			modifier = next == 'h' ? 'H' : 'D';
+			return 2;
+		case 'r':
+			modifier = 'R';
+			return 1;
+		case '!':
+			// Away from dice, or followed by =, it is the not operator instead
+			if (!chain || next == '=')
+				return 0;
+			modifier = '!';
+			return 1;
+		case '>':
+		case '<':
+			if (!chain)
+				return 0;
+			modifier = curr == '>' ? (next == '=' ? 'S' : 'G') : (next == '=' ? 'M' : 'N');
+			return next == '=' ? 2 : 1;
+		case '=':
+			if (chain != 'c')
+				return 0;
+			modifier = 'X';
+			return 1;
+		case '-':
+			if (chain != 'c' || next < '0' || next > '9')
+				return 0;
+			modifier = 'B';
+			return 1;
+	}
+	return 0;
+}
+
+/** Determine if the substring portion of the given string is a comparison, boolean or conditional operator.
+ * @param str String to check
+ * @param pos Starting position of the substring to check
+ * @param op Reference to store the character the operator is rewritten to
+ * @return 0 if the string isn't one of these operators, or a number corresponding to the length of the operator
+ *
+ * <= becomes [, >= becomes ], == (or = on its own) becomes =, != becomes #, && (or & on its own) becomes &, || (or | on its own) becomes |
+ * and ! on its own becomes ~, while <, >, ? and : stay as they are. This has to be called after is_dice_modifier_str, so that comparisons
+ * right after dice still count successes.
+ */
+static inline unsigned is_logic_operator_str(const Anope::string &str, unsigned pos, char &op)
+{
+	char curr = str[pos], next = pos + 1 < str.length() ? str[pos + 1] : 0;
+	switch (curr)
+	{
+		case '<':
+		case '>':
+			op = next == '=' ? (curr == '<' ? '[' : ']') : curr;
+			return next == '=' ? 2 : 1;
+		case '=':
+			op = '=';
+			return next == '=' ? 2 : 1;
+		case '!':
+			op = next == '=' ? '#' : '~';
+			return next == '=' ? 2 : 1;
+		case '&':
+		case '|':
+			op = curr;
+			return next == curr ? 2 : 1;
+		case '?':
+		case ':':
+			op = curr;
+			return 1;
+	}
+	return 0;
+}
+
 /** Determine the number of arguments that the given function needs.
  * @param str Function string to check
- * @return Returns 1 except for the min and max functions which return -2 (to say they require AT LEAST 2 arguments), and the atan2 and rand functions which return 2
+ * @return Returns 1 except for the min and max functions which return -2 (to say they require AT LEAST 2 arguments), the atan2 and rand functions
+ * which return 2, and the if function which returns 3
  */
 static inline int function_argument_count(const Anope::string &str)
 {
@@ -545,16 +1024,28 @@ static inline int function_argument_count(const Anope::string &str)
 		return -2;
 	if (str.equals_ci("atan2") || str.equals_ci("rand"))
 		return 2;
+	if (str.equals_ci("if"))
+		return 3;
 	return 1;
 }
 
-/** Determine if the substring portion of the given string is a constant (currently only e and pi).
+/** Determine if the substring portion of the given string is a constant (e, pi or a stat, which is a $ followed by the stat's name).
  * @param str String to check
  * @param pos Starting position of the substring to check, defaults to 0
  * @return 0 if the string isn't a constant, or a number corresponding to the length of the constant's name
+ *
+ * Stats are treated as constants up until InfixToPostfix, where they are resolved to their slots.
  */
 static inline unsigned is_constant(const Anope::string &str, unsigned pos = 0)
 {
+	// $name, the name being letters, numbers and underscores
+	if (pos < str.length() && str[pos] == '$')
+	{
+		unsigned end = pos + 1;
+		for (unsigned len = str.length(); end < len && (isalnum(static_cast<unsigned char>(str[end])) || str[end] == '_'); ++end)
+			;
+		return end > pos + 1 ? end - pos : 0;
+	}
 	// We only need a 2 character substring as that's the largest substring we will be looking at
 	Anope::string constant = str.substr(pos, 2);
 	// pi
@@ -567,6 +1058,48 @@ static inline unsigned is_constant(const Anope::string &str, unsigned pos = 0)
 	return 0;
 }
 
+/** Get the precedence of an operator, after FixInfix has rewritten it.
+ * @param chr The operator's character
+ * @return The precedence, higher binding tighter, or -1 if the character isn't an operator that goes on the operator stack
+ *
+ * From tightest to loosest: d, ^, ! (not), * / %, + -, < <= > >=, == !=, &&, || and finally ?: which is the loosest.
+ */
+static inline int operator_precedence(char chr)
+{
+	switch (chr)
+	{
+		case 'd':
+			return 9;
+		case '^':
+			return 8;
+		case '~':
+			return 7;
+		case '%':
+		case '/':
+		case '*':
+			return 6;
+		case '+':
+		case '-':
+			return 5;
+		case '<':
+		case '[':
+		case '>':
+		case ']':
+			return 4;
+		case '=':
+		case '#':
+			return 3;
+		case '&':
+			return 2;
+		case '|':
+			return 1;
+		case '?':
+		case ':':
+			return 0;
+	}
+	return -1;
+}
+
 /** Determine if the given operator has a higher precedence than the operator on the top of the stack during infix to postfix conversion.
  * @param adding The operator we are adding to the stack, or an empty string if nothing is being added and we just want to remove
  * @param topstack The operator that was at the top of the operator stack
@@ -575,36 +1108,104 @@ static inline unsigned is_constant(const Anope::string &str, unsigned pos = 0)
  * In addition to the above in regards to the return value, there are other situations. If the top of the stack is an open parenthesis,
  * or is empty, a 0 will be returned to stop the stack from popping anything else. If nothing is being added to the stack and the previous
  * situation hasn't occurred, a 1 will be returned to signify to continue popping the stack until the previous situation occurs. If the operator
- * being added is a function, we return 0 to signify we aren't popping. If the top of the stack is a function, we return 1 to signify we are
- * popping. A -1 is only returned if an invalid operator is given, hopefully that will never happen.
+ * being added is a function or a not, we return 0 to signify we aren't popping, as both come before what they apply to. If the top of the stack
+ * is a function, we return 1 to signify we are popping. ^ and ?: group from the right, so neither pops itself, and a : only pops until the ?
+ * it belongs to. A -1 is only returned if an invalid operator is given, hopefully that will never happen.
  */
 static inline int would_pop(const Anope::string &adding, const Anope::string &topstack)
 {
 	if (adding.empty())
 		return topstack.empty() || topstack == "(" ? 0 : 1;
-	if (is_function(adding))
+	if (is_function(adding) || adding == "~")
 		return 0;
 	if (topstack.empty() || topstack == "(")
 		return 0;
 	if (is_function(topstack))
 		return 1;
-	if (topstack == adding && adding != "^")
-		return 1;
-	switch (adding[0])
+	if (adding == ":")
+		return topstack == "?" ? 0 : 1;
+	int add = operator_precedence(adding[0]), top = operator_precedence(topstack[0]);
+	if (add < 0 || top < 0)
+		return -1;
+	if (top == add)
+		return adding != "^" && add ? 1 : 0;
+	return top > add ? 1 : 0;
+}
+
+/** Determine if the given character is an operator that always gives an integer result when given integers.
+ * @param chr Character to check
+ * @return true if the character is +, -, *, %, d or a comparison, boolean or conditional operator, false otherwise
+ */
+static inline bool is_integer_operator(char chr)
+{
+	return is_plusmin(chr) || chr == '*' || chr == '%' || chr == 'd' || is_logic_operator(chr);
+}
+
+/** Determine if the given number can be used by the integer evaluator without changing its value.
+ * @param num The number to check
+ * @return true if the number is integral and small enough to be exactly represented by a double, false otherwise
+ */
+static inline bool is_integer_literal(double num)
+{
+	return num == std::floor(num) && std::abs(num) <= 9007199254740992.0;
+}
+
+/** Add two 64-bit integers, checking for overflow.
+ * @param a The first value
+ * @param b The second value
+ * @param result Reference to store the sum in
+ * @return true if the addition overflowed, false otherwise
+ */
+static inline bool checked_add(int64_t a, int64_t b, int64_t &result)
+{
+#if (defined(__GNUC__) && __GNUC__ >= 5) || defined(__clang__)
+	return __builtin_add_overflow(a, b, &result);
+#else
+	if ((b > 0 && a > std::numeric_limits<int64_t>::max() - b) || (b < 0 && a < std::numeric_limits<int64_t>::min() - b))
+		return true;
+	result = a + b;
+	return false;
+#endif
+}
+
+/** Subtract two 64-bit integers, checking for overflow.
+ * @param a The value to subtract from
+ * @param b The value to subtract
+ * @param result Reference to store the difference in
+ * @return true if the subtraction overflowed, false otherwise
+ */
+static inline bool checked_sub(int64_t a, int64_t b, int64_t &result)
+{
+#if (defined(__GNUC__) && __GNUC__ >= 5) || defined(__clang__)
+	return __builtin_sub_overflow(a, b, &result);
+#else
+	if ((b < 0 && a > std::numeric_limits<int64_t>::max() + b) || (b > 0 && a < std::numeric_limits<int64_t>::min() + b))
+		return true;
+	result = a - b;
+	return false;
+#endif
+}
+
+/** Multiply two 64-bit integers, checking for overflow.
+ * @param a The first value
+ * @param b The second value
+ * @param result Reference to store the product in
+ * @return true if the multiplication overflowed, false otherwise
+ */
+static inline bool checked_mul(int64_t a, int64_t b, int64_t &result)
+{
+#if (defined(__GNUC__) && __GNUC__ >= 5) || defined(__clang__)
+	return __builtin_mul_overflow(a, b, &result);
+#else
+	if (a && b)
 	{
-		case 'd':
-			return 0;
-		case '^':
-			return topstack.equals_ci("d") ? 1 : 0;
-		case '%':
-		case '/':
-		case '*':
-			return topstack == "^" || topstack.equals_ci("d") || is_muldiv(topstack[0]) ? 1 : 0;
-		case '+':
-		case '-':
-			return is_op_noparen(topstack[0]) ? 1 : 0;
+		int64_t max = std::numeric_limits<int64_t>::max(), min = std::numeric_limits<int64_t>::min();
+		if ((a > 0 && b > 0 && a > max / b) || (a < 0 && b < 0 && a < max / b) || (a > 0 && b < 0 && b < min / a) || (a < 0 && b > 0 && a < min / b))
+			return true;
 	}
-	return -1;
+	result = a * b;
+	return false;
+#endif
 }
 
 /** Calculate a die roll for the given number of sides for a set number of times.
@@ -614,83 +1215,448 @@ static inline int would_pop(const Anope::string &adding, const Anope::string &to
  */
 DiceResult Dice(int num, unsigned sides)
 {
-	DiceResult result = DiceResult(num, sides);
+	std::vector<unsigned> faces(num);
 	for (int i = 0; i < num; ++i)
 		// Get a random number between 1 and the number of sides
-		result.AddResult(sfmtRNG.Random(1, sides));
+		faces[i] = RNG().Random(1, sides);
+	DiceResult result = DiceResult(num, sides);
+	result.SetResults(faces);
 	return result;
 }
 
-/** Round a value to the given number of decimals, originally needed for Windows but also used for other OSes as well due to undefined references.
- * @param val The value to round
- * @param decimals The number of digits after the decimal point, defaults to 0
- * @return The rounded value
- *
- * NOTE: Function is a slightly modified form of the code from this page:
- * http://social.msdn.microsoft.com/forums/en-US/vclanguage/thread/a7d4bf31-6c32-4b25-bc76-21b29f5287a1/
+/** Calculate the sum of a die roll without keeping the individual results, for when they will never be shown.
+ * @param num Number of times to throw the die
+ * @param sides Number of sides on the die
+ * @return The sum of all the throws
  */
-static double my_round(double val, unsigned decimals = 0)
+static uint64_t DiceSum(int num, unsigned sides)
 {
-	if (!val) // val must be different from zero to avoid division by zero!
-		return 0;
-	double sign = std::abs(val) / val; // we obtain the sign to calculate positive always
-	double tempval = std::abs(val * std::pow(10.0, static_cast<double>(decimals))); // shift decimal places
-	unsigned tempint = static_cast<unsigned>(tempval);
-	double decimalpart = tempval - tempint; // obtain just the decimal part
-	if (decimalpart >= 0.5)
-		tempval = std::ceil(tempval); // next integer number if greater or equal to 0.5
-	else
-		tempval = std::floor(tempval); // otherwise stay in the current integer part
-	return (tempval * std::pow(10.0, -static_cast<int>(decimals))) * sign; // shift again to the normal decimal places
+	uint64_t sum = 0;
+	for (int i = 0; i < num; ++i)
+		sum += RNG().Random(1, sides);
+	return sum;
 }
 
-/** Structure to store the infix notation string as well as the positions each character is compared to the original input */
-struct Infix
+/** The modifiers attached to a dice operator, parsed from its postfix token (such as dR1K3). */
+struct DiceModifiers
 {
-	Anope::string str;
-	std::vector<unsigned> positions;
+	/** Faces at or below this are rerolled, 0 for no rerolls */
+	unsigned reroll;
+	/** true if dice explode, rolling another die when a face is at or above explodeAt */
+	bool explode;
+	unsigned explodeAt;
+	/** The keep and drop modifiers in the order they were given, each being K (keep highest), L (keep lowest), H (drop highest) or
+	 * D (drop lowest) along with its count */
+	std::vector<std::pair<char, unsigned> > selections;
+	/** true if the dice count successes instead of being summed, a success being a face from countLow to countHigh, with doubled (if not 0)
+	 * counting as two successes and faces at or below botch (if not 0) taking one away */
+	bool count;
+	unsigned countLow, countHigh, doubled, botch;
+	/** The value of each face for dice with custom faces, empty for normal dice */
+	std::vector<int> faceValues;
+	/** The modifiers as they are shown in the results */
+	Anope::string display;
+
+	DiceModifiers(const Anope::string &token, unsigned sides) : reroll(0), explode(false), explodeAt(sides), selections(), count(false), countLow(1),
+		countHigh(sides), doubled(0), botch(0), faceValues(), display("")
+	{
+		size_t x = 1, len = token.length();
+		// Custom faces can't have any other modifiers, as CheckInfix and InfixToPostfix will have made sure of
+		if (len > 1 && token[1] == '{')
+		{
+			size_t close = token.find('}');
+			sepstream faces(token.substr(2, close - 2), ',');
+			Anope::string face;
+			while (faces.GetToken(face))
+				this->faceValues.push_back(convertTo<int>(face));
+			this->display = token.substr(1, close);
+			x = len;
+		}
+		while (x < len)
+		{
+			char modifier = token[x++];
+			unsigned val = 0;
+			size_t start = x;
+			for (; x < len && token[x] >= '0' && token[x] <= '9'; ++x)
+				val = val * 10 + (token[x] - '0');
+			Anope::string number = token.substr(start, x - start);
+			switch (modifier)
+			{
+				case 'R':
+					this->reroll = val;
+					this->display += "r" + number;
+					break;
+				case '!':
+					this->explode = true;
+					// 0 explodes on the highest face
+					if (val)
+						this->explodeAt = val;
+					this->display += val ? "!" + number : "!";
+					break;
+				case 'S':
+					this->count = true;
+					this->countLow = val;
+					this->display += ">=" + number;
+					break;
+				case 'G':
+					this->count = true;
+					this->countLow = val + 1;
+					this->display += ">" + number;
+					break;
+				case 'M':
+					this->count = true;
+					this->countHigh = val;
+					this->display += "<=" + number;
+					break;
+				case 'N':
+					this->count = true;
+					this->countHigh = val ? val - 1 : 0;
+					this->display += "<" + number;
+					break;
+				case 'X':
+					this->doubled = val;
+					this->display += "=" + number;
+					break;
+				case 'B':
+					this->botch = val;
+					this->display += "-" + number;
+					break;
+				default:
+					this->selections.push_back(std::make_pair(modifier, val));
+					this->display += (modifier == 'K' ? "kh" : (modifier == 'L' ? "kl" : (modifier == 'H' ? "dh" : "dl"))) + number;
+			}
+		}
+	}
 
-	Infix(const Anope::string &newStr, std::vector<unsigned> newPositions)
+	/** Determine if the modifiers can be used on the dice.
+	 * @param sides The number of sides on the dice
+	 * @return false if every face would be rerolled or every face that is kept would explode, true otherwise
+	 */
+	bool Usable(unsigned sides) const
+	{
+		return this->reroll < sides && (!this->explode || this->explodeAt > this->reroll + 1);
+	}
+};
+
+/** Comparison of dice by their face, with ties broken by the order they were rolled in so the same dice are always selected. */
+class DiceFaceOrder
+{
+	const std::vector<unsigned> &faces;
+
+public:
+	DiceFaceOrder(const std::vector<unsigned> &f) : faces(f)
 	{
-		this->str = newStr;
-		this->positions = newPositions;
 	}
 
-	Infix(const Anope::string &newStr, unsigned newPositions[], unsigned num)
+	bool operator()(size_t a, size_t b) const
 	{
-		this->str = newStr;
-		this->positions = std::vector<unsigned>(newPositions, newPositions + sizeof(unsigned) * num);
+		return this->faces[a] != this->faces[b] ? this->faces[a] < this->faces[b] : a < b;
 	}
 };
 
-/** Fix an infix notation equation.
- * @param infix The original infix notation equation
- * @return A fixed infix notation equation
+/** Throw dice that have modifiers, keeping every face that was thrown.
+ * @param num Number of times to throw the die
+ * @param sides Number of sides on the die
+ * @param mods The modifiers for the dice, Usable() must be true for them
+ * @param faces Vector to store every face in, in the order they were thrown
+ * @param marks Vector to store the DiceFaceMark flags for each face in, only DICE_FACE_DROPPED is set here
  *
- * This will convert a single % to 1d100, place a 1 in front of any d's that have no numbers before them, change all %'s after a d into 100,
- * add *'s for implicit multiplication, and convert unary -'s to _ for easier parsing later.
+ * A rerolled face is kept but dropped, and an exploding die throws another die right after it, with at most DICE_MAX_DICE extra dice being
+ * thrown for the whole set. The keep and drop modifiers are then applied in order to the faces that still count. They only need to find
+ * the highest or lowest faces, not sort them, so nth_element is used to partition the faces around the last one that is dropped.
  */
-static Infix FixInfix(const Anope::string &infix)
+static void ModifiedDiceFaces(int num, unsigned sides, const DiceModifiers &mods, std::vector<unsigned> &faces, std::vector<unsigned char> &marks)
 {
-	if (infix == "%")
+	// Without rerolls or explosions, every die is thrown exactly once
+	if (!mods.reroll && !mods.explode)
 	{
-		unsigned tmp[] = { 0, 0, 0, 0, 0 };
-		return Infix("1d100", tmp, 5);
+		faces.resize(num);
+		marks.assign(num, 0);
+		for (int i = 0; i < num; ++i)
+			faces[i] = RNG().Random(1, sides);
 	}
-	bool prev_was_func = false, prev_was_const = false;
-	Anope::string newinfix;
-	std::vector<unsigned> positions;
-	unsigned len = infix.length();
-	for (unsigned x = 0; x < len; ++x)
+	else
 	{
-		// Check for a function, and skip it if it exists
-		unsigned func = is_function(infix, x);
-		if (func)
-		{
-			if (x && is_number(infix[x - 1]))
+		faces.reserve(num);
+		marks.reserve(num);
+		unsigned extra = 0;
+		for (int i = 0; i < num; ++i)
+			for (bool another = true; another;)
 			{
-				newinfix += '*';
-				positions.push_back(x);
+				unsigned face = RNG().Random(1, sides);
+				while (face <= mods.reroll && extra < DICE_MAX_DICE)
+				{
+					faces.push_back(face);
+					marks.push_back(DICE_FACE_DROPPED);
+					++extra;
+					face = RNG().Random(1, sides);
+				}
+				faces.push_back(face);
+				marks.push_back(0);
+				another = mods.explode && face >= mods.explodeAt && extra < DICE_MAX_DICE;
+				if (another)
+					++extra;
+			}
+	}
+	std::vector<size_t> kept;
+	for (size_t s = 0, count = mods.selections.size(); s < count; ++s)
+	{
+		kept.clear();
+		for (size_t i = 0, len = faces.size(); i < len; ++i)
+			if (!marks[i])
+				kept.push_back(i);
+		size_t select = std::min<size_t>(mods.selections[s].second, kept.size()), dropLow = 0, dropHigh = 0;
+		switch (mods.selections[s].first)
+		{
+			case 'K':
+				dropLow = kept.size() - select;
+				break;
+			case 'L':
+				dropHigh = kept.size() - select;
+				break;
+			case 'H':
+				dropHigh = select;
+				break;
+			default:
+				dropLow = select;
+		}
+		if (dropLow)
+		{
+			std::nth_element(kept.begin(), kept.begin() + dropLow - 1, kept.end(), DiceFaceOrder(faces));
+			for (size_t i = 0; i < dropLow; ++i)
+				marks[kept[i]] = DICE_FACE_DROPPED;
+		}
+		if (dropHigh)
+		{
+			std::nth_element(kept.begin(), kept.end() - dropHigh, kept.end(), DiceFaceOrder(faces));
+			for (size_t i = kept.size() - dropHigh; i < kept.size(); ++i)
+				marks[kept[i]] = DICE_FACE_DROPPED;
+		}
+	}
+}
+
+/** Add up the values of dice with custom faces.
+ * @param faces The faces that were thrown, each an index (starting at 1) into the values
+ * @param values The value of each face
+ * @return The total of the values of the faces
+ *
+ * The dice are thrown the same way as normal dice with as many sides as there are faces, so the only extra work is a table lookup per die.
+ */
+static int64_t CustomFacesTotal(const std::vector<unsigned> &faces, const std::vector<int> &values)
+{
+	int64_t total = 0;
+	for (size_t i = 0, len = faces.size(); i < len; ++i)
+		total += values[faces[i] - 1];
+	return total;
+}
+
+/** Calculate a die roll with modifiers, the same as Dice does for plain dice.
+ * @param num Number of times to throw the die
+ * @param sides Number of sides on the die
+ * @param mods The modifiers for the dice, Usable() must be true for them
+ * @return The results of the dice in a special structure
+ */
+static DiceResult ModifiedDice(int num, unsigned sides, const DiceModifiers &mods)
+{
+	std::vector<unsigned> faces;
+	std::vector<unsigned char> marks;
+	ModifiedDiceFaces(num, sides, mods, faces, marks);
+	int64_t total = 0;
+	if (!mods.faceValues.empty())
+		total = CustomFacesTotal(faces, mods.faceValues);
+	else if (mods.count)
+		// The faces are marked one by one here as they will be shown anyway
+		for (size_t i = 0, len = faces.size(); i < len; ++i)
+		{
+			if (marks[i])
+				continue;
+			if (faces[i] >= mods.countLow && faces[i] <= mods.countHigh)
+			{
+				marks[i] = DICE_FACE_SUCCESS;
+				total += faces[i] == mods.doubled ? 2 : 1;
+			}
+			if (faces[i] <= mods.botch)
+			{
+				marks[i] |= DICE_FACE_BOTCH;
+				--total;
+			}
+		}
+	DiceResult result = DiceResult(num, sides);
+	result.SetResults(faces, marks, mods.display);
+	if (!mods.faceValues.empty())
+		result.SetFaceValues(mods.faceValues);
+	if (!mods.faceValues.empty() || mods.count)
+		result.SetTotal(total);
+	return result;
+}
+
+/** Calculate the sum of a die roll with modifiers, the same as DiceSum does for plain dice.
+ * @param num Number of times to throw the die
+ * @param sides Number of sides on the die
+ * @param mods The modifiers for the dice, Usable() must be true for them
+ * @return The sum of the throws that count, or the number of successes if the dice count them
+ */
+static int64_t ModifiedDiceSum(int num, unsigned sides, const DiceModifiers &mods)
+{
+	std::vector<unsigned> faces;
+	std::vector<unsigned char> marks;
+	ModifiedDiceFaces(num, sides, mods, faces, marks);
+	if (!mods.faceValues.empty())
+		return CustomFacesTotal(faces, mods.faceValues);
+	if (mods.count)
+	{
+		// Only the faces that still count are passed to the kernel, which are all of them unless some were rerolled or dropped
+		if (mods.reroll || !mods.selections.empty())
+		{
+			size_t kept = 0;
+			for (size_t i = 0, len = faces.size(); i < len; ++i)
+				if (!marks[i])
+					faces[kept++] = faces[i];
+			faces.resize(kept);
+		}
+		return faces.empty() ? 0 : CountSuccessFaces(&faces[0], faces.size(), mods.countLow, mods.countHigh, mods.doubled, mods.botch);
+	}
+	uint64_t sum = 0;
+	for (size_t i = 0, len = faces.size(); i < len; ++i)
+		if (!marks[i])
+			sum += faces[i];
+	return static_cast<int64_t>(sum);
+}
+
+/** Round a value to the given number of decimals, originally needed for Windows but also used for other OSes as well due to undefined references.
+ * @param val The value to round
+ * @param decimals The number of digits after the decimal point, defaults to 0
+ * @return The rounded value
+ *
+ * NOTE: Function is a slightly modified form of the code from this page:
+ * http://social.msdn.microsoft.com/forums/en-US/vclanguage/thread/a7d4bf31-6c32-4b25-bc76-21b29f5287a1/
+ */
+static double my_round(double val, unsigned decimals = 0)
+{
+	if (!val) // val must be different from zero to avoid division by zero!
+		return 0;
+	double sign = std::abs(val) / val; // we obtain the sign to calculate positive always
+	double tempval = std::abs(val * std::pow(10.0, static_cast<double>(decimals))); // shift decimal places
+	unsigned tempint = static_cast<unsigned>(tempval);
+	double decimalpart = tempval - tempint; // obtain just the decimal part
+	if (decimalpart >= 0.5)
+		tempval = std::ceil(tempval); // next integer number if greater or equal to 0.5
+	else
+		tempval = std::floor(tempval); // otherwise stay in the current integer part
+	return (tempval * std::pow(10.0, -static_cast<int>(decimals))) * sign; // shift again to the normal decimal places
+}
+
+/** Divide, rounding towards negative infinity instead of towards 0.
+ * @param num The numerator
+ * @param denom The denominator, must be positive
+ * @return The floor of num / denom
+ */
+static inline int64_t floor_div(int64_t num, int64_t denom)
+{
+	int64_t quot = num / denom;
+	return num % denom < 0 ? quot - 1 : quot;
+}
+
+/** Get the current wall clock time, used to enforce BULKROLL's time limit.
+ * @return The time in milliseconds
+ *
+ * On Windows, the performance counter is used, which Anope's own headers already bring in windows.h for.
+ */
+static double wall_clock_ms()
+{
+#ifdef _WIN32
+	LARGE_INTEGER frequency, now;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&now);
+	return now.QuadPart * 1000.0 / frequency.QuadPart;
+#else
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+#endif
+}
+
+/** The most different stat names that can be given slots */
+static const unsigned DICE_MAX_STAT_SLOTS = 4096;
+
+/** The slots of the stats, by name. A stat's slot is its index in the values of every account's stats, so that a parsed equation can load
+ * a stat's value without looking its name up. Slots are kept when the last account with a stat deletes it, so a parsed equation stays valid
+ * no matter how the stats change, until the slots run out and are given out again (see DiceServCore::CompactStatSlots).
+ */
+static std::map<Anope::string, unsigned> StatSlots;
+/** The names of the stats, by slot */
+static std::vector<Anope::string> StatNames;
+/** Set when a stat is given a slot after the functions defined with DEFINE were last compiled, as a function that couldn't be compiled
+ * because it uses that stat can be compiled now
+ */
+static bool UserFunctionsStale = false;
+
+/** Get the slot of a stat, optionally giving it one if it doesn't have one yet.
+ * @param name The stat's name, in lowercase
+ * @param add true to give the stat a slot if it doesn't have one, false otherwise
+ * @return The stat's slot, or DICE_MAX_STAT_SLOTS if it doesn't have one
+ */
+static unsigned StatSlot(const Anope::string &name, bool add)
+{
+	std::map<Anope::string, unsigned>::const_iterator slot = StatSlots.find(name);
+	if (slot != StatSlots.end())
+		return slot->second;
+	if (!add || StatNames.size() >= DICE_MAX_STAT_SLOTS)
+		return DICE_MAX_STAT_SLOTS;
+	StatNames.push_back(name);
+	UserFunctionsStale = true;
+	return StatSlots[name] = StatNames.size() - 1;
+}
+
+/** Structure to store the infix notation string as well as the positions each character is compared to the original input */
+struct Infix
+{
+	Anope::string str;
+	std::vector<unsigned> positions;
+
+	Infix(const Anope::string &newStr, std::vector<unsigned> newPositions)
+	{
+		this->str = newStr;
+		this->positions = newPositions;
+	}
+
+	Infix(const Anope::string &newStr, unsigned newPositions[], unsigned num)
+	{
+		this->str = newStr;
+		this->positions = std::vector<unsigned>(newPositions, newPositions + sizeof(unsigned) * num);
+	}
+};
+
+/** Fix an infix notation equation.
+ * @param infix The original infix notation equation
+ * @return A fixed infix notation equation
+ *
+ * This will convert a single % to 1d100, place a 1 in front of any d's that have no numbers before them, change all %'s after a d into 100,
+ * leave custom faces after a d as they are, add *'s for implicit multiplication, convert unary -'s to _ for easier parsing later, rewrite dice modifiers as single characters
+ * (see is_dice_modifier_str), adding their number if it was left off, and rewrite comparison, boolean and conditional operators as single characters
+ * (see is_logic_operator_str).
+ */
+static Infix FixInfix(const Anope::string &infix)
+{
+	if (infix == "%")
+	{
+		unsigned tmp[] = { 0, 0, 0, 0, 0 };
+		return Infix("1d100", tmp, 5);
+	}
+	bool prev_was_func = false, prev_was_const = false;
+	Anope::string newinfix;
+	std::vector<unsigned> positions;
+	unsigned len = infix.length();
+	for (unsigned x = 0; x < len; ++x)
+	{
+		// Check for a function, and skip it if it exists
+		unsigned func = is_function(infix, x);
+		if (func)
+		{
+			if (x && is_number(infix[x - 1]))
+			{
+				newinfix += '*';
+				positions.push_back(x);
 			}
 			newinfix += infix.substr(x, func);
 			for (unsigned y = 0; y < func; ++y)
@@ -720,8 +1686,29 @@ static Infix FixInfix(const Anope::string &infix)
 			prev_was_const = true;
 			continue;
 		}
-		char curr = static_cast<char>(std::tolower(infix[x]));
-		if (curr == 'd')
+		char curr = static_cast<char>(std::tolower(infix[x])), modifier, op;
+		unsigned modifier_len = is_dice_modifier_str(infix, x, dice_chain_state(newinfix), modifier),
+			op_len = modifier_len ? 0 : is_logic_operator_str(infix, x, op);
+		if (modifier_len)
+		{
+			newinfix += modifier;
+			positions.push_back(x);
+			x += modifier_len - 1;
+			// The number after a modifier is optional, defaulting to 0 for explode (for the highest face) and 1 for the others, except for
+			// success counting where it is always needed
+			if (!is_success_modifier(modifier) && (x == len - 1 || (!is_number(infix[x + 1]) && infix[x + 1] != '(')))
+			{
+				newinfix += modifier == '!' ? '0' : '1';
+				positions.push_back(x);
+			}
+		}
+		else if (op_len)
+		{
+			newinfix += op;
+			positions.push_back(x);
+			x += op_len - 1;
+		}
+		else if (curr == 'd')
 		{
 			positions.push_back(x);
 			if (!x)
@@ -745,6 +1732,14 @@ static Infix FixInfix(const Anope::string &infix)
 				positions.push_back(x);
 				positions.push_back(x);
 			}
+			// Custom faces are copied as they are, CheckInfix will make sure they are valid
+			else if (x != len - 1 && infix[x + 1] == '{')
+				do
+				{
+					++x;
+					newinfix += infix[x];
+					positions.push_back(x);
+				} while (infix[x] != '}' && x != len - 1);
 		}
 		else if (curr == '(')
 		{
@@ -769,7 +1764,8 @@ static Infix FixInfix(const Anope::string &infix)
 		else if (curr == '-')
 		{
 			positions.push_back(x);
-			if (x != len - 1 && (!x ? 1 : is_op_noparen(static_cast<char>(std::tolower(infix[x - 1]))) || infix[x - 1] == '(' || infix[x - 1] == ','))
+			char prev = newinfix.empty() ? 0 : newinfix[newinfix.length() - 1];
+			if (x != len - 1 && (!prev || is_op_noparen(prev) || prev == '(' || prev == ','))
 			{
 				if (infix[x + 1] == '(' || is_function(infix, x + 1))
 				{
@@ -803,8 +1799,12 @@ static Infix FixInfix(const Anope::string &infix)
  * - All functions must have an open parenthesis after them.
  * - A comma must be prefixed by a number or close parenthesis and must be suffixed by a number, open parenthesis, _ for unary minus, constant, or function.
  * - All non-parenthesis operators must be prefixed by a number or close parenthesis and suffixed by a number, open parenthesis, _ for unary minus, constant, or function.
+ *   The exception is not, which must be prefixed by an operator, open parenthesis, or comma, if anything.
+ * - Anywhere that a number can follow, a not can follow as well.
  * - All open parentheses must be prefixed by an operator, open parenthesis, or comma and suffixed by a number, an open parenthesis, _ for unary minus, constant, or function.
  * - All close parentheses must be prefixed by a number or close parenthesis and suffixed by an operator, close parenthesis, or comma.
+ * - Custom faces must be prefixed by a d, be a list of whole numbers separated by commas and be suffixed by an operator, close parenthesis,
+ *   or comma. They are treated like a number when checking the things around them.
  */
 static bool CheckInfix(DiceServData &data, const Infix &infix)
 {
@@ -835,17 +1835,65 @@ static bool CheckInfix(DiceServData &data, const Infix &infix)
 			prev_was_const = true;
 			continue;
 		}
-		if (infix.str[x] == ',')
+		if (infix.str[x] == '{')
+		{
+			if (!x || infix.str[x - 1] != 'd')
+			{
+				data.errPos = position;
+				data.errCode = DICE_ERROR_PARSE;
+				data.errStr = "Custom faces were found that don't come right after a d.";
+				return false;
+			}
+			size_t close = infix.str.find('}', x);
+			if (close == Anope::string::npos)
+			{
+				data.errPos = infix.positions[len];
+				data.errCode = DICE_ERROR_PARSE;
+				data.errStr = "No close brace found after custom faces.";
+				return false;
+			}
+			// Each face is a whole number of at most 5 digits, optionally negative, with commas between the faces
+			unsigned faces = 1, digits = 0;
+			for (size_t y = x + 1; y <= close; ++y)
+			{
+				char chr = infix.str[y];
+				if (chr >= '0' && chr <= '9' && digits < 5)
+					++digits;
+				else if (chr == '-' && !digits && infix.str[y - 1] != '-')
+					continue;
+				else if ((chr == ',' || chr == '}') && digits && faces <= DICE_MAX_SIDES)
+				{
+					faces += chr == ',';
+					digits = 0;
+				}
+				else
+				{
+					data.errPos = infix.positions[y];
+					data.errCode = DICE_ERROR_PARSE;
+					data.errStr = "Custom faces must be whole numbers of at most 5 digits with\ncommas between them.";
+					return false;
+				}
+			}
+			if (close != len - 1 && !is_op_noparen(infix.str[close + 1]) && infix.str[close + 1] != ')' && infix.str[close + 1] != ',')
+			{
+				data.errPos = infix.positions[close + 1];
+				data.errCode = DICE_ERROR_PARSE;
+				data.errStr = "No operator or close parenthesis found after custom faces.";
+				return false;
+			}
+			x = close;
+		}
+		else if (infix.str[x] == ',')
 		{
-			if (!x ? 1 : !is_number(infix.str[x - 1]) && infix.str[x - 1] != ')' && !prev_was_const)
+			if (!x ? 1 : !is_number(infix.str[x - 1]) && infix.str[x - 1] != ')' && infix.str[x - 1] != '}' && !prev_was_const)
 			{
 				data.errPos = position;
 				data.errCode = DICE_ERROR_PARSE;
 				data.errStr = "No number or close parenthesis before comma.";
 				return false;
 			}
-			if (x == len - 1 ? 1 : !is_number(infix.str[x + 1]) && infix.str[x + 1] != '(' && infix.str[x + 1] != '_' && !is_constant(infix.str, x + 1) &&
-				!is_function(infix.str, x + 1))
+			if (x == len - 1 ? 1 : !is_number(infix.str[x + 1]) && infix.str[x + 1] != '(' && infix.str[x + 1] != '_' && infix.str[x + 1] != '~' &&
+				!is_constant(infix.str, x + 1) && !is_function(infix.str, x + 1))
 			{
 				data.errPos = position;
 				data.errCode = DICE_ERROR_PARSE;
@@ -853,17 +1901,36 @@ static bool CheckInfix(DiceServData &data, const Infix &infix)
 				return false;
 			}
 		}
+		else if (infix.str[x] == '~')
+		{
+			// Not comes before what it applies to, so it is checked like an open parenthesis
+			if (x && !is_op_noparen(infix.str[x - 1]) && infix.str[x - 1] != '(' && infix.str[x - 1] != ',')
+			{
+				data.errPos = position;
+				data.errCode = DICE_ERROR_PARSE;
+				data.errStr = "No operator or open parenthesis found before not.";
+				return false;
+			}
+			if (x == len - 1 ? 1 : !is_number(infix.str[x + 1]) && infix.str[x + 1] != '(' && infix.str[x + 1] != '_' && infix.str[x + 1] != '~' &&
+				!is_constant(infix.str, x + 1) && !is_function(infix.str, x + 1))
+			{
+				data.errPos = position;
+				data.errCode = DICE_ERROR_PARSE;
+				data.errStr = "No number or open parenthesis after operator.";
+				return false;
+			}
+		}
 		else if (is_op_noparen(infix.str[x]))
 		{
-			if (!x ? 1 : !is_number(infix.str[x - 1]) && infix.str[x - 1] != ')' && !prev_was_const)
+			if (!x ? 1 : !is_number(infix.str[x - 1]) && infix.str[x - 1] != ')' && infix.str[x - 1] != '}' && !prev_was_const)
 			{
 				data.errPos = position;
 				data.errCode = DICE_ERROR_PARSE;
 				data.errStr = "No number or close parenthesis before operator.";
 				return false;
 			}
-			if (x == len - 1 ? 1 : !is_number(infix.str[x + 1]) && infix.str[x + 1] != '(' && infix.str[x + 1] != '_' && !is_constant(infix.str, x + 1) &&
-				!is_function(infix.str, x + 1))
+			if (x == len - 1 ? 1 : !is_number(infix.str[x + 1]) && infix.str[x + 1] != '(' && infix.str[x + 1] != '_' && infix.str[x + 1] != '~' &&
+				!is_constant(infix.str, x + 1) && !is_function(infix.str, x + 1) && (infix.str[x] != 'd' || infix.str[x + 1] != '{'))
 			{
 				data.errPos = position;
 				data.errCode = DICE_ERROR_PARSE;
@@ -880,8 +1947,8 @@ static bool CheckInfix(DiceServData &data, const Infix &infix)
 				data.errStr = "No operator or open parenthesis found before current open\nparenthesis.";
 				return false;
 			}
-			if (x != len - 1 && !is_number(infix.str[x + 1]) && infix.str[x + 1] != '(' && infix.str[x + 1] != '_' && !is_constant(infix.str, x + 1) &&
-				!is_function(infix.str, x + 1))
+			if (x != len - 1 && !is_number(infix.str[x + 1]) && infix.str[x + 1] != '(' && infix.str[x + 1] != '_' && infix.str[x + 1] != '~' &&
+				!is_constant(infix.str, x + 1) && !is_function(infix.str, x + 1))
 			{
 				data.errPos = position;
 				data.errCode = DICE_ERROR_PARSE;
@@ -891,7 +1958,7 @@ static bool CheckInfix(DiceServData &data, const Infix &infix)
 		}
 		else if (infix.str[x] == ')')
 		{
-			if (x && !is_number(infix.str[x - 1]) && infix.str[x - 1] != ')' && !prev_was_const)
+			if (x && !is_number(infix.str[x - 1]) && infix.str[x - 1] != ')' && infix.str[x - 1] != '}' && !prev_was_const)
 			{
 				data.errPos = position;
 				data.errCode = DICE_ERROR_PARSE;
@@ -964,6 +2031,22 @@ static Infix TokenizeInfix(const Infix &infix)
 			}
 			x += constant - 1;
 		}
+		else if (curr == '{')
+		{
+			// Custom faces are kept together as a single token, commas and all
+			for (; infix.str[x] != '}'; ++x)
+			{
+				newinfix += infix.str[x];
+				positions.push_back(infix.positions[x]);
+			}
+			newinfix += '}';
+			positions.push_back(infix.positions[x]);
+			if (x != len - 1)
+			{
+				newinfix += ' ';
+				positions.push_back(infix.positions[x + 1]);
+			}
+		}
 		else if (curr == ',')
 		{
 			if (x && !newinfix.empty() && newinfix[newinfix.length() - 1] != ' ')
@@ -1008,7 +2091,10 @@ enum PostfixValueType
 {
 	POSTFIX_VALUE_NONE,
 	POSTFIX_VALUE_DOUBLE,
-	POSTFIX_VALUE_STRING
+	POSTFIX_VALUE_STRING,
+	POSTFIX_VALUE_STAT,
+	POSTFIX_VALUE_REGISTER,
+	POSTFIX_VALUE_JUMP
 };
 
 /** Base class for values in a postfix equation */
@@ -1183,844 +2269,3314 @@ public:
 	}
 };
 
-/** Container for the list of Postfix values */
-class Postfix
+/** Version of PostfixValue for stats (this is used for $name, which is loaded from the roller's stats when evaluated) */
+class PostfixValueStat : public PostfixValueBase
 {
-	/** A vector storing the list of Postfix values */
-	std::vector<PostfixValueBase *> values;
+	/** The stat's slot */
+	unsigned slot;
+	/** Set if the stat had a unary minus before it */
+	bool negative;
 
-public:
-	/** Default constructor, creates an empty list.
+protected:
+	/** Nothing to delete, the slot isn't allocated.
 	 */
-	Postfix() : values()
+	void Clear()
 	{
 	}
 
-	/** Copy constructor, will copy all values from another instance to this one.
+public:
+	/** Constructor that takes the stat's slot and whether it is negated.
 	 */
-	Postfix(const Postfix &postfix) : values()
+	PostfixValueStat(unsigned Slot, bool Negative) : PostfixValueBase(POSTFIX_VALUE_STAT), slot(Slot), negative(Negative)
 	{
-		this->append(postfix);
 	}
 
-	/** Destructor, will clear the list.
+	/** Gets the stat's value from the values of the roller's stats.
+	 * @param values The values of the roller's stats, can be NULL
+	 * @param number Reference to store the value in
+	 * @return true if the roller has the stat, false otherwise
 	 */
-	~Postfix()
+	bool Get(const std::vector<double> *values, double &number) const
 	{
-		this->clear();
+		if (!values || this->slot >= values->size() || is_notanumber((*values)[this->slot]))
+			return false;
+		number = this->negative ? -(*values)[this->slot] : (*values)[this->slot];
+		return true;
 	}
 
-	/** Assignment operator, will copy all values from one instance to this one, making sure to avoid memory leaks.
-	 * @param postfix The instance to copy values from
-	 * @return A reference of the current instance, for operator chaining purposes
+	/** Gets the stat's name.
+	 * @return The name
 	 */
-	Postfix &operator=(const Postfix &postfix)
+	const Anope::string &Name() const
 	{
-		if (this != &postfix)
-		{
-			this->clear();
-			this->append(postfix);
-		}
-		return *this;
+		return StatNames[this->slot];
 	}
 
-	/** Clears the list, deleting the allocated memory to prevent memory leaks.
+	/** Creates a clone of the value.
+	 * @return A clone of the value
 	 */
-	void clear()
+	PostfixValueStat *Clone() const
 	{
-		for (unsigned y = 0, len = this->values.size(); y < len; ++y)
-			delete this->values[y];
-		this->values.clear();
+		return new PostfixValueStat(*this);
 	}
+};
 
-	/** Adds a new double value to the list.
-	 * @param dbl The double value to add
+/** Version of PostfixValue for bindings (this is used for $name=...; which stores the result into a register, and for $name afterwards, which
+ * loads it back) */
+class PostfixValueRegister : public PostfixValueBase
+{
+	/** The register's index */
+	unsigned index;
+	/** Set if the value stores into the register instead of loading from it */
+	bool store;
+	/** Set if the register had a unary minus before it */
+	bool negative;
+
+protected:
+	/** Nothing to delete, the index isn't allocated.
 	 */
-	void add(double dbl)
+	void Clear()
 	{
-		this->values.push_back(new PostfixValueDouble(dbl));
 	}
 
-	/** Adds a new string value to the list.
-	 * @param str The string value to add
+public:
+	/** Constructor that takes the register's index, whether it is stored to and whether it is negated.
 	 */
-	void add(const Anope::string &str)
+	PostfixValueRegister(unsigned Index, bool Store, bool Negative) : PostfixValueBase(POSTFIX_VALUE_REGISTER), index(Index), store(Store),
+		negative(Negative)
 	{
-		this->values.push_back(new PostfixValueString(str));
 	}
 
-	/** Appends another instance to this one.
-	 * @param postfix The instance to append from
+	/** Gets the register's index.
+	 * @return The index
 	 */
-	void append(const Postfix &postfix)
+	unsigned Index() const
 	{
-		for (unsigned y = 0, len = postfix.values.size(); y < len; ++y)
-			this->values.push_back(postfix.values[y]->Clone());
+		return this->index;
 	}
 
-	/** Determine if the list is empty or not.
-	 * @return true if the list is empty, false otherwise
+	/** Gets if the value stores into the register.
+	 * @return true for a store, false for a load
 	 */
-	bool empty() const
+	bool IsStore() const
 	{
-		return this->values.empty();
+		return this->store;
 	}
 
-	/** Gets the size of the list.
-	 * @return The size of the list.
+	/** Gets if a load from the register is negated.
+	 * @return true if the loaded value is negated, false otherwise
 	 */
-	size_t size() const
+	bool IsNegative() const
 	{
-		return this->values.size();
+		return this->negative;
 	}
 
-	/** Subscript operator, will get the value at the given index.
-	 * @param index The index to look at
-	 * @return The value for the given index
+	/** Creates a clone of the value.
+	 * @return A clone of the value
 	 */
-	PostfixValueBase *operator[](unsigned index)
+	PostfixValueRegister *Clone() const
 	{
-		if (index >= this->values.size())
-			return NULL;
-		return this->values[index];
+		return new PostfixValueRegister(*this);
+	}
+};
+
+/** The kinds of jumps in a postfix notation equation */
+enum PostfixJumpKind
+{
+	/** Takes the value on the top of the stack off, and jumps if it is 0 */
+	POSTFIX_JUMP_IF_ZERO,
+	/** Always jumps */
+	POSTFIX_JUMP_ALWAYS,
+	/** Never jumps, only marks where the two branches of a conditional meet */
+	POSTFIX_JUMP_MERGE
+};
+
+/** Version of PostfixValue for jumps (this is used for conditionals with dice in their branches, so the dice of the branch not taken aren't
+ * rolled) */
+class PostfixValueJump : public PostfixValueBase
+{
+	/** The kind of jump */
+	PostfixJumpKind kind;
+	/** The number of values after this one that are skipped when jumping */
+	unsigned skip;
+
+protected:
+	/** Nothing to delete, the kind and skip aren't allocated.
+	 */
+	void Clear()
+	{
+	}
+
+public:
+	/** Constructor that takes the kind of jump and the number of values it skips.
+	 */
+	PostfixValueJump(PostfixJumpKind Kind, unsigned Skip) : PostfixValueBase(POSTFIX_VALUE_JUMP), kind(Kind), skip(Skip)
+	{
+	}
+
+	/** Gets the kind of jump.
+	 * @return The kind
+	 */
+	PostfixJumpKind Kind() const
+	{
+		return this->kind;
+	}
+
+	/** Gets the number of values skipped when jumping.
+	 * @return The number of values
+	 */
+	unsigned Skip() const
+	{
+		return this->skip;
+	}
+
+	/** Creates a clone of the value.
+	 * @return A clone of the value
+	 */
+	PostfixValueJump *Clone() const
+	{
+		return new PostfixValueJump(*this);
+	}
+};
+
+/** Container for the list of Postfix values */
+class Postfix
+{
+	/** A vector storing the list of Postfix values */
+	std::vector<PostfixValueBase *> values;
+	/** Set as long as every value added so far is an integer literal or an operator that keeps integers as integers */
+	bool integer;
+	/** The number of registers used by bindings and the parameters of inlined functions */
+	unsigned registers;
+	/** Set if any jumps were added */
+	bool jumps;
+
+public:
+	/** Default constructor, creates an empty list.
+	 */
+	Postfix() : values(), integer(true), registers(0), jumps(false)
+	{
+	}
+
+	/** Copy constructor, will copy all values from another instance to this one.
+	 */
+	Postfix(const Postfix &postfix) : values(), integer(true), registers(0), jumps(false)
+	{
+		this->append(postfix);
+	}
+
+	/** Destructor, will clear the list.
+	 */
+	~Postfix()
+	{
+		this->clear();
+	}
+
+	/** Assignment operator, will copy all values from one instance to this one, making sure to avoid memory leaks.
+	 * @param postfix The instance to copy values from
+	 * @return A reference of the current instance, for operator chaining purposes
+	 */
+	Postfix &operator=(const Postfix &postfix)
+	{
+		if (this != &postfix)
+		{
+			this->clear();
+			this->append(postfix);
+		}
+		return *this;
+	}
+
+	/** Clears the list, deleting the allocated memory to prevent memory leaks.
+	 */
+	void clear()
+	{
+		for (unsigned y = 0, len = this->values.size(); y < len; ++y)
+			delete this->values[y];
+		this->values.clear();
+		this->integer = true;
+		this->registers = 0;
+		this->jumps = false;
+	}
+
+	/** Adds a new double value to the list.
+	 * @param dbl The double value to add
+	 */
+	void add(double dbl)
+	{
+		this->values.push_back(new PostfixValueDouble(dbl));
+		if (!is_integer_literal(dbl))
+			this->integer = false;
+	}
+
+	/** Adds a new string value to the list.
+	 * @param str The string value to add
+	 */
+	void add(const Anope::string &str)
+	{
+		this->values.push_back(new PostfixValueString(str));
+		// Dice with modifiers attached are still integer operators, but functions such as deg and dice with custom faces aren't
+		if (str.length() == 1 ? !is_integer_operator(str[0]) : !is_modified_dice(str))
+			this->integer = false;
+	}
+
+	/** Adds a new stat to the list. Stats are always whole numbers, so they keep integer-only equations as they are.
+	 * @param slot The stat's slot
+	 * @param negative true if the stat is negated, false otherwise
+	 */
+	void add(unsigned slot, bool negative)
+	{
+		this->values.push_back(new PostfixValueStat(slot, negative));
+	}
+
+	/** Adds a store of the value on the top of the stack into a register, which is taken off the stack.
+	 * @param index The register's index
+	 */
+	void add_store(unsigned index)
+	{
+		this->values.push_back(new PostfixValueRegister(index, true, false));
+		this->registers = std::max(this->registers, index + 1);
+	}
+
+	/** Adds a load from a register, the register having been stored into earlier.
+	 * @param index The register's index
+	 * @param negative true if the loaded value is negated, false otherwise
+	 */
+	void add_load(unsigned index, bool negative)
+	{
+		this->values.push_back(new PostfixValueRegister(index, false, negative));
+	}
+
+	/** Adds a jump to the list.
+	 * @param kind The kind of jump
+	 * @param skip The number of values after the jump that are skipped when jumping
+	 */
+	void add_jump(PostfixJumpKind kind, unsigned skip)
+	{
+		this->values.push_back(new PostfixValueJump(kind, skip));
+		this->jumps = true;
+	}
+
+	/** Inserts another instance into the middle of this one.
+	 * @param index The index to insert at, the values from there on being moved after the inserted ones
+	 * @param postfix The instance to insert, which can't use any registers
+	 *
+	 * Jumps only ever skip forward, so this can't break a jump that is already in the list as long as nothing is inserted into the middle
+	 * of the values that it skips.
+	 */
+	void insert(unsigned index, const Postfix &postfix)
+	{
+		std::vector<PostfixValueBase *> inserted;
+		for (unsigned y = 0, len = postfix.values.size(); y < len; ++y)
+			inserted.push_back(postfix.values[y]->Clone());
+		this->values.insert(this->values.begin() + index, inserted.begin(), inserted.end());
+		if (!postfix.integer)
+			this->integer = false;
+		if (postfix.jumps)
+			this->jumps = true;
+	}
+
+	/** Removes the last value from the list.
+	 */
+	void pop_back()
+	{
+		delete this->values.back();
+		this->values.pop_back();
+	}
+
+	/** Appends another instance to this one.
+	 * @param postfix The instance to append from
+	 * @param registerBase The number to add to the index of each register of the other instance, so that an inlined function doesn't
+	 * share registers with the equation calling it, defaults to 0
+	 */
+	void append(const Postfix &postfix, unsigned registerBase = 0)
+	{
+		for (unsigned y = 0, len = postfix.values.size(); y < len; ++y)
+		{
+			const PostfixValueBase *value = postfix.values[y];
+			if (registerBase && value->Type() == POSTFIX_VALUE_REGISTER)
+			{
+				const PostfixValueRegister *reg = anope_dynamic_static_cast<const PostfixValueRegister *>(value);
+				this->values.push_back(new PostfixValueRegister(reg->Index() + registerBase, reg->IsStore(), reg->IsNegative()));
+			}
+			else
+				this->values.push_back(value->Clone());
+		}
+		if (!postfix.integer)
+			this->integer = false;
+		if (postfix.jumps)
+			this->jumps = true;
+		if (postfix.registers)
+			this->registers = std::max(this->registers, registerBase + postfix.registers);
+	}
+
+	/** Gets the number of registers used by bindings and the parameters of inlined functions.
+	 * @return The number of registers
+	 */
+	unsigned RegisterCount() const
+	{
+		return this->registers;
+	}
+
+	/** Determine if the equation can be evaluated entirely in integer arithmetic.
+	 * @return true if every number is an integer and every operator is one of + - * % d or a comparison, boolean or conditional operator,
+	 * false otherwise
+	 */
+	bool IsInteger() const
+	{
+		return this->integer;
+	}
+
+	/** Determine if the equation has any jumps, which only the evaluators that go one value at a time can follow.
+	 * @return true if there are jumps, false otherwise
+	 */
+	bool HasJumps() const
+	{
+		return this->jumps;
+	}
+
+	/** Determine if the list is empty or not.
+	 * @return true if the list is empty, false otherwise
+	 */
+	bool empty() const
+	{
+		return this->values.empty();
+	}
+
+	/** Gets the size of the list.
+	 * @return The size of the list.
+	 */
+	size_t size() const
+	{
+		return this->values.size();
+	}
+
+	/** Subscript operator, will get the value at the given index.
+	 * @param index The index to look at
+	 * @return The value for the given index
+	 */
+	PostfixValueBase *operator[](unsigned index)
+	{
+		if (index >= this->values.size())
+			return NULL;
+		return this->values[index];
 	}
 
 	/** Same as above, but for const safety. */
 	const PostfixValueBase *operator[](unsigned index) const
 	{
-		if (index >= this->values.size())
-			return NULL;
-		return this->values[index];
+		if (index >= this->values.size())
+			return NULL;
+		return this->values[index];
+	}
+};
+
+/** A function defined with DEFINE, which is inlined into every equation that calls it. */
+struct DiceUserFunction
+{
+	/** The names of the parameters, in order, without their $ */
+	std::vector<Anope::string> params;
+	/** The body, in infix notation, with each parameter given as $name */
+	Anope::string body;
+	/** The body in postfix notation, which expects each parameter to be in the register with the same index */
+	Postfix compiled;
+	/** Set once the body has been compiled, which can only happen after the functions it calls have been compiled */
+	bool ready;
+	/** Why the body couldn't be compiled, if it couldn't be */
+	Anope::string error;
+	/** The position in the body of the above error */
+	unsigned errorPos;
+
+	DiceUserFunction() : params(), body(), compiled(), ready(false), error(), errorPos(0)
+	{
+	}
+};
+
+/** The functions defined with DEFINE, keyed by their lowercased names */
+static Anope::hash_map<DiceUserFunction> UserFunctions;
+
+/** Determine if the substring portion of the given string is a function defined with DEFINE.
+ * @param str String to check
+ * @param pos Starting position of the substring to check
+ * @return 0 if the string isn't a function defined with DEFINE, or a number corresponding to the length of the function name
+ *
+ * The name is every letter from the position on, and has to be followed by an open parenthesis, a space or the end of the string, so
+ * that this is only ever one hash lookup.
+ */
+static unsigned is_user_function(const Anope::string &str, unsigned pos)
+{
+	if (UserFunctions.empty())
+		return 0;
+	unsigned end = pos, len = str.length();
+	while (end < len && isalpha(static_cast<unsigned char>(str[end])))
+		++end;
+	if (end - pos < 2 || (end < len && str[end] != '(' && str[end] != ' '))
+		return 0;
+	return UserFunctions.count(str.substr(pos, end - pos).lower()) ? end - pos : 0;
+}
+
+/** Find the functions defined with DEFINE that the body of a function calls.
+ * @param body The body, in infix notation
+ * @param calls The list to store the lowercased names of the functions in, each only once
+ */
+static void FunctionCalls(const Anope::string &body, std::vector<Anope::string> &calls)
+{
+	for (unsigned x = 0, len = body.length(); x < len; ++x)
+	{
+		// Parameters and stats can have the name of a function, so they are skipped over
+		if (body[x] == '$')
+		{
+			x += is_constant(body, x);
+			continue;
+		}
+		unsigned func = is_user_function(body, x);
+		if (!func)
+			continue;
+		Anope::string name = body.substr(x, func).lower();
+		if (std::find(calls.begin(), calls.end(), name) == calls.end())
+			calls.push_back(name);
+		x += func - 1;
+	}
+}
+
+static bool CompileUserFunctions();
+
+/** Determine if part of a postfix notation equation rolls any dice.
+ * @param postfix The postfix notation equation
+ * @param start The index of the first value of the part
+ * @return true if any value from the start on is dice or the rand function, false otherwise
+ */
+static bool RollsDice(const Postfix &postfix, unsigned start)
+{
+	for (unsigned x = start, len = postfix.size(); x < len; ++x)
+	{
+		if (postfix[x]->Type() != POSTFIX_VALUE_STRING)
+			continue;
+		const Anope::string &token = *anope_dynamic_static_cast<const PostfixValueString *>(postfix[x])->Get();
+		if ((token[0] == 'd' && !is_builtin_function(token)) || token.equals_ci("rand"))
+			return true;
+	}
+	return false;
+}
+
+/** Add a boolean or conditional operator to a postfix notation equation, whose operands are already in it.
+ * @param postfix The postfix notation equation to add to
+ * @param op The operator, & for and, | for or, or ? for a select (from ?: or the if function)
+ * @param branch The indexes where the operands after the first one start, the second index only being used for a select
+ *
+ * Each of these normally becomes a single operator that works out both sides and picks between them without branching. When a side that
+ * isn't always worked out rolls dice, jumps are added around it instead, so that its dice are only rolled when its result is used:
+ * - c ? a : b becomes c JZ a JMP b MERGE, the JZ jumping past the JMP and the JMP jumping to the MERGE.
+ * - a && b becomes a JZ b 0 != JMP 0 MERGE, which is a ? b != 0 : 0.
+ * - a || b becomes a JZ 1 JMP b 0 != MERGE, which is a ? 1 : b != 0.
+ * The evaluators that can't follow jumps treat a MERGE as a select of the three values before it, and ignore the jumps themselves.
+ */
+static void AddConditional(Postfix &postfix, char op, const std::pair<unsigned, unsigned> &branch)
+{
+	if (!RollsDice(postfix, branch.first))
+	{
+		postfix.add(Anope::string(op));
+		return;
+	}
+	unsigned right = postfix.size() - branch.first;
+	Postfix before;
+	if (op == '?')
+	{
+		Postfix jump;
+		jump.add_jump(POSTFIX_JUMP_ALWAYS, postfix.size() - branch.second);
+		postfix.insert(branch.second, jump);
+		before.add_jump(POSTFIX_JUMP_IF_ZERO, branch.second - branch.first + 1);
+	}
+	else if (op == '&')
+	{
+		before.add_jump(POSTFIX_JUMP_IF_ZERO, right + 3);
+		postfix.add(0.0);
+		postfix.add("#");
+		postfix.add_jump(POSTFIX_JUMP_ALWAYS, 1);
+		postfix.add(0.0);
+	}
+	else
+	{
+		before.add_jump(POSTFIX_JUMP_IF_ZERO, 2);
+		before.add(1.0);
+		before.add_jump(POSTFIX_JUMP_ALWAYS, right + 2);
+		postfix.add(0.0);
+		postfix.add("#");
+	}
+	postfix.insert(branch.first, before);
+	postfix.add_jump(POSTFIX_JUMP_MERGE, 0);
+}
+
+/** Move the operator on the top of the operator stack to a postfix notation equation.
+ * @param postfix The postfix notation equation to add to, cleared on failure
+ * @param op_stack The operator stack
+ * @param arity_stack The arity stack, popped if the operator is a function
+ * @param branch_stack The stack of where the operands after the first one start, popped if the operator is &, |, : or the if function
+ * @param position The position in the original equation to give if a function was given the wrong number of arguments
+ * @param registers The number of registers used so far, increased by the registers of an inlined function
+ * @return true if the operator was moved, false otherwise
+ *
+ * A built-in function that takes a variable number of arguments gets the number of arguments from the arity stack appended to its name,
+ * with an underscore before that. A function defined with DEFINE is inlined instead, its arguments being stored into registers that
+ * are new to the equation, after which its body is added with its registers moved past the equation's own. The boolean operators, the :
+ * of ?: and the if function are added with AddConditional, a ? that is still on the stack never having been given its :.
+ */
+static bool PopOperator(DiceServData &data, Postfix &postfix, std::stack<Anope::string> &op_stack, std::stack<unsigned> &arity_stack,
+	std::stack<std::pair<unsigned, unsigned> > &branch_stack, unsigned position, unsigned &registers)
+{
+	Anope::string op = op_stack.top();
+	op_stack.pop();
+	if (!is_function(op))
+	{
+		if (op == "?")
+		{
+			data.errPos = position;
+			data.errCode = DICE_ERROR_PARSE;
+			data.errStr = "A ? was found without a : after it.";
+			postfix.clear();
+			return false;
+		}
+		if (op == "&" || op == "|" || op == ":")
+		{
+			AddConditional(postfix, op == ":" ? '?' : op[0], branch_stack.top());
+			branch_stack.pop();
+		}
+		else
+			postfix.add(op);
+		return true;
+	}
+	unsigned arity = arity_stack.top();
+	arity_stack.pop();
+	Anope::hash_map<DiceUserFunction>::const_iterator function = UserFunctions.find(op.lower());
+	if (function == UserFunctions.end())
+	{
+		if (op.equals_ci("if"))
+		{
+			if (arity != 3)
+			{
+				data.errPos = position;
+				data.errCode = DICE_ERROR_PARSE;
+				data.errStr = "The function if needs 3 arguments.";
+				postfix.clear();
+				return false;
+			}
+			AddConditional(postfix, '?', branch_stack.top());
+			branch_stack.pop();
+			return true;
+		}
+		if (function_argument_count(op) < 0)
+			op += "_" + stringify(arity);
+		postfix.add(op);
+		return true;
+	}
+	const DiceUserFunction &userFunction = function->second;
+	// The function may have been loaded before a stat it uses had a slot, so it is only tried again once a stat has been given one
+	if (!userFunction.ready && UserFunctionsStale)
+		CompileUserFunctions();
+	if (!userFunction.ready || arity != userFunction.params.size())
+	{
+		data.errPos = position;
+		data.errCode = DICE_ERROR_PARSE;
+		if (!userFunction.ready)
+			data.errStr = "The function " + op.lower() + " can't be used: " + userFunction.error;
+		else
+			data.errStr = "The function " + op.lower() + " needs " + stringify(userFunction.params.size()) + " argument" +
+				(userFunction.params.size() == 1 ? "" : "s") + ".";
+		postfix.clear();
+		return false;
+	}
+	// The arguments are on the stack in order, so the last one is stored first
+	for (unsigned y = arity; y; --y)
+		postfix.add_store(registers + y - 1);
+	postfix.append(userFunction.compiled, registers);
+	registers += std::max(arity, userFunction.compiled.RegisterCount());
+	return true;
+}
+
+/** Add a binding or a stat to a postfix notation equation.
+ * @param postfix The postfix notation equation to add to, cleared if the name is neither bound nor a stat with a slot
+ * @param token The name's token, $name or _$name for a negative value
+ * @param position The position of the name in the original equation
+ * @param bindings The registers of the names bound so far in the expression
+ * @return true if the name was added, false otherwise
+ *
+ * A binding takes the place of a stat with the same name. Only stats that someone has set have slots, so any other stat can't be rolled
+ * by anyone.
+ */
+static bool AddNamedValue(DiceServData &data, Postfix &postfix, const Anope::string &token, unsigned position,
+	const std::map<Anope::string, unsigned> &bindings)
+{
+	bool negative = token[0] == '_';
+	Anope::string name = token.substr(negative ? 2 : 1).lower();
+	std::map<Anope::string, unsigned>::const_iterator binding = bindings.find(name);
+	if (binding != bindings.end())
+	{
+		postfix.add_load(binding->second, negative);
+		return true;
+	}
+	unsigned slot = StatSlot(name, false);
+	if (slot == DICE_MAX_STAT_SLOTS)
+	{
+		data.errPos = position;
+		data.errCode = DICE_ERROR_PARSE;
+		data.errStr = "An unknown stat was found.";
+		postfix.clear();
+		return false;
+	}
+	postfix.add(slot, negative);
+	return true;
+}
+
+/** Convert an infix notation equation to a postfix notation equation, using the shunting-yard algorithm.
+ * @param infix The infix notation equation to convert
+ * @param bindings The registers of the names bound earlier in the expression
+ * @param registers The number of registers used so far in the expression, increased by any inlined functions
+ * @return A postfix notation equation
+ *
+ * Numbers are always stored in the postfix notation equation immediately, and operators are kept on a stack until they are
+ * needed to be added to the postfix notation equation.
+ * The conversion process goes as follows:
+ * - Iterate through the infix notation equation, doing the following on each operation:
+ *   - When a name is encountered, add a load from its register if it was bound, otherwise add its slot as a stat, failing if no one has
+ *     that stat.
+ *   - When a _ is encountered, add the number following it to the postfix notation equation, but make sure it's negative.
+ *   - When a number is encountered, add it to the postfix notation equation.
+ *   - When a function is encountered, add it to the operator stack and store a 1 on the arity stack.
+ *   - When a constant is encountered, convert it to a number and add it to the postfix notation equation.
+ *   - When custom faces are encountered, add the number of faces and the dice operator with the faces attached to the postfix
+ *     notation equation, failing if the dice operator is not on the top of the operator stack.
+ *   - When an operator is encountered:
+ *     - Check if we had any numbers prior to the operator, and fail if there were none.
+ *     - Always add open parentheses to the operator stack.
+ *     - When a close parenthesis is encountered, pop all operators until we get to an open parenthesis or the stack becomes
+ *       empty, failing on the latter.
+ *     - When a dice modifier is encountered, attach it and the number after it to the dice operator before it, failing if there
+ *       is no dice operator right before it or no whole number after it.
+ *     - When a : is encountered, pop the stack until its ? is on top, failing if there is none, then replace the ? with the :.
+ *     - A not is always added to the operator stack, and doesn't need a number before it.
+ *     - For all other operators, pop the stack if needed then add the operator to the stack.
+ *   - When a comma is encountered, do the same as above for when a close parenthesis is encountered, but also check to make
+ *     sure there was a function prior to the open parenthesis (if there is one). Increase the top of the arity stack by one.
+ *   - If anything else is encountered, fail as it is an invalid value.
+ * - If there were operators left on the operator stack, pop all of them, failing if anything is left on the stack (an open
+ *   parenthesis will cause this).
+ *
+ * Of special note, operators are popped from the operator stack with PopOperator, which appends the number of arguments from the
+ * arity stack to the name of a function that is allowed to take a variable number of arguments, and inlines a function defined with
+ * DEFINE. The arity stack will be popped for any function. The branch stack keeps where the later operands of &&, ||, ?: and the if
+ * function start in the postfix notation equation, so that PopOperator can add jumps around them if they roll dice.
+ *
+ * The improvement to the shunting-yard algorithm to allow functions to have arbitrary numbers of arguments comes from:
+ * https://blog.kallisti.net.nz/2008/02/extension-to-the-shunting-yard-algorithm-to-allow-variable-numbers-of-arguments-to-functions/
+ */
+static Postfix InfixToPostfix(DiceServData &data, const Infix &infix, const std::map<Anope::string, unsigned> &bindings, unsigned &registers)
+{
+	Postfix postfix;
+	unsigned len = infix.str.length(), x = 0;
+	bool prev_was_close = false, prev_was_number = false;
+	std::stack<Anope::string> op_stack;
+	std::stack<unsigned> arity_stack;
+	std::stack<std::pair<unsigned, unsigned> > branch_stack;
+	spacesepstream tokens(infix.str);
+	Anope::string token, lastone;
+	// Loop over the space-separated tokens
+	while (tokens.GetToken(token))
+	{
+		// Names, negative or not, are resolved to their registers or slots
+		if (token[0] == '$' || (token[0] == '_' && token[1] == '$'))
+		{
+			if (!AddNamedValue(data, postfix, token, infix.positions[x], bindings))
+				return postfix;
+			prev_was_number = true;
+		}
+		// If the start of the token is _, then we are dealing with a negative number
+		else if (token[0] == '_')
+		{
+			double number = 0.0;
+			Anope::string token1 = token.substr(1);
+			if (is_constant(token1))
+			{
+				if (token1.equals_ci("e"))
+					number = -exp(1.0);
+				else if (token1.equals_ci("pi"))
+					number = -atan(1.0) * 4;
+			}
+			else
+				number = is_number_str(token1) ? -convertTo<double>(token1) : std::numeric_limits<double>::quiet_NaN();
+			if (is_infinite(number) || is_notanumber(number))
+			{
+				data.errCode = is_infinite(number) ? DICE_ERROR_OVERUNDERFLOW : DICE_ERROR_UNDEFINED;
+				postfix.clear();
+				return postfix;
+			}
+			postfix.add(number);
+			prev_was_number = true;
+		}
+		else if (is_number(token[0]))
+		{
+			double number = is_number_str(token) ? convertTo<double>(token) : std::numeric_limits<double>::quiet_NaN();
+			if (is_infinite(number) || is_notanumber(number))
+			{
+				data.errCode = is_infinite(number) ? DICE_ERROR_OVERUNDERFLOW : DICE_ERROR_UNDEFINED;
+				postfix.clear();
+				return postfix;
+			}
+			postfix.add(number);
+			prev_was_number = true;
+		}
+		else if (is_function(token))
+		{
+			op_stack.push(token);
+			arity_stack.push(1);
+			if (token.equals_ci("if"))
+				branch_stack.push(std::make_pair(0u, 0u));
+		}
+		else if (is_constant(token))
+		{
+			double number = 0.0;
+			if (token.equals_ci("e"))
+				number = exp(1.0);
+			else if (token.equals_ci("pi"))
+				number = atan(1.0) * 4;
+			postfix.add(number);
+			prev_was_number = true;
+		}
+		else if (is_operator(token[0]))
+		{
+			if (!prev_was_number && token != "(" && token != ")" && token != "~" && !prev_was_close)
+			{
+				data.errPos = infix.positions[x];
+				data.errCode = DICE_ERROR_PARSE;
+				data.errStr = "No numbers were found before the operator was encountered.";
+				postfix.clear();
+				return postfix;
+			}
+			lastone = op_stack.empty() ? "" : op_stack.top();
+			prev_was_number = false;
+			if (token == "(")
+			{
+				op_stack.push(token);
+				prev_was_close = false;
+			}
+			else if (token == ")")
+			{
+				while (would_pop(token, lastone))
+				{
+					if (!PopOperator(data, postfix, op_stack, arity_stack, branch_stack, infix.positions[x], registers))
+						return postfix;
+					lastone = op_stack.empty() ? "" : op_stack.top();
+				}
+				if (lastone != "(")
+				{
+					data.errPos = infix.positions[x];
+					data.errCode = DICE_ERROR_PARSE;
+					data.errStr = "A close parenthesis was found but not enough open\nparentheses were found before it.";
+					postfix.clear();
+					return postfix;
+				}
+				else
+					op_stack.pop();
+				prev_was_close = true;
+			}
+			else if (is_dice_modifier(token[0]))
+			{
+				// A modifier is attached to the dice operator right before it, so that operator is moved to the postfix notation equation first
+				if (lastone == "d")
+				{
+					postfix.add(lastone);
+					op_stack.pop();
+				}
+				const PostfixValueBase *dice = postfix.empty() ? NULL : postfix[postfix.size() - 1];
+				const Anope::string *dice_token = dice && dice->Type() == POSTFIX_VALUE_STRING ? anope_dynamic_static_cast<const PostfixValueString *>(dice)->Get() : NULL;
+				if (!dice_token || dice_token->empty() || (*dice_token)[0] != 'd' || is_builtin_function(*dice_token))
+				{
+					data.errPos = infix.positions[x];
+					data.errCode = DICE_ERROR_PARSE;
+					data.errStr = "A dice modifier was found that doesn't come right after dice.";
+					postfix.clear();
+					return postfix;
+				}
+				if (dice_token->find('{') != Anope::string::npos)
+				{
+					data.errPos = infix.positions[x];
+					data.errCode = DICE_ERROR_PARSE;
+					data.errStr = "Dice modifiers can't be used on dice with custom faces.";
+					postfix.clear();
+					return postfix;
+				}
+				Anope::string modified = *dice_token + token;
+				x += token.length() + (x ? 1 : 0);
+				if (!tokens.GetToken(token) || !is_number_str(token) || token.find('.') != Anope::string::npos || token.length() > 5)
+				{
+					data.errPos = infix.positions[x < len ? x : len];
+					data.errCode = DICE_ERROR_PARSE;
+					data.errStr = "A dice modifier must be followed by a whole number of at most\n5 digits.";
+					postfix.clear();
+					return postfix;
+				}
+				postfix.pop_back();
+				postfix.add(modified + token);
+				prev_was_number = true;
+				prev_was_close = false;
+			}
+			else if (token == ":")
+			{
+				// The : takes the place of the ? it belongs to, with the else branch starting here
+				while (would_pop(token, lastone))
+				{
+					if (!PopOperator(data, postfix, op_stack, arity_stack, branch_stack, infix.positions[x], registers))
+						return postfix;
+					lastone = op_stack.empty() ? "" : op_stack.top();
+				}
+				if (lastone != "?")
+				{
+					data.errPos = infix.positions[x];
+					data.errCode = DICE_ERROR_PARSE;
+					data.errStr = "A : was found without a ? before it.";
+					postfix.clear();
+					return postfix;
+				}
+				op_stack.top() = token;
+				branch_stack.top().second = postfix.size();
+				prev_was_close = false;
+			}
+			else
+			{
+				if (!would_pop(token, lastone))
+					op_stack.push(token);
+				else
+				{
+					while (would_pop(token, lastone))
+					{
+						if (!PopOperator(data, postfix, op_stack, arity_stack, branch_stack, infix.positions[x], registers))
+							return postfix;
+						lastone = op_stack.empty() ? "" : op_stack.top();
+					}
+					op_stack.push(token);
+				}
+				// The operands after the first one of the boolean operators and ?: start here
+				if (token == "&" || token == "|" || token == "?")
+					branch_stack.push(std::make_pair(postfix.size(), 0u));
+				prev_was_close = false;
+			}
+		}
+		else if (token[0] == '{')
+		{
+			// Custom faces are the right side of the dice operator before them, so that operator is moved to the postfix notation equation
+			// right away, with the number of faces as its number of sides
+			lastone = op_stack.empty() ? "" : op_stack.top();
+			if (lastone != "d")
+			{
+				data.errPos = infix.positions[x];
+				data.errCode = DICE_ERROR_PARSE;
+				data.errStr = "Custom faces were found that don't come right after a d.";
+				postfix.clear();
+				return postfix;
+			}
+			op_stack.pop();
+			postfix.add(static_cast<double>(std::count(token.begin(), token.end(), ',') + 1));
+			postfix.add(lastone + token);
+			prev_was_number = true;
+			prev_was_close = false;
+		}
+		else if (token[0] == ',')
+		{
+			lastone = op_stack.empty() ? "" : op_stack.top();
+			while (would_pop(token, lastone))
+			{
+				if (!PopOperator(data, postfix, op_stack, arity_stack, branch_stack, infix.positions[x], registers))
+					return postfix;
+				lastone = op_stack.empty() ? "" : op_stack.top();
+			}
+			if (lastone != "(")
+			{
+				data.errPos = infix.positions[x];
+				data.errCode = DICE_ERROR_PARSE;
+				data.errStr = "A comma was encountered outside of a function.";
+				postfix.clear();
+				return postfix;
+			}
+			else
+			{
+				op_stack.pop();
+				lastone = op_stack.empty() ? "" : op_stack.top();
+				if (!is_function(lastone))
+				{
+					data.errPos = infix.positions[x];
+					data.errCode = DICE_ERROR_PARSE;
+					data.errStr = "A comma was encountered outside of a function.";
+					postfix.clear();
+					return postfix;
+				}
+				else
+				{
+					op_stack.push("(");
+					++arity_stack.top();
+					// The branches of the if function start after its first and second commas
+					if (lastone.equals_ci("if") && arity_stack.top() <= 3)
+					{
+						if (arity_stack.top() == 2)
+							branch_stack.top().first = postfix.size();
+						else
+							branch_stack.top().second = postfix.size();
+					}
+				}
+			}
+		}
+		else
+		{
+			data.errPos = infix.positions[x];
+			data.errCode = DICE_ERROR_PARSE;
+			data.errStr = "An invalid character was encountered.";
+			postfix.clear();
+			return postfix;
+		}
+		x += token.length() + (x ? 1 : 0);
+	}
+	if (!op_stack.empty())
+	{
+		unsigned end = len < infix.positions.size() ? infix.positions[len] : infix.positions[infix.positions.size() - 1] + 1;
+		lastone = op_stack.top();
+		while (would_pop("", lastone))
+		{
+			if (!PopOperator(data, postfix, op_stack, arity_stack, branch_stack, end, registers))
+				return postfix;
+			if (op_stack.empty())
+				break;
+			else
+				lastone = op_stack.top();
+		}
+		if (!op_stack.empty())
+		{
+			data.errPos = end;
+			data.errCode = DICE_ERROR_PARSE;
+			data.errStr = "There are more open parentheses than close parentheses.";
+			postfix.clear();
+			return postfix;
+		}
+	}
+	return postfix;
+}
+
+/** Get the number that a value in a postfix notation equation stands for, loading it from the roller's stats if it is a stat.
+ * @param value The value, which can't be an operator or function
+ * @param number Reference to store the number in
+ * @return true if there was a number, false if the number was empty or is a stat that the roller hasn't set, with the error stored in data
+ */
+static inline bool PostfixNumber(DiceServData &data, const PostfixValueBase *value, double &number)
+{
+	if (value->Type() == POSTFIX_VALUE_STAT)
+	{
+		const PostfixValueStat *stat = anope_dynamic_static_cast<const PostfixValueStat *>(value);
+		if (stat->Get(data.statValues, number))
+			return true;
+		data.errCode = DICE_ERROR_UNSET_STAT;
+		data.errStr = stat->Name();
+		return false;
+	}
+	const double *val_ptr = anope_dynamic_static_cast<const PostfixValueDouble *>(value)->Get();
+	if (!val_ptr)
+	{
+		data.errCode = DICE_ERROR_STACK;
+		data.errStr = "An empty number was found.";
+		return false;
+	}
+	number = *val_ptr;
+	return true;
+}
+
+/** Evaluate a postfix notation equation.
+ * @param The postfix notation equation to evaluate
+ * @return The final result after calculation of the equation
+ *
+ * The evaluation pops the required values from the operand stack for a function, and 2 values from the operand stack for an operator, except
+ * for not which pops 1 and select which pops 3. The result of either one is placed back on the operand stack, hopefully leaving a single result
+ * at the end. A jump that is taken skips over the values after it, so the dice in the branch of a conditional that isn't used are never rolled.
+ */
+static double EvaluatePostfix(DiceServData &data, const Postfix &postfix)
+{
+	double val = 0;
+	std::stack<double> num_stack;
+	std::vector<double> registers(postfix.RegisterCount());
+	for (unsigned x = 0, len = postfix.size(); x < len; ++x)
+	{
+		if (postfix[x]->Type() == POSTFIX_VALUE_REGISTER)
+		{
+			const PostfixValueRegister *reg = anope_dynamic_static_cast<const PostfixValueRegister *>(postfix[x]);
+			if (!reg->IsStore())
+				num_stack.push(reg->IsNegative() ? -registers[reg->Index()] : registers[reg->Index()]);
+			else if (num_stack.empty())
+			{
+				data.errCode = DICE_ERROR_STACK;
+				data.errStr = "Not enough numbers for binding.";
+				return 0;
+			}
+			else
+			{
+				registers[reg->Index()] = num_stack.top();
+				num_stack.pop();
+			}
+		}
+		else if (postfix[x]->Type() == POSTFIX_VALUE_JUMP)
+		{
+			const PostfixValueJump *jump = anope_dynamic_static_cast<const PostfixValueJump *>(postfix[x]);
+			if (jump->Kind() == POSTFIX_JUMP_IF_ZERO)
+			{
+				if (num_stack.empty())
+				{
+					data.errCode = DICE_ERROR_STACK;
+					data.errStr = "Not enough numbers for condition.";
+					return 0;
+				}
+				bool zero = !num_stack.top();
+				num_stack.pop();
+				if (zero)
+					x += jump->Skip();
+			}
+			else if (jump->Kind() == POSTFIX_JUMP_ALWAYS)
+				x += jump->Skip();
+		}
+		else if (postfix[x]->Type() == POSTFIX_VALUE_STRING)
+		{
+			const Anope::string *token_ptr = anope_dynamic_static_cast<const PostfixValueString *>(postfix[x])->Get();
+			Anope::string token = token_ptr ? *token_ptr : "";
+			if (token.empty())
+			{
+				data.errCode = DICE_ERROR_STACK;
+				data.errStr = "An empty token was found.";
+				return 0;
+			}
+			// Functions defined with DEFINE were inlined by InfixToPostfix, so only built-in functions are left
+			if (is_builtin_function(token))
+			{
+				int function_arguments = function_argument_count(token);
+				if (function_arguments < 0)
+				{
+					size_t underscore = token.find('_');
+					int real_function_arguments = convertTo<int>(token.substr(underscore + 1));
+					token = token.substr(0, underscore);
+					if (real_function_arguments < -function_arguments)
+					{
+						data.errCode = DICE_ERROR_STACK;
+						data.errStr = "Function requires at least " + stringify(-function_arguments) + " arguments, but only " +
+							stringify(real_function_arguments) + " were passed.";
+						return 0;
+					}
+					function_arguments = real_function_arguments;
+				}
+				if (num_stack.empty() || num_stack.size() < static_cast<unsigned>(function_arguments))
+				{
+					data.errCode = DICE_ERROR_STACK;
+					data.errStr = "Not enough numbers for function.";
+					return 0;
+				}
+				double val1 = num_stack.top();
+				num_stack.pop();
+				FunctionResult result;
+				if (token.equals_ci("abs"))
+				{
+					val = std::abs(val1);
+					result.SetNameAndResult("abs", val);
+					result.AddArgument(val1);
+				}
+				else if (token.equals_ci("acos"))
+				{
+					// Arc cosine is undefined outside the domain [-1, 1]
+					if (std::abs(val1) > 1)
+					{
+						data.errCode = DICE_ERROR_UNDEFINED;
+						return 0;
+					}
+					val = std::acos(val1);
+					result.SetNameAndResult("acos", val);
+					result.AddArgument(val1);
+				}
+				else if (token.equals_ci("acosh"))
+				{
+					// Inverse hyperbolic cosine is undefined for any value less than 1
+					if (val1 < 1)
+					{
+						data.errCode = DICE_ERROR_UNDEFINED;
+						return 0;
+					}
+					val = acosh(val1);
+					result.SetNameAndResult("acosh", val);
+					result.AddArgument(val1);
+				}
+				else if (token.equals_ci("asin"))
+				{
+					// Arc sine is undefined outside the domain [-1, 1]
+					if (std::abs(val1) > 1)
+					{
+						data.errCode = DICE_ERROR_UNDEFINED;
+						return 0;
+					}
+					val = std::asin(val1);
+					result.SetNameAndResult("asin", val);
+					result.AddArgument(val1);
+				}
+				else if (token.equals_ci("asinh"))
+				{
+					val = asinh(val1);
+					result.SetNameAndResult("asinh", val);
+					result.AddArgument(val1);
+				}
+				else if (token.equals_ci("atan"))
+				{
+					val = std::atan(val1);
+					result.SetNameAndResult("atan", val);
+					result.AddArgument(val1);
+				}
+				else if (token.equals_ci("atan2"))
+				{
+					double val2 = val1;
+					val1 = num_stack.top();
+					num_stack.pop();
+					val = std::atan2(val1, val2);
+					result.SetNameAndResult("atan2", val);
+					result.AddArgument(val1);
+					result.AddArgument(val2);
+				}
+				else if (token.equals_ci("atanh"))
+				{
+					// Inverse hyperbolic tangent is undefined outside the domain (-1, 1)
+					if (std::abs(val1) >= 1)
+					{
+						data.errCode = std::abs(val1) == 1 ? DICE_ERROR_DIV0 : DICE_ERROR_UNDEFINED;
+						return 0;
+					}
+					val = atanh(val1);
+					result.SetNameAndResult("atanh", val);
+					result.AddArgument(val1);
+				}
+				else if (token.equals_ci("cbrt"))
+				{
+					val = cbrt(val1);
+					result.SetNameAndResult("cbrt", val);
+					result.AddArgument(val1);
+				}
+				else if (token.equals_ci("ceil"))
+				{
+					val = std::ceil(val1);
+					result.SetNameAndResult("ceil", val);
+					result.AddArgument(val1);
+				}
+				else if (token.equals_ci("cos"))
+				{
+					val = std::cos(val1);
+					result.SetNameAndResult("cos", val);
+					result.AddArgument(val1);
+				}
+				else if (token.equals_ci("cosh"))
+				{
+					val = std::cosh(val1);
+					result.SetNameAndResult("cosh", val);
+					result.AddArgument(val1);
+				}
+				else if (token.equals_ci("deg"))
+				{
+					val = val1 * 45.0 / std::atan(1.0);
+					result.SetNameAndResult("deg", val);
+					result.AddArgument(val1);
+				}
+				else if (token.equals_ci("exp"))
+				{
+					val = std::exp(val1);
+					result.SetNameAndResult("exp", val);
+					result.AddArgument(val1);
+				}
+				else if (token.equals_ci("fac"))
+				{
+					// Negative factorials are considered undefined
+					if (static_cast<int>(val1) < 0)
+					{
+						data.errCode = DICE_ERROR_UNDEFINED;
+						return 0;
+					}
+					// Any factorials over 12 will be outside the range of a signed 32-bit integer, so don't bother to calculate them
+					if (val1 > 12)
+					{
+						data.errCode = DICE_ERROR_OVERUNDERFLOW;
+						return 0;
+					}
+					val = 1;
+					for (unsigned n = 2; n <= static_cast<unsigned>(val1); ++n)
+						val *= n;
+					result.SetNameAndResult("fac", val);
+					result.AddArgument(static_cast<unsigned>(val1));
+				}
+				else if (token.equals_ci("floor"))
+				{
+					val = std::floor(val1);
+					result.SetNameAndResult("floor", val);
+					result.AddArgument(val1);
+				}
+				else if (token.equals_ci("log"))
+				{
+					// Logarithm is invalid for values 0 or less
+					if (val1 <= 0)
+					{
+						data.errCode = DICE_ERROR_DIV0;
+						return 0;
+					}
+					val = std::log(val1);
+					result.SetNameAndResult("log", val);
+					result.AddArgument(val1);
+				}
+				else if (token.equals_ci("log10"))
+				{
+					// Logarithm is invalid for values 0 or less
+					if (val1 <= 0)
+					{
+						data.errCode = DICE_ERROR_DIV0;
+						return 0;
+					}
+					val = std::log10(val1);
+					result.SetNameAndResult("log10", val);
+					result.AddArgument(val1);
+				}
+				else if (token.equals_ci("max"))
+				{
+					std::stack<double> args;
+					args.push(val1);
+					for (int i = 1; i < function_arguments; ++i)
+					{
+						double val2 = val1;
+						val1 = num_stack.top();
+						num_stack.pop();
+						args.push(val1);
+						val = val1 = std::max(val1, val2);
+					}
+					result.SetNameAndResult("max", val);
+					while (!args.empty())
+					{
+						result.AddArgument(args.top());
+						args.pop();
+					}
+				}
+				else if (token.equals_ci("min"))
+				{
+					std::stack<double> args;
+					args.push(val1);
+					for (int i = 1; i < function_arguments; ++i)
+					{
+						double val2 = val1;
+						val1 = num_stack.top();
+						num_stack.pop();
+						args.push(val1);
+						val = val1 = std::min(val1, val2);
+					}
+					result.SetNameAndResult("min", val);
+					while (!args.empty())
+					{
+						result.AddArgument(args.top());
+						args.pop();
+					}
+				}
+				else if (token.equals_ci("rad"))
+				{
+					val = val1 * std::atan(1.0) / 45.0;
+					result.SetNameAndResult("rad", val);
+					result.AddArgument(val1);
+				}
+				else if (token.equals_ci("rand"))
+				{
+					double val2 = val1;
+					val1 = num_stack.top();
+					num_stack.pop();
+					if (val1 > val2)
+					{
+						double tmp = val2;
+						val2 = val1;
+						val1 = tmp;
+					}
+					val = RNG().Random(static_cast<int>(val1), static_cast<int>(val2));
+					result.SetNameAndResult("rand", val);
+					result.AddArgument(static_cast<int>(val1));
+					result.AddArgument(static_cast<int>(val2));
+				}
+				else if (token.equals_ci("round"))
+				{
+					val = my_round(val1);
+					result.SetNameAndResult("round", val);
+					result.AddArgument(val1);
+				}
+				else if (token.equals_ci("sin"))
+				{
+					val = std::sin(val1);
+					result.SetNameAndResult("sin", val);
+					result.AddArgument(val1);
+				}
+				else if (token.equals_ci("sinh"))
+				{
+					val = std::sinh(val1);
+					result.SetNameAndResult("sinh", val);
+					result.AddArgument(val1);
+				}
+				else if (token.equals_ci("sqrt"))
+				{
+					// Because imaginary numbers are not being used, it is impossible to take the square root of a negative number
+					if (val1 < 0)
+					{
+						data.errCode = DICE_ERROR_UNDEFINED;
+						return 0;
+					}
+					val = std::sqrt(val1);
+					result.SetNameAndResult("sqrt", val);
+					result.AddArgument(val1);
+				}
+				else if (token.equals_ci("tan"))
+				{
+					// Tangent is undefined for any value of pi / 2 + pi * n for all integers n
+					if (!std::fmod(val1 + 2 * std::atan(1.0), std::atan(1.0) * 4))
+					{
+						data.errCode = DICE_ERROR_UNDEFINED;
+						return 0;
+					}
+					val = std::tan(val1);
+					result.SetNameAndResult("tan", val);
+					result.AddArgument(val1);
+				}
+				else if (token.equals_ci("tanh"))
+				{
+					val = std::tanh(val1);
+					result.SetNameAndResult("tanh", val);
+					result.AddArgument(val1);
+				}
+				else if (token.equals_ci("trunc"))
+				{
+					val = static_cast<int>(val1);
+					result.SetNameAndResult("trunc", val);
+					result.AddArgument(val1);
+				}
+				if (is_infinite(val) || is_notanumber(val))
+				{
+					data.errCode = is_infinite(val) ? DICE_ERROR_OVERUNDERFLOW : DICE_ERROR_UNDEFINED;
+					return 0;
+				}
+				num_stack.push(val);
+				data.AddToOpResults(result);
+			}
+			else if (token == "~" || token == "?")
+			{
+				// Not and select are the only operators that don't take 2 numbers, neither of them can overflow
+				if (num_stack.size() < (token == "~" ? 1u : 3u))
+				{
+					data.errCode = DICE_ERROR_STACK;
+					data.errStr = "Not enough numbers for operator.";
+					return 0;
+				}
+				if (token == "~")
+					num_stack.top() = !num_stack.top();
+				else
+				{
+					double val3 = num_stack.top();
+					num_stack.pop();
+					double val2 = num_stack.top();
+					num_stack.pop();
+					num_stack.top() = num_stack.top() ? val2 : val3;
+				}
+			}
+			else if (is_operator(token[0]) && (token.length() == 1 || token[0] == 'd'))
+			{
+				if (num_stack.empty() || num_stack.size() < 2)
+				{
+					data.errCode = DICE_ERROR_STACK;
+					data.errStr = "Not enough numbers for operator.";
+					return 0;
+				}
+				double val2 = num_stack.top();
+				num_stack.pop();
+				double val1 = num_stack.top();
+				num_stack.pop();
+				switch (token[0])
+				{
+					case '+':
+						val = val1 + val2;
+						break;
+					case '-':
+						val = val1 - val2;
+						break;
+					case '*':
+						val = val1 * val2;
+						break;
+					case '/':
+						// Prevent division by 0
+						if (!val2)
+						{
+							data.errCode = DICE_ERROR_DIV0;
+							return 0;
+						}
+						val = val1 / val2;
+						break;
+					case '%':
+						// Prevent division by 0
+						if (!val2)
+						{
+							data.errCode = DICE_ERROR_DIV0;
+							return 0;
+						}
+						val = std::fmod(val1, val2);
+						break;
+					case '^':
+						// Because imaginary numbers are not being used, it is impossible to take the power of a negative number to a non-integer exponent
+						if (val1 < 0 && static_cast<int>(val2) != val2)
+						{
+							data.errCode = DICE_ERROR_UNDEFINED;
+							return 0;
+						}
+						// Prevent division by 0
+						if (!val1 && !val2)
+						{
+							data.errCode = DICE_ERROR_DIV0;
+							return 0;
+						}
+						// 0 to a negative power is invalid
+						if (!val1 && val2 < 0)
+						{
+							data.errCode = DICE_ERROR_OVERUNDERFLOW;
+							return 0;
+						}
+						val = std::pow(val1, val2);
+						break;
+					case '<':
+						val = val1 < val2;
+						break;
+					case '[':
+						val = val1 <= val2;
+						break;
+					case '>':
+						val = val1 > val2;
+						break;
+					case ']':
+						val = val1 >= val2;
+						break;
+					case '=':
+						val = val1 == val2;
+						break;
+					case '#':
+						val = val1 != val2;
+						break;
+					case '&':
+						// Both sides are always worked out here, so there is no need for && to branch
+						val = (val1 != 0) & (val2 != 0);
+						break;
+					case '|':
+						val = (val1 != 0) | (val2 != 0);
+						break;
+					case 'd':
+					{
+						// Make sure both the number of dice and the number of sides are within acceptable ranges
+						if (val1 < 1 || val1 > DICE_MAX_DICE)
+						{
+							data.errCode = DICE_ERROR_UNACCEPTABLE_DICE;
+							data.errNum = static_cast<int>(val1);
+							return 0;
+						}
+						if (val2 < 1 || val2 > DICE_MAX_SIDES)
+						{
+							data.errCode = DICE_ERROR_UNACCEPTABLE_SIDES;
+							data.errNum = static_cast<int>(val2);
+							return 0;
+						}
+						DiceModifiers mods(token, static_cast<unsigned>(val2));
+						if (!mods.Usable(static_cast<unsigned>(val2)))
+						{
+							data.errCode = DICE_ERROR_UNACCEPTABLE_MODIFIER;
+							data.errNum = static_cast<int>(val2);
+							return 0;
+						}
+						DiceResult result = token.length() == 1 ? Dice(static_cast<int>(val1), static_cast<unsigned>(val2)) :
+							ModifiedDice(static_cast<int>(val1), static_cast<unsigned>(val2), mods);
+						data.AddToOpResults(result);
+						val = result.Value();
+					}
+				}
+				if (is_infinite(val) || is_notanumber(val))
+				{
+					data.errCode = is_infinite(val) ? DICE_ERROR_OVERUNDERFLOW : DICE_ERROR_UNDEFINED;
+					return 0;
+				}
+				num_stack.push(val);
+			}
+		}
+		else
+		{
+			double number;
+			if (!PostfixNumber(data, postfix[x], number))
+				return 0;
+			num_stack.push(number);
+		}
+	}
+	val = num_stack.top();
+	num_stack.pop();
+	if (!num_stack.empty())
+	{
+		data.errCode = DICE_ERROR_STACK;
+		data.errStr = "Too many numbers were found as input.";
+		return 0;
 	}
-};
+	return val;
+}
 
-/** Convert an infix notation equation to a postfix notation equation, using the shunting-yard algorithm.
- * @param infix The infix notation equation to convert
- * @return A postfix notation equation
- *
- * Numbers are always stored in the postfix notation equation immediately, and operators are kept on a stack until they are
- * needed to be added to the postfix notation equation.
- * The conversion process goes as follows:
- * - Iterate through the infix notation equation, doing the following on each operation:
- *   - When a _ is encountered, add the number following it to the postfix notation equation, but make sure it's negative.
- *   - When a number is encountered, add it to the postfix notation equation.
- *   - When a function is encountered, add it to the operator stack and store a 1 on the arity stack.
- *   - When a constant is encountered, convert it to a number and add it to the postfix notation equation.
- *   - When an operator is encountered:
- *     - Check if we had any numbers prior to the operator, and fail if there were none.
- *     - Always add open parentheses to the operator stack.
- *     - When a close parenthesis is encountered, pop all operators until we get to an open parenthesis or the stack becomes
- *       empty, failing on the latter.
- *     - For all other operators, pop the stack if needed then add the operator to the stack.
- *   - When a comma is encountered, do the same as above for when a close parenthesis is encountered, but also check to make
- *     sure there was a function prior to the open parenthesis (if there is one). Increase the top of the arity stack by one.
- *   - If anything else is encountered, fail as it is an invalid value.
- * - If there were operators left on the operator stack, pop all of them, failing if anything is left on the stack (an open
- *   parenthesis will cause this).
- *
- * Of special note, when a function is being popped from the operator stack, if the function is allowed to take a variable
- * number of arguments, the number of arguments from the arity stack will be appended to the function's name, with an underscore
- * before that. The arity stack will be popped regardless.
+/** Evaluate a postfix notation equation that only uses integer operators on integer operands.
+ * @param The postfix notation equation to evaluate, IsInteger() must be true for it
+ * @return The final result after calculation of the equation
  *
- * The improvement to the shunting-yard algorithm to allow functions to have arbitrary numbers of arguments comes from:
- * https://blog.kallisti.net.nz/2008/02/extension-to-the-shunting-yard-algorithm-to-allow-variable-numbers-of-arguments-to-functions/
+ * This gives the same results as EvaluatePostfix, but the operands are kept in 64-bit integers and every operation is checked for overflow,
+ * so there is no need to check for infinity or NaN after each operation or to round the final result. An overflow is reported as
+ * DICE_ERROR_OVERUNDERFLOW, which DoEvaluate takes as a sign to evaluate the equation with EvaluatePostfix instead.
  */
-static Postfix InfixToPostfix(DiceServData &data, const Infix &infix)
+static int64_t EvaluatePostfixInteger(DiceServData &data, const Postfix &postfix)
 {
-	Postfix postfix;
-	unsigned len = infix.str.length(), x = 0;
-	bool prev_was_close = false, prev_was_number = false;
-	std::stack<Anope::string> op_stack;
-	std::stack<unsigned> arity_stack;
-	spacesepstream tokens(infix.str);
-	Anope::string token, lastone;
-	// Loop over the space-separated tokens
-	while (tokens.GetToken(token))
+	int64_t val = 0;
+	std::stack<int64_t> num_stack;
+	std::vector<int64_t> registers(postfix.RegisterCount());
+	for (unsigned x = 0, len = postfix.size(); x < len; ++x)
 	{
-		// If the start of the token is _, then we are dealing with a negative number
-		if (token[0] == '_')
+		if (postfix[x]->Type() == POSTFIX_VALUE_REGISTER)
 		{
-			double number = 0.0;
-			Anope::string token1 = token.substr(1);
-			if (is_constant(token1))
+			const PostfixValueRegister *reg = anope_dynamic_static_cast<const PostfixValueRegister *>(postfix[x]);
+			if (!reg->IsStore())
+				num_stack.push(reg->IsNegative() ? -registers[reg->Index()] : registers[reg->Index()]);
+			else if (num_stack.empty())
 			{
-				if (token1.equals_ci("e"))
-					number = -exp(1.0);
-				else if (token1.equals_ci("pi"))
-					number = -atan(1.0) * 4;
+				data.errCode = DICE_ERROR_STACK;
+				data.errStr = "Not enough numbers for binding.";
+				return 0;
 			}
 			else
-				number = is_number_str(token1) ? -convertTo<double>(token1) : std::numeric_limits<double>::quiet_NaN();
-			if (is_infinite(number) || is_notanumber(number))
 			{
-				data.errCode = is_infinite(number) ? DICE_ERROR_OVERUNDERFLOW : DICE_ERROR_UNDEFINED;
-				postfix.clear();
-				return postfix;
+				registers[reg->Index()] = num_stack.top();
+				num_stack.pop();
 			}
-			postfix.add(number);
-			prev_was_number = true;
 		}
-		else if (is_number(token[0]))
+		else if (postfix[x]->Type() == POSTFIX_VALUE_JUMP)
 		{
-			double number = is_number_str(token) ? convertTo<double>(token) : std::numeric_limits<double>::quiet_NaN();
-			if (is_infinite(number) || is_notanumber(number))
+			const PostfixValueJump *jump = anope_dynamic_static_cast<const PostfixValueJump *>(postfix[x]);
+			if (jump->Kind() == POSTFIX_JUMP_IF_ZERO)
 			{
-				data.errCode = is_infinite(number) ? DICE_ERROR_OVERUNDERFLOW : DICE_ERROR_UNDEFINED;
-				postfix.clear();
-				return postfix;
+				if (num_stack.empty())
+				{
+					data.errCode = DICE_ERROR_STACK;
+					data.errStr = "Not enough numbers for condition.";
+					return 0;
+				}
+				bool zero = !num_stack.top();
+				num_stack.pop();
+				if (zero)
+					x += jump->Skip();
 			}
-			postfix.add(number);
-			prev_was_number = true;
-		}
-		else if (is_function(token))
-		{
-			op_stack.push(token);
-			arity_stack.push(1);
-		}
-		else if (is_constant(token))
-		{
-			double number = 0.0;
-			if (token.equals_ci("e"))
-				number = exp(1.0);
-			else if (token.equals_ci("pi"))
-				number = atan(1.0) * 4;
-			postfix.add(number);
-			prev_was_number = true;
+			else if (jump->Kind() == POSTFIX_JUMP_ALWAYS)
+				x += jump->Skip();
 		}
-		else if (is_operator(token[0]))
+		else if (postfix[x]->Type() == POSTFIX_VALUE_STRING)
 		{
-			if (!prev_was_number && token != "(" && token != ")" && !prev_was_close)
+			const Anope::string *token_ptr = anope_dynamic_static_cast<const PostfixValueString *>(postfix[x])->Get();
+			if (!token_ptr || token_ptr->empty())
 			{
-				data.errPos = infix.positions[x];
-				data.errCode = DICE_ERROR_PARSE;
-				data.errStr = "No numbers were found before the operator was encountered.";
-				postfix.clear();
-				return postfix;
+				data.errCode = DICE_ERROR_STACK;
+				data.errStr = "An empty token was found.";
+				return 0;
 			}
-			lastone = op_stack.empty() ? "" : op_stack.top();
-			prev_was_number = false;
-			if (token == "(")
+			char op = (*token_ptr)[0];
+			if (num_stack.size() < (op == '~' ? 1u : op == '?' ? 3u : 2u))
 			{
-				op_stack.push(token);
-				prev_was_close = false;
+				data.errCode = DICE_ERROR_STACK;
+				data.errStr = "Not enough numbers for operator.";
+				return 0;
 			}
-			else if (token == ")")
+			if (op == '~')
 			{
-				while (would_pop(token, lastone))
-				{
-					postfix.add(lastone);
-					op_stack.pop();
-					lastone = op_stack.empty() ? "" : op_stack.top();
-				}
-				if (lastone != "(")
-				{
-					data.errPos = infix.positions[x];
-					data.errCode = DICE_ERROR_PARSE;
-					data.errStr = "A close parenthesis was found but not enough open\nparentheses were found before it.";
-					postfix.clear();
-					return postfix;
-				}
-				else
-					op_stack.pop();
-				prev_was_close = true;
+				num_stack.top() = !num_stack.top();
+				continue;
 			}
-			else
+			if (op == '?')
 			{
-				if (!would_pop(token, lastone))
-					op_stack.push(token);
-				else
+				int64_t val3 = num_stack.top();
+				num_stack.pop();
+				int64_t val2 = num_stack.top();
+				num_stack.pop();
+				num_stack.top() = num_stack.top() ? val2 : val3;
+				continue;
+			}
+			int64_t val2 = num_stack.top();
+			num_stack.pop();
+			int64_t val1 = num_stack.top();
+			num_stack.pop();
+			bool overflow = false;
+			switch (op)
+			{
+				case '+':
+					overflow = checked_add(val1, val2, val);
+					break;
+				case '-':
+					overflow = checked_sub(val1, val2, val);
+					break;
+				case '*':
+					overflow = checked_mul(val1, val2, val);
+					break;
+				case '%':
+					// Prevent division by 0
+					if (!val2)
+					{
+						data.errCode = DICE_ERROR_DIV0;
+						return 0;
+					}
+					// The remainder keeps the sign of the dividend, just like fmod does, and -1 is special-cased as the minimum value would overflow
+					val = val2 == -1 ? 0 : val1 % val2;
+					break;
+				case '<':
+					val = val1 < val2;
+					break;
+				case '[':
+					val = val1 <= val2;
+					break;
+				case '>':
+					val = val1 > val2;
+					break;
+				case ']':
+					val = val1 >= val2;
+					break;
+				case '=':
+					val = val1 == val2;
+					break;
+				case '#':
+					val = val1 != val2;
+					break;
+				case '&':
+					val = (val1 != 0) & (val2 != 0);
+					break;
+				case '|':
+					val = (val1 != 0) | (val2 != 0);
+					break;
+				case 'd':
 				{
-					while (would_pop(token, lastone))
+					// Make sure both the number of dice and the number of sides are within acceptable ranges
+					if (val1 < 1 || val1 > DICE_MAX_DICE)
 					{
-						if (is_function(lastone))
-						{
-							if (function_argument_count(lastone) < 0)
-							{
-								unsigned arity = arity_stack.top();
-								Anope::string arityStr = stringify(arity);
-								lastone += "_" + arityStr;
-							}
-							arity_stack.pop();
-						}
-						postfix.add(lastone);
-						op_stack.pop();
-						lastone = op_stack.empty() ? "" : op_stack.top();
+						data.errCode = DICE_ERROR_UNACCEPTABLE_DICE;
+						data.errNum = static_cast<int>(val1);
+						return 0;
 					}
-					op_stack.push(token);
+					if (val2 < 1 || val2 > DICE_MAX_SIDES)
+					{
+						data.errCode = DICE_ERROR_UNACCEPTABLE_SIDES;
+						data.errNum = static_cast<int>(val2);
+						return 0;
+					}
+					DiceModifiers mods(*token_ptr, static_cast<unsigned>(val2));
+					if (!mods.Usable(static_cast<unsigned>(val2)))
+					{
+						data.errCode = DICE_ERROR_UNACCEPTABLE_MODIFIER;
+						data.errNum = static_cast<int>(val2);
+						return 0;
+					}
+					DiceResult result = token_ptr->length() == 1 ? Dice(static_cast<int>(val1), static_cast<unsigned>(val2)) :
+						ModifiedDice(static_cast<int>(val1), static_cast<unsigned>(val2), mods);
+					data.AddToOpResults(result);
+					val = static_cast<int64_t>(result.Value());
 				}
-				prev_was_close = false;
 			}
+			if (overflow)
+			{
+				data.errCode = DICE_ERROR_OVERUNDERFLOW;
+				return 0;
+			}
+			num_stack.push(val);
 		}
-		else if (token[0] == ',')
+		else
 		{
-			lastone = op_stack.empty() ? "" : op_stack.top();
-			while (would_pop(token, lastone))
+			double number;
+			if (!PostfixNumber(data, postfix[x], number))
+				return 0;
+			num_stack.push(static_cast<int64_t>(number));
+		}
+	}
+	val = num_stack.top();
+	num_stack.pop();
+	if (!num_stack.empty())
+	{
+		data.errCode = DICE_ERROR_STACK;
+		data.errStr = "Too many numbers were found as input.";
+		return 0;
+	}
+	return val;
+}
+
+/** One operand of EvaluatePostfixLanes, holding the value of every lane */
+struct DiceLanes
+{
+	int64_t v[DICE_LANES];
+};
+
+/** Evaluate a postfix notation equation that only uses integer operators on integer operands, for several repetitions at once.
+ * @param postfix The postfix notation equation to evaluate, IsInteger() must be true and HasJumps() false for it
+ * @param lanes The number of repetitions to evaluate, between 1 and DICE_LANES
+ * @param results Array that will receive the result of each repetition
+ * @return true if every repetition was evaluated, false if any of them had an error (the first one's error will be stored in data)
+ *
+ * This works like EvaluatePostfixInteger, except that the operand stack is stored as structure-of-arrays, one value per lane, so that
+ * the arithmetic of every lane is done in the same loop and can be vectorized by the compiler. Each lane throws its own dice. A lane that
+ * has an error is masked off and no longer throws any dice. Nothing is added to the operator results, so this can only be used when
+ * extended output is not needed.
+ */
+static bool EvaluatePostfixLanes(DiceServData &data, const Postfix &postfix, int lanes, int64_t *results)
+{
+	std::vector<DiceLanes> num_stack;
+	num_stack.reserve(postfix.size());
+	bool active[DICE_LANES];
+	DiceErrorCode errCodes[DICE_LANES];
+	int errNums[DICE_LANES];
+	for (int l = 0; l < DICE_LANES; ++l)
+	{
+		active[l] = l < lanes;
+		errCodes[l] = DICE_ERROR_NONE;
+		errNums[l] = 0;
+	}
+	std::vector<DiceLanes> registers(postfix.RegisterCount());
+	for (unsigned x = 0, len = postfix.size(); x < len; ++x)
+	{
+		if (postfix[x]->Type() == POSTFIX_VALUE_REGISTER)
+		{
+			const PostfixValueRegister *reg = anope_dynamic_static_cast<const PostfixValueRegister *>(postfix[x]);
+			if (!reg->IsStore())
 			{
-				postfix.add(lastone);
-				op_stack.pop();
-				lastone = op_stack.empty() ? "" : op_stack.top();
+				DiceLanes val = registers[reg->Index()];
+				if (reg->IsNegative())
+					for (int l = 0; l < DICE_LANES; ++l)
+						val.v[l] = -val.v[l];
+				num_stack.push_back(val);
 			}
-			if (lastone != "(")
+			else if (num_stack.empty())
 			{
-				data.errPos = infix.positions[x];
-				data.errCode = DICE_ERROR_PARSE;
-				data.errStr = "A comma was encountered outside of a function.";
-				postfix.clear();
-				return postfix;
+				data.errCode = DICE_ERROR_STACK;
+				data.errStr = "Not enough numbers for binding.";
+				return false;
+			}
+			else
+			{
+				registers[reg->Index()] = num_stack.back();
+				num_stack.pop_back();
+			}
+		}
+		else if (postfix[x]->Type() == POSTFIX_VALUE_STRING)
+		{
+			const Anope::string *token_ptr = anope_dynamic_static_cast<const PostfixValueString *>(postfix[x])->Get();
+			if (!token_ptr || token_ptr->empty())
+			{
+				data.errCode = DICE_ERROR_STACK;
+				data.errStr = "An empty token was found.";
+				return false;
+			}
+			char op = (*token_ptr)[0];
+			if (num_stack.size() < (op == '~' ? 1u : op == '?' ? 3u : 2u))
+			{
+				data.errCode = DICE_ERROR_STACK;
+				data.errStr = "Not enough numbers for operator.";
+				return false;
+			}
+			if (op == '~')
+			{
+				DiceLanes &val = num_stack.back();
+				for (int l = 0; l < DICE_LANES; ++l)
+					val.v[l] = !val.v[l];
+				continue;
+			}
+			if (op == '?')
+			{
+				// Each lane picks its value with a mask made from its condition instead of a branch, so this can be vectorized as well
+				const DiceLanes &val3 = num_stack[num_stack.size() - 1], &val2 = num_stack[num_stack.size() - 2];
+				DiceLanes &cond = num_stack[num_stack.size() - 3];
+				for (int l = 0; l < DICE_LANES; ++l)
+				{
+					int64_t mask = -static_cast<int64_t>(cond.v[l] != 0);
+					cond.v[l] = (val2.v[l] & mask) | (val3.v[l] & ~mask);
+				}
+				num_stack.resize(num_stack.size() - 2);
+				continue;
+			}
+			const DiceLanes &val2 = num_stack[num_stack.size() - 1];
+			DiceLanes &val1 = num_stack[num_stack.size() - 2];
+			bool overflow[DICE_LANES] = { false };
+			switch (op)
+			{
+				case '+':
+					// Wrapping unsigned arithmetic, overflow happened if the result's sign differs from the sign of both operands
+					for (int l = 0; l < DICE_LANES; ++l)
+					{
+						int64_t sum = static_cast<int64_t>(static_cast<uint64_t>(val1.v[l]) + static_cast<uint64_t>(val2.v[l]));
+						overflow[l] = ((val1.v[l] ^ sum) & (val2.v[l] ^ sum)) < 0;
+						val1.v[l] = sum;
+					}
+					break;
+				case '-':
+					// Wrapping unsigned arithmetic, overflow happened if the operands' signs differ and the result's sign differs from the first operand
+					for (int l = 0; l < DICE_LANES; ++l)
+					{
+						int64_t diff = static_cast<int64_t>(static_cast<uint64_t>(val1.v[l]) - static_cast<uint64_t>(val2.v[l]));
+						overflow[l] = ((val1.v[l] ^ val2.v[l]) & (val1.v[l] ^ diff)) < 0;
+						val1.v[l] = diff;
+					}
+					break;
+				case '*':
+					for (int l = 0; l < DICE_LANES; ++l)
+						overflow[l] = checked_mul(val1.v[l], val2.v[l], val1.v[l]);
+					break;
+				case '%':
+					for (int l = 0; l < DICE_LANES; ++l)
+					{
+						if (!active[l])
+							continue;
+						// Prevent division by 0
+						if (!val2.v[l])
+						{
+							active[l] = false;
+							errCodes[l] = DICE_ERROR_DIV0;
+						}
+						else
+							val1.v[l] = val2.v[l] == -1 ? 0 : val1.v[l] % val2.v[l];
+					}
+					break;
+				case '<':
+					for (int l = 0; l < DICE_LANES; ++l)
+						val1.v[l] = val1.v[l] < val2.v[l];
+					break;
+				case '[':
+					for (int l = 0; l < DICE_LANES; ++l)
+						val1.v[l] = val1.v[l] <= val2.v[l];
+					break;
+				case '>':
+					for (int l = 0; l < DICE_LANES; ++l)
+						val1.v[l] = val1.v[l] > val2.v[l];
+					break;
+				case ']':
+					for (int l = 0; l < DICE_LANES; ++l)
+						val1.v[l] = val1.v[l] >= val2.v[l];
+					break;
+				case '=':
+					for (int l = 0; l < DICE_LANES; ++l)
+						val1.v[l] = val1.v[l] == val2.v[l];
+					break;
+				case '#':
+					for (int l = 0; l < DICE_LANES; ++l)
+						val1.v[l] = val1.v[l] != val2.v[l];
+					break;
+				case '&':
+					for (int l = 0; l < DICE_LANES; ++l)
+						val1.v[l] = (val1.v[l] != 0) & (val2.v[l] != 0);
+					break;
+				case '|':
+					for (int l = 0; l < DICE_LANES; ++l)
+						val1.v[l] = (val1.v[l] != 0) | (val2.v[l] != 0);
+					break;
+				case 'd':
+					for (int l = 0; l < DICE_LANES; ++l)
+					{
+						if (!active[l])
+							continue;
+						// Make sure both the number of dice and the number of sides are within acceptable ranges
+						if (val1.v[l] < 1 || val1.v[l] > DICE_MAX_DICE)
+						{
+							active[l] = false;
+							errCodes[l] = DICE_ERROR_UNACCEPTABLE_DICE;
+							errNums[l] = static_cast<int>(val1.v[l]);
+						}
+						else if (val2.v[l] < 1 || val2.v[l] > DICE_MAX_SIDES)
+						{
+							active[l] = false;
+							errCodes[l] = DICE_ERROR_UNACCEPTABLE_SIDES;
+							errNums[l] = static_cast<int>(val2.v[l]);
+						}
+						else if (token_ptr->length() == 1)
+							val1.v[l] = static_cast<int64_t>(DiceSum(static_cast<int>(val1.v[l]), static_cast<unsigned>(val2.v[l])));
+						else
+						{
+							DiceModifiers mods(*token_ptr, static_cast<unsigned>(val2.v[l]));
+							if (!mods.Usable(static_cast<unsigned>(val2.v[l])))
+							{
+								active[l] = false;
+								errCodes[l] = DICE_ERROR_UNACCEPTABLE_MODIFIER;
+								errNums[l] = static_cast<int>(val2.v[l]);
+							}
+							else
+								val1.v[l] = ModifiedDiceSum(static_cast<int>(val1.v[l]), static_cast<unsigned>(val2.v[l]), mods);
+						}
+					}
 			}
-			else
-			{
-				op_stack.pop();
-				lastone = op_stack.empty() ? "" : op_stack.top();
-				if (!is_function(lastone))
-				{
-					data.errPos = infix.positions[x];
-					data.errCode = DICE_ERROR_PARSE;
-					data.errStr = "A comma was encountered outside of a function.";
-					postfix.clear();
-					return postfix;
-				}
-				else
+			for (int l = 0; l < DICE_LANES; ++l)
+				if (active[l] && overflow[l])
 				{
-					op_stack.push("(");
-					++arity_stack.top();
+					active[l] = false;
+					errCodes[l] = DICE_ERROR_OVERUNDERFLOW;
 				}
-			}
+			num_stack.pop_back();
 		}
 		else
 		{
-			data.errPos = infix.positions[x];
-			data.errCode = DICE_ERROR_PARSE;
-			data.errStr = "An invalid character was encountered.";
-			postfix.clear();
-			return postfix;
+			double number;
+			if (!PostfixNumber(data, postfix[x], number))
+				return false;
+			DiceLanes val;
+			std::fill(val.v, val.v + DICE_LANES, static_cast<int64_t>(number));
+			num_stack.push_back(val);
 		}
-		x += token.length() + (x ? 1 : 0);
 	}
-	if (!op_stack.empty())
+	if (num_stack.size() != 1)
 	{
-		lastone = op_stack.top();
-		while (would_pop("", lastone))
+		data.errCode = DICE_ERROR_STACK;
+		data.errStr = "Too many numbers were found as input.";
+		return false;
+	}
+	for (int l = 0; l < lanes; ++l)
+	{
+		int64_t val = num_stack[0].v[l];
+		if (active[l] && (val > std::numeric_limits<int>::max() || val < std::numeric_limits<int>::min()))
 		{
-			if (is_function(lastone))
-			{
-				if (function_argument_count(lastone) < 0)
-				{
-					unsigned arity = arity_stack.top();
-					Anope::string arityStr = stringify(arity);
-					lastone += "_" + arityStr;
-				}
-				arity_stack.pop();
-			}
-			postfix.add(lastone);
-			op_stack.pop();
-			if (op_stack.empty())
-				break;
-			else
-				lastone = op_stack.top();
+			active[l] = false;
+			errCodes[l] = DICE_ERROR_OVERUNDERFLOW;
 		}
-		if (!op_stack.empty())
+		if (!active[l])
+		{
+			data.errCode = errCodes[l];
+			data.errNum = errNums[l];
+			return false;
+		}
+		results[l] = val;
+	}
+	return true;
+}
+
+/** The most macro expressions whose postfix notation is kept at once, the whole cache being dropped when it would go over */
+static const size_t DICE_MAX_MACRO_PROGRAMS = 10000;
+
+/** The postfix notation of the expressions of macros, keyed by the expressions themselves, so that rolling a macro never parses it again.
+ * As they are keyed by the expression, editing a macro can't leave a stale entry behind, only an unused one, which is dropped when the
+ * macro is edited or deleted.
+ */
+static std::map<Anope::string, Postfix> MacroPrograms;
+
+/** Parse one part of an infix notation expression and convert it to postfix notation.
+ * @param infix The part of the expression, in infix notation
+ * @param bindings The registers of the names bound earlier in the expression
+ * @param registers The number of registers used so far in the expression
+ * @return A postfix notation expression equivalent to the part, or an empty object if it could not be parsed or converted
+ */
+static Postfix ParseInfix(DiceServData &data, const Anope::string &infix, const std::map<Anope::string, unsigned> &bindings, unsigned &registers)
+{
+	Postfix postfix;
+	// FixInfix rewrites operators into these characters, so they can't be let through from the expression itself
+	size_t rewritten = infix.find_first_of("[]#~");
+	if (rewritten != Anope::string::npos)
+	{
+		data.errPos = rewritten;
+		data.errCode = DICE_ERROR_PARSE;
+		data.errStr = "An invalid character was encountered.";
+		return postfix;
+	}
+	Infix infixcpy = FixInfix(infix);
+	if (infixcpy.str.empty())
+		return postfix;
+	if (!CheckInfix(data, infixcpy))
+		return postfix;
+	Infix tokenized_infix = TokenizeInfix(infixcpy);
+	if (tokenized_infix.str.empty())
+		return postfix;
+	postfix = InfixToPostfix(data, tokenized_infix, bindings, registers);
+	return postfix;
+}
+
+/** Parse an infix notation expression, along with the bindings at its start, and convert the expression to postfix notation.
+ * @param infix The expression, in infix notation
+ * @param bindings The registers of the names that are already bound, which are the parameters for the body of a function
+ * @param registers The number of registers already in use
+ * @return A postfix notation expression equivalent to the infix notation expression given, or an empty object if the infix notation expression could not be parsed or converted
+ *
+ * The expression can start with bindings, each being $name=dice; so that the result of the dice can be used several times, such as
+ * $x=1d20;$x+$x. Each binding's dice are stored into a register, which every later use of the name loads from, so the dice are only rolled
+ * once. A name can only be bound once.
+ */
+static Postfix ParseBindings(DiceServData &data, const Anope::string &infix, std::map<Anope::string, unsigned> bindings, unsigned registers)
+{
+	Postfix postfix;
+	size_t start = 0, semicolon;
+	while ((semicolon = infix.find(';', start)) != Anope::string::npos)
+	{
+		unsigned name = infix[start] == '$' ? is_constant(infix, start) : 0;
+		if (!name || start + name > semicolon || infix[start + name] != '=' || start + name + 1 == semicolon)
 		{
-			data.errPos = len < infix.positions.size() ? infix.positions[len] : infix.positions[infix.positions.size() - 1] + 1;
+			data.errPos = start;
 			data.errCode = DICE_ERROR_PARSE;
-			data.errStr = "There are more open parentheses than close parentheses.";
+			data.errStr = "A binding must be a $ and a name, followed by = and dice.";
+			postfix.clear();
+			return postfix;
+		}
+		Anope::string bound = infix.substr(start + 1, name - 1).lower();
+		if (bindings.count(bound))
+		{
+			data.errPos = start;
+			data.errCode = DICE_ERROR_PARSE;
+			data.errStr = "A name can only be bound once.";
+			postfix.clear();
+			return postfix;
+		}
+		size_t dice = start + name + 1;
+		Postfix bound_postfix = ParseInfix(data, infix.substr(dice, semicolon - dice), bindings, registers);
+		if (bound_postfix.empty())
+		{
+			data.errPos += dice;
 			postfix.clear();
 			return postfix;
 		}
+		unsigned index = registers++;
+		postfix.append(bound_postfix);
+		postfix.add_store(index);
+		bindings[bound] = index;
+		start = semicolon + 1;
+	}
+	if (start && start == infix.length())
+	{
+		data.errPos = start;
+		data.errCode = DICE_ERROR_PARSE;
+		data.errStr = "No dice were found after the bindings.";
+		postfix.clear();
+		return postfix;
+	}
+	Postfix result = ParseInfix(data, start ? infix.substr(start) : infix, bindings, registers);
+	if (result.empty())
+	{
+		data.errPos += start;
+		postfix.clear();
+		return postfix;
 	}
+	postfix.append(result);
 	return postfix;
 }
 
-/** Evaluate a postfix notation equation.
- * @param The postfix notation equation to evaluate
- * @return The final result after calculation of the equation
+/** Compile the body of every function defined with DEFINE, the functions it calls being compiled first.
+ * @return true if every function could be compiled, false otherwise
  *
- * The evaluation pops the required values from the operand stack for a function, and 2 values from the operand stack for an operator. The result
- * of either one is placed back on the operand stack, hopefully leaving a single result at the end.
+ * A function that can't be compiled is kept along with the reason, but can't be called until it can be compiled. DEFINE never keeps such
+ * a function, so this only happens to functions loaded from the database before the functions or stats they use.
  */
-static double EvaluatePostfix(DiceServData &data, const Postfix &postfix)
+static bool CompileUserFunctions()
 {
-	double val = 0;
-	std::stack<double> num_stack;
-	for (unsigned x = 0, len = postfix.size(); x < len; ++x)
+	UserFunctionsStale = false;
+	for (Anope::hash_map<DiceUserFunction>::iterator it = UserFunctions.begin(), it_end = UserFunctions.end(); it != it_end; ++it)
 	{
-		if (postfix[x]->Type() == POSTFIX_VALUE_STRING)
+		it->second.ready = false;
+		it->second.compiled.clear();
+		it->second.error.clear();
+		it->second.errorPos = 0;
+	}
+	bool compiled_any = true, all = true;
+	while (compiled_any)
+	{
+		compiled_any = false;
+		for (Anope::hash_map<DiceUserFunction>::iterator it = UserFunctions.begin(), it_end = UserFunctions.end(); it != it_end; ++it)
 		{
-			const Anope::string *token_ptr = anope_dynamic_static_cast<const PostfixValueString *>(postfix[x])->Get();
-			Anope::string token = token_ptr ? *token_ptr : "";
-			if (token.empty())
+			DiceUserFunction &function = it->second;
+			if (function.ready || !function.error.empty())
+				continue;
+			// A function is only compiled once every function it calls has been, which also keeps it from being compiled against itself
+			std::vector<Anope::string> calls;
+			FunctionCalls(function.body, calls);
+			bool waiting = false;
+			for (unsigned y = 0, len = calls.size(); y < len && !waiting; ++y)
+				waiting = !UserFunctions.find(calls[y])->second.ready;
+			if (waiting)
+				continue;
+			std::map<Anope::string, unsigned> params;
+			for (unsigned y = 0, len = function.params.size(); y < len; ++y)
+				params[function.params[y]] = y;
+			DiceServData data;
+			function.compiled = ParseBindings(data, function.body, params, function.params.size());
+			if (function.compiled.empty())
 			{
-				data.errCode = DICE_ERROR_STACK;
-				data.errStr = "An empty token was found.";
-				return 0;
+				function.error = data.errStr.empty() ? "The body can't be compiled." : data.errStr;
+				function.errorPos = data.errPos;
+				all = false;
+				continue;
 			}
-			if (is_function(token))
-			{
-				int function_arguments = function_argument_count(token);
-				if (function_arguments < 0)
-				{
-					size_t underscore = token.find('_');
-					int real_function_arguments = convertTo<int>(token.substr(underscore + 1));
-					token = token.substr(0, underscore);
-					if (real_function_arguments < -function_arguments)
-					{
-						data.errCode = DICE_ERROR_STACK;
-						data.errStr = "Function requires at least " + stringify(-function_arguments) + " arguments, but only " +
-							stringify(real_function_arguments) + " were passed.";
-						return 0;
-					}
-					function_arguments = real_function_arguments;
-				}
-				if (num_stack.empty() || num_stack.size() < static_cast<unsigned>(function_arguments))
-				{
-					data.errCode = DICE_ERROR_STACK;
-					data.errStr = "Not enough numbers for function.";
-					return 0;
-				}
-				double val1 = num_stack.top();
-				num_stack.pop();
-				FunctionResult result;
-				if (token.equals_ci("abs"))
-				{
-					val = std::abs(val1);
-					result.SetNameAndResult("abs", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("acos"))
-				{
-					// Arc cosine is undefined outside the domain [-1, 1]
-					if (std::abs(val1) > 1)
-					{
-						data.errCode = DICE_ERROR_UNDEFINED;
-						return 0;
-					}
-					val = std::acos(val1);
-					result.SetNameAndResult("acos", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("acosh"))
-				{
-					// Inverse hyperbolic cosine is undefined for any value less than 1
-					if (val1 < 1)
-					{
-						data.errCode = DICE_ERROR_UNDEFINED;
-						return 0;
-					}
-					val = acosh(val1);
-					result.SetNameAndResult("acosh", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("asin"))
-				{
-					// Arc sine is undefined outside the domain [-1, 1]
-					if (std::abs(val1) > 1)
-					{
-						data.errCode = DICE_ERROR_UNDEFINED;
-						return 0;
-					}
-					val = std::asin(val1);
-					result.SetNameAndResult("asin", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("asinh"))
-				{
-					val = asinh(val1);
-					result.SetNameAndResult("asinh", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("atan"))
-				{
-					val = std::atan(val1);
-					result.SetNameAndResult("atan", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("atan2"))
-				{
-					double val2 = val1;
-					val1 = num_stack.top();
-					num_stack.pop();
-					val = std::atan2(val1, val2);
-					result.SetNameAndResult("atan2", val);
-					result.AddArgument(val1);
-					result.AddArgument(val2);
-				}
-				else if (token.equals_ci("atanh"))
-				{
-					// Inverse hyperbolic tangent is undefined outside the domain (-1, 1)
-					if (std::abs(val1) >= 1)
-					{
-						data.errCode = std::abs(val1) == 1 ? DICE_ERROR_DIV0 : DICE_ERROR_UNDEFINED;
-						return 0;
-					}
-					val = atanh(val1);
-					result.SetNameAndResult("atanh", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("cbrt"))
-				{
-					val = cbrt(val1);
-					result.SetNameAndResult("cbrt", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("ceil"))
-				{
-					val = std::ceil(val1);
-					result.SetNameAndResult("ceil", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("cos"))
-				{
-					val = std::cos(val1);
-					result.SetNameAndResult("cos", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("cosh"))
-				{
-					val = std::cosh(val1);
-					result.SetNameAndResult("cosh", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("deg"))
-				{
-					val = val1 * 45.0 / std::atan(1.0);
-					result.SetNameAndResult("deg", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("exp"))
-				{
-					val = std::exp(val1);
-					result.SetNameAndResult("exp", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("fac"))
+			function.ready = compiled_any = true;
+		}
+	}
+	// Anything still left calls itself, either directly or through other functions, or calls a function that failed above
+	for (Anope::hash_map<DiceUserFunction>::iterator it = UserFunctions.begin(), it_end = UserFunctions.end(); it != it_end; ++it)
+		if (!it->second.ready && it->second.error.empty())
+		{
+			it->second.error = "A function can't call itself, either directly or through\nother functions, or call a function that can't be compiled.";
+			all = false;
+		}
+	return all;
+}
+
+/** Parse an infix notation expression and convert the expression to postfix notation.
+ * @param infix The original expression, in infix notation, to convert to postfix notation
+ * @return A postfix notation expression equivalent to the infix notation expression given, or an empty object if the infix notation expression could not be parsed or converted
+ *
+ * Expressions that were parsed before are returned from MacroPrograms without being parsed again.
+ */
+static Postfix DoParse(DiceServData &data, const Anope::string &infix)
+{
+	std::map<Anope::string, Postfix>::const_iterator compiled = MacroPrograms.find(infix);
+	if (compiled != MacroPrograms.end())
+		return compiled->second;
+	return ParseBindings(data, infix, std::map<Anope::string, unsigned>(), 0);
+}
+
+/** Evaluate a postfix notation expression.
+ * @param postfix The postfix notation expression to evaluate
+ * @return The final result after evaluation
+ */
+static double DoEvaluate(DiceServData &data, const Postfix &postfix)
+{
+	/* Integer-only equations skip the floating point evaluator. This is only done when the result is going to be rounded, as CALC and EXCALC
+	 * show the unrounded result and a double can end up as -0 where an integer can't. */
+	if (data.roundResults && postfix.IsInteger())
+	{
+		int64_t ret = EvaluatePostfixInteger(data, postfix);
+		if (data.errCode != DICE_ERROR_OVERUNDERFLOW)
+		{
+			if (ret > std::numeric_limits<int>::max() || ret < std::numeric_limits<int>::min())
+				data.errCode = DICE_ERROR_OVERUNDERFLOW;
+			return static_cast<double>(ret);
+		}
+		/* A value along the way went past 64 bits, which the floating point evaluator can still get a result from (such as for
+		 * 99999*99999*99999*99999*0), so the equation is evaluated again with that, throwing away the dice rolled the first time. */
+		data.errCode = DICE_ERROR_NONE;
+		if (!data.opResults.empty())
+			data.opResults.back().clear();
+	}
+	double ret = EvaluatePostfix(data, postfix);
+	if (ret > std::numeric_limits<int>::max() || ret < std::numeric_limits<int>::min())
+		data.errCode = DICE_ERROR_OVERUNDERFLOW;
+	return ret;
+}
+
+/** Evaluate a parsed dice expression over and over, handing each rounded result to a sink.
+ * @param postfix The postfix notation expression to evaluate
+ * @param requested The number of times to evaluate the expression
+ * @param deadline The wall clock time, from wall_clock_ms(), to stop at, 0 for no limit
+ * @param sink Object with an Add(int64_t) function that is given each result
+ * @return The number of evaluations that were done, which is less than requested if there was an error or the time limit ran out
+ *
+ * No operator results are recorded and no results are stored. Integer-only expressions are evaluated DICE_LANES at a time, unless they have
+ * jumps that each lane would need to take on its own, and the deadline is checked between each batch of DICE_LANES evaluations.
+ */
+template<typename T> static uint64_t RollRepeatedly(DiceServData &data, const Postfix &postfix, uint64_t requested, double deadline, T &sink)
+{
+	bool useLanes = data.roundResults && postfix.IsInteger() && !postfix.HasJumps();
+	int64_t laneResults[DICE_LANES];
+	uint64_t done = 0;
+	while (done < requested)
+	{
+		if (deadline && wall_clock_ms() >= deadline)
+			break;
+		int lanes = static_cast<int>(std::min<uint64_t>(requested - done, DICE_LANES));
+		if (useLanes)
+		{
+			if (!EvaluatePostfixLanes(data, postfix, lanes, laneResults))
+			{
+				if (data.errCode != DICE_ERROR_OVERUNDERFLOW)
+					break;
+				// DoEvaluate falls back to the floating point evaluator when a value along the way overflows, which the lanes can't do
+				data.errCode = DICE_ERROR_NONE;
+				useLanes = false;
+				continue;
+			}
+			for (int l = 0; l < lanes; ++l)
+				sink.Add(laneResults[l]);
+			done += lanes;
+		}
+		else
+			for (; lanes > 0; --lanes)
+			{
+				double v = DoEvaluate(data, postfix);
+				if (data.errCode != DICE_ERROR_NONE)
+					return done;
+				sink.Add(static_cast<int64_t>(my_round(v)));
+				++done;
+			}
+	}
+	return done;
+}
+
+/** Perform an in-place fast Fourier transform.
+ * @param values The values to transform, the number of them must be a power of 2
+ * @param inverse true to do the inverse transform (including dividing by the number of values), false to do the forward transform
+ *
+ * This is the iterative radix-2 Cooley-Tukey algorithm. The twiddle factors are calculated once up front instead of being built up by
+ * repeated multiplication, as the latter loses too much precision on large transforms.
+ */
+static void FFT(std::vector<std::complex<double> > &values, bool inverse)
+{
+	size_t n = values.size();
+	// Put the values into bit-reversed order
+	for (size_t i = 1, j = 0; i < n; ++i)
+	{
+		size_t bit = n >> 1;
+		for (; j & bit; bit >>= 1)
+			j ^= bit;
+		j ^= bit;
+		if (i < j)
+			std::swap(values[i], values[j]);
+	}
+	double angle = (inverse ? -8 : 8) * std::atan(1.0) / n;
+	std::vector<std::complex<double> > twiddles(n / 2);
+	for (size_t i = 0; i < n / 2; ++i)
+		twiddles[i] = std::complex<double>(std::cos(angle * i), std::sin(angle * i));
+	for (size_t len = 2; len <= n; len <<= 1)
+	{
+		size_t half = len / 2, step = n / len;
+		for (size_t i = 0; i < n; i += len)
+			for (size_t j = 0; j < half; ++j)
+			{
+				std::complex<double> u = values[i + j], v = values[i + j + half] * twiddles[j * step];
+				values[i + j] = u + v;
+				values[i + j + half] = u - v;
+			}
+	}
+	if (inverse)
+		for (size_t i = 0; i < n; ++i)
+			values[i] /= static_cast<double>(n);
+}
+
+/** Convolve two lists of probabilities, giving the distribution of the sum of two independent results.
+ * @param a The first list
+ * @param b The second list
+ * @return The convolution, with a.size() + b.size() - 1 entries
+ *
+ * Small lists are convolved directly, larger ones go through FFT so that large pools (such as 300d20) take O(n log n) instead of O(n^2).
+ */
+static std::vector<double> Convolve(const std::vector<double> &a, const std::vector<double> &b)
+{
+	size_t len = a.size() + b.size() - 1;
+	std::vector<double> result(len, 0.0);
+	if (std::min(a.size(), b.size()) <= 32 || a.size() * b.size() <= 65536)
+	{
+		for (size_t i = 0; i < a.size(); ++i)
+			if (a[i])
+				for (size_t j = 0; j < b.size(); ++j)
+					result[i + j] += a[i] * b[j];
+		return result;
+	}
+	size_t n = 1;
+	while (n < len)
+		n <<= 1;
+	std::vector<std::complex<double> > fa(a.begin(), a.end()), fb(b.begin(), b.end());
+	fa.resize(n);
+	fb.resize(n);
+	FFT(fa, false);
+	FFT(fb, false);
+	for (size_t i = 0; i < n; ++i)
+		fa[i] *= fb[i];
+	FFT(fa, true);
+	// Rounding errors can leave tiny negative probabilities where there should be none
+	for (size_t i = 0; i < len; ++i)
+		result[i] = std::max(fa[i].real(), 0.0);
+	return result;
+}
+
+/** Add two independent distributions.
+ * @param a The first distribution, will receive the sum
+ * @param b The second distribution
+ * @return false if the sum would have too many possible results, true otherwise
+ */
+static bool DistributionAdd(DiceServDistribution &a, const DiceServDistribution &b)
+{
+	if (a.pmf.size() + b.pmf.size() - 1 > DICE_MAX_DISTRIBUTION)
+		return false;
+	a.first += b.first;
+	a.pmf = Convolve(a.pmf, b.pmf);
+	return true;
+}
+
+/** Negate a distribution.
+ * @param dist The distribution to negate
+ */
+static void DistributionNegate(DiceServDistribution &dist)
+{
+	dist.first = -dist.Highest();
+	std::reverse(dist.pmf.begin(), dist.pmf.end());
+}
+
+/** Get the distribution of the sum of a number of throws of a single die.
+ * @param num The number of dice
+ * @param die The distribution of a single die
+ * @param dist The distribution to store the results in
+ * @return false if there are too many dice or the sum would have too many possible results, true otherwise
+ *
+ * This is done by binary exponentiation of the die's distribution, so 300d20 only takes about a dozen convolutions.
+ */
+static bool DistributionRepeat(int64_t num, DiceServDistribution &die, DiceServDistribution &dist)
+{
+	if (num < 1 || num > DICE_MAX_DICE || num * static_cast<int64_t>(die.pmf.size() - 1) + 1 > static_cast<int64_t>(DICE_MAX_DISTRIBUTION))
+		return false;
+	dist.first = 0;
+	dist.pmf.assign(1, 1.0);
+	for (;;)
+	{
+		if (num & 1)
+			DistributionAdd(dist, die);
+		num >>= 1;
+		if (!num)
+			break;
+		DistributionAdd(die, die);
+	}
+	return true;
+}
+
+/** Get the distribution of a number of dice.
+ * @param num The number of dice
+ * @param sides The number of sides on each die
+ * @param dist The distribution to store the results in
+ * @return false if the dice are out of range or would have too many possible results, true otherwise
+ */
+static bool DistributionDice(int64_t num, int64_t sides, DiceServDistribution &dist)
+{
+	if (sides < 1 || sides > DICE_MAX_SIDES)
+		return false;
+	DiceServDistribution die;
+	die.first = 1;
+	die.pmf.assign(sides, 1.0 / sides);
+	return DistributionRepeat(num, die, dist);
+}
+
+/** Same as above, but for dice with custom faces.
+ * @param num The number of dice
+ * @param values The value of each face
+ * @param dist The distribution to store the results in
+ * @return false if the dice are out of range or would have too many possible results, true otherwise
+ */
+static bool DistributionCustomDice(int64_t num, const std::vector<int> &values, DiceServDistribution &dist)
+{
+	int lowest = *std::min_element(values.begin(), values.end()), highest = *std::max_element(values.begin(), values.end());
+	DiceServDistribution die;
+	die.first = lowest;
+	die.pmf.assign(highest - lowest + 1, 0.0);
+	for (size_t i = 0, len = values.size(); i < len; ++i)
+		die.pmf[values[i] - lowest] += 1.0 / len;
+	return DistributionRepeat(num, die, dist);
+}
+
+/** Combine two independent distributions one pair of results at a time.
+ * @param a The first distribution, will receive the combined distribution
+ * @param b The second distribution
+ * @param op The operator to combine them with, either * or %
+ * @return false if there would be too much work or too many possible results or if a % could divide by 0, true otherwise
+ */
+static bool DistributionCombine(DiceServDistribution &a, const DiceServDistribution &b, char op)
+{
+	if (a.pmf.size() * b.pmf.size() > DICE_MAX_DISTRIBUTION)
+		return false;
+	std::map<int64_t, double> combined;
+	for (size_t i = 0; i < a.pmf.size(); ++i)
+		if (a.pmf[i])
+			for (size_t j = 0; j < b.pmf.size(); ++j)
+				if (b.pmf[j])
 				{
-					// Negative factorials are considered undefined
-					if (static_cast<int>(val1) < 0)
-					{
-						data.errCode = DICE_ERROR_UNDEFINED;
-						return 0;
-					}
-					// Any factorials over 12 will be outside the range of a signed 32-bit integer, so don't bother to calculate them
-					if (val1 > 12)
+					int64_t val1 = a.first + static_cast<int64_t>(i), val2 = b.first + static_cast<int64_t>(j), val;
+					if (op == '*')
 					{
-						data.errCode = DICE_ERROR_OVERUNDERFLOW;
-						return 0;
+						if (checked_mul(val1, val2, val))
+							return false;
 					}
-					val = 1;
-					for (unsigned n = 2; n <= static_cast<unsigned>(val1); ++n)
-						val *= n;
-					result.SetNameAndResult("fac", val);
-					result.AddArgument(static_cast<unsigned>(val1));
-				}
-				else if (token.equals_ci("floor"))
-				{
-					val = std::floor(val1);
-					result.SetNameAndResult("floor", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("log"))
-				{
-					// Logarithm is invalid for values 0 or less
-					if (val1 <= 0)
+					else
 					{
-						data.errCode = DICE_ERROR_DIV0;
-						return 0;
+						if (!val2)
+							return false;
+						val = val2 == -1 ? 0 : val1 % val2;
 					}
-					val = std::log(val1);
-					result.SetNameAndResult("log", val);
-					result.AddArgument(val1);
+					combined[val] += a.pmf[i] * b.pmf[j];
 				}
-				else if (token.equals_ci("log10"))
+	int64_t lowest = combined.begin()->first, highest = combined.rbegin()->first;
+	if (highest - lowest >= static_cast<int64_t>(DICE_MAX_DISTRIBUTION))
+		return false;
+	a.first = lowest;
+	a.pmf.assign(highest - lowest + 1, 0.0);
+	for (std::map<int64_t, double>::const_iterator it = combined.begin(), it_end = combined.end(); it != it_end; ++it)
+		a.pmf[it->first - lowest] = it->second;
+	return true;
+}
+
+/** Take the maximum or minimum of two independent distributions.
+ * @param a The first distribution, will receive the result
+ * @param b The second distribution
+ * @param maximum true for the maximum, false for the minimum
+ *
+ * The cumulative distribution of the maximum is the product of the two cumulative distributions, and the minimum is done the same way with
+ * the survival functions. Both are built up one result at a time as the range is gone through, so this is linear in the number of possible
+ * results.
+ */
+static void DistributionExtreme(DiceServDistribution &a, const DiceServDistribution &b, bool maximum)
+{
+	int64_t lowest = maximum ? std::max(a.Lowest(), b.Lowest()) : std::min(a.Lowest(), b.Lowest()),
+		highest = maximum ? std::max(a.Highest(), b.Highest()) : std::min(a.Highest(), b.Highest());
+	std::vector<double> pmf(highest - lowest + 1, 0.0);
+	double prev = 0;
+	if (maximum)
+	{
+		// Everything below the range is only summed once, to start the running cumulative distributions off
+		double cdfA = a.AtMost(lowest - 1), cdfB = b.AtMost(lowest - 1);
+		for (int64_t v = lowest; v <= highest; ++v)
+		{
+			cdfA = v >= a.Highest() ? 1 : std::min(cdfA + a.Exactly(v), 1.0);
+			cdfB = v >= b.Highest() ? 1 : std::min(cdfB + b.Exactly(v), 1.0);
+			double cdf = cdfA * cdfB;
+			pmf[v - lowest] = std::max(cdf - prev, 0.0);
+			prev = cdf;
+		}
+	}
+	else
+	{
+		double sfA = a.AtLeast(highest + 1), sfB = b.AtLeast(highest + 1);
+		for (int64_t v = highest; v >= lowest; --v)
+		{
+			sfA = v <= a.Lowest() ? 1 : std::min(sfA + a.Exactly(v), 1.0);
+			sfB = v <= b.Lowest() ? 1 : std::min(sfB + b.Exactly(v), 1.0);
+			double sf = sfA * sfB;
+			pmf[v - lowest] = std::max(sf - prev, 0.0);
+			prev = sf;
+		}
+	}
+	a.first = lowest;
+	a.pmf.swap(pmf);
+}
+
+/** Make the distribution of a condition, which is 1 when it holds and 0 when it doesn't.
+ * @param prob The probability of the condition holding
+ * @param dist The distribution to store the results in
+ */
+static void DistributionCondition(double prob, DiceServDistribution &dist)
+{
+	dist.first = prob >= 1 ? 1 : 0;
+	if (prob <= 0 || prob >= 1)
+		dist.pmf.assign(1, 1.0);
+	else
+	{
+		dist.pmf.assign(2, 1 - prob);
+		dist.pmf[1] = prob;
+	}
+}
+
+/** Compare two independent distributions.
+ * @param a The first distribution, will receive the distribution of the comparison
+ * @param b The second distribution, will be negated
+ * @param op The comparison, after FixInfix has rewritten it
+ * @return false if the difference of the two would have too many possible results, true otherwise
+ *
+ * The comparison is worked out from the distribution of a - b, which is only a single convolution.
+ */
+static bool DistributionCompare(DiceServDistribution &a, DiceServDistribution &b, char op)
+{
+	DistributionNegate(b);
+	if (!DistributionAdd(a, b))
+		return false;
+	double prob;
+	switch (op)
+	{
+		case '<':
+			prob = a.AtMost(-1);
+			break;
+		case '[':
+			prob = a.AtMost(0);
+			break;
+		case '>':
+			prob = a.AtLeast(1);
+			break;
+		case ']':
+			prob = a.AtLeast(0);
+			break;
+		case '=':
+			prob = a.Exactly(0);
+			break;
+		default:
+			prob = 1 - a.Exactly(0);
+	}
+	DistributionCondition(prob, a);
+	return true;
+}
+
+/** Pick between two independent distributions, depending on a third.
+ * @param cond The distribution of the condition, will receive the distribution of the result
+ * @param a The distribution picked when the condition isn't 0
+ * @param b The distribution picked when the condition is 0
+ * @return false if the result would have too many possible results, true otherwise
+ */
+static bool DistributionSelect(DiceServDistribution &cond, const DiceServDistribution &a, const DiceServDistribution &b)
+{
+	double prob = 1 - cond.Exactly(0);
+	if (prob <= 0 || prob >= 1)
+	{
+		cond = prob >= 1 ? a : b;
+		return true;
+	}
+	int64_t lowest = std::min(a.Lowest(), b.Lowest()), highest = std::max(a.Highest(), b.Highest());
+	if (highest - lowest >= static_cast<int64_t>(DICE_MAX_DISTRIBUTION))
+		return false;
+	std::vector<double> pmf(highest - lowest + 1, 0.0);
+	for (size_t i = 0, len = a.pmf.size(); i < len; ++i)
+		pmf[a.first + i - lowest] += prob * a.pmf[i];
+	for (size_t i = 0, len = b.pmf.size(); i < len; ++i)
+		pmf[b.first + i - lowest] += (1 - prob) * b.pmf[i];
+	cond.first = lowest;
+	cond.pmf.swap(pmf);
+	return true;
+}
+
+/** Work out the exact distribution of a postfix notation expression.
+ * @param postfix The postfix notation expression
+ * @param dist The distribution to store the results in
+ * @return true if the distribution was worked out, false if the expression can't be handled exactly (or uses a stat that isn't set, with the
+ * error stored in data)
+ *
+ * Every value on the stack is a distribution, with numbers being a distribution with a single result. As each operand comes from a separate
+ * part of the expression, they are independent of each other. Only integer numbers with + - * % d, the comparison, boolean and conditional
+ * operators and the abs, max, min, ceil, floor, round and trunc functions are handled, anything else (such as division or powers) needs to be
+ * estimated by sampling instead. Both branches of a conditional are worked out, so its jumps are ignored and the MERGE where they meet is
+ * the same as a select.
+ */
+static bool DistributionOfPostfix(DiceServData &data, const Postfix &postfix, DiceServDistribution &dist)
+{
+	std::vector<DiceServDistribution> dist_stack;
+	std::vector<DiceServDistribution> registers(postfix.RegisterCount());
+	std::vector<bool> loaded(postfix.RegisterCount());
+	for (unsigned x = 0, len = postfix.size(); x < len; ++x)
+	{
+		if (postfix[x]->Type() == POSTFIX_VALUE_REGISTER)
+		{
+			// A binding used more than once isn't independent of itself, so it can only be followed if it is used at most once
+			const PostfixValueRegister *reg = anope_dynamic_static_cast<const PostfixValueRegister *>(postfix[x]);
+			if (reg->IsStore())
+			{
+				if (dist_stack.empty())
+					return false;
+				registers[reg->Index()].first = dist_stack.back().first;
+				registers[reg->Index()].pmf.swap(dist_stack.back().pmf);
+				dist_stack.pop_back();
+			}
+			else
+			{
+				if (loaded[reg->Index()])
+					return false;
+				loaded[reg->Index()] = true;
+				dist_stack.push_back(registers[reg->Index()]);
+				if (reg->IsNegative())
+					DistributionNegate(dist_stack.back());
+			}
+		}
+		else if (postfix[x]->Type() == POSTFIX_VALUE_JUMP)
+		{
+			if (anope_dynamic_static_cast<const PostfixValueJump *>(postfix[x])->Kind() != POSTFIX_JUMP_MERGE)
+				continue;
+			if (dist_stack.size() < 3 || !DistributionSelect(dist_stack[dist_stack.size() - 3], dist_stack[dist_stack.size() - 2], dist_stack.back()))
+				return false;
+			dist_stack.resize(dist_stack.size() - 2);
+		}
+		else if (postfix[x]->Type() == POSTFIX_VALUE_STRING)
+		{
+			const Anope::string *token_ptr = anope_dynamic_static_cast<const PostfixValueString *>(postfix[x])->Get();
+			if (!token_ptr || token_ptr->empty())
+				return false;
+			Anope::string token = *token_ptr;
+			if (is_builtin_function(token))
+			{
+				size_t underscore = token.find('_');
+				unsigned arguments = underscore == Anope::string::npos ? 1 : convertTo<unsigned>(token.substr(underscore + 1));
+				token = token.substr(0, underscore);
+				if (dist_stack.size() < arguments)
+					return false;
+				DiceServDistribution &val = dist_stack[dist_stack.size() - arguments];
+				if (token.equals_ci("max") || token.equals_ci("min"))
+					for (unsigned y = 1; y < arguments; ++y)
+						DistributionExtreme(val, dist_stack[dist_stack.size() - arguments + y], token.equals_ci("max"));
+				else if (token.equals_ci("abs"))
 				{
-					// Logarithm is invalid for values 0 or less
-					if (val1 <= 0)
+					if (val.Lowest() < 0)
 					{
-						data.errCode = DICE_ERROR_DIV0;
-						return 0;
+						DiceServDistribution negative = val;
+						DistributionNegate(negative);
+						int64_t lowest = val.Highest() < 0 ? negative.Lowest() : 0, highest = std::max(val.Highest(), negative.Highest());
+						std::vector<double> pmf(highest - lowest + 1, 0.0);
+						for (int64_t v = lowest; v <= highest; ++v)
+							pmf[v - lowest] = val.Exactly(v) + (v ? negative.Exactly(v) : 0);
+						val.first = lowest;
+						val.pmf.swap(pmf);
 					}
-					val = std::log10(val1);
-					result.SetNameAndResult("log10", val);
-					result.AddArgument(val1);
 				}
-				else if (token.equals_ci("max"))
+				// Rounding an integer leaves it as is
+				else if (!token.equals_ci("ceil") && !token.equals_ci("floor") && !token.equals_ci("round") && !token.equals_ci("trunc"))
+					return false;
+				dist_stack.resize(dist_stack.size() - arguments + 1);
+				continue;
+			}
+			if (token == "~")
+			{
+				if (dist_stack.empty())
+					return false;
+				DistributionCondition(dist_stack.back().Exactly(0), dist_stack.back());
+				continue;
+			}
+			if (token == "?")
+			{
+				if (dist_stack.size() < 3 || !DistributionSelect(dist_stack[dist_stack.size() - 3], dist_stack[dist_stack.size() - 2], dist_stack.back()))
+					return false;
+				dist_stack.resize(dist_stack.size() - 2);
+				continue;
+			}
+			// Dice with modifiers are left to sampling, but dice with custom faces are exact
+			if (dist_stack.size() < 2 || (token.length() != 1 && token.find("d{") != 0))
+				return false;
+			DiceServDistribution &val2 = dist_stack[dist_stack.size() - 1];
+			DiceServDistribution &val1 = dist_stack[dist_stack.size() - 2];
+			switch (token[0])
+			{
+				case '+':
+					if (!DistributionAdd(val1, val2))
+						return false;
+					break;
+				case '-':
+					DistributionNegate(val2);
+					if (!DistributionAdd(val1, val2))
+						return false;
+					break;
+				case '*':
+				case '%':
+					if (!DistributionCombine(val1, val2, token[0]))
+						return false;
+					break;
+				case '<':
+				case '[':
+				case '>':
+				case ']':
+				case '=':
+				case '#':
+					if (!DistributionCompare(val1, val2, token[0]))
+						return false;
+					break;
+				case '&':
+					DistributionCondition((1 - val1.Exactly(0)) * (1 - val2.Exactly(0)), val1);
+					break;
+				case '|':
+					DistributionCondition(1 - val1.Exactly(0) * val2.Exactly(0), val1);
+					break;
+				case 'd':
 				{
-					std::stack<double> args;
-					args.push(val1);
-					for (int i = 1; i < function_arguments; ++i)
-					{
-						double val2 = val1;
-						val1 = num_stack.top();
-						num_stack.pop();
-						args.push(val1);
-						val = val1 = std::max(val1, val2);
-					}
-					result.SetNameAndResult("max", val);
-					while (!args.empty())
+					// The number of sides has to be fixed, but the number of dice can vary, in which case each possible number of dice is weighted
+					if (val2.pmf.size() != 1)
+						return false;
+					int64_t sides = val2.first;
+					if (token.length() != 1)
 					{
-						result.AddArgument(args.top());
-						args.pop();
+						// Dice with custom faces only have exact odds for a fixed number of dice
+						if (val1.pmf.size() != 1 || !DistributionCustomDice(val1.first, DiceModifiers(token, sides).faceValues, val1))
+							return false;
+						break;
 					}
-				}
-				else if (token.equals_ci("min"))
-				{
-					std::stack<double> args;
-					args.push(val1);
-					for (int i = 1; i < function_arguments; ++i)
+					if (val1.pmf.size() == 1)
 					{
-						double val2 = val1;
-						val1 = num_stack.top();
-						num_stack.pop();
-						args.push(val1);
-						val = val1 = std::min(val1, val2);
+						if (!DistributionDice(val1.first, sides, val1))
+							return false;
+						break;
 					}
-					result.SetNameAndResult("min", val);
-					while (!args.empty())
+					if (val1.Lowest() < 1 || val1.Highest() > DICE_MAX_DICE || sides < 1 || sides > DICE_MAX_SIDES ||
+						val1.Highest() * (sides - 1) + 1 > static_cast<int64_t>(DICE_MAX_DISTRIBUTION) ||
+						val1.Highest() * val1.Highest() * (sides - 1) > static_cast<int64_t>(DICE_MAX_DISTRIBUTION) * 16)
+						return false;
+					DiceServDistribution die, sum, mixture;
+					DistributionDice(1, sides, die);
+					mixture.first = val1.Lowest();
+					mixture.pmf.assign(val1.Highest() * sides - mixture.first + 1, 0.0);
+					for (int64_t n = 1; n <= val1.Highest(); ++n)
 					{
-						result.AddArgument(args.top());
-						args.pop();
+						if (n == 1)
+							sum = die;
+						else
+							DistributionAdd(sum, die);
+						double weight = val1.Exactly(n);
+						if (weight)
+							for (size_t i = 0; i < sum.pmf.size(); ++i)
+								mixture.pmf[sum.first + i - mixture.first] += weight * sum.pmf[i];
 					}
+					val1 = mixture;
+					break;
 				}
-				else if (token.equals_ci("rad"))
-				{
-					val = val1 * std::atan(1.0) / 45.0;
-					result.SetNameAndResult("rad", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("rand"))
+				default:
+					return false;
+			}
+			dist_stack.pop_back();
+		}
+		else
+		{
+			double number;
+			if (!PostfixNumber(data, postfix[x], number) || !is_integer_literal(number))
+				return false;
+			DiceServDistribution val;
+			val.first = static_cast<int64_t>(number);
+			val.pmf.assign(1, 1.0);
+			dist_stack.push_back(val);
+		}
+	}
+	if (dist_stack.size() != 1)
+		return false;
+	dist.first = dist_stack[0].first;
+	dist.pmf.swap(dist_stack[0].pmf);
+	return true;
+}
+
+/** Replace the operands on the top of the stack with the result of an operator or function, when every one of them is a constant.
+ * @param token The operator or function, as it appears in the postfix notation expression
+ * @param avg_stack The stack of summaries
+ * @param arguments The number of operands the operator or function takes
+ * @return true if it was evaluated, false if it caused an error
+ *
+ * This goes through EvaluatePostfix so that constants give the same results and errors as they would when rolling, it must not be used
+ * for anything that rolls dice.
+ */
+static bool FoldConstants(DiceServData &data, const Anope::string &token, std::vector<DiceServAverage> &avg_stack, unsigned arguments)
+{
+	Postfix folded;
+	for (size_t y = avg_stack.size() - arguments, len = avg_stack.size(); y < len; ++y)
+		folded.add(avg_stack[y].mean);
+	folded.add(token);
+	double val = EvaluatePostfix(data, folded);
+	if (data.errCode != DICE_ERROR_NONE)
+		return false;
+	avg_stack.resize(avg_stack.size() - arguments);
+	avg_stack.push_back(DiceServAverage(val));
+	return true;
+}
+
+/** Replace the three operands of a select on the top of the stack with the select's result, when its condition is a constant.
+ * @param avg_stack The stack of summaries
+ * @return true if it was followed, false if the condition isn't a constant or there was an error
+ *
+ * The dice of both branches are still counted, as the branch that isn't picked is rolled as well unless it is jumped over.
+ */
+static bool AverageSelect(DiceServData &data, std::vector<DiceServAverage> &avg_stack)
+{
+	if (avg_stack.size() < 3)
+		return false;
+	size_t first = avg_stack.size() - 3;
+	if (!avg_stack[first].IsConstant())
+		return false;
+	if (avg_stack[first + 1].IsConstant() && avg_stack[first + 2].IsConstant())
+		return FoldConstants(data, "?", avg_stack, 3);
+	double dice = avg_stack[first].dice + avg_stack[first + 1].dice + avg_stack[first + 2].dice;
+	avg_stack[first] = avg_stack[avg_stack[first].mean ? first + 1 : first + 2];
+	avg_stack[first].dice = dice;
+	avg_stack.resize(first + 1);
+	return true;
+}
+
+/** Work out the analytic summary of the results of a postfix notation expression, without rolling any dice.
+ * @param postfix The postfix notation expression to summarize
+ * @param avg The summary to store the results in
+ * @return true if the summary was worked out, false if there was an error or the expression can't be followed analytically
+ *
+ * The mean and variance are carried through + - * and division by a constant as each operand comes from a separate part of the expression,
+ * and so is independent of the others. A die with s sides has a mean of (s + 1) / 2 and a variance of (s^2 - 1) / 12, and these are
+ * combined with the moments of the number of dice and the number of sides when those vary. Anything applied only to constants is simply
+ * evaluated. The remaining functions are only followed when they can't change the results (such as floor of an integer), and a conditional
+ * is only followed when its condition is a constant, otherwise this gives up and leaves data without an error.
+ */
+static bool AverageOfPostfix(DiceServData &data, const Postfix &postfix, DiceServAverage &avg)
+{
+	std::vector<DiceServAverage> avg_stack;
+	std::vector<DiceServAverage> registers(postfix.RegisterCount());
+	std::vector<bool> loaded(postfix.RegisterCount());
+	for (unsigned x = 0, len = postfix.size(); x < len; ++x)
+	{
+		if (postfix[x]->Type() == POSTFIX_VALUE_REGISTER)
+		{
+			// As with DistributionOfPostfix, a binding can only be followed if it is used at most once
+			const PostfixValueRegister *reg = anope_dynamic_static_cast<const PostfixValueRegister *>(postfix[x]);
+			if (reg->IsStore())
+			{
+				if (avg_stack.empty())
+					return false;
+				registers[reg->Index()] = avg_stack.back();
+				avg_stack.pop_back();
+			}
+			else
+			{
+				if (loaded[reg->Index()])
+					return false;
+				loaded[reg->Index()] = true;
+				avg_stack.push_back(registers[reg->Index()]);
+				if (reg->IsNegative())
 				{
-					double val2 = val1;
-					val1 = num_stack.top();
-					num_stack.pop();
-					if (val1 > val2)
-					{
-						double tmp = val2;
-						val2 = val1;
-						val1 = tmp;
-					}
-					val = sfmtRNG.Random(static_cast<int>(val1), static_cast<int>(val2));
-					result.SetNameAndResult("rand", val);
-					result.AddArgument(static_cast<int>(val1));
-					result.AddArgument(static_cast<int>(val2));
+					DiceServAverage &negated = avg_stack.back();
+					negated.mean = -negated.mean;
+					std::swap(negated.lowest, negated.highest);
+					negated.lowest = -negated.lowest;
+					negated.highest = -negated.highest;
 				}
-				else if (token.equals_ci("round"))
+			}
+		}
+		else if (postfix[x]->Type() == POSTFIX_VALUE_JUMP)
+		{
+			// As with DistributionOfPostfix, both branches are followed and the MERGE is a select
+			if (anope_dynamic_static_cast<const PostfixValueJump *>(postfix[x])->Kind() == POSTFIX_JUMP_MERGE && !AverageSelect(data, avg_stack))
+				return false;
+		}
+		else if (postfix[x]->Type() == POSTFIX_VALUE_STRING)
+		{
+			const Anope::string *token_ptr = anope_dynamic_static_cast<const PostfixValueString *>(postfix[x])->Get();
+			if (!token_ptr || token_ptr->empty())
+				return false;
+			const Anope::string &token = *token_ptr;
+			if (is_builtin_function(token))
+			{
+				size_t underscore = token.find('_');
+				unsigned arguments = underscore == Anope::string::npos ? function_argument_count(token) : convertTo<unsigned>(token.substr(underscore + 1));
+				Anope::string name = token.substr(0, underscore);
+				if (!arguments || avg_stack.size() < arguments)
+					return false;
+				size_t first = avg_stack.size() - arguments;
+				bool constant = true;
+				for (size_t y = first; y < avg_stack.size(); ++y)
+					constant = constant && avg_stack[y].IsConstant();
+				DiceServAverage &val = avg_stack[first];
+				if (name.equals_ci("rand"))
 				{
-					val = my_round(val1);
-					result.SetNameAndResult("round", val);
-					result.AddArgument(val1);
+					// Both ends are truncated and swapped if needed, then every integer between them is equally likely
+					if (!constant)
+						return false;
+					double low = static_cast<int>(val.mean), high = static_cast<int>(avg_stack[first + 1].mean);
+					if (low > high)
+						std::swap(low, high);
+					double count = high - low + 1;
+					val = DiceServAverage(low);
+					val.mean = (low + high) / 2;
+					val.variance = (count * count - 1) / 12;
+					val.highest = high;
+					avg_stack.pop_back();
+					continue;
 				}
-				else if (token.equals_ci("sin"))
+				if (constant)
 				{
-					val = std::sin(val1);
-					result.SetNameAndResult("sin", val);
-					result.AddArgument(val1);
+					if (!FoldConstants(data, token, avg_stack, arguments))
+						return false;
+					continue;
 				}
-				else if (token.equals_ci("sinh"))
+				if (name.equals_ci("ceil") || name.equals_ci("floor") || name.equals_ci("round") || name.equals_ci("trunc"))
 				{
-					val = std::sinh(val1);
-					result.SetNameAndResult("sinh", val);
-					result.AddArgument(val1);
+					if (!val.integer)
+						return false;
 				}
-				else if (token.equals_ci("sqrt"))
+				else if (name.equals_ci("abs"))
 				{
-					// Because imaginary numbers are not being used, it is impossible to take the square root of a negative number
-					if (val1 < 0)
+					if (val.highest <= 0)
 					{
-						data.errCode = DICE_ERROR_UNDEFINED;
-						return 0;
+						val.mean = -val.mean;
+						std::swap(val.lowest, val.highest);
+						val.lowest = -val.lowest;
+						val.highest = -val.highest;
 					}
-					val = std::sqrt(val1);
-					result.SetNameAndResult("sqrt", val);
-					result.AddArgument(val1);
+					else if (val.lowest < 0)
+						return false;
 				}
-				else if (token.equals_ci("tan"))
+				else if (name.equals_ci("max") || name.equals_ci("min"))
 				{
-					// Tangent is undefined for any value of pi / 2 + pi * n for all integers n
-					if (!std::fmod(val1 + 2 * std::atan(1.0), std::atan(1.0) * 4))
+					// Only followed when one argument is always the one picked, otherwise the full distribution is needed
+					bool maximum = name.equals_ci("max");
+					size_t picked = first;
+					for (size_t y = first + 1; y < avg_stack.size(); ++y)
+						if (maximum ? avg_stack[y].lowest > avg_stack[picked].lowest : avg_stack[y].highest < avg_stack[picked].highest)
+							picked = y;
+					double dice = 0;
+					for (size_t y = first; y < avg_stack.size(); ++y)
 					{
-						data.errCode = DICE_ERROR_UNDEFINED;
-						return 0;
+						if (y != picked && (maximum ? avg_stack[y].highest > avg_stack[picked].lowest : avg_stack[y].lowest < avg_stack[picked].highest))
+							return false;
+						dice += avg_stack[y].dice;
 					}
-					val = std::tan(val1);
-					result.SetNameAndResult("tan", val);
-					result.AddArgument(val1);
+					val = avg_stack[picked];
+					val.dice = dice;
 				}
-				else if (token.equals_ci("tanh"))
+				else
+					return false;
+				avg_stack.resize(first + 1);
+				continue;
+			}
+			if (token == "~")
+			{
+				if (avg_stack.empty() || !avg_stack.back().IsConstant() || !FoldConstants(data, token, avg_stack, 1))
+					return false;
+				continue;
+			}
+			if (token == "?")
+			{
+				if (!AverageSelect(data, avg_stack))
+					return false;
+				continue;
+			}
+			if (avg_stack.size() < 2 || (token.length() != 1 && token.find("d{") != 0))
+				return false;
+			if (token[0] != 'd' && avg_stack[avg_stack.size() - 1].IsConstant() && avg_stack[avg_stack.size() - 2].IsConstant())
+			{
+				if (!FoldConstants(data, token, avg_stack, 2))
+					return false;
+				continue;
+			}
+			DiceServAverage &val2 = avg_stack[avg_stack.size() - 1];
+			DiceServAverage &val1 = avg_stack[avg_stack.size() - 2];
+			switch (token[0])
+			{
+				case '+':
+					val1.mean += val2.mean;
+					val1.variance += val2.variance;
+					val1.lowest += val2.lowest;
+					val1.highest += val2.highest;
+					break;
+				case '-':
+					val1.mean -= val2.mean;
+					val1.variance += val2.variance;
+					val1.lowest -= val2.highest;
+					val1.highest -= val2.lowest;
+					break;
+				case '*':
 				{
-					val = std::tanh(val1);
-					result.SetNameAndResult("tanh", val);
-					result.AddArgument(val1);
+					// Var(XY) = E[X^2]E[Y^2] - E[X]^2E[Y]^2 for independent X and Y
+					double square1 = val1.mean * val1.mean, square2 = val2.mean * val2.mean;
+					double bounds[] = { val1.lowest * val2.lowest, val1.lowest * val2.highest, val1.highest * val2.lowest, val1.highest * val2.highest };
+					val1.variance = (val1.variance + square1) * (val2.variance + square2) - square1 * square2;
+					val1.mean *= val2.mean;
+					val1.lowest = *std::min_element(bounds, bounds + 4);
+					val1.highest = *std::max_element(bounds, bounds + 4);
+					break;
 				}
-				else if (token.equals_ci("trunc"))
+				case '/':
 				{
-					val = static_cast<int>(val1);
-					result.SetNameAndResult("trunc", val);
-					result.AddArgument(val1);
+					if (!val2.IsConstant())
+						return false;
+					if (!val2.mean)
+					{
+						data.errCode = DICE_ERROR_DIV0;
+						return false;
+					}
+					double divisor = val2.mean;
+					val1.mean /= divisor;
+					val1.variance /= divisor * divisor;
+					val1.lowest /= divisor;
+					val1.highest /= divisor;
+					if (divisor < 0)
+						std::swap(val1.lowest, val1.highest);
+					val1.integer = false;
+					break;
 				}
-				if (is_infinite(val) || is_notanumber(val))
+				case 'd':
 				{
-					data.errCode = is_infinite(val) ? DICE_ERROR_OVERUNDERFLOW : DICE_ERROR_UNDEFINED;
-					return 0;
+					// Make sure both the number of dice and the number of sides are always within acceptable ranges, as EvaluatePostfix would
+					if (val1.lowest < 1 || val1.highest > DICE_MAX_DICE)
+					{
+						data.errCode = DICE_ERROR_UNACCEPTABLE_DICE;
+						data.errNum = static_cast<int>(val1.lowest < 1 ? val1.lowest : val1.highest);
+						return false;
+					}
+					if (val2.lowest < 1 || val2.highest > DICE_MAX_SIDES)
+					{
+						data.errCode = DICE_ERROR_UNACCEPTABLE_SIDES;
+						data.errNum = static_cast<int>(val2.lowest < 1 ? val2.lowest : val2.highest);
+						return false;
+					}
+					// Both are truncated when rolled, which can only be followed for constants
+					double dice = val1.dice;
+					if (val1.IsConstant())
+						val1 = DiceServAverage(static_cast<int>(val1.mean));
+					else if (!val1.integer)
+						return false;
+					if (val2.IsConstant())
+					{
+						val2.lowest = val2.highest = val2.mean = static_cast<int>(val2.mean);
+						val2.integer = true;
+					}
+					else if (!val2.integer)
+						return false;
+					if (token.length() != 1)
+					{
+						// Each die of a custom die is a face picked at random, so the sum has a mean of E[N]M and a variance of E[N]V + Var(N)M^2
+						std::vector<int> values = DiceModifiers(token, static_cast<unsigned>(val2.mean)).faceValues;
+						double faceMean = 0, faceVariance = 0;
+						for (size_t i = 0, len = values.size(); i < len; ++i)
+							faceMean += static_cast<double>(values[i]) / len;
+						for (size_t i = 0, len = values.size(); i < len; ++i)
+							faceVariance += (values[i] - faceMean) * (values[i] - faceMean) / len;
+						double faceLow = *std::min_element(values.begin(), values.end()), faceHigh = *std::max_element(values.begin(), values.end());
+						double bounds[] = { val1.lowest * faceLow, val1.lowest * faceHigh, val1.highest * faceLow, val1.highest * faceHigh };
+						val1.variance = val1.mean * faceVariance + val1.variance * faceMean * faceMean;
+						val1.mean *= faceMean;
+						val1.dice = dice + val1.highest;
+						val1.lowest = *std::min_element(bounds, bounds + 4);
+						val1.highest = *std::max_element(bounds, bounds + 4);
+						break;
+					}
+					/* With N dice that have S sides each, the sum of the dice given S has a variance of N(S^2 - 1) / 12 and a mean of NM,
+					 * where M = (S + 1) / 2, so the variance of the sum is E[N](E[S^2] - 1) / 12 + Var(NM). */
+					double dieMean = (val2.mean + 1) / 2, dieVariance = val2.variance / 4;
+					double squareN = val1.mean * val1.mean, squareM = dieMean * dieMean;
+					double variance = val1.mean * (val2.variance + val2.mean * val2.mean - 1) / 12 +
+						(val1.variance + squareN) * (dieVariance + squareM) - squareN * squareM;
+					val1.dice = dice + val1.highest;
+					val1.mean *= dieMean;
+					val1.variance = variance;
+					val1.highest *= val2.highest;
+					break;
 				}
-				num_stack.push(val);
-				data.AddToOpResults(result);
+				default:
+					return false;
 			}
-			else if (is_operator(token[0]) && token.length() == 1)
+			val1.dice += val2.dice;
+			val1.integer = val1.integer && val2.integer;
+			avg_stack.pop_back();
+		}
+		else
+		{
+			double number;
+			if (!PostfixNumber(data, postfix[x], number))
+				return false;
+			avg_stack.push_back(DiceServAverage(number));
+		}
+	}
+	if (avg_stack.size() != 1)
+		return false;
+	avg = avg_stack[0];
+	return true;
+}
+
+/** Predict what rolling a postfix notation expression will do, without rolling it and without touching the caller's data.
+ * @param data The caller's data, only used for the roller's stats
+ * @param postfix The postfix notation expression to check
+ * @param avg The summary to store the prediction in
+ * @return true if the prediction could be made, false otherwise
+ */
+static bool PredictPostfix(const DiceServData &data, const Postfix &postfix, DiceServAverage &avg)
+{
+	DiceServData scratch;
+	scratch.statValues = data.statValues;
+	return AverageOfPostfix(scratch, postfix, avg);
+}
+
+/** Determine if every result of an expression will be out of the range DoEvaluate accepts, so rolling it can only overflow.
+ * @param avg The predicted summary of the expression
+ * @return true if every result will overflow, false otherwise
+ */
+static inline bool AlwaysOverflows(const DiceServAverage &avg)
+{
+	return avg.lowest > std::numeric_limits<int>::max() || avg.highest < std::numeric_limits<int>::min();
+}
+
+/** Sink for RollRepeatedly that counts how many times each result came up */
+struct DiceResultCounts
+{
+	std::map<int64_t, uint64_t> counts;
+
+	void Add(int64_t val)
+	{
+		++this->counts[val];
+	}
+};
+
+/** Number of evaluations that the bulk roll scheduler hands out at a time */
+static const uint64_t DICE_SIMULATION_CHUNK = 256;
+
+/** Fewest dice a bulk roll is predicted to roll in total before it is worth starting threads for it */
+static const double DICE_SIMULATION_MIN_DICE = 1 << 16;
+
+/** Work-stealing scheduler for BULKROLL and SIMULATE.
+ *
+ * The evaluations are split into chunks that are dealt out evenly between one queue per worker. Each worker takes chunks from the back of
+ * its own queue, and once that runs dry, steals chunks from the front of the other queues, so a worker that falls behind doesn't hold up
+ * the rest. Each queue has its own lock, so the workers only contend with each other while stealing.
+ */
+class DiceSimulationScheduler
+{
+	struct Queue
+	{
+		Mutex lock;
+		std::deque<uint64_t> chunks;
+	};
+
+	std::vector<Queue *> queues;
+	Mutex cancelLock;
+	bool cancelled;
+
+public:
+	/** The wall clock time, from wall_clock_ms(), to stop at, 0 for no limit */
+	double deadline;
+
+	DiceSimulationScheduler(unsigned workers, uint64_t requested, double d) : queues(), cancelled(false), deadline(d)
+	{
+		for (unsigned w = 0; w < workers; ++w)
+			this->queues.push_back(new Queue());
+		for (unsigned c = 0; requested; ++c)
+		{
+			uint64_t chunk = std::min(requested, DICE_SIMULATION_CHUNK);
+			this->queues[c % workers]->chunks.push_back(chunk);
+			requested -= chunk;
+		}
+	}
+
+	~DiceSimulationScheduler()
+	{
+		for (unsigned w = 0, len = this->queues.size(); w < len; ++w)
+			delete this->queues[w];
+	}
+
+	/** Get the next chunk of evaluations for a worker.
+	 * @param worker The index of the worker
+	 * @return The number of evaluations in the chunk, or 0 if there are none left or the simulation was cancelled
+	 */
+	uint64_t Next(unsigned worker)
+	{
+		if (this->Cancelled())
+			return 0;
+		for (unsigned i = 0, len = this->queues.size(); i < len; ++i)
+		{
+			Queue *queue = this->queues[(worker + i) % len];
+			queue->lock.Lock();
+			if (!queue->chunks.empty())
 			{
-				if (num_stack.empty() || num_stack.size() < 2)
-				{
-					data.errCode = DICE_ERROR_STACK;
-					data.errStr = "Not enough numbers for operator.";
-					return 0;
-				}
-				double val2 = num_stack.top();
-				num_stack.pop();
-				double val1 = num_stack.top();
-				num_stack.pop();
-				switch (token[0])
+				uint64_t chunk;
+				if (!i)
 				{
-					case '+':
-						val = val1 + val2;
-						break;
-					case '-':
-						val = val1 - val2;
-						break;
-					case '*':
-						val = val1 * val2;
-						break;
-					case '/':
-						// Prevent division by 0
-						if (!val2)
-						{
-							data.errCode = DICE_ERROR_DIV0;
-							return 0;
-						}
-						val = val1 / val2;
-						break;
-					case '%':
-						// Prevent division by 0
-						if (!val2)
-						{
-							data.errCode = DICE_ERROR_DIV0;
-							return 0;
-						}
-						val = std::fmod(val1, val2);
-						break;
-					case '^':
-						// Because imaginary numbers are not being used, it is impossible to take the power of a negative number to a non-integer exponent
-						if (val1 < 0 && static_cast<int>(val2) != val2)
-						{
-							data.errCode = DICE_ERROR_UNDEFINED;
-							return 0;
-						}
-						// Prevent division by 0
-						if (!val1 && !val2)
-						{
-							data.errCode = DICE_ERROR_DIV0;
-							return 0;
-						}
-						// 0 to a negative power is invalid
-						if (!val1 && val2 < 0)
-						{
-							data.errCode = DICE_ERROR_OVERUNDERFLOW;
-							return 0;
-						}
-						val = std::pow(val1, val2);
-						break;
-					case 'd':
-					{
-						// Make sure both the number of dice and the number of sides are within acceptable ranges
-						if (val1 < 1 || val1 > DICE_MAX_DICE)
-						{
-							data.errCode = DICE_ERROR_UNACCEPTABLE_DICE;
-							data.errNum = static_cast<int>(val1);
-							return 0;
-						}
-						if (val2 < 1 || val2 > DICE_MAX_SIDES)
-						{
-							data.errCode = DICE_ERROR_UNACCEPTABLE_SIDES;
-							data.errNum = static_cast<int>(val2);
-							return 0;
-						}
-						DiceResult result = Dice(static_cast<int>(val1), static_cast<unsigned>(val2));
-						data.AddToOpResults(result);
-						val = result.Value();
-					}
+					chunk = queue->chunks.back();
+					queue->chunks.pop_back();
 				}
-				if (is_infinite(val) || is_notanumber(val))
+				else
 				{
-					data.errCode = is_infinite(val) ? DICE_ERROR_OVERUNDERFLOW : DICE_ERROR_UNDEFINED;
-					return 0;
+					chunk = queue->chunks.front();
+					queue->chunks.pop_front();
 				}
-				num_stack.push(val);
+				queue->lock.Unlock();
+				return chunk;
 			}
+			queue->lock.Unlock();
 		}
-		else
+		return 0;
+	}
+
+	/** Tell every worker to stop once it finishes its current chunk.
+	 */
+	void Cancel()
+	{
+		this->cancelLock.Lock();
+		this->cancelled = true;
+		this->cancelLock.Unlock();
+	}
+
+	bool Cancelled()
+	{
+		this->cancelLock.Lock();
+		bool ret = this->cancelled;
+		this->cancelLock.Unlock();
+		return ret;
+	}
+};
+
+/** A thread that runs chunks of a bulk roll's evaluations, with its own generator, copy of the expression and statistics */
+class DiceSimulationWorker : public Thread
+{
+	DiceSimulationScheduler &scheduler;
+	unsigned index;
+	dSFMT216091 rng;
+	Postfix postfix;
+
+public:
+	DiceServData data;
+	DiceServBulkStats stats;
+	/** Set if this worker ran into the deadline */
+	bool timedOut;
+
+	DiceSimulationWorker(DiceSimulationScheduler &s, unsigned i, uint32_t seed, const DiceServData &d, const Postfix &p) : Thread(), scheduler(s),
+		index(i), rng(seed), postfix(p), data(d), stats(), timedOut(false)
+	{
+	}
+
+	void Run() anope_override
+	{
+		threadRNG = &this->rng;
+		uint64_t chunk;
+		while ((chunk = this->scheduler.Next(this->index)))
 		{
-			const PostfixValueDouble *dbl = anope_dynamic_static_cast<const PostfixValueDouble *>(postfix[x]);
-			const double *val_ptr = dbl->Get();
-			if (!val_ptr)
+			uint64_t done = RollRepeatedly(this->data, this->postfix, chunk, this->scheduler.deadline, this->stats);
+			if (done < chunk)
 			{
-				data.errCode = DICE_ERROR_STACK;
-				data.errStr = "An empty number was found.";
-				return 0;
+				// Either an error or the deadline, both of which mean none of the other workers need to keep going
+				this->timedOut = this->data.errCode == DICE_ERROR_NONE;
+				this->scheduler.Cancel();
+				break;
 			}
-			num_stack.push(*val_ptr);
 		}
+		threadRNG = NULL;
 	}
-	val = num_stack.top();
-	num_stack.pop();
-	if (!num_stack.empty())
-	{
-		data.errCode = DICE_ERROR_STACK;
-		data.errStr = "Too many numbers were found as input.";
-		return 0;
-	}
-	return val;
+};
+
+const OperatorResultType &OperatorResultBase::Type() const
+{
+	return this->type;
 }
 
-/** Parse an infix notation expression and convert the expression to postfix notation.
- * @param infix The original expression, in infix notation, to convert to postfix notation
- * @return A postfix notation expression equivalent to the infix notation expression given, or an empty object if the infix notation expression could not be parsed or converted
- */
-static Postfix DoParse(DiceServData &data, const Anope::string &infix)
+DiceResult::DiceResult(int n, unsigned s) : OperatorResultBase(OPERATOR_RESULT_TYPE_DICE), num(n), sides(s), results(), modifiers(""), marks(), sum(0),
+	lowest(0), highest(0), faceValues(), totaled(false), total(0)
 {
-	Infix infixcpy = FixInfix(infix);
-	Postfix postfix;
-	if (infixcpy.str.empty())
-		return postfix;
-	if (!CheckInfix(data, infixcpy))
-		return postfix;
-	Infix tokenized_infix = TokenizeInfix(infixcpy);
-	if (tokenized_infix.str.empty())
-		return postfix;
-	postfix = InfixToPostfix(data, tokenized_infix);
-	return postfix;
 }
 
-/** Evaluate a postfix notation expression.
- * @param postfix The postfix notation expression to evaluate
- * @return The final result after evaluation
+void DiceResult::AddResult(unsigned result)
+{
+	if (this->results.empty())
+		this->lowest = this->highest = result;
+	else
+	{
+		this->lowest = std::min(this->lowest, result);
+		this->highest = std::max(this->highest, result);
+	}
+	this->sum += result;
+	this->results.push_back(result);
+}
+
+/** Replaces all the results at once, the given vector is swapped in (and so will be left with the old results).
  */
-static double DoEvaluate(DiceServData &data, const Postfix &postfix)
+void DiceResult::SetResults(std::vector<unsigned> &newResults)
 {
-	double ret = EvaluatePostfix(data, postfix);
-	if (ret > std::numeric_limits<int>::max() || ret < std::numeric_limits<int>::min())
-		data.errCode = DICE_ERROR_OVERUNDERFLOW;
-	return ret;
+	this->results.swap(newResults);
+	if (this->results.empty())
+	{
+		this->sum = 0;
+		this->lowest = this->highest = 0;
+	}
+	else
+		SummarizeFaces(&this->results[0], this->results.size(), this->sum, this->lowest, this->highest);
 }
 
-const OperatorResultType &OperatorResultBase::Type() const
+/** Same as above, but for dice with modifiers, where the results that were dropped or rerolled are kept to be shown but don't count towards
+ * the totals. The given vectors are swapped in as well (the results vector will be left with only the results that count).
+ */
+void DiceResult::SetResults(std::vector<unsigned> &newResults, std::vector<unsigned char> &newMarks, const Anope::string &newModifiers)
 {
-	return this->type;
+	this->modifiers = newModifiers;
+	this->marks.swap(newMarks);
+	std::vector<unsigned> kept;
+	kept.reserve(newResults.size());
+	for (size_t i = 0, len = newResults.size(); i < len; ++i)
+		if (!(this->marks[i] & DICE_FACE_DROPPED))
+			kept.push_back(newResults[i]);
+	this->SetResults(kept);
+	this->results.swap(newResults);
 }
 
-DiceResult::DiceResult(int n, unsigned s) : OperatorResultBase(OPERATOR_RESULT_TYPE_DICE), num(n), sides(s), results()
+void DiceResult::SetFaceValues(const std::vector<int> &values)
 {
+	this->faceValues = values;
 }
 
-void DiceResult::AddResult(unsigned result)
+/** Makes the value of the dice the given total instead of the sum of the results.
+ */
+void DiceResult::SetTotal(int64_t value)
 {
-	this->results.push_back(result);
+	this->totaled = true;
+	this->total = value;
 }
 
 const std::vector<unsigned> &DiceResult::Results() const
@@ -2035,29 +5591,61 @@ const unsigned &DiceResult::Sides() const
 
 Anope::string DiceResult::DiceString() const
 {
-	return stringify(this->num) + "d" + stringify(this->sides);
+	// The custom faces are part of the modifiers, and take the place of the number of sides
+	return stringify(this->num) + "d" + (this->faceValues.empty() ? stringify(this->sides) : "") + this->modifiers;
+}
+
+uint64_t DiceResult::Sum() const
+{
+	return this->sum;
+}
+
+unsigned DiceResult::Lowest() const
+{
+	return this->lowest;
+}
+
+unsigned DiceResult::Highest() const
+{
+	return this->highest;
 }
 
-unsigned DiceResult::Sum() const
+size_t DiceResult::CountAtLeast(unsigned threshold) const
 {
-	return std::accumulate(this->results.begin(), this->results.end(), 0u);
+	if (this->marks.empty())
+		return this->results.empty() ? 0 : CountFacesAtLeast(&this->results[0], this->results.size(), threshold);
+	size_t count = 0;
+	for (size_t i = 0, len = this->results.size(); i < len; ++i)
+		if (!(this->marks[i] & DICE_FACE_DROPPED) && this->results[i] >= threshold)
+			++count;
+	return count;
 }
 
 double DiceResult::Value() const
 {
-	return this->Sum();
+	return this->totaled ? static_cast<double>(this->total) : static_cast<double>(this->sum);
 }
 
 Anope::string DiceResult::LongString() const
 {
 	std::ostringstream str;
-	str << stringify(this->num) << "d" << stringify(this->sides) << "=(";
+	str << this->DiceString() << "=(";
 	bool first = true;
 	for (size_t i = 0, len = this->results.size(); i < len; ++i)
 	{
 		if (!first)
 			str << " ";
-		str << stringify(this->results[i]);
+		// Results that don't count are shown in reverse, successes in bold and botches underlined
+		unsigned char mark = this->marks.empty() ? 0 : this->marks[i];
+		Anope::string face = this->faceValues.empty() ? stringify(this->results[i]) : stringify(this->faceValues[this->results[i] - 1]);
+		if (mark & DICE_FACE_DROPPED)
+			str << "\x16" << face << "\x16";
+		else if (mark & DICE_FACE_SUCCESS)
+			str << "\x02" << face << "\x02";
+		else if (mark & DICE_FACE_BOTCH)
+			str << "\x1F" << face << "\x1F";
+		else
+			str << face;
 		first = false;
 	}
 	str << ")";
@@ -2066,7 +5654,7 @@ Anope::string DiceResult::LongString() const
 
 Anope::string DiceResult::ShortString() const
 {
-	return stringify(this->num) + "d" + stringify(this->sides) + "=(" + stringify(this->Sum()) + ")";
+	return this->DiceString() + "=(" + (this->totaled ? stringify(this->total) : stringify(this->Sum())) + ")";
 }
 
 DiceResult *DiceResult::Clone() const
@@ -2152,6 +5740,92 @@ bool OperatorResults::empty() const
 	return this->results.empty();
 }
 
+void DiceServBulkStats::WidenBins()
+{
+	uint64_t merged[BINS] = { 0 };
+	int64_t first = floor_div(this->binFirst, 2);
+	for (unsigned i = 0; i < BINS; ++i)
+		merged[floor_div(this->binFirst + i, 2) - first] += this->bins[i];
+	std::copy(merged, merged + BINS, this->bins);
+	this->binFirst = first;
+	this->binWidth *= 2;
+}
+
+void DiceServBulkStats::FitBins()
+{
+	// Widen the bins until lowest and highest are less than BINS bins apart
+	while (floor_div(this->highest, this->binWidth) - floor_div(this->lowest, this->binWidth) >= static_cast<int64_t>(BINS))
+		this->WidenBins();
+	// Then shift the bins so that both lowest and highest are within them
+	int64_t first = this->binFirst, lowBin = floor_div(this->lowest, this->binWidth), highBin = floor_div(this->highest, this->binWidth);
+	if (lowBin < first)
+		first = lowBin;
+	else if (highBin >= first + static_cast<int64_t>(BINS))
+		first = highBin - BINS + 1;
+	if (first == this->binFirst)
+		return;
+	uint64_t shifted[BINS] = { 0 };
+	for (unsigned i = 0; i < BINS; ++i)
+		if (this->bins[i])
+			shifted[this->binFirst + i - first] = this->bins[i];
+	std::copy(shifted, shifted + BINS, this->bins);
+	this->binFirst = first;
+}
+
+void DiceServBulkStats::Add(int64_t val)
+{
+	++this->count;
+	double delta = val - this->mean;
+	this->mean += delta / this->count;
+	this->m2 += delta * (val - this->mean);
+	if (this->count == 1)
+	{
+		this->lowest = this->highest = val;
+		this->binFirst = val - BINS / 2;
+	}
+	else if (val < this->lowest)
+		this->lowest = val;
+	else if (val > this->highest)
+		this->highest = val;
+	if (val < this->binFirst * this->binWidth || val >= (this->binFirst + static_cast<int64_t>(BINS)) * this->binWidth)
+		this->FitBins();
+	++this->bins[floor_div(val, this->binWidth) - this->binFirst];
+}
+
+void DiceServBulkStats::Merge(const DiceServBulkStats &other)
+{
+	if (!other.count)
+		return;
+	if (!this->count)
+	{
+		this->count = other.count;
+		this->mean = other.mean;
+		this->m2 = other.m2;
+		this->lowest = other.lowest;
+		this->highest = other.highest;
+		this->binFirst = other.binFirst;
+		this->binWidth = other.binWidth;
+		std::copy(other.bins, other.bins + BINS, this->bins);
+		return;
+	}
+	// Combine the moments with Chan et al.'s parallel form of Welford's algorithm
+	uint64_t total = this->count + other.count;
+	double delta = other.mean - this->mean;
+	this->mean += delta * other.count / total;
+	this->m2 += other.m2 + delta * delta * this->count * other.count / total;
+	this->count = total;
+	this->lowest = std::min(this->lowest, other.lowest);
+	this->highest = std::max(this->highest, other.highest);
+	/* Both sets of bins are aligned to their power of 2 widths, so once these bins are at least as wide as the other ones, each of the
+	 * other bins falls entirely within one of these. */
+	while (this->binWidth < other.binWidth)
+		this->WidenBins();
+	this->FitBins();
+	for (unsigned i = 0; i < BINS; ++i)
+		if (other.bins[i])
+			this->bins[floor_div((other.binFirst + i) * other.binWidth, this->binWidth) - this->binFirst] += other.bins[i];
+}
+
 void DiceServData::Reset()
 {
 	this->timesResults.clear();
@@ -2178,14 +5852,82 @@ static Anope::string Join(const std::vector<Anope::string> &params, size_t first
 	return joinedString;
 }
 
+/** Keep the postfix notation of a macro's expression, so that rolling the macro doesn't have to parse it.
+ * @param expr The macro's expression
+ * @param postfix The postfix notation of the expression, parsed if empty
+ */
+static void CompileMacro(const Anope::string &expr, const Postfix &postfix = Postfix())
+{
+	if (MacroPrograms.count(expr))
+		return;
+	if (MacroPrograms.size() >= DICE_MAX_MACRO_PROGRAMS)
+		MacroPrograms.clear();
+	if (postfix.empty())
+	{
+		DiceServData scratch;
+		Postfix parsed = DoParse(scratch, expr);
+		if (!parsed.empty())
+			MacroPrograms[expr] = parsed;
+	}
+	else
+		MacroPrograms[expr] = postfix;
+}
+
+/** Replace the macros (@name) in part of a dice expression with their expressions.
+ * @param part The part of the dice expression, changed in place
+ * @param nc The account to look for macros in first, if any
+ * @param ci The channel to look for macros in next, if any
+ * @param missing Reference to store the name of a macro that couldn't be found in
+ * @return true if every macro was found, false otherwise
+ *
+ * A part that is only a single macro is replaced as-is, so that its compiled program is used, otherwise each macro is put in parentheses.
+ */
+static bool ExpandMacros(Anope::string &part, NickCore *nc, ChannelInfo *ci, Anope::string &missing)
+{
+	size_t at = part.find('@');
+	if (at == Anope::string::npos)
+		return true;
+	std::map<Anope::string, Anope::string> ncMacros, ciMacros;
+	if (nc)
+		diceServCore->GetMacros(nc, ncMacros);
+	if (ci)
+		diceServCore->GetMacros(ci, ciMacros);
+	Anope::string expanded = part.substr(0, at);
+	while (at != Anope::string::npos)
+	{
+		size_t end = at + 1, len = part.length();
+		while (end < len && (isalnum(static_cast<unsigned char>(part[end])) || part[end] == '-' || part[end] == '_'))
+			++end;
+		Anope::string name = part.substr(at + 1, end - at - 1).lower();
+		std::map<Anope::string, Anope::string>::const_iterator macro = ncMacros.find(name);
+		if (macro == ncMacros.end() && (macro = ciMacros.find(name)) == ciMacros.end())
+		{
+			missing = name;
+			return false;
+		}
+		if (!at && end == len)
+		{
+			CompileMacro(macro->second);
+			expanded = macro->second;
+		}
+		else
+			expanded += "(" + macro->second + ")";
+		at = part.find('@', end);
+		expanded += part.substr(end, at == Anope::string::npos ? Anope::string::npos : at - end);
+	}
+	part = expanded;
+	return true;
+}
+
 bool DiceServData::PreParse(CommandSource &source, const std::vector<Anope::string> &params, unsigned expectedChannelPos)
 {
 	User *user = source.GetUser();
 	// Check for a ignore on the user or their registered nick, if any, and deny them access if they are ignored
-	if (this->DiceServ->IsIgnored(user))
+	if (diceServCore->IsIgnored(user, DICE_IGNORE_USER))
 		return false;
-	if (source.GetAccount() && this->DiceServ->IsIgnored(source.GetAccount()))
+	if (source.GetAccount() && diceServCore->IsIgnored(source.GetAccount(), DICE_IGNORE_ACCOUNT))
 		return false;
+	this->statValues = diceServCore->StatValues(source.GetAccount());
 	// Set up the dice, chan, and comment strings
 	if (source.c)
 	{
@@ -2213,6 +5955,8 @@ bool DiceServData::PreParse(CommandSource &source, const std::vector<Anope::stri
 		this->commentStr = this->chanStr + (this->commentStr.empty() ? "" : " ") + this->commentStr;
 		this->chanStr = "";
 	}
+	// Macros can come from the channel even if the results can't be sent there
+	ChannelInfo *macroChannel = this->chanStr.empty() ? NULL : ChannelInfo::Find(this->chanStr);
 	/* If a channel was given, ignore the roll if the user isn't in the channel.
 	 * Also, check if the channel has ignored rolls to it or if it's been moderated (+m) and the user has no status to the channel. */
 	if (!this->chanStr.empty())
@@ -2226,7 +5970,9 @@ bool DiceServData::PreParse(CommandSource &source, const std::vector<Anope::stri
 					source.Reply(CHAN_X_INVALID, this->chanStr.c_str());
 				return false;
 			}
-			if (this->DiceServ->IsIgnored(c) || (c->ci ? this->DiceServ->IsIgnored(c->ci) : false) || c->MatchesList(user, "QUIET") || c->HasMode("MODERATED"))
+			// The channel's quiet list is only matched against if nothing cheaper has already kept the results out of the channel
+			if (diceServCore->IsIgnored(c, DICE_IGNORE_CHANNEL) || (c->ci ? diceServCore->IsIgnored(c->ci, DICE_IGNORE_REGISTERED_CHANNEL) : false) ||
+				c->HasMode("MODERATED") || c->MatchesList(user, "QUIET"))
 				this->chanStr = "";
 			if (this->chanStr.empty() && source.c)
 				return false;
@@ -2234,6 +5980,17 @@ bool DiceServData::PreParse(CommandSource &source, const std::vector<Anope::stri
 		else
 			this->chanStr = "";
 	}
+	return this->SplitDice(source, macroChannel);
+}
+
+/** Split the dice into the number of times and the dice to roll, once PreParse's checks are done.
+ * @param macroChannel The channel whose macros can be used, or NULL if none can be
+ * @return true if the dice were split, false if they use a macro that doesn't exist
+ *
+ * MULTIROLL calls this for each of its expressions after the first, so that the checks are only done once.
+ */
+bool DiceServData::SplitDice(CommandSource &source, ChannelInfo *macroChannel)
+{
 	// If a [ is found in the dice expression and the expression ends in a ], assume it is of an alternate group format of x[y] and convert to the x~y format instead
 	size_t sbracket = this->diceStr.find('[');
 	if (sbracket != Anope::string::npos && this->diceStr[this->diceStr.length() - 1] == ']')
@@ -2249,7 +6006,16 @@ bool DiceServData::PreParse(CommandSource &source, const std::vector<Anope::stri
 		this->dicePart = this->diceStr.substr(tilde + 1);
 	}
 	else
+	{
+		this->timesPart = "";
 		this->dicePart = this->diceStr;
+	}
+	Anope::string missing;
+	if (!ExpandMacros(this->timesPart, source.GetAccount(), macroChannel, missing) || !ExpandMacros(this->dicePart, source.GetAccount(), macroChannel, missing))
+	{
+		source.Reply(_("There is no macro named \002%s\002."), missing.c_str());
+		return false;
+	}
 	return true;
 }
 
@@ -2453,6 +6219,45 @@ Anope::string DiceServData::GenerateNoExOutput() const
 	return output.str();
 }
 
+Anope::string DiceServData::GenerateAverageOutput(const DiceServAverage &avg) const
+{
+	std::ostringstream output;
+	output << "<" << this->rollPrefix << " [" << this->dicePrefix << this->diceStr << this->diceSuffix << "]: mean " << std::fixed << std::setprecision(3)
+		<< avg.mean << ", stddev " << avg.StdDev() << ", range " << stringify(avg.lowest) << ".." << stringify(avg.highest) << ">";
+	if (!this->commentStr.empty())
+		output << " " << this->commentStr;
+
+	return output.str();
+}
+
+/** Handle the AVG mode of ROLL and CALC, showing the average of the dice instead of rolling them.
+ * @param source The source of the command
+ * @param params The parameters given to the command, without the AVG
+ */
+void DiceServData::RollAverage(CommandSource &source, const std::vector<Anope::string> &params)
+{
+	if (!this->PreParse(source, params, 1))
+		return;
+	// Every set is the same dice, so they all have the same average
+	if (!this->timesPart.empty())
+		this->diceSuffix = ", per set";
+	if (!this->CheckMessageLengthPreProcess(source))
+		return;
+
+	DiceServAverage avg;
+	this->Average(avg);
+
+	if (this->errCode != DICE_ERROR_NONE)
+	{
+		this->HandleError(source);
+		return;
+	}
+	Anope::string output = this->GenerateAverageOutput(avg);
+	if (!this->CheckMessageLengthPostProcess(source, output))
+		return;
+	this->SendReply(source, output);
+}
+
 void DiceServData::StartNewOpResults()
 {
 	this->opResults.push_back(OperatorResults());
@@ -2460,12 +6265,15 @@ void DiceServData::StartNewOpResults()
 
 void DiceServData::AddToOpResults(const DiceResult &result)
 {
-	this->opResults[this->opResults.size() - 1].add(result);
+	// Nothing is recorded if StartNewOpResults was never called, as is the case for BULKROLL
+	if (!this->opResults.empty())
+		this->opResults[this->opResults.size() - 1].add(result);
 }
 
 void DiceServData::AddToOpResults(const FunctionResult &result)
 {
-	this->opResults[this->opResults.size() - 1].add(result);
+	if (!this->opResults.empty())
+		this->opResults[this->opResults.size() - 1].add(result);
 }
 
 void DiceServData::SetOpResultsAsTimesResults()
@@ -2476,17 +6284,37 @@ void DiceServData::SetOpResultsAsTimesResults()
 
 void DiceServData::Roll()
 {
-	this->DiceServ->Roller(*this);
+	diceServCore->Roller(*this);
+}
+
+void DiceServData::RollSets(int sets)
+{
+	diceServCore->SetsRoller(*this, sets);
+}
+
+void DiceServData::BulkRoll(DiceServBulkStats &stats, unsigned threads)
+{
+	diceServCore->BulkRoller(*this, stats, threads);
+}
+
+void DiceServData::Odds(DiceServDistribution &dist)
+{
+	diceServCore->OddsCalculator(*this, dist);
+}
+
+void DiceServData::Average(DiceServAverage &avg)
+{
+	diceServCore->Averager(*this, avg);
 }
 
 DiceResult *DiceServData::Dice(int num, unsigned sides)
 {
-	return this->DiceServ->Dice(num, sides);
+	return diceServCore->Dice(num, sides);
 }
 
 void DiceServData::HandleError(CommandSource &source)
 {
-	this->DiceServ->ErrorHandler(source, *this);
+	diceServCore->ErrorHandler(source, *this);
 }
 
 void DiceServData::SendReply(CommandSource &source, const Anope::string &output) const
@@ -2530,6 +6358,11 @@ public:
 		return data.PreParse(source, params, expectedChannelPos);
 	}
 
+	bool SplitDice(DiceServData &data, CommandSource &source, ChannelInfo *macroChannel)
+	{
+		return data.SplitDice(source, macroChannel);
+	}
+
 	bool CheckMessageLengthPreProcess(DiceServData &data, CommandSource &source)
 	{
 		return data.CheckMessageLengthPreProcess(source);
@@ -2555,90 +6388,305 @@ public:
 		return data.GenerateNoExOutput();
 	}
 
+	Anope::string GenerateAverageOutput(const DiceServData &data, const DiceServAverage &avg) const
+	{
+		return data.GenerateAverageOutput(avg);
+	}
+
+	void RollAverage(DiceServData &data, CommandSource &source, const std::vector<Anope::string> &params)
+	{
+		data.RollAverage(source, params);
+	}
+
 	void StartNewOpResults(DiceServData &data)
 	{
 		data.StartNewOpResults();
 	}
 
-	void AddToOpResults(DiceServData &data, const DiceResult &result)
+	void AddToOpResults(DiceServData &data, const DiceResult &result)
+	{
+		data.AddToOpResults(result);
+	}
+
+	void AddToOpResults(DiceServData &data, const FunctionResult &result)
+	{
+		data.AddToOpResults(result);
+	}
+
+	void SetOpResultsAsTimesResults(DiceServData &data)
+	{
+		data.SetOpResultsAsTimesResults();
+	}
+
+	void Roll(DiceServData &data)
+	{
+		data.Roll();
+	}
+
+	void RollSets(DiceServData &data, int sets)
+	{
+		data.RollSets(sets);
+	}
+
+	void BulkRoll(DiceServData &data, DiceServBulkStats &stats, unsigned threads)
+	{
+		data.BulkRoll(stats, threads);
+	}
+
+	void Odds(DiceServData &data, DiceServDistribution &dist)
+	{
+		data.Odds(dist);
+	}
+
+	void Average(DiceServData &data, DiceServAverage &avg)
+	{
+		data.Average(avg);
+	}
+
+	DiceResult *Dice(DiceServData &data, int num, unsigned sides)
+	{
+		return data.Dice(num, sides);
+	}
+
+	void HandleError(DiceServData &data, CommandSource &source)
+	{
+		data.HandleError(source);
+	}
+
+	void SendReply(const DiceServData &data, CommandSource &source, const Anope::string &output) const
+	{
+		data.SendReply(source, output);
+	}
+
+	bool HasExtended(const DiceServData &data) const
+	{
+		return data.HasExtended();
+	}
+
+	const std::vector<unsigned> &Results(const DiceResult &result) const
+	{
+		return result.Results();
+	}
+
+	const unsigned &Sides(const DiceResult &result) const
+	{
+		return result.Sides();
+	}
+
+	Anope::string DiceString(const DiceResult &result) const
+	{
+		return result.DiceString();
+	}
+
+	uint64_t Sum(const DiceResult &result) const
+	{
+		return result.Sum();
+	}
+
+	unsigned Lowest(const DiceResult &result) const
+	{
+		return result.Lowest();
+	}
+
+	unsigned Highest(const DiceResult &result) const
+	{
+		return result.Highest();
+	}
+
+	size_t CountAtLeast(const DiceResult &result, unsigned threshold) const
+	{
+		return result.CountAtLeast(threshold);
+	}
+
+	DiceResult *Clone(const DiceResult &result) const
+	{
+		return result.Clone();
+	}
+};
+
+/** A timer designed to load an old DiceServ database from Anope 1.8.x or pre-Anope 1.9.2 after the main database has loaded.
+ */
+class DiceServUpgradeTimer : public Timer
+{
+	Anope::string diceservdb;
+
+public:
+	DiceServUpgradeTimer(Module *creator, long timeout, bool dorepeat, const Anope::string &db) : Timer(creator, timeout, Anope::CurTime, dorepeat),
+		diceservdb(db)
+	{
+	}
+
+	void Tick(time_t) anope_override;
+};
+
+/** The values of an account's stats, indexed by their slots, with NaN in the slots of the stats the account doesn't have. This is built from
+ * the account's stored stats the first time it is needed and thrown away whenever they change.
+ */
+struct DiceServStatValues
+{
+	std::vector<double> values;
+
+	DiceServStatValues(Extensible *)
 	{
-		data.AddToOpResults(result);
 	}
+};
 
-	void AddToOpResults(DiceServData &data, const FunctionResult &result)
+/** The stats of accounts, kept as space-separated name=value pairs. Loading an account's stats gives each of them a slot, so that equations
+ * using them can be parsed before they are rolled.
+ */
+class DiceServStatsItem : public SerializableExtensibleItem<Anope::string>
+{
+	ExtensibleItem<DiceServStatValues> &statValues;
+
+public:
+	DiceServStatsItem(Module *m, const Anope::string &n, ExtensibleItem<DiceServStatValues> &values) : SerializableExtensibleItem<Anope::string>(m, n),
+		statValues(values)
 	{
-		data.AddToOpResults(result);
 	}
 
-	void SetOpResultsAsTimesResults(DiceServData &data)
+	void ExtensibleUnserialize(Extensible *e, Serializable *s, Serialize::Data &data) anope_override
 	{
-		data.SetOpResultsAsTimesResults();
+		SerializableExtensibleItem<Anope::string>::ExtensibleUnserialize(e, s, data);
+		this->statValues.Unset(e);
+		const Anope::string *stored = this->Get(e);
+		if (!stored)
+			return;
+		spacesepstream sep(*stored);
+		Anope::string stat;
+		while (sep.GetToken(stat))
+			StatSlot(stat.substr(0, stat.find('=')), true);
 	}
+};
 
-	void Roll(DiceServData &data)
+/** How many ignore lookups are made for every one that is timed, see DiceServIgnoreItem::Check */
+static const uint64_t DICE_IGNORE_TIMING_INTERVAL = 64;
+
+/** The ignores of channels and nicks, which also keeps a list of each kind of object that is ignored. LIST goes over these lists instead of
+ * every channel and nick to find the ignored ones. The lists are updated whenever an object is ignored, unignored or loaded from the
+ * database, and Anope unsets the ignore of an object that is deleted, so they never hold an object that is gone.
+ */
+class DiceServIgnoreItem : public SerializableExtensibleItem<bool>
+{
+	std::set<Extensible *> ignored[DICE_IGNORE_KINDS];
+	/* The users who are only ignored because the account they are logged into is */
+	std::set<Extensible *> inherited;
+	uint64_t checks, skipped, lookupsTimed;
+	/* The total time of the timed lookups, in milliseconds */
+	double lookupTime;
+
+	/** Add an object that was just ignored to the list for its kind.
+	 * @param obj The object
+	 */
+	void Index(Extensible *obj)
 	{
-		data.Roll();
+		if (dynamic_cast<ChannelInfo *>(obj))
+			this->ignored[DICE_IGNORE_REGISTERED_CHANNEL].insert(obj);
+		else if (dynamic_cast<Channel *>(obj))
+			this->ignored[DICE_IGNORE_CHANNEL].insert(obj);
+		else if (dynamic_cast<NickCore *>(obj))
+			this->ignored[DICE_IGNORE_ACCOUNT].insert(obj);
+		else if (dynamic_cast<User *>(obj))
+			this->ignored[DICE_IGNORE_USER].insert(obj);
 	}
 
-	DiceResult *Dice(DiceServData &data, int num, unsigned sides)
+	/** Look up an object's ignore, timing the lookup.
+	 * @param obj The object
+	 * @return true if the object is ignored, false otherwise
+	 */
+	bool TimeLookup(Extensible *obj)
 	{
-		return data.Dice(num, sides);
+		double start = wall_clock_ms();
+		bool found = this->HasExt(obj);
+		this->lookupTime += wall_clock_ms() - start;
+		++this->lookupsTimed;
+		return found;
 	}
 
-	void HandleError(DiceServData &data, CommandSource &source)
+public:
+	DiceServIgnoreItem(Module *m, const Anope::string &n) : SerializableExtensibleItem<bool>(m, n), checks(0), skipped(0),
+		lookupsTimed(0), lookupTime(0)
 	{
-		data.HandleError(source);
 	}
 
-	void SendReply(const DiceServData &data, CommandSource &source, const Anope::string &output) const
+	void Ignore(Extensible *obj)
 	{
-		data.SendReply(source, output);
+		this->Set(obj);
+		this->Index(obj);
+		this->inherited.erase(obj);
 	}
 
-	bool HasExtended(const DiceServData &data) const
+	/** Ignore a user because the account they are logged into is ignored, unless they are already ignored on their own.
+	 * @param obj The user
+	 */
+	void Inherit(Extensible *obj)
 	{
-		return data.HasExtended();
+		if (this->HasExt(obj))
+			return;
+		this->Set(obj);
+		this->Index(obj);
+		this->inherited.insert(obj);
 	}
 
-	const std::vector<unsigned> &Results(const DiceResult &result) const
+	bool Inherited(Extensible *obj) const
 	{
-		return result.Results();
+		return this->inherited.count(obj);
 	}
 
-	const unsigned &Sides(const DiceResult &result) const
+	/* This is also called while the object is being deleted, when it can no longer be told what kind of object it is, so it is taken out of
+	 * all of the lists. */
+	void Unset(Extensible *obj) anope_override
 	{
-		return result.Sides();
+		SerializableExtensibleItem<bool>::Unset(obj);
+		for (unsigned kind = 0; kind < DICE_IGNORE_KINDS; ++kind)
+			this->ignored[kind].erase(obj);
+		this->inherited.erase(obj);
 	}
 
-	Anope::string DiceString(const DiceResult &result) const
+	void ExtensibleUnserialize(Extensible *e, Serializable *s, Serialize::Data &data) anope_override
 	{
-		return result.DiceString();
+		SerializableExtensibleItem<bool>::ExtensibleUnserialize(e, s, data);
+		if (this->HasExt(e))
+			this->Index(e);
 	}
 
-	unsigned Sum(const DiceResult &result) const
+	const std::set<Extensible *> &Ignored(DiceServIgnoreKind kind) const
 	{
-		return result.Sum();
+		return this->ignored[kind];
 	}
 
-	DiceResult *Clone(const DiceResult &result) const
+	/** Check if an object of a known kind is ignored, going by the list for its kind first.
+	 * @param obj The object
+	 * @param kind The kind of object it is
+	 * @return true if the object is ignored, false otherwise
+	 *
+	 * Most of the time nothing of a kind is ignored, so a roll usually gets its answer from the list being empty instead of from a lookup.
+	 * How often that happens is counted, for STATUS to show. One in every DICE_IGNORE_TIMING_INTERVAL of the lookups that are made is
+	 * timed, which is what the time saved by the skipped lookups is estimated from. Timing every lookup would cost more than the lookups
+	 * themselves, and a skipped check never makes a lookup just to time it.
+	 */
+	bool Check(Extensible *obj, DiceServIgnoreKind kind)
 	{
-		return result.Clone();
+		++this->checks;
+		if (this->ignored[kind].empty())
+		{
+			++this->skipped;
+			return false;
+		}
+		return (this->checks - this->skipped) % DICE_IGNORE_TIMING_INTERVAL == 1 ? this->TimeLookup(obj) : this->HasExt(obj);
 	}
-};
-
-/** A timer designed to load an old DiceServ database from Anope 1.8.x or pre-Anope 1.9.2 after the main database has loaded.
- */
-class DiceServUpgradeTimer : public Timer
-{
-	Anope::string diceservdb;
 
-public:
-	DiceServUpgradeTimer(Module *creator, long timeout, bool dorepeat, const Anope::string &db) : Timer(creator, timeout, Anope::CurTime, dorepeat),
-		diceservdb(db)
+	/** Get the counts of the checks made by Check.
+	 * @param checksMade Gets the number of checks made
+	 * @param checksSkipped Gets the number of checks that didn't need a lookup
+	 * @param timeSaved Gets the estimated time, in milliseconds, that the skipped lookups would have taken, or -1 if no lookup has been
+	 * timed yet
+	 */
+	void Counts(uint64_t &checksMade, uint64_t &checksSkipped, double &timeSaved) const
 	{
+		checksMade = this->checks;
+		checksSkipped = this->skipped;
+		timeSaved = this->lookupsTimed ? this->skipped * (this->lookupTime / this->lookupsTimed) : -1;
 	}
-
-	void Tick(time_t) anope_override;
 };
 
 /** DiceServ's core module, provides the interface for other modules to be able to use the roller.
@@ -2647,19 +6695,24 @@ class DiceServCore : public Module, public DiceServService
 {
 	Reference<BotInfo> DiceServ;
 	DiceServDataHandler DiceServHandler;
-	SerializableExtensibleItem<bool> DiceServIgnore;
+	DiceServIgnoreItem DiceServIgnore;
+	/* Macros are kept as space-separated name=expression pairs, neither of which can contain spaces */
+	SerializableExtensibleItem<Anope::string> DiceServMacros;
+	ExtensibleItem<DiceServStatValues> DiceServStatCache;
+	DiceServStatsItem DiceServStats;
 
 	/** Makes sure that a user who was ignored by their NickServ account is still ignored no matter what.
 	 */
 	void NickEvent(User *u)
 	{
 		if (u->Account() && this->IsIgnored(u->Account()))
-			this->Ignore(u);
+			this->DiceServIgnore.Inherit(u);
 	}
 
 public:
 	DiceServCore(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, PSEUDOCLIENT | THIRD), DiceServService(this),
-		DiceServHandler(this), DiceServIgnore(this, "diceserv_ignore")
+		DiceServHandler(this), DiceServIgnore(this, "diceserv_ignore"), DiceServMacros(this, "diceserv_macros"),
+		DiceServStatCache(this, "diceserv_stat_values"), DiceServStats(this, "diceserv_stats", DiceServStatCache)
 	{
 		this->SetAuthor(DiceServService::Author());
 		this->SetVersion(DiceServService::Version());
@@ -2679,6 +6732,13 @@ public:
 					new DiceServUpgradeTimer(this, 1, true, diceservdb);
 			}
 		}
+
+		diceServCore = this;
+	}
+
+	~DiceServCore()
+	{
+		diceServCore = NULL;
 	}
 
 	void OnReload(Configuration::Conf *conf) anope_override
@@ -2718,6 +6778,8 @@ public:
 					"    fac(\037x\037)         Factorial of \037x\037\n"
 					"    floor(\037x\037)       The next largest integer less than or\n"
 					"                   equal to \037x\037\n"
+					"    if(\037c\037,\037a\037,\037b\037)      \037a\037 if \037c\037 isn't 0, otherwise \037b\037 (only\n"
+					"                   the one used has its dice rolled)\n"
 					"    log(\037x\037)         Natural logarithm of \037x\037\n"
 					"    log10(\037x\037)       Common logarithm of \037x\037\n"
 					"    max(...)       Maximum of all values given (they must\n"
@@ -2814,6 +6876,13 @@ public:
 		this->NickEvent(u);
 	}
 
+	/** Updates the DiceServ ignore status of a user who identified to their NickServ account if they were ignored on it.
+	 */
+	void OnNickIdentify(User *u) anope_override
+	{
+		this->NickEvent(u);
+	}
+
 	/** If a user was ignored in DiceServ when they register a nick, then persist the ignore onto their account.
 	 */
 	void OnNickRegister(User *u, NickAlias *, const Anope::string &) anope_override
@@ -2898,6 +6967,22 @@ public:
 				source.Reply(_("Error description is as follows:"));
 				source.Reply("%s", data.errStr.c_str());
 				break;
+			case DICE_ERROR_TOO_WIDE:
+				source.Reply(_("The results of the following expression are spread out too\nwidely to work out their odds:"));
+				source.Reply(" %s", data.diceStr.c_str());
+				break;
+			case DICE_ERROR_NO_AVERAGE:
+				source.Reply(_("The average of the following expression can't be worked out\nwithout rolling it, try BULKROLL instead:"));
+				source.Reply(" %s", data.diceStr.c_str());
+				break;
+			case DICE_ERROR_UNACCEPTABLE_MODIFIER:
+				source.Reply(_("The dice modifiers in the following expression would reroll\nor explode every face of a die with %d sides:"), data.errNum);
+				source.Reply(" %s", data.diceStr.c_str());
+				break;
+			case DICE_ERROR_UNSET_STAT:
+				source.Reply(_("The following expression uses the stat \002%s\002, which you\nhaven't set:"), data.errStr.c_str());
+				source.Reply(" %s", data.diceStr.c_str());
+				break;
 		}
 	}
 
@@ -2940,35 +7025,204 @@ public:
 		}
 		// As long as there was no error, roll the dice
 		if (data.errCode == DICE_ERROR_NONE)
+			this->SetsRoller(data, n);
+	}
+
+	/** DiceServ's roller for a number of sets of the dice expression, which is only parsed once for all of them, adding each result to the
+	 * buffer. Used by Roller once it knows the number of times, and by the INIT command to roll for many characters at once.
+	 * @param n The number of sets to roll
+	 */
+	void SetsRoller(DiceServData &data, int n)
+	{
+		// Parse the dice
+		Postfix dice_postfix = DoParse(data, data.dicePart);
+		// If the parsing failed, leave
+		if (dice_postfix.empty())
 		{
-			// Parse the dice
-			Postfix dice_postfix = DoParse(data, data.dicePart);
-			// If the parsing failed, leave
-			if (dice_postfix.empty())
+			if (!data.timesPart.empty())
+				data.errPos += data.timesPart.length() + 1;
+			return;
+		}
+		// There's no need to roll anything if every result would overflow anyways
+		DiceServAverage predicted;
+		if (PredictPostfix(data, dice_postfix, predicted) && AlwaysOverflows(predicted))
+		{
+			data.errCode = DICE_ERROR_OVERUNDERFLOW;
+			return;
+		}
+		// Without extended output the individual dice are never shown, so integer-only sets can be evaluated several at a time
+		if (n > 1 && !data.isExtended && data.roundResults && dice_postfix.IsInteger() && !dice_postfix.HasJumps())
+		{
+			int64_t laneResults[DICE_LANES];
+			for (; n > 0; n -= DICE_LANES)
 			{
-				if (!data.timesPart.empty())
-					data.errPos += data.timesPart.length() + 1;
-				return;
-			}
-			// Roll as many sets as were requested
-			for (; n > 0; --n)
-			{
-				// Evaluate the dice, then check for errors
-				data.StartNewOpResults();
-				v = DoEvaluate(data, dice_postfix);
-				// As long as we didn't have an error, we will continue
-				if (data.errCode == DICE_ERROR_NONE)
-					// Round the result, if needed, and add it the buffer
-					data.results.push_back(data.roundResults ? static_cast<int>(my_round(v)) : v);
-				// Leave if there was an error
-				else
+				int lanes = std::min(n, DICE_LANES);
+				if (!EvaluatePostfixLanes(data, dice_postfix, lanes, laneResults))
 				{
+					// An overflow is left to the loop below, where DoEvaluate can fall back to the floating point evaluator
+					if (data.errCode == DICE_ERROR_OVERUNDERFLOW)
+					{
+						data.errCode = DICE_ERROR_NONE;
+						break;
+					}
 					if (!data.timesPart.empty())
 						data.errPos += data.timesPart.length() + 1;
 					return;
 				}
+				data.results.insert(data.results.end(), laneResults, laneResults + lanes);
+			}
+		}
+		// Roll as many sets as were requested
+		for (; n > 0; --n)
+		{
+			// Evaluate the dice, then check for errors
+			data.StartNewOpResults();
+			double v = DoEvaluate(data, dice_postfix);
+			// As long as we didn't have an error, we will continue
+			if (data.errCode == DICE_ERROR_NONE)
+				// Round the result, if needed (integer-only equations never need it), and add it the buffer
+				data.results.push_back(data.roundResults && !dice_postfix.IsInteger() ? static_cast<int>(my_round(v)) : v);
+			// Leave if there was an error
+			else
+			{
+				if (!data.timesPart.empty())
+					data.errPos += data.timesPart.length() + 1;
+				return;
+			}
+		}
+		dice_postfix.clear();
+	}
+
+	/** DiceServ's bulk roller, evaluates the dice expression as many times as stats requests and adds each rounded result to stats,
+	 * splitting the evaluations between a pool of threads.
+	 * @param threads The number of threads to use
+	 *
+	 * Each thread is given its own generator, seeded from the main one, and its own statistics, which are merged once every thread is done.
+	 * If no thread could be started at all, the evaluations are done on this thread instead.
+	 */
+	void BulkRoller(DiceServData &data, DiceServBulkStats &stats, unsigned threads)
+	{
+		// Parse the dice
+		Postfix dice_postfix = DoParse(data, data.dicePart);
+		// If the parsing failed, leave
+		if (dice_postfix.empty())
+			return;
+		DiceServAverage predicted;
+		bool isPredicted = PredictPostfix(data, dice_postfix, predicted);
+		if (isPredicted && AlwaysOverflows(predicted))
+		{
+			data.errCode = DICE_ERROR_OVERUNDERFLOW;
+			return;
+		}
+		// Threads aren't started at all when the whole simulation is predicted to be cheap, as starting them would take longer than the rolls
+		bool inlineOnly = isPredicted && stats.requested * (predicted.dice + 1) < DICE_SIMULATION_MIN_DICE;
+		threads = inlineOnly ? 1 : std::max(threads, 1u);
+		DiceSimulationScheduler scheduler(threads, stats.requested, stats.timeLimit ? wall_clock_ms() + stats.timeLimit : 0);
+		std::vector<DiceSimulationWorker *> workers;
+		for (unsigned w = 0; w < threads; ++w)
+		{
+			uint32_t seed = (static_cast<uint32_t>(RNG().Random(0, 65535)) << 16) | static_cast<uint32_t>(RNG().Random(0, 65535));
+			workers.push_back(new DiceSimulationWorker(scheduler, w, seed, data, dice_postfix));
+		}
+		// Any chunks dealt to a worker that couldn't be started will be stolen by the ones that were
+		unsigned started = 0;
+		for (; !inlineOnly && started < threads; ++started)
+			try
+			{
+				workers[started]->Start();
+			}
+			catch (const CoreException &)
+			{
+				break;
+			}
+		if (!started)
+			workers[0]->Run();
+		bool timedOut = false;
+		for (unsigned w = 0; w < threads; ++w)
+		{
+			if (w < started)
+				workers[w]->Join();
+			const DiceServData &workerData = workers[w]->data;
+			if (workerData.errCode != DICE_ERROR_NONE && data.errCode == DICE_ERROR_NONE)
+			{
+				data.errCode = workerData.errCode;
+				data.errStr = workerData.errStr;
+				data.errPos = workerData.errPos;
+				data.errNum = workerData.errNum;
+			}
+			timedOut = timedOut || workers[w]->timedOut;
+			stats.Merge(workers[w]->stats);
+			delete workers[w];
+		}
+		stats.timedOut = data.errCode == DICE_ERROR_NONE && (timedOut || stats.count < stats.requested);
+	}
+
+	/** DiceServ's odds calculator, works out the distribution of the results of the dice expression, estimating it by rolling the dice
+	 * sampleLimit times if it can't be worked out exactly.
+	 */
+	void OddsCalculator(DiceServData &data, DiceServDistribution &dist)
+	{
+		// Parse the dice
+		Postfix dice_postfix = DoParse(data, data.dicePart);
+		// If the parsing failed, leave
+		if (dice_postfix.empty())
+			return;
+		if ((data.roundResults && DistributionOfPostfix(data, dice_postfix, dist)) || data.errCode != DICE_ERROR_NONE)
+			return;
+		DiceResultCounts sink;
+		dist.samples = RollRepeatedly(data, dice_postfix, dist.sampleLimit, dist.timeLimit ? wall_clock_ms() + dist.timeLimit : 0, sink);
+		if (data.errCode != DICE_ERROR_NONE || sink.counts.empty())
+			return;
+		int64_t lowest = sink.counts.begin()->first, highest = sink.counts.rbegin()->first;
+		if (highest - lowest >= static_cast<int64_t>(DICE_MAX_DISTRIBUTION))
+		{
+			data.errCode = DICE_ERROR_TOO_WIDE;
+			return;
+		}
+		dist.first = lowest;
+		dist.pmf.assign(highest - lowest + 1, 0.0);
+		for (std::map<int64_t, uint64_t>::const_iterator it = sink.counts.begin(), it_end = sink.counts.end(); it != it_end; ++it)
+			dist.pmf[it->first - lowest] = static_cast<double>(it->second) / dist.samples;
+	}
+
+	/** DiceServ's averager, works out the mean, standard deviation and range of the results of the dice expression without rolling it.
+	 *
+	 * The mean is of the unrounded results, but the range is rounded if the results would be.
+	 */
+	void Averager(DiceServData &data, DiceServAverage &avg)
+	{
+		// Parse the dice
+		Postfix dice_postfix = DoParse(data, data.dicePart);
+		// If the parsing failed, leave
+		if (dice_postfix.empty())
+			return;
+		if (!AverageOfPostfix(data, dice_postfix, avg))
+		{
+			if (data.errCode != DICE_ERROR_NONE)
+				return;
+			// Functions such as max of dice that overlap can't be followed analytically, but can still be worked out from the full distribution
+			DiceServDistribution dist;
+			if (!DistributionOfPostfix(data, dice_postfix, dist))
+			{
+				data.errCode = DICE_ERROR_NO_AVERAGE;
+				return;
 			}
-			dice_postfix.clear();
+			double stddev = dist.StdDev();
+			avg.mean = dist.Mean();
+			avg.variance = stddev * stddev;
+			avg.lowest = static_cast<double>(dist.Lowest());
+			avg.highest = static_cast<double>(dist.Highest());
+			avg.integer = true;
+		}
+		if (AlwaysOverflows(avg))
+		{
+			data.errCode = DICE_ERROR_OVERUNDERFLOW;
+			return;
+		}
+		if (data.roundResults)
+		{
+			avg.lowest = my_round(avg.lowest);
+			avg.highest = my_round(avg.highest);
 		}
 	}
 
@@ -2979,20 +7233,42 @@ public:
 		return ::Dice(num, sides).Clone();
 	}
 
+	/** Get a random number from DiceServ's RNG, used currently by the TABLE command for drawing from tables.
+	 * @return A random number in [0, 1)
+	 */
+	double Random()
+	{
+		return RNG().Random();
+	}
+
 	/** Add an ignore to the given object (usually a channel or nick).
 	 * @param obj The extensible object to add an ignore to.
+	 *
+	 * An account's ignore is also added to every user logged into it who isn't already ignored.
 	 */
 	void Ignore(Extensible *obj)
 	{
-		this->DiceServIgnore.Set(obj);
+		this->DiceServIgnore.Ignore(obj);
+		NickCore *nc = dynamic_cast<NickCore *>(obj);
+		if (nc)
+			for (std::list<User *>::const_iterator it = nc->users.begin(), it_end = nc->users.end(); it != it_end; ++it)
+				this->DiceServIgnore.Inherit(*it);
 	}
 
 	/** Remove an ignore from the given object (usually a channel or nick).
 	 * @param obj The extensible object to remove an ignore from.
+	 *
+	 * An account's ignore is also removed from every user logged into it who only had it from the account, while a user who was
+	 * ignored on their own stays ignored.
 	 */
 	void Unignore(Extensible *obj)
 	{
 		this->DiceServIgnore.Unset(obj);
+		NickCore *nc = dynamic_cast<NickCore *>(obj);
+		if (nc)
+			for (std::list<User *>::const_iterator it = nc->users.begin(), it_end = nc->users.end(); it != it_end; ++it)
+				if (this->DiceServIgnore.Inherited(*it))
+					this->DiceServIgnore.Unset(*it);
 	}
 
 	/** Get if the given object (usually a channel or nick) is ignored.
@@ -3003,6 +7279,304 @@ public:
 	{
 		return this->DiceServIgnore.HasExt(obj);
 	}
+
+	/** Get if the given object of a known kind is ignored, which is cheaper than not knowing its kind when nothing of that kind is ignored.
+	 * @param obj The extensible object to check ignore status of.
+	 * @param kind The kind of object it is.
+	 * @return true if the object is ignored, false otherwise.
+	 */
+	bool IsIgnored(Extensible *obj, DiceServIgnoreKind kind)
+	{
+		return this->DiceServIgnore.Check(obj, kind);
+	}
+
+	/** Get how many ignore checks have been made by rolls, how many of them didn't need a lookup and about how much time that saved.
+	 * @param checks Gets the number of checks made
+	 * @param skipped Gets the number of checks answered by nothing of the object's kind being ignored
+	 * @param timeSaved Gets the time the skipped lookups would have taken, in milliseconds, estimated from timing some of the lookups
+	 * that were made, or -1 if none have been timed yet
+	 */
+	void GetIgnoreChecks(uint64_t &checks, uint64_t &skipped, double &timeSaved)
+	{
+		this->DiceServIgnore.Counts(checks, skipped, timeSaved);
+	}
+
+	/** Get the objects of one kind that are ignored.
+	 * @param kind The kind of objects to get
+	 * @return The ignored objects of that kind, which can be counted in constant time
+	 */
+	const std::set<Extensible *> &GetIgnored(DiceServIgnoreKind kind)
+	{
+		return this->DiceServIgnore.Ignored(kind);
+	}
+
+	/** Add or change a macro on the given object (usually a channel or account).
+	 * @param data The data to store any parsing error in
+	 * @param obj The extensible object to store the macro on
+	 * @param name The macro's name, already validated and in lowercase
+	 * @param expr The macro's expression, which is parsed before being stored
+	 * @return true if the expression was valid and the macro was stored, false otherwise
+	 */
+	bool SetMacro(DiceServData &data, Extensible *obj, const Anope::string &name, const Anope::string &expr)
+	{
+		Postfix postfix = DoParse(data, expr);
+		if (postfix.empty())
+			return false;
+		std::map<Anope::string, Anope::string> macros;
+		this->GetMacros(obj, macros);
+		Anope::string &old = macros[name];
+		if (!old.empty())
+			MacroPrograms.erase(old);
+		old = expr;
+		CompileMacro(expr, postfix);
+		this->StoreMacros(obj, macros);
+		return true;
+	}
+
+	/** Remove a macro from the given object (usually a channel or account).
+	 * @param obj The extensible object to remove the macro from
+	 * @param name The macro's name, in lowercase
+	 * @return true if the macro existed, false otherwise
+	 */
+	bool DelMacro(Extensible *obj, const Anope::string &name)
+	{
+		std::map<Anope::string, Anope::string> macros;
+		this->GetMacros(obj, macros);
+		std::map<Anope::string, Anope::string>::iterator macro = macros.find(name);
+		if (macro == macros.end())
+			return false;
+		MacroPrograms.erase(macro->second);
+		macros.erase(macro);
+		this->StoreMacros(obj, macros);
+		return true;
+	}
+
+	/** Get the macros of the given object (usually a channel or account).
+	 * @param obj The extensible object to get the macros of
+	 * @param macros Map to store the macros in, by name
+	 */
+	void GetMacros(Extensible *obj, std::map<Anope::string, Anope::string> &macros)
+	{
+		const Anope::string *stored = this->DiceServMacros.Get(obj);
+		if (!stored)
+			return;
+		spacesepstream sep(*stored);
+		Anope::string macro;
+		while (sep.GetToken(macro))
+		{
+			size_t eq = macro.find('=');
+			if (eq != Anope::string::npos)
+				macros[macro.substr(0, eq)] = macro.substr(eq + 1);
+		}
+	}
+
+	/** Set a stat on the given account.
+	 * @param nc The account to set the stat on
+	 * @param name The stat's name, already validated and in lowercase
+	 * @param value The stat's value
+	 * @return true if the stat was set, false if there are too many different stats for it to be given a slot
+	 */
+	bool SetStat(NickCore *nc, const Anope::string &name, int value)
+	{
+		if (StatSlot(name, true) == DICE_MAX_STAT_SLOTS)
+		{
+			this->CompactStatSlots();
+			if (StatSlot(name, true) == DICE_MAX_STAT_SLOTS)
+				return false;
+		}
+		std::map<Anope::string, int> stats;
+		this->GetStats(nc, stats);
+		stats[name] = value;
+		this->StoreStats(nc, stats);
+		return true;
+	}
+
+	/** Remove a stat from the given account.
+	 * @param nc The account to remove the stat from
+	 * @param name The stat's name, in lowercase
+	 * @return true if the stat existed, false otherwise
+	 */
+	bool DelStat(NickCore *nc, const Anope::string &name)
+	{
+		std::map<Anope::string, int> stats;
+		this->GetStats(nc, stats);
+		if (!stats.erase(name))
+			return false;
+		this->StoreStats(nc, stats);
+		return true;
+	}
+
+	/** Get the stats of the given account.
+	 * @param nc The account to get the stats of
+	 * @param stats Map to store the stats in, by name
+	 */
+	void GetStats(NickCore *nc, std::map<Anope::string, int> &stats)
+	{
+		const Anope::string *stored = this->DiceServStats.Get(nc);
+		if (!stored)
+			return;
+		spacesepstream sep(*stored);
+		Anope::string stat;
+		while (sep.GetToken(stat))
+		{
+			size_t eq = stat.find('=');
+			if (eq != Anope::string::npos)
+				stats[stat.substr(0, eq)] = convertTo<int>(stat.substr(eq + 1));
+		}
+	}
+
+	/** Get the values of the given account's stats, indexed by their slots, for rolling.
+	 * @param nc The account to get the values of the stats of, can be NULL
+	 * @return The values, or NULL if there is no account or it has no stats
+	 */
+	const std::vector<double> *StatValues(NickCore *nc)
+	{
+		if (!nc)
+			return NULL;
+		DiceServStatValues *cached = this->DiceServStatCache.Get(nc);
+		if (cached)
+			return &cached->values;
+		std::map<Anope::string, int> stats;
+		this->GetStats(nc, stats);
+		if (stats.empty())
+			return NULL;
+		cached = this->DiceServStatCache.Set(nc);
+		for (std::map<Anope::string, int>::const_iterator stat = stats.begin(), end = stats.end(); stat != end; ++stat)
+		{
+			unsigned slot = StatSlot(stat->first, true);
+			if (slot == DICE_MAX_STAT_SLOTS)
+				continue;
+			if (slot >= cached->values.size())
+				cached->values.resize(slot + 1, std::numeric_limits<double>::quiet_NaN());
+			cached->values[slot] = stat->second;
+		}
+		return &cached->values;
+	}
+
+	/** Define a function, or redefine an existing one, which is then inlined into any dice that call it.
+	 * @param data The data to store any error in, along with the expression the error is in
+	 * @param name The function's name, already validated and in lowercase
+	 * @param params The names of the function's parameters without their $, already validated and in lowercase
+	 * @param body The function's body, with each parameter given as $name
+	 * @param check true to refuse the function if it can't be compiled or would stop another function from compiling, false to keep it
+	 * regardless, for functions loaded from the database before the functions they call
+	 * @return true if the function was defined, false otherwise
+	 */
+	bool DefineFunction(DiceServData &data, const Anope::string &name, const std::vector<Anope::string> &params, const Anope::string &body, bool check)
+	{
+		if (is_builtin_function(name) == name.length() || is_constant(name) == name.length())
+		{
+			data.diceStr = name;
+			data.errPos = 0;
+			data.errCode = DICE_ERROR_PARSE;
+			data.errStr = "A function can't have the name of a built-in function or constant.";
+			return false;
+		}
+		std::map<Anope::string, DiceUserFunction> old;
+		for (Anope::hash_map<DiceUserFunction>::const_iterator it = UserFunctions.begin(), it_end = UserFunctions.end(); it != it_end; ++it)
+			old[it->first] = it->second;
+		DiceUserFunction &function = UserFunctions[name];
+		function.params = params;
+		function.body = body;
+		// Every function is compiled again, as the ones calling this one have it inlined into them
+		CompileUserFunctions();
+		MacroPrograms.clear();
+		if (!check)
+			return true;
+		for (Anope::hash_map<DiceUserFunction>::const_iterator it = UserFunctions.begin(), it_end = UserFunctions.end(); it != it_end; ++it)
+		{
+			std::map<Anope::string, DiceUserFunction>::const_iterator before = old.find(it->first);
+			if (it->second.ready || (before != old.end() && !before->second.ready))
+				continue;
+			data.diceStr = it->second.body;
+			data.errPos = it->second.errorPos;
+			data.errCode = DICE_ERROR_PARSE;
+			data.errStr = it->first == name ? it->second.error : "The function " + it->first + " would stop working: " + it->second.error;
+			UserFunctions.erase(name);
+			if (old.count(name))
+				UserFunctions[name] = old[name];
+			CompileUserFunctions();
+			return false;
+		}
+		return true;
+	}
+
+	/** Remove a function.
+	 * @param data The data to store any error in, along with the expression the error is in
+	 * @param name The function's name, in lowercase
+	 * @param check true to refuse to remove a function that other functions call, false to remove it regardless
+	 * @return true if the function was removed, false otherwise
+	 */
+	bool UndefineFunction(DiceServData &data, const Anope::string &name, bool check)
+	{
+		if (!UserFunctions.count(name))
+			return false;
+		for (Anope::hash_map<DiceUserFunction>::const_iterator it = UserFunctions.begin(), it_end = UserFunctions.end(); check && it != it_end; ++it)
+		{
+			std::vector<Anope::string> calls;
+			FunctionCalls(it->second.body, calls);
+			if (it->first == name || std::find(calls.begin(), calls.end(), name) == calls.end())
+				continue;
+			data.diceStr = it->second.body;
+			data.errPos = 0;
+			data.errCode = DICE_ERROR_PARSE;
+			data.errStr = "The function " + it->first + " calls " + name + ", so it can't be removed.";
+			return false;
+		}
+		UserFunctions.erase(name);
+		CompileUserFunctions();
+		MacroPrograms.clear();
+		return true;
+	}
+
+private:
+	/** Give out the stat slots again, only to the stats that some account still has, once every slot has been given out.
+	 *
+	 * Everything parsed with the old slots is thrown away: the functions are compiled again, the macros are parsed again the next time
+	 * they are rolled and the values of every account's stats are loaded again.
+	 */
+	void CompactStatSlots()
+	{
+		StatSlots.clear();
+		StatNames.clear();
+		for (nickcore_map::const_iterator it = NickCoreList->begin(), it_end = NickCoreList->end(); it != it_end; ++it)
+		{
+			this->DiceServStatCache.Unset(it->second);
+			std::map<Anope::string, int> stats;
+			this->GetStats(it->second, stats);
+			for (std::map<Anope::string, int>::const_iterator stat = stats.begin(), end = stats.end(); stat != end; ++stat)
+				StatSlot(stat->first, true);
+		}
+		CompileUserFunctions();
+		MacroPrograms.clear();
+	}
+
+	void StoreStats(NickCore *nc, const std::map<Anope::string, int> &stats)
+	{
+		this->DiceServStatCache.Unset(nc);
+		if (stats.empty())
+		{
+			this->DiceServStats.Unset(nc);
+			return;
+		}
+		Anope::string stored;
+		for (std::map<Anope::string, int>::const_iterator stat = stats.begin(), end = stats.end(); stat != end; ++stat)
+			stored += (stored.empty() ? "" : " ") + stat->first + "=" + stringify(stat->second);
+		this->DiceServStats.Set(nc, stored);
+	}
+
+	void StoreMacros(Extensible *obj, const std::map<Anope::string, Anope::string> &macros)
+	{
+		if (macros.empty())
+		{
+			this->DiceServMacros.Unset(obj);
+			return;
+		}
+		Anope::string stored;
+		for (std::map<Anope::string, Anope::string>::const_iterator macro = macros.begin(), end = macros.end(); macro != end; ++macro)
+			stored += (stored.empty() ? "" : " ") + macro->first + "=" + macro->second;
+		this->DiceServMacros.Set(obj, stored);
+	}
 };
 
 void DiceServUpgradeTimer::Tick(time_t)
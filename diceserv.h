@@ -1,8 +1,11 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
 #include <iomanip>
 #include <limits>
 #include <numeric>
+#include <set>
 #include "module.h"
 
 /** Specialization of Anope's stringify that handles doubles only. This gives us max precision on output of doubles.
@@ -28,7 +31,21 @@ enum DiceErrorCode
 	DICE_ERROR_UNACCEPTABLE_SIDES,
 	DICE_ERROR_UNACCEPTABLE_TIMES,
 	DICE_ERROR_OVERUNDERFLOW,
-	DICE_ERROR_STACK
+	DICE_ERROR_STACK,
+	DICE_ERROR_TOO_WIDE,
+	DICE_ERROR_NO_AVERAGE,
+	DICE_ERROR_UNACCEPTABLE_MODIFIER,
+	DICE_ERROR_UNSET_STAT
+};
+
+/** Enumeration of the kinds of objects DiceServ can ignore, which it keeps separate lists of */
+enum DiceServIgnoreKind
+{
+	DICE_IGNORE_CHANNEL,
+	DICE_IGNORE_REGISTERED_CHANNEL,
+	DICE_IGNORE_USER,
+	DICE_IGNORE_ACCOUNT,
+	DICE_IGNORE_KINDS
 };
 
 /** Enumeration for OperatorResult to determine its type */
@@ -62,21 +79,51 @@ public:
 	virtual OperatorResultBase *Clone() const = 0;
 };
 
+/** Flags for the results of dice that have modifiers */
+enum DiceFaceMark
+{
+	/** The result doesn't count, either because it was rerolled or because it was dropped */
+	DICE_FACE_DROPPED = 1,
+	/** The result is counted as a success */
+	DICE_FACE_SUCCESS = 2,
+	/** The result takes away a success */
+	DICE_FACE_BOTCH = 4
+};
+
 /** Version of OperatorResult that stores the result of a set of dice rolls */
 class DiceResult : public OperatorResultBase
 {
 	int num;
 	unsigned sides;
 	std::vector<unsigned> results;
+	/** The keep, drop, reroll and explode modifiers as they are shown, empty for plain dice */
+	Anope::string modifiers;
+	/** DiceFaceMark flags for each result, empty if every result counts towards the total and none are marked */
+	std::vector<unsigned char> marks;
+	/** Running totals, updated as results are added so they never need to be recalculated */
+	uint64_t sum;
+	unsigned lowest, highest;
+	/** The value of each face for dice with custom faces, the results being indexes into it (starting at 1), empty for normal dice */
+	std::vector<int> faceValues;
+	/** true if the value of the dice is the total instead of the sum of the results, for dice that count successes or have custom faces */
+	bool totaled;
+	int64_t total;
 
 public:
 	DiceResult(int n = 0, unsigned s = 0);
 
 	void AddResult(unsigned result);
+	void SetResults(std::vector<unsigned> &newResults);
+	void SetResults(std::vector<unsigned> &newResults, std::vector<unsigned char> &newMarks, const Anope::string &newModifiers);
+	void SetFaceValues(const std::vector<int> &values);
+	void SetTotal(int64_t value);
 	const std::vector<unsigned> &Results() const;
 	const unsigned &Sides() const;
 	Anope::string DiceString() const;
-	unsigned Sum() const;
+	uint64_t Sum() const;
+	unsigned Lowest() const;
+	unsigned Highest() const;
+	size_t CountAtLeast(unsigned threshold) const;
 	double Value() const;
 	Anope::string LongString() const;
 	Anope::string ShortString() const;
@@ -155,6 +202,256 @@ public:
 	}
 };
 
+/** Streaming summary of many evaluations of the same expression, used by BULKROLL.
+ *
+ * Nothing is kept for each individual result: the mean and variance are updated with Welford's algorithm and the results are counted in
+ * a fixed number of histogram bins. The bins are aligned to multiples of their width, which is always a power of 2 and is doubled whenever
+ * the results no longer fit.
+ */
+class DiceServBulkStats
+{
+	/** Doubles the width of the bins, merging each pair of bins */
+	void WidenBins();
+	/** Makes sure the bins cover everything from lowest to highest, widening and shifting them as needed */
+	void FitBins();
+
+public:
+	static const unsigned BINS = 16;
+
+	/** The number of evaluations that were requested */
+	uint64_t requested;
+	/** The wall clock time, in milliseconds, the evaluations are allowed to take, 0 for no limit */
+	unsigned timeLimit;
+	/** Set if the time limit ran out before all the evaluations were done */
+	bool timedOut;
+	uint64_t count;
+	double mean, m2;
+	int64_t lowest, highest;
+	/** Bin i counts the results from (binFirst + i) * binWidth up to, but not including, (binFirst + i + 1) * binWidth */
+	int64_t binFirst, binWidth;
+	uint64_t bins[BINS];
+
+	DiceServBulkStats(uint64_t r = 0, unsigned t = 0) : requested(r), timeLimit(t), timedOut(false), count(0), mean(0), m2(0), lowest(0), highest(0),
+		binFirst(0), binWidth(1)
+	{
+		std::fill(this->bins, this->bins + BINS, 0);
+	}
+
+	void Add(int64_t val);
+	void Merge(const DiceServBulkStats &other);
+
+	double Variance() const
+	{
+		return this->count > 1 ? this->m2 / (this->count - 1) : 0;
+	}
+
+	double StdDev() const
+	{
+		return std::sqrt(this->Variance());
+	}
+};
+
+/** Probability distribution of the results of a dice expression, used by ODDS.
+ *
+ * The probability of a result of first + i is stored in pmf[i]. The distribution is exact unless samples is non-zero, in which case it was
+ * estimated from that many rolls because the expression could not be worked out exactly.
+ */
+class DiceServDistribution
+{
+public:
+	/** The number of rolls to estimate from if the expression can't be worked out exactly */
+	uint64_t sampleLimit;
+	/** The wall clock time, in milliseconds, estimating is allowed to take, 0 for no limit */
+	unsigned timeLimit;
+	/** The number of rolls the distribution was estimated from, 0 if it is exact */
+	uint64_t samples;
+	int64_t first;
+	std::vector<double> pmf;
+
+	DiceServDistribution(uint64_t s = 0, unsigned t = 0) : sampleLimit(s), timeLimit(t), samples(0), first(0), pmf()
+	{
+	}
+
+	int64_t Lowest() const
+	{
+		return this->first;
+	}
+
+	int64_t Highest() const
+	{
+		return this->first + static_cast<int64_t>(this->pmf.size()) - 1;
+	}
+
+	double Mean() const
+	{
+		double mean = 0;
+		for (size_t i = 0, len = this->pmf.size(); i < len; ++i)
+			mean += this->pmf[i] * i;
+		return this->first + mean;
+	}
+
+	double StdDev() const
+	{
+		// Taken around the lowest result instead of 0 so that large offsets don't cost precision
+		double mean = this->Mean() - this->first, variance = 0;
+		for (size_t i = 0, len = this->pmf.size(); i < len; ++i)
+			variance += this->pmf[i] * (i - mean) * (i - mean);
+		return std::sqrt(variance);
+	}
+
+	/** Get the probability of a result at most the given value.
+	 * @param val The value to check
+	 * @return The probability, between 0 and 1
+	 */
+	double AtMost(int64_t val) const
+	{
+		if (val < this->Lowest())
+			return 0;
+		if (val >= this->Highest())
+			return 1;
+		double prob = 0;
+		for (int64_t i = 0, last = val - this->first; i <= last; ++i)
+			prob += this->pmf[i];
+		return std::min(prob, 1.0);
+	}
+
+	/** Get the probability of a result at least the given value.
+	 * @param val The value to check
+	 * @return The probability, between 0 and 1
+	 */
+	double AtLeast(int64_t val) const
+	{
+		if (val <= this->Lowest())
+			return 1;
+		if (val > this->Highest())
+			return 0;
+		double prob = 0;
+		for (int64_t i = val - this->first, len = this->pmf.size(); i < len; ++i)
+			prob += this->pmf[i];
+		return std::min(prob, 1.0);
+	}
+
+	/** Get the probability of a result of exactly the given value.
+	 * @param val The value to check
+	 * @return The probability, between 0 and 1
+	 */
+	double Exactly(int64_t val) const
+	{
+		return val < this->Lowest() || val > this->Highest() ? 0 : this->pmf[val - this->first];
+	}
+
+	/** Get the lowest result that at least the given percentage of results are at or below.
+	 * @param percent The percentage, between 0 and 100
+	 * @return The result
+	 */
+	int64_t Percentile(double percent) const
+	{
+		// The tolerance keeps rounding errors in the probabilities from skipping past a result that is right on the percentile
+		double target = percent / 100 - 1e-12, prob = 0;
+		for (size_t i = 0, len = this->pmf.size(); i < len; ++i)
+		{
+			prob += this->pmf[i];
+			if (prob >= target)
+				return this->first + static_cast<int64_t>(i);
+		}
+		return this->Highest();
+	}
+};
+
+/** Analytic summary of the results of a dice expression, used by the AVG mode of ROLL and CALC.
+ *
+ * Only the mean, the variance and the bounds are kept, so unlike DiceServDistribution, working this out costs no more than parsing does and
+ * never rolls any dice. It is also used to predict what rolling an expression will do before any dice are rolled.
+ */
+class DiceServAverage
+{
+public:
+	double mean, variance;
+	/** The lowest and highest possible results */
+	double lowest, highest;
+	/** The most dice that a single evaluation can roll */
+	double dice;
+	/** Set if every possible result is an integer */
+	bool integer;
+
+	DiceServAverage(double val = 0) : mean(val), variance(0), lowest(val), highest(val), dice(0), integer(std::floor(val) == val)
+	{
+	}
+
+	bool IsConstant() const
+	{
+		return this->lowest == this->highest;
+	}
+
+	double StdDev() const
+	{
+		// Rounding errors can leave the variance of a constant very slightly negative
+		return std::sqrt(std::max(this->variance, 0.0));
+	}
+};
+
+/** A set of weighted choices that can be drawn from in constant time, however many choices there are, used by the TABLE command.
+ *
+ * This uses Vose's version of Walker's alias method: each choice gets a column holding its own probability, topped up with the leftover
+ * probability of one other choice (its alias). A draw picks a column at random and then either the column's choice or its alias.
+ */
+class DiceServAliasTable
+{
+	/** The chance of each column giving its own choice instead of its alias */
+	std::vector<double> prob;
+	std::vector<unsigned> alias;
+
+public:
+	/** Build the table from the weights of the choices.
+	 * @param weights The weight of each choice, all of which must be positive
+	 */
+	void Build(const std::vector<double> &weights)
+	{
+		size_t len = weights.size();
+		this->prob.assign(len, 1.0);
+		this->alias.resize(len);
+		double total = std::accumulate(weights.begin(), weights.end(), 0.0);
+		std::vector<double> scaled(len);
+		std::vector<unsigned> small, large;
+		for (size_t i = 0; i < len; ++i)
+		{
+			this->alias[i] = i;
+			scaled[i] = weights[i] * len / total;
+			(scaled[i] < 1 ? small : large).push_back(i);
+		}
+		while (!small.empty() && !large.empty())
+		{
+			unsigned less = small.back(), more = large.back();
+			small.pop_back();
+			this->prob[less] = scaled[less];
+			this->alias[less] = more;
+			scaled[more] -= 1 - scaled[less];
+			if (scaled[more] < 1)
+			{
+				large.pop_back();
+				small.push_back(more);
+			}
+		}
+		// Whatever is left over is only off from 1 by rounding errors, so those columns always give their own choice
+	}
+
+	size_t Size() const
+	{
+		return this->prob.size();
+	}
+
+	/** Draw a choice from the table.
+	 * @param random A random number in [0, 1), which picks both the column and which of its choices to give
+	 * @return The index of the choice
+	 */
+	unsigned Draw(double random) const
+	{
+		double scaled = random * this->prob.size();
+		size_t column = std::min(static_cast<size_t>(scaled), this->prob.size() - 1);
+		return scaled - column < this->prob[column] ? column : this->alias[column];
+	}
+};
+
 class DiceServData;
 
 class DiceServService : public Service
@@ -172,22 +469,138 @@ public:
 
 	static const Anope::string &Version()
 	{
-		static Anope::string version = "3.0.4";
+		static Anope::string version = "3.1.0";
 		return version;
 	}
 
 	virtual void ErrorHandler(CommandSource &source, const DiceServData &data) = 0;
 	virtual void Roller(DiceServData &data) = 0;
+	virtual void SetsRoller(DiceServData &data, int n) = 0;
+	virtual void BulkRoller(DiceServData &data, DiceServBulkStats &stats, unsigned threads) = 0;
+	virtual void OddsCalculator(DiceServData &data, DiceServDistribution &dist) = 0;
+	virtual void Averager(DiceServData &data, DiceServAverage &avg) = 0;
 	virtual DiceResult *Dice(int num, unsigned sides) = 0;
+	virtual double Random() = 0;
 	virtual void Ignore(Extensible *obj) = 0;
 	virtual void Unignore(Extensible *obj) = 0;
 	virtual bool IsIgnored(Extensible *obj) = 0;
+	virtual bool IsIgnored(Extensible *obj, DiceServIgnoreKind kind) = 0;
+	virtual void GetIgnoreChecks(uint64_t &checks, uint64_t &skipped, double &timeSaved) = 0;
+	virtual const std::set<Extensible *> &GetIgnored(DiceServIgnoreKind kind) = 0;
+	virtual bool SetMacro(DiceServData &data, Extensible *obj, const Anope::string &name, const Anope::string &expr) = 0;
+	virtual bool DelMacro(Extensible *obj, const Anope::string &name) = 0;
+	virtual void GetMacros(Extensible *obj, std::map<Anope::string, Anope::string> &macros) = 0;
+	virtual bool SetStat(NickCore *nc, const Anope::string &name, int value) = 0;
+	virtual bool DelStat(NickCore *nc, const Anope::string &name) = 0;
+	virtual void GetStats(NickCore *nc, std::map<Anope::string, int> &stats) = 0;
+	virtual const std::vector<double> *StatValues(NickCore *nc) = 0;
+	virtual bool DefineFunction(DiceServData &data, const Anope::string &name, const std::vector<Anope::string> &params, const Anope::string &body, bool check) = 0;
+	virtual bool UndefineFunction(DiceServData &data, const Anope::string &name, bool check) = 0;
 };
 
-class DiceServData
+/** The part of DiceServServiceHandle that doesn't depend on the service, so that DiceServModule can keep all of its handles together.
+ */
+class DiceServServiceHandleBase
+{
+public:
+	virtual ~DiceServServiceHandleBase()
+	{
+	}
+
+	virtual void Refresh() = 0;
+	virtual void Invalidate(Module *m) = 0;
+	virtual bool Resolved() const = 0;
+};
+
+/** A resolved handle to one of DiceServ's services.
+ *
+ * ServiceReference checks that it is still valid every time it is dereferenced, which adds up when a single roll goes through the handler
+ * a dozen times. This keeps the resolved pointer instead, and only looks the service up again when the module holding the handle is told
+ * that a module was loaded or unloaded (see DiceServModule below).
+ */
+template<typename T> class DiceServServiceHandle : public DiceServServiceHandleBase
+{
+	Anope::string type, name;
+	T *service;
+
+public:
+	DiceServServiceHandle(const Anope::string &t, const Anope::string &n) : type(t), name(n), service(NULL)
+	{
+	}
+
+	/** Looks up the service again, should be called when the holding module is created and whenever a module is loaded.
+	 */
+	void Refresh() anope_override
+	{
+		this->service = static_cast<T *>(Service::FindService(this->type, this->name));
+	}
+
+	/** Drops the service if the module being unloaded is the one that provides it.
+	 * @param m The module being unloaded
+	 */
+	void Invalidate(Module *m) anope_override
+	{
+		if (this->service && this->service->owner == m)
+			this->service = NULL;
+	}
+
+	bool Resolved() const anope_override
+	{
+		return this->service;
+	}
+
+	operator bool() const
+	{
+		return this->service;
+	}
+
+	T *operator->() const
+	{
+		return this->service;
+	}
+};
+
+/** The base of DiceServ's command modules, which keeps the handles to the services they need up to date as modules come and go.
+ */
+class DiceServModule : public Module
 {
-	ServiceReference<DiceServService> DiceServ;
+	std::vector<DiceServServiceHandleBase *> handles;
+
+protected:
+	DiceServModule(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, THIRD)
+	{
+		this->SetAuthor(DiceServService::Author());
+		this->SetVersion(DiceServService::Version());
+	}
+
+	/** Looks up a service the module can't work without, and keeps the handle to it up to date from then on.
+	 * @param handle The handle to the service
+	 * @param what What the service is, for the error given if it isn't loaded
+	 */
+	void Require(DiceServServiceHandleBase &handle, const Anope::string &what)
+	{
+		handle.Refresh();
+		if (!handle.Resolved())
+			throw ModuleException("No interface for " + what);
+		this->handles.push_back(&handle);
+	}
+
+public:
+	void OnModuleLoad(User *, Module *) anope_override
+	{
+		for (std::vector<DiceServServiceHandleBase *>::const_iterator it = this->handles.begin(), it_end = this->handles.end(); it != it_end; ++it)
+			(*it)->Refresh();
+	}
+
+	void OnModuleUnload(User *, Module *m) anope_override
+	{
+		for (std::vector<DiceServServiceHandleBase *>::const_iterator it = this->handles.begin(), it_end = this->handles.end(); it != it_end; ++it)
+			(*it)->Invalidate(m);
+	}
+};
 
+class DiceServData
+{
 public:
 	bool isExtended, roundResults, sourceIsBot;
 	Anope::string rollPrefix, dicePrefix, diceStr, timesPart, dicePart, diceSuffix, extraStr, chanStr, commentStr;
@@ -199,27 +612,34 @@ public:
 	Anope::string errStr;
 	unsigned errPos;
 	int errNum;
+	/** The values of the roller's stats, indexed by their slots, or NULL if the roller has no stats */
+	const std::vector<double> *statValues;
 
-	DiceServData() : DiceServ("DiceServService", "DiceServ"), isExtended(false), roundResults(true), sourceIsBot(false), rollPrefix(""), dicePrefix(""),
-		diceStr(""), timesPart(""), dicePart(""), diceSuffix(""), extraStr(""), chanStr(""), commentStr(""), maxMessageLength(510), timesResults(), opResults(),
-		results(), errCode(DICE_ERROR_NONE), errStr(""), errPos(0u), errNum(0)
+	DiceServData() : isExtended(false), roundResults(true), sourceIsBot(false), rollPrefix(""), dicePrefix(""), diceStr(""), timesPart(""), dicePart(""),
+		diceSuffix(""), extraStr(""), chanStr(""), commentStr(""), maxMessageLength(510), timesResults(), opResults(), results(), errCode(DICE_ERROR_NONE),
+		errStr(""), errPos(0u), errNum(0), statValues(NULL)
 	{
-		if (!this->DiceServ)
-			throw ModuleException("No interface for DiceServ");
 	}
 
 	void Reset();
 	bool PreParse(CommandSource &source, const std::vector<Anope::string> &params, unsigned expectedChannelPos);
+	bool SplitDice(CommandSource &source, ChannelInfo *macroChannel);
 	bool CheckMessageLengthPreProcess(CommandSource &source);
 	bool CheckMessageLengthPostProcess(CommandSource &source, const Anope::string &output) const;
 	Anope::string GenerateLongExOutput() const;
 	Anope::string GenerateShortExOutput() const;
 	Anope::string GenerateNoExOutput() const;
+	Anope::string GenerateAverageOutput(const DiceServAverage &avg) const;
+	void RollAverage(CommandSource &source, const std::vector<Anope::string> &params);
 	void StartNewOpResults();
 	void AddToOpResults(const DiceResult &result);
 	void AddToOpResults(const FunctionResult &result);
 	void SetOpResultsAsTimesResults();
 	void Roll();
+	void RollSets(int sets);
+	void BulkRoll(DiceServBulkStats &stats, unsigned threads);
+	void Odds(DiceServDistribution &dist);
+	void Average(DiceServAverage &avg);
 	DiceResult *Dice(int num, unsigned sides);
 	void HandleError(CommandSource &source);
 	void SendReply(CommandSource &source, const Anope::string &output) const;
@@ -237,16 +657,23 @@ public:
 
 	virtual void Reset(DiceServData &data) = 0;
 	virtual bool PreParse(DiceServData &data, CommandSource &source, const std::vector<Anope::string> &params, unsigned expectedChannelPos) = 0;
+	virtual bool SplitDice(DiceServData &data, CommandSource &source, ChannelInfo *macroChannel) = 0;
 	virtual bool CheckMessageLengthPreProcess(DiceServData &data, CommandSource &source) = 0;
 	virtual bool CheckMessageLengthPostProcess(const DiceServData &data, CommandSource &source, const Anope::string &output) const = 0;
 	virtual Anope::string GenerateLongExOutput(const DiceServData &data) const = 0;
 	virtual Anope::string GenerateShortExOutput(const DiceServData &data) const = 0;
 	virtual Anope::string GenerateNoExOutput(const DiceServData &data) const = 0;
+	virtual Anope::string GenerateAverageOutput(const DiceServData &data, const DiceServAverage &avg) const = 0;
+	virtual void RollAverage(DiceServData &data, CommandSource &source, const std::vector<Anope::string> &params) = 0;
 	virtual void StartNewOpResults(DiceServData &data) = 0;
 	virtual void AddToOpResults(DiceServData &data, const DiceResult &result) = 0;
 	virtual void AddToOpResults(DiceServData &data, const FunctionResult &result) = 0;
 	virtual void SetOpResultsAsTimesResults(DiceServData &data) = 0;
 	virtual void Roll(DiceServData &data) = 0;
+	virtual void RollSets(DiceServData &data, int sets) = 0;
+	virtual void BulkRoll(DiceServData &data, DiceServBulkStats &stats, unsigned threads) = 0;
+	virtual void Odds(DiceServData &data, DiceServDistribution &dist) = 0;
+	virtual void Average(DiceServData &data, DiceServAverage &avg) = 0;
 	virtual DiceResult *Dice(DiceServData &data, int num, unsigned sides) = 0;
 	virtual void HandleError(DiceServData &data, CommandSource &source) = 0;
 	virtual void SendReply(const DiceServData &data, CommandSource &source, const Anope::string &output) const = 0;
@@ -257,6 +684,61 @@ public:
 	virtual const std::vector<unsigned> &Results(const DiceResult &result) const = 0;
 	virtual const unsigned &Sides(const DiceResult &result) const = 0;
 	virtual Anope::string DiceString(const DiceResult &result) const = 0;
-	virtual unsigned Sum(const DiceResult &result) const = 0;
+	virtual uint64_t Sum(const DiceResult &result) const = 0;
+	virtual unsigned Lowest(const DiceResult &result) const = 0;
+	virtual unsigned Highest(const DiceResult &result) const = 0;
+	virtual size_t CountAtLeast(const DiceResult &result, unsigned threshold) const = 0;
 	virtual DiceResult *Clone(const DiceResult &result) const = 0;
 };
+
+/** Check if the dice expression given to a command is preceded by a mode keyword (such as AVG), removing the keyword if it is.
+ * @param mode The keyword to look for
+ * @param params The parameters given to the command, changed in place
+ * @param maxParams The maximum number of parameters the command takes
+ * @return true if the keyword was found, false otherwise
+ *
+ * Anope joins everything past the last parameter into it, so the parameters after the keyword are split up again, leaving them where they
+ * would have been had the keyword not been given.
+ */
+inline bool ExtractDiceMode(CommandSource &source, const Anope::string &mode, std::vector<Anope::string> &params, unsigned maxParams)
+{
+	// Fantasy prepends the channel to the parameters
+	unsigned modePos = source.c ? 1 : 0;
+	if (params.size() < modePos + 2 || !params[modePos].equals_ci(mode))
+		return false;
+	Anope::string rest = params[modePos + 1];
+	for (size_t x = modePos + 2, len = params.size(); x < len; ++x)
+		rest += " " + params[x];
+	params.resize(modePos);
+	spacesepstream sep(rest);
+	Anope::string token;
+	while (params.size() + 1 < maxParams && sep.GetToken(token))
+		params.push_back(token);
+	if (!sep.StreamEnd())
+		params.push_back(sep.GetRemaining());
+	return true;
+}
+
+/** Check if someone can change or wipe out what DiceServ keeps for a channel, such as its deck or initiative order.
+ * @param source The source of the command
+ * @param c The channel
+ * @return true if they are a Services Operator with diceserv/set, a channel operator, or have the AUTOOP privilege on the registered channel
+ */
+inline bool CanManageChannel(CommandSource &source, Channel *c)
+{
+	return source.HasCommand("diceserv/set") || c->HasUserStatus(source.GetUser(), "OP") || (c->ci && source.AccessFor(c->ci).HasPriv("AUTOOP"));
+}
+
+/** The base of ROLL and CALC, which take the same parameters and both have an AVG mode.
+ */
+class DiceServRollCommandBase : public Command
+{
+protected:
+	DiceServRollCommandBase(Module *creator, const Anope::string &sname) : Command(creator, sname, 1, 3)
+	{
+		this->AllowUnregistered(true);
+		this->RequireUser(true);
+		this->SetSyntax(_("\037dice\037 [[\037channel\037] \037comment\037]"));
+		this->SetSyntax(_("AVG \037dice\037 [[\037channel\037] \037comment\037]"));
+	}
+};
@@ -0,0 +1,256 @@
+/* ----------------------------------------------------------------------------
+ * Name    : ds_bulkroll.cpp
+ * Author  : Naram Qashat (CyberBotX)
+ * ----------------------------------------------------------------------------
+ * Description:
+ *
+ * The BULKROLL and SIMULATE commands of DiceServ. See diceserv.cpp for more
+ * information about DiceServ, including version and license.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "diceserv.h"
+
+static DiceServServiceHandle<DiceServDataHandlerService> DiceServDataHandler("DiceServDataHandlerService", "DiceServ");
+
+/** Base for BULKROLL and SIMULATE, which take the same parameters, split their rolls between the same pool of threads and give the same kind
+ * of summary.
+ */
+class DSBulkCommandBase : public Command
+{
+protected:
+	unsigned maxRolls, timeLimit, threads;
+
+	/** Parse the parameters of the command.
+	 * @param data The dice data to fill in
+	 * @param count Reference to store the number of times to roll in
+	 * @return true if the parameters were valid, false otherwise (a reply will have been sent already if needed)
+	 */
+	bool ParseParams(CommandSource &source, const std::vector<Anope::string> &params, DiceServData &data, int &count)
+	{
+		// Fantasy prepends the channel to the parameters, so the count may still be missing
+		if (params.size() < (source.c ? 3u : 2u))
+		{
+			this->OnSyntaxError(source, "");
+			return false;
+		}
+		if (!DiceServDataHandler->PreParse(data, source, params, 2))
+			return false;
+		if (!data.timesPart.empty())
+		{
+			source.Reply(_("\037dice\037 for a bulk roll can not contain a number of times\n"
+				"(with ~ or []), use \037count\037 instead."));
+			return false;
+		}
+		count = convertTo<int>(data.extraStr, false);
+		Anope::string tmp = stringify(count);
+		if (data.extraStr != tmp)
+		{
+			source.Reply(_("\037count\037 for a bulk roll must be a number."));
+			return false;
+		}
+		if (count < 1 || static_cast<unsigned>(count) > this->maxRolls)
+		{
+			source.Reply(_("The count you entered (\037%d\037) was out of range, it must be\nbetween 1 and %u."), count, this->maxRolls);
+			return false;
+		}
+		data.diceSuffix = " x" + tmp;
+		return DiceServDataHandler->CheckMessageLengthPreProcess(data, source);
+	}
+
+	/** Generate the one line summary of the results.
+	 * @param data The dice data
+	 * @param stats The statistics of the results
+	 * @param showInterval true to show the 95% confidence interval of the mean, false otherwise
+	 * @return The summary
+	 */
+	static Anope::string GenerateOutput(const DiceServData &data, const DiceServBulkStats &stats, bool showInterval)
+	{
+		std::ostringstream output;
+		output << "<" << data.rollPrefix << " [" << data.diceStr << data.diceSuffix << "]: min " << stats.lowest << ", max " << stats.highest << std::fixed
+			<< std::setprecision(3) << ", mean " << stats.mean;
+		if (showInterval)
+			output << " +/- " << 1.96 * stats.StdDev() / std::sqrt(static_cast<double>(stats.count)) << " (95% CI)";
+		output << ", stddev " << stats.StdDev() << " |" << std::setprecision(1);
+		// Only the bins from the lowest result to the highest result are shown
+		for (unsigned i = 0; i < DiceServBulkStats::BINS; ++i)
+		{
+			if (!stats.bins[i] && (stats.binFirst + i + 1) * stats.binWidth <= stats.lowest)
+				continue;
+			int64_t binLow = (stats.binFirst + i) * stats.binWidth, binHigh = binLow + stats.binWidth - 1;
+			if (binLow > stats.highest)
+				break;
+			output << " " << binLow;
+			if (binHigh != binLow)
+				output << ".." << binHigh;
+			output << ":" << 100.0 * stats.bins[i] / stats.count << "%";
+		}
+		if (stats.timedOut)
+			output << " (time limit reached after " << stats.count << " rolls)";
+		output << ">";
+		if (!data.commentStr.empty())
+			output << " " << data.commentStr;
+		return output.str();
+	}
+
+	/** Reply with the summary, or with the error if there was one.
+	 * @param data The dice data
+	 * @param stats The statistics of the results
+	 * @param showInterval true to show the 95% confidence interval of the mean, false otherwise
+	 */
+	static void SendSummary(CommandSource &source, DiceServData &data, const DiceServBulkStats &stats, bool showInterval)
+	{
+		if (data.errCode != DICE_ERROR_NONE)
+		{
+			DiceServDataHandler->HandleError(data, source);
+			return;
+		}
+		if (!stats.count)
+		{
+			source.Reply(_("The time limit for a bulk roll ran out before any results\nwere rolled. Please try again with simpler dice."));
+			return;
+		}
+		Anope::string output = GenerateOutput(data, stats, showInterval);
+		if (!DiceServDataHandler->CheckMessageLengthPostProcess(data, source, output))
+			return;
+		DiceServDataHandler->SendReply(data, source, output);
+	}
+
+public:
+	DSBulkCommandBase(Module *creator, const Anope::string &sname, unsigned rolls) : Command(creator, sname, 2, 4), maxRolls(rolls), timeLimit(100),
+		threads(4)
+	{
+		this->AllowUnregistered(true);
+		this->RequireUser(true);
+		this->SetSyntax(_("\037dice\037 \037count\037 [[\037channel\037] \037comment\037]"));
+	}
+
+	void SetLimits(unsigned rolls, unsigned time, unsigned t)
+	{
+		this->maxRolls = rolls;
+		this->timeLimit = time;
+		this->threads = t;
+	}
+};
+
+/** BULKROLL command
+ *
+ * Handles rolling the same dice expression many times, showing a summary of the results instead of the results themselves.
+ */
+class DSBulkRollCommand : public DSBulkCommandBase
+{
+public:
+	DSBulkRollCommand(Module *creator) : DSBulkCommandBase(creator, "diceserv/bulkroll", 100000)
+	{
+		this->SetDesc(_("Rolls dice many times and summarizes the results"));
+	}
+
+	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
+	{
+		DiceServData data;
+		data.rollPrefix = "Bulk roll";
+
+		int count;
+		if (!this->ParseParams(source, params, data, count))
+			return;
+
+		DiceServBulkStats stats(count, this->timeLimit);
+		DiceServDataHandler->BulkRoll(data, stats, this->threads);
+		SendSummary(source, data, stats, false);
+	}
+
+	bool OnHelp(CommandSource &source, const Anope::string &) anope_override
+	{
+		this->SendSyntax(source);
+		source.Reply(" ");
+		source.Reply(_("Rolls the given dice expression \037count\037 times and shows\n"
+			"the lowest and highest results, the mean, the standard\n"
+			"deviation and how often the results fell into each range,\n"
+			"instead of every result. See \002%s%s HELP ROLL\002 for\n"
+			"more information on dice expressions. \037count\037 may be up\n"
+			"to %u. The rolls are split between several threads. If the\n"
+			"rolls take too long, the summary is made from the rolls that\n"
+			"were done in time."), Config->StrictPrivmsg.c_str(), source.service->nick.c_str(), this->maxRolls);
+		source.Reply(" ");
+		source.Reply(_("Example:\n"
+			"  %s%s BULKROLL 3d6 100000\n"
+			"    Rolls 3d6 100,000 times and summarizes the results."), Config->StrictPrivmsg.c_str(), source.service->nick.c_str());
+		const Anope::string &fantasycharacters = Config->GetModule("fantasy")->Get<const Anope::string>("fantasycharacter", "!");
+		if (!fantasycharacters.empty())
+			source.Reply(_(" \n"
+				"Additionally, if fantasy is enabled, this command can be triggered by using:\n"
+				" \n"
+				"!bulkroll \037dice\037 \037count\037 [\037comment\037]\n"
+				" \n"
+				"where ! is one of the following characters: %s"), fantasycharacters.c_str());
+		return true;
+	}
+};
+
+/** SIMULATE command
+ *
+ * Handles the same as BULKROLL, but allows more rolls and shows how precise the mean is.
+ */
+class DSSimulateCommand : public DSBulkCommandBase
+{
+public:
+	DSSimulateCommand(Module *creator) : DSBulkCommandBase(creator, "diceserv/simulate", 1000000)
+	{
+		this->SetDesc(_("Rolls dice many times and shows how precise the mean is"));
+	}
+
+	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
+	{
+		DiceServData data;
+		data.rollPrefix = "Simulation";
+
+		int count;
+		if (!this->ParseParams(source, params, data, count))
+			return;
+
+		DiceServBulkStats stats(count, this->timeLimit);
+		DiceServDataHandler->BulkRoll(data, stats, this->threads);
+		SendSummary(source, data, stats, true);
+	}
+
+	bool OnHelp(CommandSource &source, const Anope::string &) anope_override
+	{
+		this->SendSyntax(source);
+		source.Reply(" ");
+		source.Reply(_("This command is identical to BULKROLL (see \002%s%s\002\n"
+			"\002HELP BULKROLL\002 for more information on how to use this),\n"
+			"except up to %u rolls are allowed and the 95%% confidence\n"
+			"interval of the mean is also shown."), Config->StrictPrivmsg.c_str(), source.service->nick.c_str(), this->maxRolls);
+		const Anope::string &fantasycharacters = Config->GetModule("fantasy")->Get<const Anope::string>("fantasycharacter", "!");
+		if (!fantasycharacters.empty())
+			source.Reply(_(" \n"
+				"Additionally, if fantasy is enabled, this command can be triggered by using:\n"
+				" \n"
+				"!simulate \037dice\037 \037count\037 [\037comment\037]\n"
+				" \n"
+				"where ! is one of the following characters: %s"), fantasycharacters.c_str());
+		return true;
+	}
+};
+
+class DSBulkRoll : public DiceServModule
+{
+	DSBulkRollCommand bulkroll_cmd;
+	DSSimulateCommand simulate_cmd;
+
+public:
+	DSBulkRoll(const Anope::string &modname, const Anope::string &creator) : DiceServModule(modname, creator), bulkroll_cmd(this), simulate_cmd(this)
+	{
+		this->Require(DiceServDataHandler, "DiceServ's data handler");
+	}
+
+	void OnReload(Configuration::Conf *conf) anope_override
+	{
+		Configuration::Block *block = conf->GetModule(this);
+		unsigned timeLimit = block->Get<unsigned>("timelimit", "100"), threads = std::min(std::max(block->Get<unsigned>("threads", "4"), 1u), 64u);
+		this->bulkroll_cmd.SetLimits(block->Get<unsigned>("maxrolls", "100000"), timeLimit, threads);
+		this->simulate_cmd.SetLimits(block->Get<unsigned>("maxsimulations", "1000000"), timeLimit, threads);
+	}
+};
+
+MODULE_INIT(DSBulkRoll)
@@ -11,25 +11,32 @@
 
 #include "diceserv.h"
 
-static ServiceReference<DiceServDataHandlerService> DiceServDataHandler("DiceServDataHandlerService", "DiceServ");
+static DiceServServiceHandle<DiceServDataHandlerService> DiceServDataHandler("DiceServDataHandlerService", "DiceServ");
 
 /** CALC command
  *
  * Handles regular dice rolls, sans rounding, resulting in more of a calculation.
  */
-class DSCalcCommand : public Command
+class DSCalcCommand : public DiceServRollCommandBase
 {
 public:
-	DSCalcCommand(Module *creator) : Command(creator, "diceserv/calc", 1, 3)
+	DSCalcCommand(Module *creator) : DiceServRollCommandBase(creator, "diceserv/calc")
 	{
-		this->AllowUnregistered(true);
-		this->RequireUser(true);
 		this->SetDesc(_("ROLL without rounding, for calculations"));
-		this->SetSyntax(_("\037dice\037 [[\037channel\037] \037comment\037]"));
 	}
 
 	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
 	{
+		std::vector<Anope::string> avgParams = params;
+		if (ExtractDiceMode(source, "AVG", avgParams, 3))
+		{
+			DiceServData data;
+			data.roundResults = false;
+			data.rollPrefix = "Calc average";
+			DiceServDataHandler->RollAverage(data, source, avgParams);
+			return;
+		}
+
 		DiceServData data;
 		data.roundResults = false;
 		data.rollPrefix = "Calc";
@@ -62,7 +69,7 @@ public:
 		source.Reply(_("This command is identical to ROLL (see \002%s%s\002\n"
 			"\002HELP ROLL\002 for more information on how to use this and\n"
 			"ROLL), except the results are not rounded off and are\n"
-			"displayed as is."), Config->StrictPrivmsg.c_str(), source.service->nick.c_str());
+			"displayed as is. This includes the AVG mode."), Config->StrictPrivmsg.c_str(), source.service->nick.c_str());
 		const Anope::string &fantasycharacters = Config->GetModule("fantasy")->Get<const Anope::string>("fantasycharacter", "!");
 		if (!fantasycharacters.empty())
 			source.Reply(_(" \n"
@@ -161,19 +168,15 @@ public:
 	}
 };
 
-class DSCalc : public Module
+class DSCalc : public DiceServModule
 {
 	DSCalcCommand calc_cmd;
 	DSExcalcCommand excalc_cmd;
 
 public:
-	DSCalc(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, THIRD), calc_cmd(this), excalc_cmd(this)
+	DSCalc(const Anope::string &modname, const Anope::string &creator) : DiceServModule(modname, creator), calc_cmd(this), excalc_cmd(this)
 	{
-		this->SetAuthor(DiceServService::Author());
-		this->SetVersion(DiceServService::Version());
-
-		if (!DiceServDataHandler)
-			throw ModuleException("No interface for DiceServ's data handler");
+		this->Require(DiceServDataHandler, "DiceServ's data handler");
 	}
 };
 
@@ -0,0 +1,343 @@
+/* ----------------------------------------------------------------------------
+ * Name    : ds_deck.cpp
+ * Author  : Naram Qashat (CyberBotX)
+ * ----------------------------------------------------------------------------
+ * Description:
+ *
+ * The DECK command of DiceServ. See diceserv.cpp for more information about
+ * DiceServ, including version and license.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "diceserv.h"
+
+static DiceServServiceHandle<DiceServService> DiceServ("DiceServService", "DiceServ");
+static DiceServServiceHandle<DiceServDataHandlerService> DiceServDataHandler("DiceServDataHandlerService", "DiceServ");
+
+/** The most cards a single DRAW or RETURN can move, the same as the most sets a dice roll can have */
+static const int DECK_MAX_CARDS = 25;
+/** The most cards a numbered deck can have */
+static const unsigned DECK_MAX_NUMBERED = 1000;
+
+enum DeckType
+{
+	DECK_STANDARD,
+	DECK_JOKERS,
+	DECK_TAROT,
+	DECK_MAJOR,
+	DECK_NUMBERED
+};
+
+static const char *CardRanks[] = { "Ace", "2", "3", "4", "5", "6", "7", "8", "9", "10", "Jack", "Queen", "King" };
+static const char *CardSuits[] = { "Clubs", "Diamonds", "Hearts", "Spades" };
+static const char *TarotRanks[] = { "Ace", "2", "3", "4", "5", "6", "7", "8", "9", "10", "Page", "Knight", "Queen", "King" };
+static const char *TarotSuits[] = { "Wands", "Cups", "Swords", "Pentacles" };
+static const char *MajorArcana[] =
+{
+	"The Fool", "The Magician", "The High Priestess", "The Empress", "The Emperor", "The Hierophant", "The Lovers", "The Chariot", "Strength",
+	"The Hermit", "Wheel of Fortune", "Justice", "The Hanged Man", "Death", "Temperance", "The Devil", "The Tower", "The Star", "The Moon", "The Sun",
+	"Judgement", "The World"
+};
+
+/** A channel's deck of cards.
+ *
+ * Only the order of the cards and how many have been drawn are kept, at 2 bytes a card, and the order isn't even made until the first card
+ * is drawn, so a channel that creates a deck and never draws from it costs next to nothing. Cards are shuffled as they are drawn: each draw
+ * swaps a random undrawn card into the next spot (one step of a Fisher-Yates shuffle), so shuffling every card back in only has to reset
+ * the count of drawn cards.
+ */
+struct DiceServDeck
+{
+	DeckType type;
+	uint16_t size, drawn;
+	/** The cards that have been drawn, in the order they were drawn, followed by the undrawn cards in no particular order */
+	std::vector<uint16_t> order;
+
+	DiceServDeck(Extensible *) : type(DECK_STANDARD), size(52), drawn(0), order()
+	{
+	}
+
+	unsigned Left() const
+	{
+		return this->size - this->drawn;
+	}
+
+	/** Draw a card from the deck, which must have at least one card left.
+	 * @return The card
+	 */
+	uint16_t Draw()
+	{
+		if (this->order.empty())
+		{
+			this->order.resize(this->size);
+			for (uint16_t i = 0; i < this->size; ++i)
+				this->order[i] = i;
+		}
+		unsigned pick = this->drawn + static_cast<unsigned>(DiceServ->Random() * this->Left());
+		std::swap(this->order[this->drawn], this->order[std::min(pick, this->size - 1u)]);
+		return this->order[this->drawn++];
+	}
+
+	/** Put the last card drawn back into the deck, which must have had at least one card drawn.
+	 * @return The card
+	 */
+	uint16_t Return()
+	{
+		return this->order[--this->drawn];
+	}
+
+	/** Get the name of a card.
+	 * @param card The card
+	 * @return The name
+	 */
+	Anope::string CardName(uint16_t card) const
+	{
+		switch (this->type)
+		{
+			case DECK_STANDARD:
+			case DECK_JOKERS:
+				if (card >= 52)
+					return card == 52 ? "Red Joker" : "Black Joker";
+				return Anope::string(CardRanks[card % 13]) + " of " + CardSuits[card / 13];
+			case DECK_TAROT:
+			case DECK_MAJOR:
+				if (card < 22)
+					return MajorArcana[card];
+				card -= 22;
+				return Anope::string(TarotRanks[card % 14]) + " of " + TarotSuits[card / 14];
+			default:
+				return stringify(card + 1);
+		}
+	}
+};
+
+/** DECK command
+ *
+ * Handles creating, shuffling, drawing from and returning cards to a channel's deck of cards.
+ */
+class DSDeckCommand : public Command
+{
+	ExtensibleItem<DiceServDeck> decks;
+
+	/** Parse the type of a deck.
+	 * @param name The name of the type, or the number of cards for a numbered deck
+	 * @param type Reference to store the type in
+	 * @param size Reference to store the number of cards in
+	 * @return true if the type was valid, false otherwise
+	 */
+	static bool ParseType(const Anope::string &name, DeckType &type, unsigned &size)
+	{
+		if (name.equals_ci("STANDARD"))
+		{
+			type = DECK_STANDARD;
+			size = 52;
+		}
+		else if (name.equals_ci("JOKERS"))
+		{
+			type = DECK_JOKERS;
+			size = 54;
+		}
+		else if (name.equals_ci("TAROT"))
+		{
+			type = DECK_TAROT;
+			size = 78;
+		}
+		else if (name.equals_ci("MAJOR"))
+		{
+			type = DECK_MAJOR;
+			size = 22;
+		}
+		else
+		{
+			size = convertTo<unsigned>(name, false);
+			if (name != stringify(size) || size < 2 || size > DECK_MAX_NUMBERED)
+				return false;
+			type = DECK_NUMBERED;
+		}
+		return true;
+	}
+
+public:
+	DSDeckCommand(Module *creator) : Command(creator, "diceserv/deck", 1, 4), decks(creator, "diceserv_deck")
+	{
+		this->AllowUnregistered(true);
+		this->RequireUser(true);
+		this->SetDesc(_("Draws cards from a channel's deck"));
+		this->SetSyntax(_("CREATE \037type\037 \037channel\037 [\037comment\037]"));
+		this->SetSyntax(_("SHUFFLE \037channel\037 [\037comment\037]"));
+		this->SetSyntax(_("DRAW [\037count\037] \037channel\037 [\037comment\037]"));
+		this->SetSyntax(_("RETURN [\037count\037] \037channel\037 [\037comment\037]"));
+	}
+
+	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
+	{
+		// Fantasy prepends the channel to the parameters, so everything is one further in
+		unsigned actionPos = source.c ? 1 : 0;
+		if (params.size() <= actionPos)
+		{
+			this->OnSyntaxError(source, "");
+			return;
+		}
+		Anope::string action = params[actionPos].upper();
+		if (action != "CREATE" && action != "SHUFFLE" && action != "DRAW" && action != "RETURN")
+		{
+			this->OnSyntaxError(source, "");
+			return;
+		}
+		bool hasArg = params.size() > actionPos + 1 && (action == "CREATE" || ((action == "DRAW" || action == "RETURN") &&
+			params[actionPos + 1].is_pos_number_only()));
+		if (action == "CREATE" && !hasArg)
+		{
+			this->OnSyntaxError(source, "");
+			return;
+		}
+
+		// Without an argument, the comment can end up split over the last two parameters
+		std::vector<Anope::string> newParams = params;
+		if (!hasArg && newParams.size() == 4)
+		{
+			newParams[2] += " " + newParams[3];
+			newParams.pop_back();
+		}
+
+		DiceServData data;
+		data.rollPrefix = "Deck";
+		if (!DiceServDataHandler->PreParse(data, source, newParams, hasArg ? 2 : 1))
+			return;
+		data.diceStr = action + (hasArg ? " " + data.extraStr : "");
+		// Decks belong to channels, so there has to be a channel that the results can be sent to
+		Channel *c = data.chanStr.empty() ? NULL : Channel::Find(data.chanStr);
+		if (!c)
+		{
+			source.Reply(_("A deck can only be used in a channel that you are in, that\n%s isn't ignoring and that isn't moderated."),
+				source.service->nick.c_str());
+			return;
+		}
+		// Anyone can draw from the deck, but only channel operators can replace it or put the cards that have been drawn back
+		if (action != "DRAW" && !CanManageChannel(source, c))
+		{
+			source.Reply(ACCESS_DENIED);
+			return;
+		}
+		if (!DiceServDataHandler->CheckMessageLengthPreProcess(data, source))
+			return;
+
+		std::ostringstream output;
+		output << "<" << data.rollPrefix << " [" << data.diceStr << "]: ";
+		DiceServDeck *deck = this->decks.Get(c);
+		if (action == "CREATE")
+		{
+			DeckType type;
+			unsigned size;
+			if (!ParseType(data.extraStr, type, size))
+			{
+				source.Reply(_("The type of deck must be STANDARD, JOKERS, TAROT, MAJOR or a\nnumber of cards between 2 and %u."), DECK_MAX_NUMBERED);
+				return;
+			}
+			deck = this->decks.Set(c);
+			deck->type = type;
+			deck->size = size;
+			output << "a shuffled deck of " << deck->size << " cards";
+		}
+		else if (!deck)
+		{
+			source.Reply(_("There is no deck in \037%s\037, create one with the CREATE\noption first."), c->name.c_str());
+			return;
+		}
+		else if (action == "SHUFFLE")
+		{
+			deck->drawn = 0;
+			output << "all " << deck->size << " cards shuffled back in";
+		}
+		else
+		{
+			int count = 1;
+			if (hasArg)
+			{
+				count = convertTo<int>(data.extraStr, false);
+				if (data.extraStr != stringify(count) || count < 1 || count > DECK_MAX_CARDS)
+				{
+					source.Reply(_("The number of cards must be between 1 and %d."), DECK_MAX_CARDS);
+					return;
+				}
+			}
+			if (action == "DRAW" && static_cast<unsigned>(count) > deck->Left())
+			{
+				source.Reply(_("There are only %u cards left in the deck in \037%s\037."), deck->Left(), c->name.c_str());
+				return;
+			}
+			if (action == "RETURN" && count > deck->drawn)
+			{
+				source.Reply(_("Only %u cards have been drawn from the deck in \037%s\037."), static_cast<unsigned>(deck->drawn), c->name.c_str());
+				return;
+			}
+			for (int i = 0; i < count; ++i)
+				output << (i ? ", " : "") << deck->CardName(action == "DRAW" ? deck->Draw() : deck->Return());
+			if (action == "RETURN")
+				output << " returned";
+			output << " (" << deck->Left() << " left)";
+		}
+		output << ">";
+		if (!data.commentStr.empty())
+			output << " " << data.commentStr;
+
+		if (!DiceServDataHandler->CheckMessageLengthPostProcess(data, source, output.str()))
+			return;
+		DiceServDataHandler->SendReply(data, source, output.str());
+	}
+
+	bool OnHelp(CommandSource &source, const Anope::string &) anope_override
+	{
+		this->SendSyntax(source);
+		source.Reply(" ");
+		source.Reply(_("Handles a deck of cards in a channel, which anyone in the\n"
+			"channel can use. The deck lasts for as long as the channel\n"
+			"does. The results are always sent to the channel.\n"
+			" \n"
+			"CREATE replaces the channel's deck with a new one, shuffled.\n"
+			"The \037type\037 can be STANDARD (52 cards), JOKERS (54 cards,\n"
+			"including 2 jokers), TAROT (78 cards), MAJOR (the 22 major\n"
+			"arcana of a tarot deck) or a number of cards up to %u.\n"
+			" \n"
+			"SHUFFLE puts all the cards back into the deck and shuffles it.\n"
+			" \n"
+			"DRAW draws \037count\037 cards from the deck (1 if left off).\n"
+			" \n"
+			"RETURN puts the last \037count\037 cards drawn back into the deck\n"
+			"(1 if left off), shuffling them in with the cards that are\n"
+			"left. Up to %d cards can be drawn or returned at once.\n"
+			" \n"
+			"Anyone can use DRAW, but only channel operators can use\n"
+			"CREATE, SHUFFLE and RETURN."), DECK_MAX_NUMBERED, DECK_MAX_CARDS);
+		source.Reply(" ");
+		source.Reply(_("Examples:\n"
+			"  %s%s DECK CREATE JOKERS #savage\n"
+			"    Creates a deck with 2 jokers for #savage.\n"
+			"  %s%s DECK DRAW 5 #savage\n"
+			"    Draws 5 cards from the deck of #savage."), Config->StrictPrivmsg.c_str(), source.service->nick.c_str(), Config->StrictPrivmsg.c_str(),
+			source.service->nick.c_str());
+		const Anope::string &fantasycharacters = Config->GetModule("fantasy")->Get<const Anope::string>("fantasycharacter", "!");
+		if (!fantasycharacters.empty())
+			source.Reply(_(" \n"
+				"Additionally, if fantasy is enabled, this command can be triggered by using:\n"
+				" \n"
+				"!deck {CREATE \037type\037|SHUFFLE|DRAW [\037count\037]|RETURN [\037count\037]} [\037comment\037]\n"
+				" \n"
+				"where ! is one of the following characters: %s"), fantasycharacters.c_str());
+		return true;
+	}
+};
+
+class DSDeck : public DiceServModule
+{
+	DSDeckCommand deck_cmd;
+
+public:
+	DSDeck(const Anope::string &modname, const Anope::string &creator) : DiceServModule(modname, creator), deck_cmd(this)
+	{
+		this->Require(DiceServ, "DiceServ");
+		this->Require(DiceServDataHandler, "DiceServ's data handler");
+	}
+};
+
+MODULE_INIT(DSDeck)
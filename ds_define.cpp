@@ -0,0 +1,356 @@
+/* ----------------------------------------------------------------------------
+ * Name    : ds_define.cpp
+ * Author  : Naram Qashat (CyberBotX)
+ * ----------------------------------------------------------------------------
+ * Description:
+ *
+ * The DEFINE command of DiceServ. See diceserv.cpp for more information about
+ * DiceServ, including version and license.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "diceserv.h"
+
+static DiceServServiceHandle<DiceServService> DiceServ("DiceServService", "DiceServ");
+static DiceServServiceHandle<DiceServDataHandlerService> DiceServDataHandler("DiceServDataHandlerService", "DiceServ");
+
+/** The most parameters a single function can have */
+static const unsigned DEFINE_MAX_PARAMS = 8;
+
+struct DiceServFunction;
+
+/** The functions that have been defined, keyed by their lowercased names */
+static std::map<Anope::string, DiceServFunction *> Functions;
+
+/** A function defined with DEFINE, stored in the database. */
+struct DiceServFunction : Serializable
+{
+	Anope::string name, params, body;
+
+	DiceServFunction(const Anope::string &n, const Anope::string &p, const Anope::string &b) : Serializable("DiceServFunction"), name(n), params(p),
+		body(b)
+	{
+		Functions[n] = this;
+	}
+
+	~DiceServFunction()
+	{
+		Functions.erase(this->name);
+		// Any function still defined is taken out of DiceServ, as happens when this module is unloaded
+		if (DiceServ)
+		{
+			DiceServData data;
+			DiceServ->UndefineFunction(data, this->name, false);
+		}
+	}
+
+	/** Get the names of the parameters of the function.
+	 * @return The names, in order
+	 */
+	std::vector<Anope::string> ParamList() const
+	{
+		std::vector<Anope::string> list;
+		spacesepstream(this->params).GetTokens(list);
+		return list;
+	}
+
+	void Serialize(Serialize::Data &data) const anope_override
+	{
+		data["name"] << this->name;
+		data["params"] << this->params;
+		data["body"] << this->body;
+	}
+
+	static Serializable *Unserialize(Serializable *obj, Serialize::Data &data);
+};
+
+Serializable *DiceServFunction::Unserialize(Serializable *obj, Serialize::Data &data)
+{
+	Anope::string name, params, body;
+	data["name"] >> name;
+	data["params"] >> params;
+	data["body"] >> body;
+
+	DiceServFunction *function;
+	DiceServData scratch;
+	if (obj)
+	{
+		function = anope_dynamic_static_cast<DiceServFunction *>(obj);
+		if (function->name != name)
+			DiceServ->UndefineFunction(scratch, function->name, false);
+		Functions.erase(function->name);
+		function->name = name;
+		function->params = params;
+		function->body = body;
+		Functions[name] = function;
+	}
+	else
+		function = new DiceServFunction(name, params, body);
+	// The functions it calls may not have been loaded yet, so it is kept even if it can't be compiled
+	DiceServ->DefineFunction(scratch, name, function->ParamList(), body, false);
+	return function;
+}
+
+/** Check if a function name is valid, only letters being allowed so that it can't be mistaken for anything else in dice.
+ * @param name The name to check
+ * @return true if the name is valid, false otherwise
+ */
+static bool IsValidFunctionName(const Anope::string &name)
+{
+	if (name.length() < 2 || name.length() > 32)
+		return false;
+	for (unsigned x = 0, len = name.length(); x < len; ++x)
+		if (!isalpha(static_cast<unsigned char>(name[x])))
+			return false;
+	return true;
+}
+
+/** Check if a parameter name is valid, it has to start with a letter and can only have letters, numbers and underscores, the same as a
+ * stat's name.
+ * @param name The name to check, without its $
+ * @return true if the name is valid, false otherwise
+ */
+static bool IsValidParamName(const Anope::string &name)
+{
+	if (name.empty() || name.length() > 32 || !isalpha(static_cast<unsigned char>(name[0])))
+		return false;
+	for (unsigned x = 1, len = name.length(); x < len; ++x)
+		if (!isalnum(static_cast<unsigned char>(name[x])) && name[x] != '_')
+			return false;
+	return true;
+}
+
+/** Split a function's name and parameters, given as name($a,$b).
+ * @param head The name and parameters
+ * @param name Reference to store the lowercased name in
+ * @param params The list to store the lowercased names of the parameters in, without their $
+ * @return true if the name and parameters are valid, false otherwise
+ */
+static bool ParseHead(const Anope::string &head, Anope::string &name, std::vector<Anope::string> &params)
+{
+	size_t paren = head.find('(');
+	if (paren == Anope::string::npos || head[head.length() - 1] != ')')
+		return false;
+	name = head.substr(0, paren).lower();
+	if (!IsValidFunctionName(name))
+		return false;
+	commasepstream sep(head.substr(paren + 1, head.length() - paren - 2));
+	Anope::string param;
+	while (sep.GetToken(param))
+	{
+		if (param[0] != '$' || !IsValidParamName(param.substr(1)))
+			return false;
+		param = param.substr(1).lower();
+		if (std::find(params.begin(), params.end(), param) != params.end())
+			return false;
+		params.push_back(param);
+	}
+	return !params.empty() && params.size() <= DEFINE_MAX_PARAMS;
+}
+
+/** DEFINE command
+ *
+ * Handles the functions that can be called in any dice, which are inlined into the dice that call them.
+ */
+class DSDefineCommand : public Command
+{
+	unsigned maxFunctions, maxLength;
+
+public:
+	DSDefineCommand(Module *creator) : Command(creator, "diceserv/define", 1, 3), maxFunctions(50), maxLength(200)
+	{
+		this->SetDesc(_("Sets, deletes or lists dice functions"));
+		this->SetSyntax(_("SET \037name\037(\037$param\037[,\037$param\037...]) \037dice\037"));
+		this->SetSyntax(_("DEL \037name\037"));
+		this->SetSyntax(_("LIST"));
+	}
+
+	void SetLimits(unsigned functions, unsigned length)
+	{
+		this->maxFunctions = functions;
+		this->maxLength = length;
+	}
+
+	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
+	{
+		const Anope::string &action = params[0].upper();
+
+		if (action == "LIST")
+		{
+			if (params.size() > 1)
+			{
+				this->OnSyntaxError(source, action);
+				return;
+			}
+			if (Functions.empty())
+			{
+				source.Reply(_("There are no functions."));
+				return;
+			}
+			source.Reply(_("Functions:"));
+			for (std::map<Anope::string, DiceServFunction *>::const_iterator it = Functions.begin(), it_end = Functions.end(); it != it_end; ++it)
+			{
+				std::vector<Anope::string> paramList = it->second->ParamList();
+				Anope::string head = it->first + "(";
+				for (unsigned x = 0, len = paramList.size(); x < len; ++x)
+					head += (x ? ",$" : "$") + paramList[x];
+				source.Reply("  %s) = %s", head.c_str(), it->second->body.c_str());
+			}
+			return;
+		}
+		if (action != "SET" && action != "DEL")
+		{
+			this->OnSyntaxError(source, "");
+			return;
+		}
+		if (params.size() != (action == "SET" ? 3u : 2u))
+		{
+			this->OnSyntaxError(source, action);
+			return;
+		}
+
+		// Functions can be called by anyone, so only Services operators can change them
+		if (!source.HasCommand("diceserv/define"))
+		{
+			source.Reply(ACCESS_DENIED);
+			return;
+		}
+		if (Anope::ReadOnly)
+		{
+			source.Reply(_("Sorry, dice function setting is temporarily disabled."));
+			return;
+		}
+
+		DiceServData data;
+		if (action == "DEL")
+		{
+			Anope::string name = params[1].lower();
+			std::map<Anope::string, DiceServFunction *>::iterator it = Functions.find(name);
+			if (it == Functions.end())
+			{
+				source.Reply(_("There is no function named \002%s\002."), name.c_str());
+				return;
+			}
+			if (!DiceServ->UndefineFunction(data, name, true))
+			{
+				DiceServDataHandler->HandleError(data, source);
+				return;
+			}
+			delete it->second;
+			source.Reply(_("The function \002%s\002 has been removed."), name.c_str());
+			return;
+		}
+
+		Anope::string name;
+		std::vector<Anope::string> paramList;
+		if (!ParseHead(params[1], name, paramList))
+		{
+			source.Reply(_("A function has to be given as its name followed by its parameters\n"
+				"in parentheses, such as adv($bonus). The name can only have\n"
+				"letters and has to be 2 to 32 characters long, and there can be\n"
+				"1 to %u parameters, each a $ followed by a name that starts with a\n"
+				"letter and only has letters, numbers and underscores."), DEFINE_MAX_PARAMS);
+			return;
+		}
+		const Anope::string &body = params[2];
+		if (body.length() > this->maxLength)
+		{
+			source.Reply(_("A function's dice can be at most %u characters long."), this->maxLength);
+			return;
+		}
+		std::map<Anope::string, DiceServFunction *>::iterator it = Functions.find(name);
+		if (it == Functions.end() && Functions.size() >= this->maxFunctions)
+		{
+			source.Reply(_("There are already the most functions there can be (%u)."), this->maxFunctions);
+			return;
+		}
+
+		// The dice are compiled right away, so a function that can't be compiled or that calls itself is never kept
+		data.diceStr = data.dicePart = body;
+		if (!DiceServ->DefineFunction(data, name, paramList, body, true))
+		{
+			DiceServDataHandler->HandleError(data, source);
+			return;
+		}
+		Anope::string paramStr;
+		for (unsigned x = 0, len = paramList.size(); x < len; ++x)
+			paramStr += (x ? " " : "") + paramList[x];
+		DiceServFunction *function;
+		if (it != Functions.end())
+		{
+			function = it->second;
+			function->params = paramStr;
+			function->body = body;
+		}
+		else
+			function = new DiceServFunction(name, paramStr, body);
+		function->QueueUpdate();
+		source.Reply(_("The function \002%s\002 has been set to %s."), params[1].c_str(), body.c_str());
+	}
+
+	bool OnHelp(CommandSource &source, const Anope::string &) anope_override
+	{
+		this->SendSyntax(source);
+		source.Reply(" ");
+		source.Reply(_("Handles dice functions, which can be called by name in any dice\n"
+			"in the same way as the built-in functions, such as adv(5). A\n"
+			"function's dice use its parameters with $\037param\037, and can call\n"
+			"other functions, but can't call themselves, either directly or\n"
+			"through other functions. Calling a function rolls its dice in\n"
+			"place, with each $\037param\037 being the result of that argument,\n"
+			"which is only rolled once. Anyone can list and call the\n"
+			"functions, but only Services operators can change them.\n"
+			" \n"
+			"SET adds a function or changes an existing one. The dice are\n"
+			"checked when the function is set, and can't have spaces in\n"
+			"them.\n"
+			" \n"
+			"DEL removes a function, as long as no other function calls it.\n"
+			" \n"
+			"LIST shows the functions.\n"
+			" \n"
+			"There can be up to %u functions, each at most %u characters\n"
+			"long. See \002%s%s HELP ROLL\002 for more information on dice\n"
+			"expressions."), this->maxFunctions, this->maxLength, Config->StrictPrivmsg.c_str(), source.service->nick.c_str());
+		source.Reply(" ");
+		source.Reply(_("Example:\n"
+			"  %s%s DEFINE SET adv($bonus) max(1d20,1d20)+$bonus\n"
+			"    Sets a function so that %s%s ROLL adv(5) rolls 1d20\n"
+			"    with advantage and adds 5."), Config->StrictPrivmsg.c_str(), source.service->nick.c_str(), Config->StrictPrivmsg.c_str(),
+			source.service->nick.c_str());
+		return true;
+	}
+};
+
+class DSDefine : public DiceServModule
+{
+	/** Deletes the functions when the module is unloaded. This has to happen after the type below is gone, so that the functions are only
+	 * taken out of memory and not out of the database.
+	 */
+	struct FunctionDeleter
+	{
+		~FunctionDeleter()
+		{
+			while (!Functions.empty())
+				delete Functions.begin()->second;
+		}
+	} function_deleter;
+	DSDefineCommand define_cmd;
+	Serialize::Type function_type;
+
+public:
+	DSDefine(const Anope::string &modname, const Anope::string &creator) : DiceServModule(modname, creator), function_deleter(), define_cmd(this),
+		function_type("DiceServFunction", DiceServFunction::Unserialize)
+	{
+		this->Require(DiceServ, "DiceServ");
+		this->Require(DiceServDataHandler, "DiceServ's data handler");
+	}
+
+	void OnReload(Configuration::Conf *conf) anope_override
+	{
+		Configuration::Block *block = conf->GetModule(this);
+		this->define_cmd.SetLimits(block->Get<unsigned>("maxfunctions", "50"), block->Get<unsigned>("maxlength", "200"));
+	}
+};
+
+MODULE_INIT(DSDefine)
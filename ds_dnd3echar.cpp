@@ -12,7 +12,7 @@
 #include <algorithm>
 #include "diceserv.h"
 
-static ServiceReference<DiceServDataHandlerService> DiceServDataHandler("DiceServDataHandlerService", "DiceServ");
+static DiceServServiceHandle<DiceServDataHandlerService> DiceServDataHandler("DiceServDataHandlerService", "DiceServ");
 
 /** DND3ECHAR command
  *
@@ -20,32 +20,6 @@ static ServiceReference<DiceServDataHandlerService> DiceServDataHandler("DiceSer
  */
 class DSDnD3eCharCommand : public Command
 {
-	/** Find the lowest result out of the 4 6-sided dice thrown for a Dungeons and Dragons 3rd Edition character.
-	 * @param result The set of results to access
-	 * @param min Reference to an integer storing the lowest result
-	 * @return The index of the lowest result
-	 */
-	static unsigned GetMinDnD(const DiceResult &result, unsigned &min)
-	{
-		std::vector<unsigned>::const_iterator begin = DiceServDataHandler->Results(result).begin(),
-			minElement = std::min_element(begin, DiceServDataHandler->Results(result).end());
-		min = *minElement;
-		return minElement - begin;
-	}
-
-	/** Remove the minimum value from a result's total.
-	 * @param data The data that contains the results to access
-	 */
-	static void DnDRollCorrect(DiceServData &data)
-	{
-		for (size_t i = 0; i < 6; ++i)
-		{
-			unsigned min;
-			GetMinDnD(*static_cast<const DiceResult *>(data.opResults[i][0]), min);
-			data.results[i] -= min;
-		}
-	}
-
 	/** Determine the modifier of a given value for Dungeons and Dragons 3rd Edition.
 	 * @param val The value to get the modifier of
 	 * @return The modifier of the value
@@ -87,7 +61,7 @@ public:
 	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
 	{
 		std::vector<Anope::string> newParams = params;
-		newParams.insert(newParams.begin() + (source.c ? 1 : 0), "6~4d6");
+		newParams.insert(newParams.begin() + (source.c ? 1 : 0), "6~4d6dl1");
 
 		DiceServData data;
 		data.isExtended = true;
@@ -111,8 +85,6 @@ public:
 				return;
 			}
 
-			DnDRollCorrect(data);
-
 			if (DnDmodadd(data) <= 0 || DnDmaxatt(data) <= 13)
 			{
 				source.Reply(DnDmodadd(data) <= 0 ? _("D&D 3e Character roll resulted in a character that had their\n"
@@ -126,19 +98,6 @@ public:
 
 		Anope::string output = DiceServDataHandler->GenerateLongExOutput(data);
 
-		size_t lastPos = 0;
-		for (unsigned i = 0; i < 6; ++i)
-		{
-			size_t diceResult = output.find("4d6=(", lastPos);
-
-			unsigned min, minPos = GetMinDnD(*static_cast<const DiceResult *>(data.opResults[i][0]), min);
-
-			output = output.substr(0, diceResult + 5 + 2 * minPos) + static_cast<char>(22) + output.substr(diceResult + 5 + 2 * minPos, 1) +
-				static_cast<char>(22) + output.substr(diceResult + 6 + 2 * minPos);
-
-			lastPos = diceResult + 5;
-		}
-
 		if (!DiceServDataHandler->CheckMessageLengthPostProcess(data, source, output))
 		{
 			DiceServDataHandler->HandleError(data, source);
@@ -152,9 +111,9 @@ public:
 		this->SendSyntax(source);
 		source.Reply(" ");
 		source.Reply(_("This command is performs the rolls needs to create a D&D 3e\n"
-			"character, which consists of 6 sets of 4d6, the lowest\n"
-			"result of each set being discarded. The discarded die will\n"
-			"be shown in reverse, so you can still see all 4 dice and\n"
+			"character, which consists of 6 sets of 4d6dl1 (4d6 with the\n"
+			"lowest result of each set being discarded). The discarded die\n"
+			"will be shown in reverse, so you can still see all 4 dice and\n"
 			"which was removed. The syntax for channel and comment is the\n"
 			"same as with the ROLL command (see \002%s%s HELP ROLL\002\n"
 			"for more information on how to use this and ROLL).\n"
@@ -169,24 +128,20 @@ public:
 				" \n"), fantasycharacters.c_str());
 		source.Reply(_("Example:\n"
 			"  %s%s DND3ECHAR\n"
-			"    {4d6=(\x16" "3\x16 5 5 6)}=16\n"
+			"    {4d6dl1=(\x16" "3\x16 5 5 6)}=16\n"
 			"  (The above is basically 19 minus the lowest of 3)"), Config->StrictPrivmsg.c_str(), source.service->nick.c_str());
 		return true;
 	}
 };
 
-class DSDnD3eChar : public Module
+class DSDnD3eChar : public DiceServModule
 {
 	DSDnD3eCharCommand cmd;
 
 public:
-	DSDnD3eChar(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, THIRD), cmd(this)
+	DSDnD3eChar(const Anope::string &modname, const Anope::string &creator) : DiceServModule(modname, creator), cmd(this)
 	{
-		this->SetAuthor(DiceServService::Author());
-		this->SetVersion(DiceServService::Version());
-
-		if (!DiceServDataHandler)
-			throw ModuleException("No interface for DiceServ's data handler");
+		this->Require(DiceServDataHandler, "DiceServ's data handler");
 	}
 };
 
@@ -11,7 +11,7 @@
 
 #include "diceserv.h"
 
-static ServiceReference<DiceServDataHandlerService> DiceServDataHandler("DiceServDataHandlerService", "DiceServ");
+static DiceServServiceHandle<DiceServDataHandlerService> DiceServDataHandler("DiceServDataHandlerService", "DiceServ");
 
 /* Step table for the pen & paper RPG Earthdawn 1st Edition / Classic Edition / 2nd Edition
  * Retrieved from http://arkanabar.tripod.com/steps.html
@@ -45,26 +45,26 @@ step	dice		step	dice				step	dice				step	dice
 static Anope::string EarthdawnStepTable[] =
 {
 	"", /* 0, not used */
-	"1d4-2", "1d4-1", "1d4", "1d6", "1d8", /* 1-5 */
-	"1d10", "1d12", "2d6", "1d8+1d6", "1d10+1d6", /* 6-10 */
-	"1d10+1d8", "2d10", "1d12+1d10", "1d20+1d4", "1d20+1d6", /* 11-15 */
-	"1d20+1d8", "1d20+1d10", "1d20+1d12", "1d20+2d6", "1d20+1d8+1d6", /* 16-20 */
-	"1d20+1d10+1d6", "1d20+1d10+1d8", "1d20+2d10", "1d20+1d12+1d10", "1d20+1d10+1d8+1d4", /* 21-25 */
-	"1d20+1d10+1d8+1d6", "1d20+1d10+2d8", "1d20+2d10+1d8", "1d20+1d12+1d10+1d8", "1d20+1d10+1d8+2d6", /* 26-30 */
-	"1d20+1d10+2d8+1d6", "1d20+2d10+1d8+1d6", "1d20+2d10+2d8", "1d20+3d10+1d8", "1d20+1d12+2d10+1d8", /* 31-35 */
-	"2d20+1d10+1d8+1d4", "2d20+1d10+1d8+1d6", "2d20+1d10+2d8", "2d20+2d10+1d8", "2d20+1d12+1d10+1d8", /* 36-40 */
-	"2d20+1d10+1d8+2d6", "2d20+1d10+2d8+1d6", "2d20+2d10+1d8+1d6", "2d20+2d10+2d8", "2d20+3d10+1d8", /* 41-45 */
-	"2d20+1d12+2d10+1d8", "2d20+2d10+2d8+1d4", "2d20+2d10+2d8+1d6", "2d20+2d10+3d8", "2d20+3d10+2d8", /* 46-50 */
-	"2d20+1d12+2d10+2d8", "2d20+2d10+2d8+2d6", "2d20+2d10+3d8+1d6", "2d20+3d10+2d8+1d6", "2d20+3d10+3d8", /* 51-55 */
-	"2d20+4d10+2d8", "2d20+1d12+3d10+2d8", "3d20+2d10+2d8+1d4", "3d20+2d10+2d8+1d6", "3d20+2d10+3d8", /* 56-60 */
-	"3d20+3d10+2d8", "3d20+1d12+2d10+2d8", "3d20+2d10+2d8+2d6", "3d20+2d10+3d8+1d6", "3d20+3d10+2d8+1d6", /* 61-65 */
-	"3d20+3d10+3d8", "3d20+4d10+2d8", "3d20+1d12+3d10+2d8", "3d20+3d10+3d8+1d4", "3d20+3d10+3d8+1d6", /* 66-70 */
-	"3d20+3d10+4d8", "3d20+4d10+3d8", "3d20+1d12+3d10+3d8", "3d20+3d10+3d8+2d6", "3d20+3d10+4d8+1d6", /* 71-75 */
-	"3d20+4d10+3d8+1d6", "3d20+4d10+4d8", "3d20+5d10+3d8", "3d20+1d12+4d10+3d8", "4d20+3d10+3d8+1d4", /* 76-80 */
-	"4d20+3d10+3d8+1d6", "4d20+3d10+4d8", "4d20+4d10+3d8", "4d20+1d12+3d10+3d8", "4d20+3d10+3d8+2d6", /* 81-85 */
-	"4d20+3d10+4d8+1d6", "4d20+4d10+3d8+1d6", "4d20+4d10+4d8", "4d20+5d10+3d8", "4d20+1d12+4d10+3d8", /* 86-90 */
-	"4d20+4d10+4d8+1d4", "4d20+4d10+4d8+1d6", "4d20+4d10+5d8", "4d20+5d10+4d8", "4d20+1d12+4d10+4d8", /* 91-95 */
-	"4d20+4d10+4d8+2d6", "4d20+4d10+5d8+1d6", "4d20+5d10+4d8+1d6", "4d20+5d10+5d8", "4d20+6d10+4d8"/* 96-100 */
+	"1d4!-2", "1d4!-1", "1d4!", "1d6!", "1d8!", /* 1-5 */
+	"1d10!", "1d12!", "2d6!", "1d8!+1d6!", "1d10!+1d6!", /* 6-10 */
+	"1d10!+1d8!", "2d10!", "1d12!+1d10!", "1d20!+1d4!", "1d20!+1d6!", /* 11-15 */
+	"1d20!+1d8!", "1d20!+1d10!", "1d20!+1d12!", "1d20!+2d6!", "1d20!+1d8!+1d6!", /* 16-20 */
+	"1d20!+1d10!+1d6!", "1d20!+1d10!+1d8!", "1d20!+2d10!", "1d20!+1d12!+1d10!", "1d20!+1d10!+1d8!+1d4!", /* 21-25 */
+	"1d20!+1d10!+1d8!+1d6!", "1d20!+1d10!+2d8!", "1d20!+2d10!+1d8!", "1d20!+1d12!+1d10!+1d8!", "1d20!+1d10!+1d8!+2d6!", /* 26-30 */
+	"1d20!+1d10!+2d8!+1d6!", "1d20!+2d10!+1d8!+1d6!", "1d20!+2d10!+2d8!", "1d20!+3d10!+1d8!", "1d20!+1d12!+2d10!+1d8!", /* 31-35 */
+	"2d20!+1d10!+1d8!+1d4!", "2d20!+1d10!+1d8!+1d6!", "2d20!+1d10!+2d8!", "2d20!+2d10!+1d8!", "2d20!+1d12!+1d10!+1d8!", /* 36-40 */
+	"2d20!+1d10!+1d8!+2d6!", "2d20!+1d10!+2d8!+1d6!", "2d20!+2d10!+1d8!+1d6!", "2d20!+2d10!+2d8!", "2d20!+3d10!+1d8!", /* 41-45 */
+	"2d20!+1d12!+2d10!+1d8!", "2d20!+2d10!+2d8!+1d4!", "2d20!+2d10!+2d8!+1d6!", "2d20!+2d10!+3d8!", "2d20!+3d10!+2d8!", /* 46-50 */
+	"2d20!+1d12!+2d10!+2d8!", "2d20!+2d10!+2d8!+2d6!", "2d20!+2d10!+3d8!+1d6!", "2d20!+3d10!+2d8!+1d6!", "2d20!+3d10!+3d8!", /* 51-55 */
+	"2d20!+4d10!+2d8!", "2d20!+1d12!+3d10!+2d8!", "3d20!+2d10!+2d8!+1d4!", "3d20!+2d10!+2d8!+1d6!", "3d20!+2d10!+3d8!", /* 56-60 */
+	"3d20!+3d10!+2d8!", "3d20!+1d12!+2d10!+2d8!", "3d20!+2d10!+2d8!+2d6!", "3d20!+2d10!+3d8!+1d6!", "3d20!+3d10!+2d8!+1d6!", /* 61-65 */
+	"3d20!+3d10!+3d8!", "3d20!+4d10!+2d8!", "3d20!+1d12!+3d10!+2d8!", "3d20!+3d10!+3d8!+1d4!", "3d20!+3d10!+3d8!+1d6!", /* 66-70 */
+	"3d20!+3d10!+4d8!", "3d20!+4d10!+3d8!", "3d20!+1d12!+3d10!+3d8!", "3d20!+3d10!+3d8!+2d6!", "3d20!+3d10!+4d8!+1d6!", /* 71-75 */
+	"3d20!+4d10!+3d8!+1d6!", "3d20!+4d10!+4d8!", "3d20!+5d10!+3d8!", "3d20!+1d12!+4d10!+3d8!", "4d20!+3d10!+3d8!+1d4!", /* 76-80 */
+	"4d20!+3d10!+3d8!+1d6!", "4d20!+3d10!+4d8!", "4d20!+4d10!+3d8!", "4d20!+1d12!+3d10!+3d8!", "4d20!+3d10!+3d8!+2d6!", /* 81-85 */
+	"4d20!+3d10!+4d8!+1d6!", "4d20!+4d10!+3d8!+1d6!", "4d20!+4d10!+4d8!", "4d20!+5d10!+3d8!", "4d20!+1d12!+4d10!+3d8!", /* 86-90 */
+	"4d20!+4d10!+4d8!+1d4!", "4d20!+4d10!+4d8!+1d6!", "4d20!+4d10!+5d8!", "4d20!+5d10!+4d8!", "4d20!+1d12!+4d10!+4d8!", /* 91-95 */
+	"4d20!+4d10!+4d8!+2d6!", "4d20!+4d10!+5d8!+1d6!", "4d20!+5d10!+4d8!+1d6!", "4d20!+5d10!+5d8!", "4d20!+6d10!+4d8!"/* 96-100 */
 };
 
 /** EARTHDAWN command
@@ -154,64 +154,6 @@ public:
 		}
 		Anope::string output = DiceServDataHandler->GenerateLongExOutput(data);
 
-		size_t lastPos = 0;
-		for (size_t i = 0, len = data.opResults[0].size(); i < len; ++i)
-		{
-			const DiceResult *result = static_cast<const DiceResult *>(data.opResults[0][i]);
-			Anope::string diceStr = DiceServDataHandler->DiceString(*result);
-
-			size_t diceResult = output.find(diceStr + "=(", lastPos);
-
-			std::vector<unsigned>::const_iterator begin = DiceServDataHandler->Results(*result).begin(), end = DiceServDataHandler->Results(*result).end(),
-				found;
-			size_t tmpPos = diceResult + diceStr.length() + 2;
-			while ((found = std::find(begin, end, DiceServDataHandler->Sides(*result))) != end)
-			{
-				std::vector<unsigned> bonuses;
-
-				Anope::string sidesStr = stringify(DiceServDataHandler->Sides(*result));
-				size_t resultPos = output.find(sidesStr, tmpPos);
-
-				DiceResult *bonusResult = NULL;
-				do
-				{
-					if (bonusResult)
-						delete bonusResult;
-					bonusResult = DiceServDataHandler->Dice(data, 1, DiceServDataHandler->Sides(*result));
-					bonuses.push_back(DiceServDataHandler->Sum(*bonusResult));
-				} while (DiceServDataHandler->Sum(*bonusResult) == DiceServDataHandler->Sides(*result));
-				delete bonusResult;
-
-				std::ostringstream bonusStream;
-				bonusStream << "Bonus[";
-
-				bool first = true;
-				for (size_t j = 0, len2 = bonuses.size(); j < len2; ++j)
-				{
-					if (!first)
-						bonusStream << " ";
-					bonusStream << stringify(bonuses[j]);
-					data.results[0] += bonuses[j];
-					first = false;
-				}
-
-				bonusStream << "]";
-
-				Anope::string bonusStr = bonusStream.str();
-
-				output = output.substr(0, resultPos + sidesStr.length()) + " " + bonusStr + output.substr(resultPos + sidesStr.length());
-
-				tmpPos = resultPos + sidesStr.length() + bonusStr.length() + 2;
-
-				begin = found + 1;
-			}
-
-			lastPos = diceResult + diceStr.length() + 2;
-		}
-
-		size_t beforeResult = output.find("} "), afterResult = output.find(">", beforeResult);
-		output = output.substr(0, beforeResult + 2) + stringify(data.results[0]) + output.substr(afterResult);
-
 		if (!DiceServDataHandler->CheckMessageLengthPostProcess(data, source, output))
 		{
 			DiceServDataHandler->HandleError(data, source);
@@ -229,6 +171,8 @@ public:
 			"Earthdawn's rolling system works on the concept of a step\n"
 			"table, with different rolls depending on the given step.\n"
 			"Step must be an integer value and must be between 1 and 100.\n"
+			"Every die explodes, meaning that another die is rolled and\n"
+			"added whenever a die rolls its highest number.\n"
 			"Karma is an optional modifier, and if given, must come\n"
 			"right after the step and have a plus between step and karma.\n"
 			"The syntax for channel and comment is the same as with the\n"
@@ -248,27 +192,23 @@ public:
 				" \n"), fantasycharacters.c_str());
 		source.Reply(_("Examples:\n"
 			"  %s%s EARTHDAWN 5\n"
-			"    Same as %s%s EXROLL 1d8\n"
+			"    Same as %s%s EXROLL 1d8!\n"
 			"  %s%s EARTHDAWN 100+6\n"
-			"    Same as %s%s EXROLL (4d20+6d10+4d8)+6"), Config->StrictPrivmsg.c_str(), source.service->nick.c_str(), Config->StrictPrivmsg.c_str(),
+			"    Same as %s%s EXROLL (4d20!+6d10!+4d8!)+6"), Config->StrictPrivmsg.c_str(), source.service->nick.c_str(), Config->StrictPrivmsg.c_str(),
 			source.service->nick.c_str(), Config->StrictPrivmsg.c_str(), source.service->nick.c_str(), Config->StrictPrivmsg.c_str(),
 		source.service->nick.c_str());
 		return true;
 	}
 };
 
-class DSEarthdawn : public Module
+class DSEarthdawn : public DiceServModule
 {
 	DSEarthdawnCommand cmd;
 
 public:
-	DSEarthdawn(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, THIRD), cmd(this)
+	DSEarthdawn(const Anope::string &modname, const Anope::string &creator) : DiceServModule(modname, creator), cmd(this)
 	{
-		this->SetAuthor(DiceServService::Author());
-		this->SetVersion(DiceServService::Version());
-
-		if (!DiceServDataHandler)
-			throw ModuleException("No interface for DiceServ's data handler");
+		this->Require(DiceServDataHandler, "DiceServ's data handler");
 	}
 };
 
@@ -0,0 +1,407 @@
+/* ----------------------------------------------------------------------------
+ * Name    : ds_init.cpp
+ * Author  : Naram Qashat (CyberBotX)
+ * ----------------------------------------------------------------------------
+ * Description:
+ *
+ * The INIT command of DiceServ. See diceserv.cpp for more information about
+ * DiceServ, including version and license.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "diceserv.h"
+
+static DiceServServiceHandle<DiceServService> DiceServ("DiceServService", "DiceServ");
+static DiceServServiceHandle<DiceServDataHandlerService> DiceServDataHandler("DiceServDataHandlerService", "DiceServ");
+
+/** A character in a channel's initiative order. */
+struct InitEntry
+{
+	Anope::string name, dice;
+	double result;
+	/** Breaks ties between characters with the same result, chosen at random when the character's initiative is rolled */
+	double tiebreak;
+
+	InitEntry(const Anope::string &n, const Anope::string &d, double r, double t) : name(n), dice(d), result(r), tiebreak(t)
+	{
+	}
+
+	/** Characters are ordered from the highest result to the lowest, ties being broken by the tiebreaker and then by the name.
+	 */
+	bool operator<(const InitEntry &other) const
+	{
+		if (this->result != other.result)
+			return this->result > other.result;
+		if (this->tiebreak != other.tiebreak)
+			return this->tiebreak > other.tiebreak;
+		return this->name < other.name;
+	}
+};
+
+typedef std::set<InitEntry> InitList;
+
+/** A channel's initiative order.
+ *
+ * The characters are kept sorted in a balanced tree, so adding, re-rolling or removing a character only takes O(log n), along with an index
+ * of the characters by name. The character whose turn is next is kept as a position in the tree, which adding or removing other characters
+ * doesn't disturb.
+ */
+struct DiceServInitiative
+{
+	InitList order;
+	/** The characters in the order, keyed by their lowercased names */
+	std::map<Anope::string, InitList::iterator> byName;
+	/** The character whose turn is next, the end of the order if the next turn starts a new round */
+	InitList::iterator next;
+	unsigned round;
+
+	DiceServInitiative(Extensible *) : order(), byName(), next(order.end()), round(0)
+	{
+	}
+
+	/** Add a character to the order, replacing the character with the same name if there is one.
+	 * @param entry The character
+	 */
+	void Add(const InitEntry &entry)
+	{
+		this->Remove(entry.name);
+		this->byName[entry.name.lower()] = this->order.insert(entry).first;
+	}
+
+	/** Remove a character from the order.
+	 * @param name The name of the character
+	 * @return true if the character was in the order, false otherwise
+	 */
+	bool Remove(const Anope::string &name)
+	{
+		std::map<Anope::string, InitList::iterator>::iterator it = this->byName.find(name.lower());
+		if (it == this->byName.end())
+			return false;
+		// If the character was up next, the turn passes to the one after them
+		if (this->next == it->second)
+			++this->next;
+		this->order.erase(it->second);
+		this->byName.erase(it);
+		return true;
+	}
+
+	void Clear()
+	{
+		this->byName.clear();
+		this->order.clear();
+		this->next = this->order.end();
+		this->round = 0;
+	}
+};
+
+/** INIT command
+ *
+ * Handles a channel's initiative order, rolling the initiative of characters and keeping track of whose turn it is.
+ */
+class DSInitCommand : public Command
+{
+	ExtensibleItem<DiceServInitiative> inits;
+	unsigned maxEntries;
+
+	/** Roll the initiative of a group of characters that all use the same dice, with the dice only being parsed once for the whole group.
+	 * @param data The dice data, which will hold the error if there is one
+	 * @param dice The dice expression
+	 * @param count The number of characters
+	 * @param results The list to add the results to
+	 * @return true if the dice were rolled, false otherwise
+	 */
+	static bool RollGroup(DiceServData &data, const Anope::string &dice, int count, std::vector<double> &results)
+	{
+		data.diceStr = data.dicePart = dice;
+		DiceServDataHandler->Reset(data);
+		DiceServDataHandler->RollSets(data, count);
+		if (data.errCode != DICE_ERROR_NONE)
+			return false;
+		results.insert(results.end(), data.results.begin(), data.results.end());
+		return true;
+	}
+
+	/** Get the order of the characters, as much of it as fits.
+	 * @param init The initiative order
+	 * @param maxLength The longest the list can be
+	 * @return The list
+	 */
+	static Anope::string OrderList(const DiceServInitiative &init, int maxLength)
+	{
+		Anope::string list;
+		unsigned shown = 0;
+		for (InitList::const_iterator it = init.order.begin(), it_end = init.order.end(); it != it_end; ++it, ++shown)
+		{
+			Anope::string item = (it == init.next && init.round ? "\002" + it->name + "\002 " : it->name + " ") + stringify(it->result);
+			// Enough room has to be left to say how many weren't shown
+			if (static_cast<int>(list.length() + item.length()) + 20 > maxLength)
+				return list + " (and " + stringify(init.order.size() - shown) + " more)";
+			list += (list.empty() ? "" : ", ") + item;
+		}
+		return list.empty() ? "no one" : list;
+	}
+
+public:
+	DSInitCommand(Module *creator) : Command(creator, "diceserv/init", 1, 6), inits(creator, "diceserv_init"), maxEntries(100)
+	{
+		this->AllowUnregistered(true);
+		this->RequireUser(true);
+		this->SetDesc(_("Keeps track of a channel's initiative order"));
+		this->SetSyntax(_("ADD \037name\037 \037dice\037 [\037count\037] \037channel\037 [\037comment\037]"));
+		this->SetSyntax(_("ROLL \037channel\037 [\037comment\037]"));
+		this->SetSyntax(_("NEXT \037channel\037 [\037comment\037]"));
+		this->SetSyntax(_("REMOVE \037name\037 \037channel\037 [\037comment\037]"));
+		this->SetSyntax(_("LIST \037channel\037 [\037comment\037]"));
+		this->SetSyntax(_("CLEAR \037channel\037 [\037comment\037]"));
+	}
+
+	void SetMaxEntries(unsigned entries)
+	{
+		this->maxEntries = entries;
+	}
+
+	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
+	{
+		// Fantasy prepends the channel to the parameters, so everything is one further in
+		unsigned actionPos = source.c ? 1 : 0;
+		if (params.size() <= actionPos)
+		{
+			this->OnSyntaxError(source, "");
+			return;
+		}
+		Anope::string action = params[actionPos].upper();
+		unsigned args;
+		if (action == "ADD")
+			args = params.size() > actionPos + 3 && params[actionPos + 3].is_pos_number_only() ? 3 : 2;
+		else if (action == "REMOVE")
+			args = 1;
+		else if (action == "ROLL" || action == "NEXT" || action == "LIST" || action == "CLEAR")
+			args = 0;
+		else
+		{
+			this->OnSyntaxError(source, "");
+			return;
+		}
+		if (params.size() <= actionPos + args)
+		{
+			this->OnSyntaxError(source, "");
+			return;
+		}
+
+		// The arguments are taken out, leaving the channel and comment where PreParse expects them
+		std::vector<Anope::string> newParams(params.begin(), params.begin() + actionPos + 1);
+		for (size_t x = actionPos + 1 + args, len = params.size(); x < len; ++x)
+		{
+			if (newParams.size() < 3)
+				newParams.push_back(params[x]);
+			else
+				newParams.back() += " " + params[x];
+		}
+
+		DiceServData data;
+		data.rollPrefix = "Initiative";
+		if (!DiceServDataHandler->PreParse(data, source, newParams, 1))
+			return;
+		data.diceStr = action;
+		for (unsigned x = 1; x <= args; ++x)
+			data.diceStr += " " + params[actionPos + x];
+		// Initiative orders belong to channels, so there has to be a channel that the results can be sent to
+		Channel *c = data.chanStr.empty() ? NULL : Channel::Find(data.chanStr);
+		if (!c)
+		{
+			source.Reply(_("An initiative order can only be used in a channel that you are\nin, that %s isn't ignoring and that isn't moderated."),
+				source.service->nick.c_str());
+			return;
+		}
+		// Rolling everyone again or clearing the order throws away the whole order, so only channel operators can do that
+		if ((action == "ROLL" || action == "CLEAR") && !CanManageChannel(source, c))
+		{
+			source.Reply(ACCESS_DENIED);
+			return;
+		}
+		if (!DiceServDataHandler->CheckMessageLengthPreProcess(data, source))
+			return;
+		Anope::string display = data.diceStr;
+
+		std::ostringstream output;
+		output << "<" << data.rollPrefix << " [" << display << "]: ";
+		DiceServInitiative *init = this->inits.Get(c);
+		if (action == "ADD")
+		{
+			const Anope::string &name = params[actionPos + 1], &dice = params[actionPos + 2];
+			if (name.length() > 32 || name[0] == '#')
+			{
+				source.Reply(_("Names in an initiative order can be at most 32 characters\nlong and can't start with #."));
+				return;
+			}
+			int count = 1;
+			if (args == 3)
+			{
+				const Anope::string &countStr = params[actionPos + 3];
+				count = convertTo<int>(countStr, false);
+				if (countStr != stringify(count) || count < 1 || static_cast<unsigned>(count) > this->maxEntries)
+				{
+					source.Reply(_("The number of characters to add must be between 1 and %u."), this->maxEntries);
+					return;
+				}
+			}
+			if ((init ? init->order.size() : 0) + count > this->maxEntries)
+			{
+				source.Reply(_("An initiative order can have at most %u characters."), this->maxEntries);
+				return;
+			}
+			std::vector<double> results;
+			if (!RollGroup(data, dice, count, results))
+			{
+				DiceServDataHandler->HandleError(data, source);
+				return;
+			}
+			if (!init)
+				init = this->inits.Set(c);
+			// A group of characters is numbered, such as goblin1 to goblin40
+			for (int i = 0; i < count; ++i)
+				init->Add(InitEntry(count == 1 ? name : name + stringify(i + 1), dice, results[i], DiceServ->Random()));
+			if (count == 1)
+				output << name << " " << results[0];
+			else
+				output << count << " added, from " << *std::min_element(results.begin(), results.end()) << " to "
+					<< *std::max_element(results.begin(), results.end());
+		}
+		else if (!init || init->order.empty())
+		{
+			source.Reply(_("There is no one in the initiative order of \037%s\037, add\nsomeone with the ADD option first."), c->name.c_str());
+			return;
+		}
+		else if (action == "ROLL")
+		{
+			// Characters that use the same dice are rolled together, so each different expression is only parsed once
+			std::map<Anope::string, std::vector<InitList::const_iterator> > groups;
+			for (InitList::const_iterator it = init->order.begin(), it_end = init->order.end(); it != it_end; ++it)
+				groups[it->dice].push_back(it);
+			std::vector<InitEntry> rerolled;
+			for (std::map<Anope::string, std::vector<InitList::const_iterator> >::const_iterator it = groups.begin(), it_end = groups.end(); it != it_end;
+				++it)
+			{
+				std::vector<double> results;
+				if (!RollGroup(data, it->first, it->second.size(), results))
+				{
+					DiceServDataHandler->HandleError(data, source);
+					return;
+				}
+				for (size_t i = 0, len = results.size(); i < len; ++i)
+					rerolled.push_back(InitEntry(it->second[i]->name, it->first, results[i], DiceServ->Random()));
+			}
+			unsigned round = init->round;
+			init->Clear();
+			init->round = round;
+			for (size_t i = 0, len = rerolled.size(); i < len; ++i)
+				init->Add(rerolled[i]);
+			output << OrderList(*init, data.maxMessageLength - static_cast<int>(display.length()) - 20);
+		}
+		else if (action == "NEXT")
+		{
+			if (init->next == init->order.end())
+			{
+				init->next = init->order.begin();
+				++init->round;
+			}
+			output << "round " << init->round << ", " << init->next->name << " (" << init->next->result << ")";
+			++init->next;
+		}
+		else if (action == "REMOVE")
+		{
+			const Anope::string &name = params[actionPos + 1];
+			if (!init->Remove(name))
+			{
+				source.Reply(_("\002%s\002 isn't in the initiative order of \037%s\037."), name.c_str(), c->name.c_str());
+				return;
+			}
+			output << name << " removed";
+		}
+		else if (action == "LIST")
+		{
+			if (init->round)
+				output << "round " << init->round << ", ";
+			output << OrderList(*init, data.maxMessageLength - static_cast<int>(display.length()) - 30);
+		}
+		else
+		{
+			this->inits.Unset(c);
+			output << "cleared";
+		}
+		output << ">";
+		if (!data.commentStr.empty())
+			output << " " << data.commentStr;
+
+		data.diceStr = display;
+		if (!DiceServDataHandler->CheckMessageLengthPostProcess(data, source, output.str()))
+			return;
+		DiceServDataHandler->SendReply(data, source, output.str());
+	}
+
+	bool OnHelp(CommandSource &source, const Anope::string &) anope_override
+	{
+		this->SendSyntax(source);
+		source.Reply(" ");
+		source.Reply(_("Keeps track of the initiative order of a channel, which\n"
+			"anyone in the channel can use. The order lasts for as long as\n"
+			"the channel does. The results are always sent to the channel.\n"
+			" \n"
+			"ADD rolls the \037dice\037 for a character and adds them to the\n"
+			"order, replacing any character with the same name. If a\n"
+			"\037count\037 is given, that many characters are added, numbered\n"
+			"after the name (such as goblin1, goblin2 and so on).\n"
+			" \n"
+			"ROLL rolls the initiative of every character again.\n"
+			" \n"
+			"NEXT shows whose turn it is, starting a new round after the\n"
+			"last character in the order.\n"
+			" \n"
+			"REMOVE takes a character out of the order.\n"
+			" \n"
+			"LIST shows the order, with whoever's turn is next in bold.\n"
+			" \n"
+			"CLEAR takes everyone out of the order.\n"
+			" \n"
+			"Only channel operators can use ROLL and CLEAR.\n"
+			" \n"
+			"Ties are broken at random when initiative is rolled. An order\n"
+			"can have up to %u characters. See \002%s%s HELP ROLL\002\n"
+			"for more information on dice expressions."), this->maxEntries, Config->StrictPrivmsg.c_str(), source.service->nick.c_str());
+		source.Reply(" ");
+		source.Reply(_("Examples:\n"
+			"  %s%s INIT ADD goblin 1d20+2 40 #dnd\n"
+			"    Adds 40 goblins to the initiative order of #dnd.\n"
+			"  %s%s INIT NEXT #dnd\n"
+			"    Shows whose turn it is in #dnd."), Config->StrictPrivmsg.c_str(), source.service->nick.c_str(), Config->StrictPrivmsg.c_str(),
+			source.service->nick.c_str());
+		const Anope::string &fantasycharacters = Config->GetModule("fantasy")->Get<const Anope::string>("fantasycharacter", "!");
+		if (!fantasycharacters.empty())
+			source.Reply(_(" \n"
+				"Additionally, if fantasy is enabled, this command can be triggered by using:\n"
+				" \n"
+				"!init {ADD \037name\037 \037dice\037 [\037count\037]|ROLL|NEXT|REMOVE \037name\037|LIST|CLEAR} [\037comment\037]\n"
+				" \n"
+				"where ! is one of the following characters: %s"), fantasycharacters.c_str());
+		return true;
+	}
+};
+
+class DSInit : public DiceServModule
+{
+	DSInitCommand init_cmd;
+
+public:
+	DSInit(const Anope::string &modname, const Anope::string &creator) : DiceServModule(modname, creator), init_cmd(this)
+	{
+		this->Require(DiceServ, "DiceServ");
+		this->Require(DiceServDataHandler, "DiceServ's data handler");
+	}
+
+	void OnReload(Configuration::Conf *conf) anope_override
+	{
+		this->init_cmd.SetMaxEntries(conf->GetModule(this)->Get<unsigned>("maxentries", "100"));
+	}
+};
+
+MODULE_INIT(DSInit)
@@ -0,0 +1,253 @@
+/* ----------------------------------------------------------------------------
+ * Name    : ds_inline.cpp
+ * Author  : Naram Qashat (CyberBotX)
+ * ----------------------------------------------------------------------------
+ * Description:
+ *
+ * The SET INLINE command of DiceServ, along with the inline rolls it turns on
+ * for a channel. See diceserv.cpp for more information about DiceServ,
+ * including version and license.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "diceserv.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define DICESERV_INLINE_SSE2
+# include <emmintrin.h>
+# ifdef _MSC_VER
+#  include <intrin.h>
+# endif
+#endif
+
+static DiceServServiceHandle<DiceServDataHandlerService> DiceServDataHandler("DiceServDataHandlerService", "DiceServ");
+
+/** Find the first [[ in a message.
+ * @param msg The message
+ * @param start Where in the message to start looking
+ * @return Where the [[ is, or Anope::string::npos if there isn't one
+ *
+ * Almost no message has an inline roll in it, so this is all that most messages in a channel with inline rolls cost. Like memchr, 16
+ * characters are checked at a time with SSE2 where the compiler targets it, comparing each of them and the one after it against [ so that
+ * a lone [ doesn't stop the scan. Elsewhere, and for the last few characters, they are checked one at a time.
+ */
+static size_t FindInlineRoll(const Anope::string &msg, size_t start)
+{
+	const char *str = msg.c_str();
+	size_t i = start, len = msg.length();
+#ifdef DICESERV_INLINE_SSE2
+	const __m128i bracket = _mm_set1_epi8('[');
+	// The second load reads one character further, so it has to stay within the message as well
+	for (; i + 17 <= len; i += 16)
+	{
+		__m128i first = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(str + i)), bracket),
+			second = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(str + i + 1)), bracket);
+		unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(first, second)));
+		if (mask)
+		{
+#ifdef _MSC_VER
+			unsigned long bit;
+			_BitScanForward(&bit, mask);
+			return i + bit;
+#else
+			return i + __builtin_ctz(mask);
+#endif
+		}
+	}
+#endif
+	for (; i + 1 < len; ++i)
+		if (str[i] == '[' && str[i + 1] == '[')
+			return i;
+	return Anope::string::npos;
+}
+
+/** Determine if the text between [[ and ]] starts like dice, so that brackets used for something else, such as wiki links, are skipped
+ * before anything is done with them.
+ * @param dice The text, without spaces
+ * @return true if the text starts with a number, (, -, %, a macro, a stat, or a d followed by a number, % or custom faces, false otherwise
+ */
+static bool LooksLikeDice(const Anope::string &dice)
+{
+	char first = dice[0], second = dice.length() > 1 ? dice[1] : 0;
+	if ((first >= '0' && first <= '9') || first == '(' || first == '-' || first == '%' || first == '@' || first == '$')
+		return true;
+	return (first == 'd' || first == 'D') && ((second >= '0' && second <= '9') || second == '%' || second == '{');
+}
+
+/** SET INLINE command
+ *
+ * Turns inline rolls on or off for a channel.
+ */
+class DSSetInlineCommand : public Command
+{
+	SerializableExtensibleItem<bool> &inlineRolls;
+	unsigned maxRolls;
+
+public:
+	DSSetInlineCommand(Module *creator, SerializableExtensibleItem<bool> &item) : Command(creator, "diceserv/set/inline", 2, 2), inlineRolls(item), maxRolls(5)
+	{
+		this->SetDesc(_("Turn inline rolls on or off for a channel"));
+		this->SetSyntax(_("\037channel\037 {ON|OFF}"));
+	}
+
+	void SetMaxRolls(unsigned rolls)
+	{
+		this->maxRolls = rolls;
+	}
+
+	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
+	{
+		if (Anope::ReadOnly)
+		{
+			source.Reply(_("Sorry, dice inline option setting is temporarily disabled."));
+			return;
+		}
+		const Anope::string &chan = params[0], &param = params[1];
+		if (!param.equals_ci("ON") && !param.equals_ci("OFF"))
+		{
+			this->OnSyntaxError(source, "");
+			return;
+		}
+		// The setting is kept in the database and the messages are seen through the channel's BotServ bot, so the channel has to be registered
+		ChannelInfo *ci = ChannelInfo::Find(chan);
+		if (!ci)
+		{
+			source.Reply(CHAN_X_NOT_REGISTERED, chan.c_str());
+			return;
+		}
+		if (!source.HasCommand("diceserv/set") && !(ci->HasExt("SECUREFOUNDER") ? source.IsFounder(ci) : source.AccessFor(ci).HasPriv("FOUNDER")))
+		{
+			source.Reply(ACCESS_DENIED);
+			return;
+		}
+
+		if (param.equals_ci("ON"))
+		{
+			this->inlineRolls.Set(ci);
+			source.Reply(_("Dice given as [[\037dice\037]] in messages to \037%s\037 will now be rolled."), ci->name.c_str());
+		}
+		else
+		{
+			this->inlineRolls.Unset(ci);
+			source.Reply(_("Dice given as [[\037dice\037]] in messages to \037%s\037 will no longer be rolled."), ci->name.c_str());
+		}
+	}
+
+	bool OnHelp(CommandSource &source, const Anope::string &) anope_override
+	{
+		this->SendSyntax(source);
+		source.Reply(" ");
+		source.Reply(_("Turns inline rolls on or off for a channel. When they are on,\n"
+			"dice given as [[\037dice\037]] anywhere in a message to the channel\n"
+			"are rolled, and the channel's BotServ bot repeats the message\n"
+			"with the results in place of the dice. Up to %u dice can be\n"
+			"rolled in one message, and brackets that don't hold dice that\n"
+			"can be rolled are left as they are, without an error. Only\n"
+			"the channel's founder (or someone with founder-level access)\n"
+			"can use this option, and the channel must be registered and\n"
+			"have a BotServ bot assigned."), this->maxRolls);
+		source.Reply(" ");
+		source.Reply(_("Example:\n"
+			"  %s%s SET INLINE #dnd ON\n"
+			"    Afterwards, saying \"I hit for [[1d8+3]] damage\" in #dnd\n"
+			"    has the bot reply with the damage rolled."), Config->StrictPrivmsg.c_str(), source.service->nick.c_str());
+		return true;
+	}
+};
+
+class DSInline : public DiceServModule
+{
+	SerializableExtensibleItem<bool> inlineRolls;
+	DSSetInlineCommand set_inline_cmd;
+	unsigned maxRolls;
+
+public:
+	DSInline(const Anope::string &modname, const Anope::string &creator) : DiceServModule(modname, creator), inlineRolls(this, "diceserv_inline"),
+		set_inline_cmd(this, inlineRolls), maxRolls(5)
+	{
+		this->Require(DiceServDataHandler, "DiceServ's data handler");
+	}
+
+	void OnReload(Configuration::Conf *conf) anope_override
+	{
+		this->maxRolls = conf->GetModule(this)->Get<unsigned>("maxrolls", "5");
+		this->set_inline_cmd.SetMaxRolls(this->maxRolls);
+	}
+
+	void OnPrivmsg(User *u, Channel *c, Anope::string &msg) anope_override
+	{
+		// The scan comes first, the rest is only looked at for the rare message that has a [[ in it
+		size_t open = FindInlineRoll(msg, 0);
+		if (open == Anope::string::npos || !c->ci || !this->inlineRolls.HasExt(c->ci) || !c->ci->bi || !c->FindUser(c->ci->bi))
+			return;
+
+		Anope::string text = msg;
+		// An action is repeated without the CTCP around it, other CTCPs are left alone
+		if (text[0] == '\1')
+		{
+			if (text.find("\1ACTION ") != 0)
+				return;
+			text = text.substr(8);
+			if (!text.empty() && text[text.length() - 1] == '\1')
+				text.erase(text.end() - 1);
+			open = FindInlineRoll(text, 0);
+			if (open == Anope::string::npos)
+				return;
+		}
+
+		CommandSource source(u->nick, u, u->Account(), u, c->ci->bi);
+		source.c = c;
+		DiceServData data, roll;
+		Anope::string output = u->nick + ": " + text.substr(0, open);
+		size_t rest = 0;
+		bool rolled = false;
+		for (unsigned rolls = 0; open != Anope::string::npos && rolls < this->maxRolls; ++rolls)
+		{
+			size_t close = text.find("]]", open + 2);
+			if (close == Anope::string::npos)
+				break;
+			// The dice can end in a ] of their own, as in 3[1d6]
+			while (close + 2 < text.length() && text[close + 2] == ']')
+				++close;
+			Anope::string dice = text.substr(open + 2, close - open - 2).replace_all_cs(" ", "");
+			if (dice.empty())
+				break;
+
+			// Brackets that don't hold dice, or hold dice that can't be rolled, are left as they are without telling the user, as they
+			// are only part of what was said
+			bool rollable = LooksLikeDice(dice);
+			if (rollable)
+			{
+				roll = DiceServData();
+				roll.rollPrefix = "Roll";
+				std::vector<Anope::string> params;
+				params.push_back(c->name);
+				params.push_back(dice);
+				if (!DiceServDataHandler->PreParse(roll, source, params, 1) || !DiceServDataHandler->CheckMessageLengthPreProcess(roll, source))
+					return;
+				DiceServDataHandler->Roll(roll);
+				rollable = roll.errCode == DICE_ERROR_NONE;
+			}
+			if (rollable)
+			{
+				output += DiceServDataHandler->GenerateNoExOutput(roll);
+				data = roll;
+				rolled = true;
+			}
+			else
+				output += text.substr(open, close + 2 - open);
+
+			rest = close + 2;
+			open = FindInlineRoll(text, rest);
+			output += text.substr(rest, open == Anope::string::npos ? Anope::string::npos : open - rest);
+		}
+		if (!rolled)
+			return;
+		if (open != Anope::string::npos)
+			output += text.substr(open);
+		if (!DiceServDataHandler->CheckMessageLengthPostProcess(data, source, output))
+			return;
+		DiceServDataHandler->SendReply(data, source, output);
+	}
+};
+
+MODULE_INIT(DSInline)
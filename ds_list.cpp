@@ -11,7 +11,174 @@
 
 #include "diceserv.h"
 
-ServiceReference<DiceServService> DiceServ("DiceServService", "DiceServ");
+static DiceServServiceHandle<DiceServService> DiceServ("DiceServService", "DiceServ");
+
+/** A mask that has been compiled so that many names can be matched against it, with * matching any number of characters and ? matching any
+ * one character, without case sensitivity, the same as Anope::Match.
+ *
+ * The mask is split on * into pieces, where ? still matches any one character. The first and last pieces have to be at the start and end of
+ * the name, so they are checked first, and a name that is too short to hold all of the pieces is turned away without looking at it at all.
+ */
+class CompiledMask
+{
+	/** The pieces of the mask between the *s, in lowercase, the first and last being empty if the mask starts or ends with a * */
+	std::vector<Anope::string> pieces;
+	/** The length of all of the pieces together, which is the shortest a matching name can be */
+	size_t minLength;
+
+	/** Check if a piece of the mask matches a name at a position.
+	 * @param piece The piece of the mask
+	 * @param name The name
+	 * @param pos The position in the name, which must leave room for the piece
+	 * @return true if the piece matches, false otherwise
+	 */
+	static bool PieceAt(const Anope::string &piece, const Anope::string &name, size_t pos)
+	{
+		for (size_t i = 0, len = piece.length(); i < len; ++i)
+			if (piece[i] != '?' && piece[i] != static_cast<char>(Anope::tolower(name[pos + i])))
+				return false;
+		return true;
+	}
+
+public:
+	CompiledMask(const Anope::string &mask) : pieces(), minLength(0)
+	{
+		Anope::string piece;
+		for (size_t i = 0, len = mask.length(); i <= len; ++i)
+		{
+			if (i == len || mask[i] == '*')
+			{
+				this->pieces.push_back(piece);
+				this->minLength += piece.length();
+				piece.clear();
+			}
+			else
+				piece += static_cast<char>(Anope::tolower(mask[i]));
+		}
+	}
+
+	bool Matches(const Anope::string &name) const
+	{
+		size_t len = name.length();
+		if (len < this->minLength)
+			return false;
+		const Anope::string &prefix = this->pieces.front(), &suffix = this->pieces.back();
+		if (this->pieces.size() == 1)
+			return len == prefix.length() && PieceAt(prefix, name, 0);
+		if (!PieceAt(prefix, name, 0) || !PieceAt(suffix, name, len - suffix.length()))
+			return false;
+		size_t pos = prefix.length(), end = len - suffix.length();
+		for (size_t x = 1, count = this->pieces.size() - 1; x < count; ++x)
+		{
+			const Anope::string &piece = this->pieces[x];
+			// Taking the first place each piece fits leaves the most room for the pieces after it
+			while (pos + piece.length() <= end && !PieceAt(piece, name, pos))
+				++pos;
+			if (pos + piece.length() > end)
+				return false;
+			pos += piece.length();
+		}
+		return true;
+	}
+};
+
+/** The entries of a list, which shows the ones that match the mask, starting from the one given with FROM and going for as many as LIMIT
+ * allows. Matching stops once one more entry has been found after the last one shown, so that LIST can tell that there are more.
+ */
+class DSListEntries
+{
+	CommandSource &source;
+	CompiledMask mask;
+	unsigned from, limit;
+	/** true to show if an entry is registered, which is only done if both registered and unregistered entries are being shown */
+	bool showReg;
+	unsigned matched;
+
+public:
+	DSListEntries(CommandSource &s, const Anope::string &pattern, unsigned f, unsigned l, bool reg) : source(s), mask(pattern), from(f), limit(l),
+		showReg(reg), matched(0)
+	{
+	}
+
+	/** Show an entry of the list if it matches the mask and is within the entries to be shown.
+	 * @param name The name of the channel or nick
+	 * @param registered true if the channel or nick is registered, false otherwise
+	 * @param ignored true if the channel or nick is ignored, false otherwise
+	 */
+	void Add(const Anope::string &name, bool registered, bool ignored)
+	{
+		if (!this->mask.Matches(name) || ++this->matched < this->from || this->Done())
+			return;
+		if (this->showReg)
+			this->source.Reply("   %-20s  %-5s  %s", name.c_str(), registered ? _("Reg") : _("Unreg"), ignored ? _("Ignored") : _("Allowed"));
+		else
+			this->source.Reply("   %-20s  %s", name.c_str(), ignored ? _("Ignored") : _("Allowed"));
+	}
+
+	/** Check if an entry was found after the last one to be shown, in which case there is no need to look any further.
+	 * @return true if there are more entries than were shown, false otherwise
+	 */
+	bool Done() const
+	{
+		return this->matched >= this->from + this->limit;
+	}
+
+	/** Show the footer of the list.
+	 */
+	void Footer() const
+	{
+		if (this->Done())
+			this->source.Reply(_("End of list - matches %u to %u shown, use FROM %u to see more."), this->from, this->from + this->limit - 1,
+				this->from + this->limit);
+		else
+			this->source.Reply(_("End of list - %u/%u matches shown."), this->matched < this->from ? 0 : this->matched - this->from + 1, this->matched);
+	}
+};
+
+/** Orders ignored objects of one kind by the name that LIST shows them under, without case sensitivity */
+struct IgnoredNameLess
+{
+	DiceServIgnoreKind kind;
+
+	IgnoredNameLess(DiceServIgnoreKind k) : kind(k)
+	{
+	}
+
+	const Anope::string &Name(Extensible *obj) const
+	{
+		switch (this->kind)
+		{
+			case DICE_IGNORE_CHANNEL:
+				return anope_dynamic_static_cast<Channel *>(obj)->name;
+			case DICE_IGNORE_REGISTERED_CHANNEL:
+				return anope_dynamic_static_cast<ChannelInfo *>(obj)->name;
+			case DICE_IGNORE_USER:
+				return anope_dynamic_static_cast<User *>(obj)->nick;
+			default:
+				return anope_dynamic_static_cast<NickCore *>(obj)->display;
+		}
+	}
+
+	bool operator()(Extensible *obj1, Extensible *obj2) const
+	{
+		return ci::less()(this->Name(obj1), this->Name(obj2));
+	}
+};
+
+/** Get the ignored objects of one kind, sorted by name so that paging through them with FROM gives the same pages every time.
+ * @param kind The kind of objects to get
+ * @return The ignored objects
+ *
+ * DiceServ keeps each list in order of the objects' addresses, as nicks and account names can change while they are ignored, so the
+ * objects are sorted here instead. Only the ignored objects are sorted, never every channel or nick.
+ */
+static std::vector<Extensible *> SortedIgnored(DiceServIgnoreKind kind)
+{
+	const std::set<Extensible *> &ignored = DiceServ->GetIgnored(kind);
+	std::vector<Extensible *> sorted(ignored.begin(), ignored.end());
+	std::sort(sorted.begin(), sorted.end(), IgnoredNameLess(kind));
+	return sorted;
+}
 
 /** LIST command
  *
@@ -21,10 +188,10 @@ ServiceReference<DiceServService> DiceServ("DiceServService", "DiceServ");
 class DSListCommand : public Command
 {
 public:
-	DSListCommand(Module *creator) : Command(creator, "diceserv/list", 3, 4)
+	DSListCommand(Module *creator) : Command(creator, "diceserv/list", 3, 8)
 	{
 		this->SetDesc(Anope::printf(_("Gives list of %s access"), Config->GetClient("DiceServ")->nick.c_str()));
-		this->SetSyntax(_("{IGNORE|ALLOW|ALL} \037what\037 \037pattern\037 [{REG|UNREG}]"));
+		this->SetSyntax(_("{IGNORE|ALLOW|ALL} \037what\037 \037pattern\037 [{REG|UNREG}] [LIMIT \037count\037] [FROM \037number\037]"));
 	}
 
 	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
@@ -60,13 +227,30 @@ public:
 			REG_SHOW_REG,
 			REG_SHOW_UNREG
 		} reg = REG_SHOW_ALL;
-		// If the optional regtype argument is given, it must be one of the following, otherwise we stop processing
-		if (params.size() > 3)
+		unsigned from = 1, limit = 100;
+		// The optional arguments can be given in any order, but only one of REG or UNREG can be given, otherwise we stop processing
+		for (size_t x = 3, len = params.size(); x < len; ++x)
 		{
-			if (params[3].equals_ci("REG"))
+			if (reg == REG_SHOW_ALL && params[x].equals_ci("REG"))
 				reg = REG_SHOW_REG;
-			if (params[3].equals_ci("UNREG"))
+			else if (reg == REG_SHOW_ALL && params[x].equals_ci("UNREG"))
 				reg = REG_SHOW_UNREG;
+			else if ((params[x].equals_ci("LIMIT") || params[x].equals_ci("FROM")) && x + 1 < len && params[x + 1].is_pos_number_only() &&
+				params[x + 1].length() < 10)
+			{
+				unsigned value = convertTo<unsigned>(params[++x]);
+				if (params[x - 1].equals_ci("LIMIT"))
+				{
+					if (value < 1 || value > 100)
+					{
+						source.Reply(_("The limit must be between 1 and 100."));
+						return;
+					}
+					limit = value;
+				}
+				else if (value)
+					from = value;
+			}
 			else
 			{
 				this->OnSyntaxError(source, "");
@@ -77,118 +261,139 @@ public:
 		source.Reply(_("List of \037%s %s\037 entries matching \002%s\002%s:"),
 			show == SHOW_IGNORED ? _("ignored") : (show == SHOW_ALLOWED ? _("allowed") : _("all")), what.equals_ci("CHANNELS") ? _("channels") : _("nicks"),
 			pattern.c_str(), reg == REG_SHOW_ALL ? "" : (reg == REG_SHOW_REG ? _(" (registered only)") : _(" (unregistered only)")));
-		bool display;
-		int shown = 0;
+		/* Ignored entries are found from DiceServ's lists of what is ignored, so that only they have to be gone over. Allowed entries still
+		 * need every channel or nick to be gone over, but are told apart by looking them up in those lists. */
+		DSListEntries entries(source, pattern, from, limit, reg == REG_SHOW_ALL);
 		// If we are to show channels, we do so
 		if (what.equals_ci("CHANNELS"))
 		{
-			// If no regtype argument is given or we want to look only at unregistered channels, we process the channels list
+			const std::set<Extensible *> &ignoredChannels = DiceServ->GetIgnored(DICE_IGNORE_CHANNEL),
+				&ignoredRegistered = DiceServ->GetIgnored(DICE_IGNORE_REGISTERED_CHANNEL);
+			// If no regtype argument is given or we want to look only at unregistered channels, we process the unregistered channels
 			if (reg == REG_SHOW_UNREG || reg == REG_SHOW_ALL)
-				for (channel_map::const_iterator it = ChannelList.begin(), it_end = ChannelList.end(); it != it_end; ++it)
+			{
+				if (show == SHOW_IGNORED)
 				{
-					Channel *c = it->second;
-					// Skip the channel if it's registered
-					if (c->ci)
-						continue;
-					display = false;
-					// We will only show the channel if it was part of the ignore type request
-					bool diceserv_ignore = DiceServ->IsIgnored(c);
-					if (diceserv_ignore && (show == SHOW_IGNORED || show == SHOW_ALL))
-						display = true;
-					else if (!diceserv_ignore && (show == SHOW_ALLOWED || show == SHOW_ALL))
-						display = true;
-					// If we are to display the channel, make sure it matches the pattern first, and we haven't shown too many entries already
-					if (display && (pattern.equals_ci(c->name) || Anope::Match(c->name, pattern)) && ++shown <= 100)
+					std::vector<Extensible *> sorted = SortedIgnored(DICE_IGNORE_CHANNEL);
+					for (std::vector<Extensible *>::const_iterator it = sorted.begin(), it_end = sorted.end(); it != it_end && !entries.Done(); ++it)
 					{
-						if (reg == REG_SHOW_ALL)
-							source.Reply("   %-20s  %-5s  %s", c->name.c_str(), _("Unreg"), diceserv_ignore ? _("Ignored") : _("Allowed"));
-						else
-							source.Reply("   %-20s  %s", c->name.c_str(), diceserv_ignore ? _("Ignored") : _("Allowed"));
+						Channel *c = anope_dynamic_static_cast<Channel *>(*it);
+						// Skip the channel if it's registered
+						if (!c->ci)
+							entries.Add(c->name, false, true);
 					}
 				}
-			// If no regtype argument is given or we want to look only at registered channels, we process the ChanServ list
+				else
+					for (channel_map::const_iterator it = ChannelList.begin(), it_end = ChannelList.end(); it != it_end && !entries.Done(); ++it)
+					{
+						Channel *c = it->second;
+						// Skip the channel if it's registered
+						if (c->ci)
+							continue;
+						bool diceserv_ignore = ignoredChannels.count(c);
+						if (!diceserv_ignore || show == SHOW_ALL)
+							entries.Add(c->name, false, diceserv_ignore);
+					}
+			}
+			// If no regtype argument is given or we want to look only at registered channels, we process the registered channels
 			if (reg == REG_SHOW_REG || reg == REG_SHOW_ALL)
-				for (registered_channel_map::const_iterator it = RegisteredChannelList->begin(), it_end = RegisteredChannelList->end(); it != it_end; ++it)
+			{
+				if (show == SHOW_IGNORED)
 				{
-					ChannelInfo *ci = it->second;
-					// Skip the channel if it's suspended
-					if (ci->HasExt("SUSPENDED"))
-						continue;
-					display = false;
-					// We will only show the channel if it was part of the ignore type request
-					bool diceserv_ignore = DiceServ->IsIgnored(ci);
-					if (diceserv_ignore && (show == SHOW_IGNORED || show == SHOW_ALL))
-						display = true;
-					else if (!diceserv_ignore && (show == SHOW_ALLOWED || show == SHOW_ALL))
-						display = true;
-					// If we are to display the channel, make sure it matches the pattern first, and we haven't shown too many entries already
-					if (display && (pattern.equals_ci(ci->name) || Anope::Match(ci->name, pattern)) && ++shown <= 100)
+					std::vector<Extensible *> sorted = SortedIgnored(DICE_IGNORE_REGISTERED_CHANNEL);
+					for (std::vector<Extensible *>::const_iterator it = sorted.begin(), it_end = sorted.end(); it != it_end && !entries.Done(); ++it)
 					{
-						if (reg == REG_SHOW_ALL)
-							source.Reply("   %-20s  %-5s  %s", ci->name.c_str(), _("Reg"), diceserv_ignore ? _("Ignored") : _("Allowed"));
-						else
-							source.Reply("   %-20s  %s", ci->name.c_str(), diceserv_ignore ? _("Ignored") : _("Allowed"));
+						ChannelInfo *ci = anope_dynamic_static_cast<ChannelInfo *>(*it);
+						// Skip the channel if it's suspended
+						if (!ci->HasExt("SUSPENDED"))
+							entries.Add(ci->name, true, true);
 					}
 				}
+				else
+					for (registered_channel_map::const_iterator it = RegisteredChannelList->begin(), it_end = RegisteredChannelList->end();
+						it != it_end && !entries.Done(); ++it)
+					{
+						ChannelInfo *ci = it->second;
+						// Skip the channel if it's suspended
+						if (ci->HasExt("SUSPENDED"))
+							continue;
+						bool diceserv_ignore = ignoredRegistered.count(ci);
+						if (!diceserv_ignore || show == SHOW_ALL)
+							entries.Add(ci->name, true, diceserv_ignore);
+					}
+			}
 		}
 		// Otherwise, we are to show nicks
 		else
 		{
-			// If no regtype argument is given or we want to look only at unregistered nicks, we process the users list
+			const std::set<Extensible *> &ignoredUsers = DiceServ->GetIgnored(DICE_IGNORE_USER), &ignoredAccounts = DiceServ->GetIgnored(DICE_IGNORE_ACCOUNT);
+			// If no regtype argument is given or we want to look only at unregistered nicks, we process the users
 			if (reg == REG_SHOW_UNREG || reg == REG_SHOW_ALL)
-				for (Anope::hash_map<User *>::const_iterator it = UserListByNick.begin(), it_end = UserListByNick.end(); it != it_end; ++it)
+			{
+				if (show == SHOW_IGNORED)
 				{
-					// Check if the nick is a bot, and skip it if it is
-					BotInfo *bot = BotInfo::Find(it->second->nick);
-					if (bot)
-						continue;
-					User *nu = it->second;
-					// Skip the nick if it's registered
-					if (nu->Account())
-						continue;
-					display = false;
-					// We will only show the channel if it was part of the ignore type request
-					bool diceserv_ignore = DiceServ->IsIgnored(nu);
-					if (diceserv_ignore && (show == SHOW_IGNORED || show == SHOW_ALL))
-						display = true;
-					else if (!diceserv_ignore && (show == SHOW_ALLOWED || show == SHOW_ALL))
-						display = true;
-					// If we are to display the nick, make sure it matches the pattern first, and we haven't shown too many entries already
-					if (display && (pattern.equals_ci(nu->nick) || Anope::Match(nu->nick, pattern)) && ++shown <= 100)
+					std::vector<Extensible *> sorted = SortedIgnored(DICE_IGNORE_USER);
+					for (std::vector<Extensible *>::const_iterator it = sorted.begin(), it_end = sorted.end(); it != it_end && !entries.Done(); ++it)
 					{
-						if (reg == REG_SHOW_ALL)
-							source.Reply("   %-20s  %-5s  %s", nu->nick.c_str(), _("Unreg"), diceserv_ignore ? _("Ignored") : _("Allowed"));
-						else
-							source.Reply("   %-20s  %s", nu->nick.c_str(), diceserv_ignore ? _("Ignored") : _("Allowed"));
+						User *nu = anope_dynamic_static_cast<User *>(*it);
+						// Skip the nick if it's registered (bots can't be ignored, so they never need to be skipped here)
+						if (!nu->Account())
+							entries.Add(nu->nick, false, true);
 					}
 				}
-			// If no regtype argument is given or we want to look only at registered nicks, we process the NickServ list
+				else
+					for (Anope::hash_map<User *>::const_iterator it = UserListByNick.begin(), it_end = UserListByNick.end();
+						it != it_end && !entries.Done(); ++it)
+					{
+						User *nu = it->second;
+						// Skip the nick if it's registered or a bot
+						if (nu->Account() || BotInfo::Find(nu->nick))
+							continue;
+						bool diceserv_ignore = ignoredUsers.count(nu);
+						if (!diceserv_ignore || show == SHOW_ALL)
+							entries.Add(nu->nick, false, diceserv_ignore);
+					}
+			}
+			// If no regtype argument is given or we want to look only at registered nicks, we process the registered nicks
 			if (reg == REG_SHOW_REG || reg == REG_SHOW_ALL)
-				for (nickalias_map::const_iterator it = NickAliasList->begin(), it_end = NickAliasList->end(); it != it_end; ++it)
+			{
+				if (show == SHOW_IGNORED)
 				{
-					NickAlias *na = it->second;
-					// Skip the nick if it's suspended
-					if (na->nc && na->nc->HasExt("SUSPENDED"))
-						continue;
-					display = false;
-					// We will only show the channel if it was part of the ignore type request
-					bool diceserv_ignore = DiceServ->IsIgnored(na->nc);
-					if (diceserv_ignore && (show == SHOW_IGNORED || show == SHOW_ALL))
-						display = true;
-					else if (!diceserv_ignore && (show == SHOW_ALLOWED || show == SHOW_ALL))
-						display = true;
-					// If we are to display the nick, make sure it matches the pattern first, and we haven't shown too many entries already
-					if (display && (pattern.equals_ci(na->nick) || Anope::Match(na->nick, pattern, false)) && ++shown <= 100)
+					std::vector<Extensible *> sorted = SortedIgnored(DICE_IGNORE_ACCOUNT);
+					for (std::vector<Extensible *>::const_iterator it = sorted.begin(), it_end = sorted.end(); it != it_end && !entries.Done(); ++it)
 					{
-						if (reg == REG_SHOW_ALL)
-							source.Reply("   %-20s  %-5s  %s", na->nick.c_str(), _("Reg"), diceserv_ignore ? _("Ignored") : _("Allowed"));
-						else
-							source.Reply("   %-20s  %s", na->nick.c_str(), diceserv_ignore ? _("Ignored") : _("Allowed"));
+						NickCore *nc = anope_dynamic_static_cast<NickCore *>(*it);
+						// Skip the account if it's suspended, otherwise every nick of the account is ignored
+						if (nc->HasExt("SUSPENDED"))
+							continue;
+						for (std::vector<NickAlias *>::const_iterator alias = nc->aliases->begin(), alias_end = nc->aliases->end();
+							alias != alias_end && !entries.Done(); ++alias)
+							entries.Add((*alias)->nick, true, true);
 					}
 				}
+				else
+					for (nickalias_map::const_iterator it = NickAliasList->begin(), it_end = NickAliasList->end(); it != it_end && !entries.Done(); ++it)
+					{
+						NickAlias *na = it->second;
+						// Skip the nick if it's suspended
+						if (na->nc && na->nc->HasExt("SUSPENDED"))
+							continue;
+						bool diceserv_ignore = ignoredAccounts.count(na->nc);
+						if (!diceserv_ignore || show == SHOW_ALL)
+							entries.Add(na->nick, true, diceserv_ignore);
+					}
+			}
 		}
-		// Show the footer
-		source.Reply(_("End of list - %d/%d matches shown."), shown > 100 ? 100 : shown, shown);
+		// Show the footer, with the totals coming from the sizes of the lists instead of from going over them
+		entries.Footer();
+		if (what.equals_ci("CHANNELS"))
+			source.Reply(_("%u of %u channels in use and %u of %u registered channels are ignored."),
+				static_cast<unsigned>(DiceServ->GetIgnored(DICE_IGNORE_CHANNEL).size()), static_cast<unsigned>(ChannelList.size()),
+				static_cast<unsigned>(DiceServ->GetIgnored(DICE_IGNORE_REGISTERED_CHANNEL).size()), static_cast<unsigned>(RegisteredChannelList->size()));
+		else
+			source.Reply(_("%u of %u users online and %u of %u registered accounts are ignored."),
+				static_cast<unsigned>(DiceServ->GetIgnored(DICE_IGNORE_USER).size()), static_cast<unsigned>(UserListByNick.size()),
+				static_cast<unsigned>(DiceServ->GetIgnored(DICE_IGNORE_ACCOUNT).size()), static_cast<unsigned>(NickCoreList->size()));
 	}
 
 	bool OnHelp(CommandSource &source, const Anope::string &) anope_override
@@ -206,25 +411,28 @@ public:
 			" \n"
 			"\037pattern\037 is the mask you want to view.\n"
 			" \n"
-			"The final parameter is optional, if given, it will allow you\n"
-			"to choose if only registered or unregistered entries are\n"
-			"shown on the list."));
+			"REG or UNREG is optional, if given, it will allow you to\n"
+			"choose if only registered or unregistered entries are shown\n"
+			"on the list.\n"
+			" \n"
+			"Up to 100 entries are shown, or \037count\037 entries if LIMIT is\n"
+			"given. FROM starts the list at the entry \037number\037, so that\n"
+			"a long list can be gone through a page at a time, such as\n"
+			"with FROM 101 after the first 100 entries. Ignored entries\n"
+			"are listed in order of their names. Otherwise, the order of\n"
+			"the entries can change when channels or nicks come and go."));
 		return true;
 	}
 };
 
-class DSList : public Module
+class DSList : public DiceServModule
 {
 	DSListCommand cmd;
 
 public:
-	DSList(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, THIRD), cmd(this)
+	DSList(const Anope::string &modname, const Anope::string &creator) : DiceServModule(modname, creator), cmd(this)
 	{
-		this->SetAuthor(DiceServService::Author());
-		this->SetVersion(DiceServService::Version());
-
-		if (!DiceServ)
-			throw ModuleException("No interface for DiceServ");
+		this->Require(DiceServ, "DiceServ");
 	}
 };
 
@@ -0,0 +1,220 @@
+/* ----------------------------------------------------------------------------
+ * Name    : ds_macro.cpp
+ * Author  : Naram Qashat (CyberBotX)
+ * ----------------------------------------------------------------------------
+ * Description:
+ *
+ * The MACRO command of DiceServ. See diceserv.cpp for more information about
+ * DiceServ, including version and license.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "diceserv.h"
+
+static DiceServServiceHandle<DiceServService> DiceServ("DiceServService", "DiceServ");
+static DiceServServiceHandle<DiceServDataHandlerService> DiceServDataHandler("DiceServDataHandlerService", "DiceServ");
+
+/** Check if a macro name is valid, only letters, numbers, dashes and underscores being allowed.
+ * @param name The name to check
+ * @return true if the name is valid, false otherwise
+ */
+static bool IsValidMacroName(const Anope::string &name)
+{
+	if (name.empty() || name.length() > 32)
+		return false;
+	for (unsigned x = 0, len = name.length(); x < len; ++x)
+		if (!isalnum(static_cast<unsigned char>(name[x])) && name[x] != '-' && name[x] != '_')
+			return false;
+	return true;
+}
+
+/** MACRO command
+ *
+ * Handles the macros of an account or a channel, which are named dice expressions that can be rolled with @name.
+ */
+class DSMacroCommand : public Command
+{
+	unsigned maxMacros, maxLength;
+
+public:
+	DSMacroCommand(Module *creator) : Command(creator, "diceserv/macro", 1, 4), maxMacros(20), maxLength(100)
+	{
+		this->SetDesc(_("Sets, deletes or lists dice macros"));
+		this->SetSyntax(_("SET [\037channel\037] \037name\037 \037dice\037"));
+		this->SetSyntax(_("DEL [\037channel\037] \037name\037"));
+		this->SetSyntax(_("LIST [\037channel\037]"));
+	}
+
+	void SetLimits(unsigned macros, unsigned length)
+	{
+		this->maxMacros = macros;
+		this->maxLength = length;
+	}
+
+	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
+	{
+		const Anope::string &action = params[0].upper();
+		size_t pos = 1;
+		ChannelInfo *ci = NULL;
+		if (params.size() > 1 && params[1][0] == '#')
+		{
+			// Macros are kept in the database, so they can only be set on registered channels
+			ci = ChannelInfo::Find(params[1]);
+			if (!ci)
+			{
+				source.Reply(CHAN_X_NOT_REGISTERED, params[1].c_str());
+				return;
+			}
+			pos = 2;
+		}
+		NickCore *nc = source.GetAccount();
+		Extensible *owner = ci ? static_cast<Extensible *>(ci) : static_cast<Extensible *>(nc);
+		const Anope::string &ownerName = ci ? ci->name : nc->display;
+
+		if (action == "LIST")
+		{
+			if (params.size() > pos)
+			{
+				this->OnSyntaxError(source, action);
+				return;
+			}
+			std::map<Anope::string, Anope::string> macros;
+			DiceServ->GetMacros(owner, macros);
+			if (macros.empty())
+			{
+				source.Reply(_("\037%s\037 has no macros."), ownerName.c_str());
+				return;
+			}
+			source.Reply(_("Macros of \037%s\037:"), ownerName.c_str());
+			for (std::map<Anope::string, Anope::string>::const_iterator it = macros.begin(), it_end = macros.end(); it != it_end; ++it)
+				source.Reply("  @%s = %s", it->first.c_str(), it->second.c_str());
+			return;
+		}
+		if (action != "SET" && action != "DEL")
+		{
+			this->OnSyntaxError(source, "");
+			return;
+		}
+		if (params.size() < pos + (action == "SET" ? 2 : 1) || (action == "DEL" && params.size() > pos + 1))
+		{
+			this->OnSyntaxError(source, action);
+			return;
+		}
+
+		if (Anope::ReadOnly)
+		{
+			source.Reply(_("Sorry, dice macro setting is temporarily disabled."));
+			return;
+		}
+		if (ci && !source.HasCommand("diceserv/set") && !(ci->HasExt("SECUREFOUNDER") ? source.IsFounder(ci) : source.AccessFor(ci).HasPriv("FOUNDER")))
+		{
+			source.Reply(ACCESS_DENIED);
+			return;
+		}
+		Anope::string name = params[pos];
+		if (name[0] == '@')
+			name.erase(name.begin());
+		if (!IsValidMacroName(name))
+		{
+			source.Reply(_("Macro names can only have letters, numbers, dashes and\nunderscores, and can be at most 32 characters long."));
+			return;
+		}
+		name = name.lower();
+
+		if (action == "DEL")
+		{
+			if (DiceServ->DelMacro(owner, name))
+				source.Reply(_("The macro \002%s\002 has been removed from \037%s\037."), name.c_str(), ownerName.c_str());
+			else
+				source.Reply(_("\037%s\037 has no macro named \002%s\002."), ownerName.c_str(), name.c_str());
+			return;
+		}
+
+		Anope::string expr = params[pos + 1];
+		for (size_t x = pos + 2, len = params.size(); x < len; ++x)
+			expr += " " + params[x];
+		if (expr.find(' ') != Anope::string::npos || expr.find('@') != Anope::string::npos)
+		{
+			source.Reply(_("A macro's dice can't have spaces or other macros in them."));
+			return;
+		}
+		if (expr.length() > this->maxLength)
+		{
+			source.Reply(_("A macro's dice can be at most %u characters long."), this->maxLength);
+			return;
+		}
+		std::map<Anope::string, Anope::string> macros;
+		DiceServ->GetMacros(owner, macros);
+		if (!macros.count(name) && macros.size() >= this->maxMacros)
+		{
+			source.Reply(_("\037%s\037 already has the most macros it can have (%u)."), ownerName.c_str(), this->maxMacros);
+			return;
+		}
+
+		// The dice are parsed right away, so a macro that can't be rolled is never kept
+		DiceServData data;
+		data.diceStr = data.dicePart = expr;
+		if (!DiceServ->SetMacro(data, owner, name, expr))
+		{
+			DiceServDataHandler->HandleError(data, source);
+			return;
+		}
+		source.Reply(_("The macro \002%s\002 has been set on \037%s\037 to %s."), name.c_str(), ownerName.c_str(), expr.c_str());
+	}
+
+	bool OnHelp(CommandSource &source, const Anope::string &) anope_override
+	{
+		this->SendSyntax(source);
+		source.Reply(" ");
+		source.Reply(_("Handles dice macros, which are named dice expressions that\n"
+			"can be rolled by giving @\037name\037 in place of the dice, or\n"
+			"as part of other dice, with any command that rolls dice.\n"
+			"Without a \037channel\037, the macros are your own and follow your\n"
+			"account. With a \037channel\037, the macros can be used by anyone\n"
+			"rolling in that channel, but only the channel's founder (or\n"
+			"someone with founder-level access) can change them, and the\n"
+			"channel must be registered. Your own macros are used before\n"
+			"a channel's macros with the same name.\n"
+			" \n"
+			"SET adds a macro or changes an existing one. The dice are\n"
+			"checked when the macro is set, and can't have spaces or\n"
+			"other macros in them.\n"
+			" \n"
+			"DEL removes a macro.\n"
+			" \n"
+			"LIST shows the macros.\n"
+			" \n"
+			"Up to %u macros can be set on an account or a channel, each\n"
+			"at most %u characters long. See \002%s%s HELP ROLL\002 for more\n"
+			"information on dice expressions."), this->maxMacros, this->maxLength, Config->StrictPrivmsg.c_str(), source.service->nick.c_str());
+		source.Reply(" ");
+		source.Reply(_("Examples:\n"
+			"  %s%s MACRO SET attack 1d20+5\n"
+			"    Sets a macro for your account, so that %s%s ROLL @attack\n"
+			"    rolls 1d20+5.\n"
+			"  %s%s MACRO SET #dnd fireball 8d6\n"
+			"    Sets a macro that anyone can roll in #dnd."), Config->StrictPrivmsg.c_str(), source.service->nick.c_str(),
+			Config->StrictPrivmsg.c_str(), source.service->nick.c_str(), Config->StrictPrivmsg.c_str(), source.service->nick.c_str());
+		return true;
+	}
+};
+
+class DSMacro : public DiceServModule
+{
+	DSMacroCommand macro_cmd;
+
+public:
+	DSMacro(const Anope::string &modname, const Anope::string &creator) : DiceServModule(modname, creator), macro_cmd(this)
+	{
+		this->Require(DiceServ, "DiceServ");
+		this->Require(DiceServDataHandler, "DiceServ's data handler");
+	}
+
+	void OnReload(Configuration::Conf *conf) anope_override
+	{
+		Configuration::Block *block = conf->GetModule(this);
+		this->macro_cmd.SetLimits(block->Get<unsigned>("maxmacros", "20"), block->Get<unsigned>("maxlength", "100"));
+	}
+};
+
+MODULE_INIT(DSMacro)
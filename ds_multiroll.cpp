@@ -0,0 +1,235 @@
+/* ----------------------------------------------------------------------------
+ * Name    : ds_multiroll.cpp
+ * Author  : Naram Qashat (CyberBotX)
+ * ----------------------------------------------------------------------------
+ * Description:
+ *
+ * The MULTIROLL command of DiceServ. See diceserv.cpp for more information
+ * about DiceServ, including version and license.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "diceserv.h"
+
+static DiceServServiceHandle<DiceServDataHandlerService> DiceServDataHandler("DiceServDataHandlerService", "DiceServ");
+
+/** Check if a part of a list of dice is a binding, which is $name= followed by dice.
+ * @param part The part to check
+ * @return true if the part is a binding, false otherwise
+ */
+static bool IsBinding(const Anope::string &part)
+{
+	if (part.length() < 2 || part[0] != '$')
+		return false;
+	size_t x = 1, len = part.length();
+	while (x < len && (isalnum(static_cast<unsigned char>(part[x])) || part[x] == '_'))
+		++x;
+	// $name== is a comparison, not a binding
+	return x > 1 && x < len && part[x] == '=' && (x + 1 == len || part[x + 1] != '=');
+}
+
+/** Split a list of dice on ;, keeping any bindings together with the dice after them.
+ * @param list The list of dice
+ * @param exprs The list to add each of the dice to
+ *
+ * ; also ends a binding, as in $x=1d20;$x+$x, so a part that is a binding is joined to the part after it instead of being rolled on its own.
+ */
+static void SplitDiceList(const Anope::string &list, std::vector<Anope::string> &exprs)
+{
+	Anope::string bindings;
+	size_t start = 0;
+	while (start <= list.length())
+	{
+		size_t semicolon = list.find(';', start);
+		Anope::string part = list.substr(start, semicolon == Anope::string::npos ? Anope::string::npos : semicolon - start);
+		start = semicolon == Anope::string::npos ? list.length() + 1 : semicolon + 1;
+		if (part.empty())
+			continue;
+		if (IsBinding(part))
+			bindings += part + ";";
+		else
+		{
+			exprs.push_back(bindings + part);
+			bindings.clear();
+		}
+	}
+	// Bindings with nothing after them are left for the parser to complain about
+	if (!bindings.empty())
+		exprs.push_back(bindings);
+}
+
+/** MULTIROLL command
+ *
+ * Handles rolling a list of dice at once, with the results put together into as few lines as will fit.
+ */
+class DSMultirollCommand : public Command
+{
+	unsigned maxExpressions;
+
+public:
+	DSMultirollCommand(Module *creator) : Command(creator, "diceserv/multiroll", 1, 3), maxExpressions(10)
+	{
+		this->AllowUnregistered(true);
+		this->RequireUser(true);
+		this->SetDesc(_("Rolls a list of dice at once"));
+		this->SetSyntax(_("\037dice\037[;\037dice\037...] [[\037channel\037] \037comment\037]"));
+	}
+
+	void SetMaxExpressions(unsigned expressions)
+	{
+		this->maxExpressions = expressions;
+	}
+
+	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
+	{
+		// Fantasy prepends the channel to the parameters, so the dice are one further in
+		unsigned dicePos = source.c ? 1 : 0;
+		if (params.size() <= dicePos)
+		{
+			this->OnSyntaxError(source, "");
+			return;
+		}
+		std::vector<Anope::string> exprs;
+		SplitDiceList(params[dicePos], exprs);
+		if (exprs.empty())
+		{
+			this->OnSyntaxError(source, "");
+			return;
+		}
+		if (exprs.size() > this->maxExpressions)
+		{
+			source.Reply(_("You can only roll up to %u dice at once."), this->maxExpressions);
+			return;
+		}
+
+		/* The checks on the user and the channel are only done for the first dice, the rest of the dice are only split. The macros come from
+		 * the channel given even when the results can't be sent there, the same as with PreParse. */
+		std::vector<Anope::string> firstParams = params;
+		firstParams[dicePos] = exprs[0];
+		DiceServData first;
+		first.rollPrefix = "Multiroll";
+		if (!DiceServDataHandler->PreParse(first, source, firstParams, 1))
+			return;
+		Anope::string chan = source.c ? params[0] : (params.size() > 1 && params[1][0] == '#' ? params[1] : "");
+		ChannelInfo *macroChannel = chan.empty() ? NULL : ChannelInfo::Find(chan);
+		std::vector<DiceServData> datas(exprs.size(), first);
+		for (size_t i = 1, len = exprs.size(); i < len; ++i)
+		{
+			datas[i].diceStr = exprs[i];
+			if (!DiceServDataHandler->SplitDice(datas[i], source, macroChannel))
+				return;
+		}
+		if (!DiceServDataHandler->CheckMessageLengthPreProcess(first, source))
+			return;
+
+		// Identical dice are only parsed once, being rolled as that many sets, which also lets integer-only dice be evaluated side by side
+		std::map<Anope::string, std::vector<size_t> > same;
+		for (size_t i = 0, len = datas.size(); i < len; ++i)
+			same[datas[i].timesPart + "~" + datas[i].dicePart].push_back(i);
+		for (std::map<Anope::string, std::vector<size_t> >::const_iterator it = same.begin(), it_end = same.end(); it != it_end; ++it)
+		{
+			const std::vector<size_t> &indexes = it->second;
+			DiceServData &data = datas[indexes[0]];
+			// Dice with a number of times have to be rolled one at a time, since the number of times can be different for each
+			if (!data.timesPart.empty() || indexes.size() == 1)
+			{
+				for (size_t i = 0, len = indexes.size(); i < len; ++i)
+				{
+					DiceServDataHandler->Roll(datas[indexes[i]]);
+					if (datas[indexes[i]].errCode != DICE_ERROR_NONE)
+					{
+						DiceServDataHandler->HandleError(datas[indexes[i]], source);
+						return;
+					}
+				}
+				continue;
+			}
+			DiceServDataHandler->RollSets(data, indexes.size());
+			if (data.errCode != DICE_ERROR_NONE)
+			{
+				DiceServDataHandler->HandleError(data, source);
+				return;
+			}
+			std::vector<double> results;
+			results.swap(data.results);
+			for (size_t i = 0, len = indexes.size(); i < len; ++i)
+				datas[indexes[i]].results.push_back(results[i]);
+		}
+
+		/* The results are put into as few lines as will fit. Only the last line gets the comment, but each line leaves room for it, since
+		 * which line is the last one isn't known until all of the results have been put in. */
+		std::vector<Anope::string> lines(1);
+		int room = first.maxMessageLength - static_cast<int>(first.rollPrefix.length()) - 3;
+		if (!first.commentStr.empty())
+			room -= first.commentStr.length() + 1;
+		for (size_t i = 0, len = datas.size(); i < len; ++i)
+		{
+			Anope::string item = "[" + datas[i].diceStr + "]:";
+			for (size_t j = 0, count = datas[i].results.size(); j < count; ++j)
+				item += " " + stringify(datas[i].results[j]);
+			if (!lines.back().empty() && static_cast<int>(lines.back().length() + item.length()) + 2 >= room)
+				lines.push_back("");
+			lines.back() += (lines.back().empty() ? "" : ", ") + item;
+		}
+		for (size_t i = 0, len = lines.size(); i < len; ++i)
+		{
+			lines[i] = "<" + first.rollPrefix + " " + lines[i] + ">";
+			if (i == len - 1 && !first.commentStr.empty())
+				lines[i] += " " + first.commentStr;
+			if (!DiceServDataHandler->CheckMessageLengthPostProcess(first, source, lines[i]))
+				return;
+		}
+		for (size_t i = 0, len = lines.size(); i < len; ++i)
+			DiceServDataHandler->SendReply(first, source, lines[i]);
+	}
+
+	bool OnHelp(CommandSource &source, const Anope::string &) anope_override
+	{
+		this->SendSyntax(source);
+		source.Reply(" ");
+		source.Reply(_("Rolls a list of dice at once, with a ; between each of them.\n"
+			"This is the same as using ROLL on each of them, except that\n"
+			"the results are put together into as few lines as will fit,\n"
+			"such as:\n"
+			" \n"
+			"<Multiroll [\037dice\037]: \037result\037, [\037dice\037]: \037result\037>\n"
+			" \n"
+			"Up to %u dice can be given. Bindings (see \002%s%s HELP ROLL\002\n"
+			"\002EXPRESSIONS\002) also end in a ;, and are kept with the dice\n"
+			"after them. \037Channel\037 and \037comment\037 work the same as with ROLL."), this->maxExpressions, Config->StrictPrivmsg.c_str(),
+			source.service->nick.c_str());
+		const Anope::string &fantasycharacters = Config->GetModule("fantasy")->Get<const Anope::string>("fantasycharacter", "!");
+		if (!fantasycharacters.empty())
+		{
+			source.Reply(" ");
+			source.Reply(_("Additionally, if fantasy is enabled, this command can be triggered by using:\n"
+				" \n"
+				"!multiroll \037dice\037[;\037dice\037...] [\037comment\037]\n"
+				" \n"
+				"where ! is one of the following characters: %s"), fantasycharacters.c_str());
+		}
+		source.Reply(" ");
+		source.Reply(_("Example:\n"
+			"  %s%s MULTIROLL 1d20+5;2d6+3;1d8\n"
+			"    Rolls an attack and two kinds of damage at once."), Config->StrictPrivmsg.c_str(), source.service->nick.c_str());
+		return true;
+	}
+};
+
+class DSMultiroll : public DiceServModule
+{
+	DSMultirollCommand multiroll_cmd;
+
+public:
+	DSMultiroll(const Anope::string &modname, const Anope::string &creator) : DiceServModule(modname, creator), multiroll_cmd(this)
+	{
+		this->Require(DiceServDataHandler, "DiceServ's data handler");
+	}
+
+	void OnReload(Configuration::Conf *conf) anope_override
+	{
+		this->multiroll_cmd.SetMaxExpressions(conf->GetModule(this)->Get<unsigned>("maxexpressions", "10"));
+	}
+};
+
+MODULE_INIT(DSMultiroll)
@@ -0,0 +1,207 @@
+/* ----------------------------------------------------------------------------
+ * Name    : ds_odds.cpp
+ * Author  : Naram Qashat (CyberBotX)
+ * ----------------------------------------------------------------------------
+ * Description:
+ *
+ * The ODDS command of DiceServ. See diceserv.cpp for more information about
+ * DiceServ, including version and license.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "diceserv.h"
+
+static DiceServServiceHandle<DiceServDataHandlerService> DiceServDataHandler("DiceServDataHandlerService", "DiceServ");
+
+/** ODDS command
+ *
+ * Handles showing the odds of the results of a dice expression, optionally answering a question about them.
+ */
+class DSOddsCommand : public Command
+{
+	unsigned maxSamples, timeLimit;
+
+	/** Determine if a parameter is a query instead of a channel or comment.
+	 * @param param The parameter to check
+	 * @return true if the parameter starts with <, >, = or is a p followed by a number, false otherwise
+	 */
+	static bool IsQuery(const Anope::string &param)
+	{
+		if (param.empty())
+			return false;
+		if (param[0] == '<' || param[0] == '>' || param[0] == '=')
+			return true;
+		return param.length() > 1 && (param[0] == 'p' || param[0] == 'P') && param[1] >= '0' && param[1] <= '9';
+	}
+
+public:
+	DSOddsCommand(Module *creator) : Command(creator, "diceserv/odds", 1, 4), maxSamples(100000), timeLimit(100)
+	{
+		this->AllowUnregistered(true);
+		this->RequireUser(true);
+		this->SetDesc(_("Shows the odds of the results of dice"));
+		this->SetSyntax(_("\037dice\037 [\037query\037] [[\037channel\037] \037comment\037]"));
+	}
+
+	void SetLimits(unsigned samples, unsigned time)
+	{
+		this->maxSamples = samples;
+		this->timeLimit = time;
+	}
+
+	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
+	{
+		DiceServData data;
+		data.rollPrefix = "Odds";
+
+		// Fantasy prepends the channel to the parameters, so the query would be one further in
+		unsigned queryPos = source.c ? 2 : 1;
+		bool hasQuery = params.size() > queryPos && IsQuery(params[queryPos]);
+		if (!DiceServDataHandler->PreParse(data, source, params, hasQuery ? 2 : 1))
+			return;
+
+		if (!data.timesPart.empty())
+			data.diceSuffix = ", per set";
+
+		// Split the query into the comparison or percentile and its number
+		Anope::string queryOp, queryNum;
+		if (hasQuery)
+		{
+			size_t numStart = data.extraStr.find_first_not_of("<>=pP");
+			queryOp = data.extraStr.substr(0, numStart);
+			queryNum = numStart == Anope::string::npos ? "" : data.extraStr.substr(numStart);
+			if (queryOp.equals_ci("p"))
+			{
+				double percent = convertTo<double>(queryNum, false);
+				if (queryNum.empty() || queryNum[0] < '0' || queryNum[0] > '9' || percent < 0 || percent > 100)
+				{
+					source.Reply(_("The percentile for odds must be a number between 0 and 100."));
+					return;
+				}
+			}
+			else
+			{
+				int num = convertTo<int>(queryNum, false);
+				if (queryNum != stringify(num) || (queryOp != "<" && queryOp != "<=" && queryOp != ">" && queryOp != ">=" && queryOp != "="))
+				{
+					source.Reply(_("\037query\037 for odds must be one of <, <=, >, >= or = followed by a\nnumber, or p followed by a percentile."));
+					return;
+				}
+			}
+		}
+
+		if (!DiceServDataHandler->CheckMessageLengthPreProcess(data, source))
+			return;
+
+		// The ~ only repeats the same dice, so every set has the same odds as the dice on their own
+		DiceServDistribution dist(this->maxSamples, this->timeLimit);
+		DiceServDataHandler->Odds(data, dist);
+
+		if (data.errCode != DICE_ERROR_NONE)
+		{
+			DiceServDataHandler->HandleError(data, source);
+			return;
+		}
+		if (dist.pmf.empty())
+		{
+			source.Reply(_("The time limit for working out the odds ran out before any\nresults were rolled. Please try again with simpler dice."));
+			return;
+		}
+
+		std::ostringstream output;
+		output << "<" << data.rollPrefix << " [" << data.diceStr << data.diceSuffix << "]: range " << dist.Lowest() << ".." << dist.Highest() << std::fixed
+			<< std::setprecision(3) << ", mean " << dist.Mean() << ", stddev " << dist.StdDev() << ", median " << dist.Percentile(50);
+		if (hasQuery)
+		{
+			if (queryOp.equals_ci("p"))
+				output << ", percentile " << queryNum << " = " << dist.Percentile(convertTo<double>(queryNum, false));
+			else
+			{
+				int64_t num = convertTo<int>(queryNum);
+				double prob;
+				if (queryOp == "<")
+					prob = dist.AtMost(num - 1);
+				else if (queryOp == "<=")
+					prob = dist.AtMost(num);
+				else if (queryOp == ">")
+					prob = dist.AtLeast(num + 1);
+				else if (queryOp == ">=")
+					prob = dist.AtLeast(num);
+				else
+					prob = dist.Exactly(num);
+				output << ", P(" << queryOp << queryNum << ") = ";
+				// Very unlikely results would otherwise show up as 0%
+				if (prob && prob * 100 < 0.001)
+					output << std::scientific;
+				output << prob * 100 << "%";
+			}
+		}
+		if (dist.samples)
+			output << " (estimated from " << dist.samples << " rolls)";
+		output << ">";
+		if (!data.commentStr.empty())
+			output << " " << data.commentStr;
+
+		if (!DiceServDataHandler->CheckMessageLengthPostProcess(data, source, output.str()))
+			return;
+		DiceServDataHandler->SendReply(data, source, output.str());
+	}
+
+	bool OnHelp(CommandSource &source, const Anope::string &) anope_override
+	{
+		this->SendSyntax(source);
+		source.Reply(" ");
+		source.Reply(_("Works out the odds of the results of the given dice\n"
+			"expression without rolling it, showing the range of results,\n"
+			"the mean, the standard deviation and the median. See\n"
+			"\002%s%s HELP ROLL\002 for more information on dice\n"
+			"expressions. If the expression contains a number of times\n"
+			"(with ~), the odds are for each set on its own."), Config->StrictPrivmsg.c_str(), source.service->nick.c_str());
+		source.Reply(" ");
+		source.Reply(_("If a \037query\037 is given, its answer is also shown. It can\n"
+			"be one of:\n"
+			" \n"
+			"    >=\037n\037, >\037n\037, <=\037n\037, <\037n\037, =\037n\037   The chance of a result compared to \037n\037\n"
+			"    p\037n\037                   The result at the \037n\037th percentile"));
+		source.Reply(" ");
+		source.Reply(_("The odds are exact for integers with +, -, *, %%, dice and the\n"
+			"abs, ceil, floor, max, min, round and trunc functions.\n"
+			"Anything else (such as division) is estimated by rolling the\n"
+			"dice up to %u times."), this->maxSamples);
+		source.Reply(" ");
+		source.Reply(_("Examples:\n"
+			"  %s%s ODDS 3d6 >=15\n"
+			"    The chance of rolling 15 or higher on 3d6.\n"
+			"  %s%s ODDS 300d20 p90\n"
+			"    The result that 90%% of rolls of 300d20 are at or below."), Config->StrictPrivmsg.c_str(), source.service->nick.c_str(),
+			Config->StrictPrivmsg.c_str(), source.service->nick.c_str());
+		const Anope::string &fantasycharacters = Config->GetModule("fantasy")->Get<const Anope::string>("fantasycharacter", "!");
+		if (!fantasycharacters.empty())
+			source.Reply(_(" \n"
+				"Additionally, if fantasy is enabled, this command can be triggered by using:\n"
+				" \n"
+				"!odds \037dice\037 [\037query\037] [\037comment\037]\n"
+				" \n"
+				"where ! is one of the following characters: %s"), fantasycharacters.c_str());
+		return true;
+	}
+};
+
+class DSOdds : public DiceServModule
+{
+	DSOddsCommand odds_cmd;
+
+public:
+	DSOdds(const Anope::string &modname, const Anope::string &creator) : DiceServModule(modname, creator), odds_cmd(this)
+	{
+		this->Require(DiceServDataHandler, "DiceServ's data handler");
+	}
+
+	void OnReload(Configuration::Conf *conf) anope_override
+	{
+		Configuration::Block *block = conf->GetModule(this);
+		this->odds_cmd.SetLimits(block->Get<unsigned>("samples", "100000"), block->Get<unsigned>("timelimit", "100"));
+	}
+};
+
+MODULE_INIT(DSOdds)
@@ -11,25 +11,31 @@
 
 #include "diceserv.h"
 
-static ServiceReference<DiceServDataHandlerService> DiceServDataHandler("DiceServDataHandlerService", "DiceServ");
+static DiceServServiceHandle<DiceServDataHandlerService> DiceServDataHandler("DiceServDataHandlerService", "DiceServ");
 
 /** ROLL command
  *
  * Handles regular dice rolls.
  */
-class DSRollCommand : public Command
+class DSRollCommand : public DiceServRollCommandBase
 {
 public:
-	DSRollCommand(Module *creator) : Command(creator, "diceserv/roll", 1, 3)
+	DSRollCommand(Module *creator) : DiceServRollCommandBase(creator, "diceserv/roll")
 	{
-		this->AllowUnregistered(true);
-		this->RequireUser(true);
 		this->SetDesc(_("Rolls dice (or performs math too)"));
-		this->SetSyntax(_("\037dice\037 [[\037channel\037] \037comment\037]"));
 	}
 
 	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
 	{
+		std::vector<Anope::string> avgParams = params;
+		if (ExtractDiceMode(source, "AVG", avgParams, 3))
+		{
+			DiceServData data;
+			data.rollPrefix = "Roll average";
+			DiceServDataHandler->RollAverage(data, source, avgParams);
+			return;
+		}
+
 		DiceServData data;
 		data.rollPrefix = "Roll";
 
@@ -79,6 +85,11 @@ public:
 				"\037Comment\037 is also an optional argument. You do not need to\n"
 				"give a channel to use a comment. If given, this comment will\n"
 				"be added to the end of the result.\n"
+				" \n"
+				"If AVG is given before \037dice\037, the dice will not be rolled.\n"
+				"Instead, the mean and standard deviation of the results and\n"
+				"the range they can fall in will be worked out and shown. The\n"
+				"mean is of the results before they are rounded.\n"
 				" "));
 			const Anope::string &fantasycharacters = Config->GetModule("fantasy")->Get<const Anope::string>("fantasycharacter", "!");
 			if (!fantasycharacters.empty())
@@ -100,10 +111,12 @@ public:
 				"  Roll 3d6, double the result, then add 5:\n"
 				"    %s%s ROLL 3d6*2+5\n"
 				"  Roll 3d6 three consecutive times:\n"
-				"    %s%s ROLL 3~3d6"), Config->StrictPrivmsg.c_str(), source.service->nick.c_str(), Config->StrictPrivmsg.c_str(),
+				"    %s%s ROLL 3~3d6\n"
+				"  Show the average of 8d6+4d4+3:\n"
+				"    %s%s ROLL AVG 8d6+4d4+3"), Config->StrictPrivmsg.c_str(), source.service->nick.c_str(), Config->StrictPrivmsg.c_str(),
 				source.service->nick.c_str(), Config->StrictPrivmsg.c_str(), source.service->nick.c_str(), Config->StrictPrivmsg.c_str(),
 				source.service->nick.c_str(), Config->StrictPrivmsg.c_str(), source.service->nick.c_str(), Config->StrictPrivmsg.c_str(),
-				source.service->nick.c_str());
+				source.service->nick.c_str(), Config->StrictPrivmsg.c_str(), source.service->nick.c_str());
 		}
 		else if (subcommand.equals_ci("EXPRESSIONS"))
 			source.Reply(_("\002" "Dice expression syntax\002\n"
@@ -148,12 +161,75 @@ public:
 				"+ - * / ^ %% (in addition to 'd' for dice rolls and\n"
 				"parentheses to force order of operations.)\n"
 				" \n"
+				"Numbers can also be compared with < <= > >= == and != (= on\n"
+				"its own is the same as ==), which give 1 if the comparison\n"
+				"holds and 0 if it doesn't, and combined with && (and), || (or)\n"
+				"and ! (not), where anything but 0 counts as holding. These\n"
+				"come after the math operators, in that order. \037c\037?\037a\037:\037b\037 (or\n"
+				"if(\037c\037,\037a\037,\037b\037)) gives \037a\037 if \037c\037 isn't 0 and \037b\037 otherwise,\n"
+				"and the dice of the one that isn't used aren't rolled, the\n"
+				"same going for the right side of && and ||. For example,\n"
+				"(1d20+5)>=15?2d6:0 only rolls damage on a hit. < <= > and >=\n"
+				"right after dice count successes instead (see below), so use\n"
+				"parentheses to compare the total of the dice with them. ==\n"
+				"and != always compare the total, so 2d6=7 gives 1 if the two\n"
+				"dice add up to 7, while 2d6>3 counts the dice over 3.\n"
+				" \n"
 				"Also note that if you use decimals in your expressions, the\n"
 				"result will be returned in integer form, unless you use CALC\n"
 				"or EXCALC. An additional note, implicit multiplication with\n"
 				"parentheses (example: 2(3d6)) will function as it should (as\n"
 				"2*(3d6)).\n"
 				" \n"
+				"The following modifiers can be put right after dice, and more\n"
+				"than one can be given (they are applied in the order given):\n"
+				" \n"
+				"    kh\037n\037 or k\037n\037      Keep the highest \037n\037 dice\n"
+				"    kl\037n\037            Keep the lowest \037n\037 dice\n"
+				"    dh\037n\037            Drop the highest \037n\037 dice\n"
+				"    dl\037n\037            Drop the lowest \037n\037 dice\n"
+				"    r\037n\037             Reroll any die of \037n\037 or less\n"
+				"    !\037n\037             Roll another die for any die of \037n\037\n"
+				"                   or more (explode)\n"
+				" \n"
+				"\037n\037 defaults to 1 if left off, except for ! where it\n"
+				"defaults to the highest side of the die. For example, 4d6dl1\n"
+				"drops the lowest of 4d6 and 2d20kh keeps the highest of\n"
+				"2d20. Dice that don't count are shown in reverse by EXROLL.\n"
+				" \n"
+				"Dice can also count successes instead of being added up, by\n"
+				"putting >=\037n\037, >\037n\037, <=\037n\037 or <\037n\037 right after them (or\n"
+				"after their modifiers). Right after that, =\037n\037 makes a die of\n"
+				"\037n\037 count as two successes and -\037n\037 makes any die of \037n\037 or\n"
+				"less take away a success. For example, 12d10>=8=10-1 counts\n"
+				"the dice of 8 or more, with 10s counting twice and 1s taking\n"
+				"one away. Use parentheses to subtract from the successes, as\n"
+				"in (12d10>=8)-1. Successes are shown in bold by EXROLL.\n"
+				" \n"
+				"Dice can have custom faces by putting the value of each face\n"
+				"in braces after the d, with commas between them. For example,\n"
+				"4d{-1,0,0,1} rolls four dice with one -1, two 0s and one 1\n"
+				"each. The values can be negative, but modifiers can't be used\n"
+				"on dice with custom faces.\n"
+				" \n"
+				"A macro set with the MACRO command can be used by giving\n"
+				"@\037name\037, either as the whole dice or as part of them, such\n"
+				"as @attack+2.\n"
+				" \n"
+				"A stat set with the STAT command can be used like a number by\n"
+				"giving $\037name\037, such as 1d20+$str. Put a stat in parentheses\n"
+				"to use it as a number of dice, as in ($level)d6.\n"
+				" \n"
+				"The result of some dice can be used more than once by binding\n"
+				"it to a name first, with $\037name\037= and the dice followed by a ;\n"
+				"before the rest of the expression. For example, $a=1d6;$a*$a\n"
+				"rolls a single die and squares it. The bound dice are only\n"
+				"rolled and shown once, and each name can only be bound once.\n"
+				" \n"
+				"A function set with the DEFINE command can be called like the\n"
+				"built-in functions, such as adv(5). Its dice are rolled in\n"
+				"place of the call, with each argument rolled only once.\n"
+				" \n"
 				"In addition to the above math operators, certain functions\n"
 				"are also recognized. For a full list, see\n"
 				"\002%s%s HELP FUNCTIONS\002. The following math constants are\n"
@@ -264,19 +340,15 @@ public:
 	}
 };
 
-class DSRoll : public Module
+class DSRoll : public DiceServModule
 {
 	DSRollCommand roll_cmd;
 	DSExrollCommand exroll_cmd;
 
 public:
-	DSRoll(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, THIRD), roll_cmd(this), exroll_cmd(this)
+	DSRoll(const Anope::string &modname, const Anope::string &creator) : DiceServModule(modname, creator), roll_cmd(this), exroll_cmd(this)
 	{
-		this->SetAuthor(DiceServService::Author());
-		this->SetVersion(DiceServService::Version());
-
-		if (!DiceServDataHandler)
-			throw ModuleException("No interface for DiceServ's data handler");
+		this->Require(DiceServDataHandler, "DiceServ's data handler");
 	}
 };
 
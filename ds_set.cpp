@@ -11,7 +11,7 @@
 
 #include "diceserv.h"
 
-ServiceReference<DiceServService> DiceServ("DiceServService", "DiceServ");
+static DiceServServiceHandle<DiceServService> DiceServ("DiceServService", "DiceServ");
 
 /** SET command
  *
@@ -190,35 +190,14 @@ public:
 			// If the nick wasn't found and a NickServ entry wasn't found (or the nick is suspended), display an error
 			if (bot || (!nu && (!na || (na->nc && na->nc->HasExt("SUSPENDED")))))
 				source.Reply(_("Nick %s is not a valid nick."), where.c_str());
-			// If we found a registered nick, we will store the ignore there
+			// If we found a registered nick, we will store the ignore there, DiceServ also stores it on everyone logged into the account
 			else if (na)
 			{
-				// If a User record was not found, we will check all the users to find one that has a matching NickCore
-				if (!nu)
-				{
-					Anope::hash_map<User *>::const_iterator it = UserListByNick.begin(), it_end = UserListByNick.end();
-					for (; it != it_end; ++it)
-					{
-						nu = it->second;
-						if (nu->Account() == na->nc)
-							break;
-					}
-					if (it == it_end)
-						nu = NULL;
-				}
 				// Either add or delete the ignore data
 				if (mode == IGNORE_ADD)
-				{
 					DiceServ->Ignore(na->nc);
-					if (nu)
-						DiceServ->Ignore(nu);
-				}
 				else
-				{
 					DiceServ->Unignore(na->nc);
-					if (nu)
-						DiceServ->Unignore(nu);
-				}
 				source.Reply(mode == IGNORE_ADD ? _("\002%s\002 will now ignore all dice rolls by \037%s\037.") :
 					_("\002%s\002 will now allow all dice rolls by \037%s\037."), source.service->nick.c_str(), where.c_str());
 			}
@@ -227,7 +206,7 @@ public:
 			{
 				// Either add or delete the ignore data
 				if (mode == IGNORE_ADD)
-					nu->Extend("diceserv_ignore", 1);
+					DiceServ->Ignore(nu);
 				else
 					DiceServ->Unignore(nu);
 				source.Reply(mode == IGNORE_ADD ? _("\002%s\002 will now ignore all dice rolls by \037%s\037.") :
@@ -298,19 +277,15 @@ public:
 	}
 };
 
-class DSSet : public Module
+class DSSet : public DiceServModule
 {
 	DSSetCommand set_cmd;
 	DSSetIgnoreCommand set_ignore_cmd;
 
 public:
-	DSSet(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, THIRD), set_cmd(this), set_ignore_cmd(this)
+	DSSet(const Anope::string &modname, const Anope::string &creator) : DiceServModule(modname, creator), set_cmd(this), set_ignore_cmd(this)
 	{
-		this->SetAuthor(DiceServService::Author());
-		this->SetVersion(DiceServService::Version());
-
-		if (!DiceServ)
-			throw ModuleException("No interface for DiceServ");
+		this->Require(DiceServ, "DiceServ");
 	}
 
 	void OnReload(Configuration::Conf *conf) anope_override
@@ -0,0 +1,180 @@
+/* ----------------------------------------------------------------------------
+ * Name    : ds_stat.cpp
+ * Author  : Naram Qashat (CyberBotX)
+ * ----------------------------------------------------------------------------
+ * Description:
+ *
+ * The STAT command of DiceServ. See diceserv.cpp for more information about
+ * DiceServ, including version and license.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "diceserv.h"
+
+static DiceServServiceHandle<DiceServService> DiceServ("DiceServService", "DiceServ");
+
+/** Check if a stat name is valid, it has to start with a letter and can only have letters, numbers and underscores.
+ * @param name The name to check
+ * @return true if the name is valid, false otherwise
+ */
+static bool IsValidStatName(const Anope::string &name)
+{
+	if (name.empty() || name.length() > 32 || !isalpha(static_cast<unsigned char>(name[0])))
+		return false;
+	for (unsigned x = 1, len = name.length(); x < len; ++x)
+		if (!isalnum(static_cast<unsigned char>(name[x])) && name[x] != '_')
+			return false;
+	return true;
+}
+
+/** STAT command
+ *
+ * Handles the stats of an account, which are named numbers that can be used in dice with $name.
+ */
+class DSStatCommand : public Command
+{
+	unsigned maxStats;
+
+public:
+	DSStatCommand(Module *creator) : Command(creator, "diceserv/stat", 1, 3), maxStats(50)
+	{
+		this->SetDesc(_("Sets, deletes or lists your character's stats"));
+		this->SetSyntax(_("SET \037name\037 \037value\037"));
+		this->SetSyntax(_("DEL \037name\037"));
+		this->SetSyntax(_("LIST"));
+	}
+
+	void SetMaxStats(unsigned stats)
+	{
+		this->maxStats = stats;
+	}
+
+	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
+	{
+		const Anope::string &action = params[0].upper();
+		NickCore *nc = source.GetAccount();
+
+		if (action == "LIST")
+		{
+			if (params.size() > 1)
+			{
+				this->OnSyntaxError(source, action);
+				return;
+			}
+			std::map<Anope::string, int> stats;
+			DiceServ->GetStats(nc, stats);
+			if (stats.empty())
+			{
+				source.Reply(_("You have no stats."));
+				return;
+			}
+			source.Reply(_("Your stats:"));
+			for (std::map<Anope::string, int>::const_iterator it = stats.begin(), it_end = stats.end(); it != it_end; ++it)
+				source.Reply("  $%s = %d", it->first.c_str(), it->second);
+			return;
+		}
+		if (action != "SET" && action != "DEL")
+		{
+			this->OnSyntaxError(source, "");
+			return;
+		}
+		if (params.size() != (action == "SET" ? 3u : 2u))
+		{
+			this->OnSyntaxError(source, action);
+			return;
+		}
+
+		if (Anope::ReadOnly)
+		{
+			source.Reply(_("Sorry, dice stat setting is temporarily disabled."));
+			return;
+		}
+		Anope::string name = params[1];
+		if (name[0] == '$')
+			name.erase(name.begin());
+		if (!IsValidStatName(name))
+		{
+			source.Reply(_("Stat names have to start with a letter, can only have letters,\nnumbers and underscores, and can be at most 32 characters long."));
+			return;
+		}
+		name = name.lower();
+
+		if (action == "DEL")
+		{
+			if (DiceServ->DelStat(nc, name))
+				source.Reply(_("Your stat \002%s\002 has been removed."), name.c_str());
+			else
+				source.Reply(_("You have no stat named \002%s\002."), name.c_str());
+			return;
+		}
+
+		const Anope::string &valueStr = params[2];
+		int value = convertTo<int>(valueStr, false);
+		// Stats are whole numbers, so that dice using them can still be rolled with integers only
+		if (valueStr != stringify(value) || value < -99999 || value > 99999)
+		{
+			source.Reply(_("A stat has to be a whole number between -99999 and 99999."));
+			return;
+		}
+		std::map<Anope::string, int> stats;
+		DiceServ->GetStats(nc, stats);
+		if (!stats.count(name) && stats.size() >= this->maxStats)
+		{
+			source.Reply(_("You already have the most stats you can have (%u)."), this->maxStats);
+			return;
+		}
+		if (!DiceServ->SetStat(nc, name, value))
+		{
+			source.Reply(_("There are too many different stats in use for \002%s\002 to be\nadded, please use a stat name that is already in use."), name.c_str());
+			return;
+		}
+		source.Reply(_("Your stat \002%s\002 has been set to %d."), name.c_str(), value);
+	}
+
+	bool OnHelp(CommandSource &source, const Anope::string &) anope_override
+	{
+		this->SendSyntax(source);
+		source.Reply(" ");
+		source.Reply(_("Handles your character's stats, which are named whole numbers\n"
+			"kept on your account that can be used in dice by giving\n"
+			"$\037name\037, such as 1d20+$str+$prof. A stat is looked up each\n"
+			"time the dice are rolled, so changing a stat changes the\n"
+			"results of any macros that use it. A stat has to be set\n"
+			"before it can be used in a macro.\n"
+			" \n"
+			"SET adds a stat or changes an existing one. The value has to\n"
+			"be a whole number between -99999 and 99999.\n"
+			" \n"
+			"DEL removes a stat.\n"
+			" \n"
+			"LIST shows your stats.\n"
+			" \n"
+			"You can have up to %u stats. See \002%s%s HELP ROLL\002 for more\n"
+			"information on dice expressions."), this->maxStats, Config->StrictPrivmsg.c_str(), source.service->nick.c_str());
+		source.Reply(" ");
+		source.Reply(_("Example:\n"
+			"  %s%s STAT SET str 3\n"
+			"    Sets your str stat to 3, so that %s%s ROLL 1d20+$str\n"
+			"    rolls 1d20+3."), Config->StrictPrivmsg.c_str(), source.service->nick.c_str(), Config->StrictPrivmsg.c_str(),
+			source.service->nick.c_str());
+		return true;
+	}
+};
+
+class DSStat : public DiceServModule
+{
+	DSStatCommand stat_cmd;
+
+public:
+	DSStat(const Anope::string &modname, const Anope::string &creator) : DiceServModule(modname, creator), stat_cmd(this)
+	{
+		this->Require(DiceServ, "DiceServ");
+	}
+
+	void OnReload(Configuration::Conf *conf) anope_override
+	{
+		this->stat_cmd.SetMaxStats(conf->GetModule(this)->Get<unsigned>("maxstats", "50"));
+	}
+};
+
+MODULE_INIT(DSStat)
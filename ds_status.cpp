@@ -11,24 +11,23 @@
 
 #include "diceserv.h"
 
-ServiceReference<DiceServService> DiceServ("DiceServService", "DiceServ");
+static DiceServServiceHandle<DiceServService> DiceServ("DiceServService", "DiceServ");
 
 /** STATUS command
  *
- * This will allow Services Operators to view the ignore status of a single channel or a single nickname/user.
+ * This will allow Services Operators to view the ignore status of channels or nicknames/users, one or more at a time, or the statistics of
+ * the ignore checks made by rolls.
  */
 class DSStatusCommand : public Command
 {
-public:
-	DSStatusCommand(Module *creator) : Command(creator, "diceserv/status", 1, 1)
-	{
-		this->SetDesc(_("Shows allow status of channel or nick"));
-		this->SetSyntax(_("{\037channel\037|\037nick\037}"));
-	}
+	unsigned maxTargets;
 
-	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
+	/** Show the status of a single channel or nick.
+	 * @param source The source of the command
+	 * @param what The channel or nick to show the status of
+	 */
+	void ShowStatus(CommandSource &source, const Anope::string &what)
 	{
-		Anope::string what = params[0];
 		// If the argument starts with a #, assume it's a channel
 		if (what[0] == '#')
 		{
@@ -58,19 +57,9 @@ public:
 			// If we found a registered nick, show the data for that
 			else if (na)
 			{
-				// If a User record was not found, we will check all the users to find one that has a matching NickCore
-				if (!nu)
-				{
-					Anope::hash_map<User *>::const_iterator it = UserListByNick.begin(), it_end = UserListByNick.end();
-					for (; it != it_end; ++it)
-					{
-						nu = it->second;
-						if (nu->Account() == na->nc)
-							break;
-					}
-					if (it == it_end)
-						nu = NULL;
-				}
+				// If a User record was not found, the account's list of the users logged into it gives one from another nick in their group
+				if (!nu && !na->nc->users.empty())
+					nu = na->nc->users.front();
 				// If we have a User record, then the given nick is online from another nick in their group, show that
 				if (nu && nu->nick != na->nick)
 					source.Reply(_("Status for registered nick \037%s\037: %s\n  (online as \037%s\037)"), what.c_str(),
@@ -85,6 +74,54 @@ public:
 		}
 	}
 
+	/** Show how many ignore checks rolls have made, how many of them were skipped and about how much time that saved.
+	 * @param source The source of the command
+	 */
+	void ShowIgnoreChecks(CommandSource &source)
+	{
+		uint64_t checks, skipped;
+		double timeSaved;
+		DiceServ->GetIgnoreChecks(checks, skipped, timeSaved);
+		source.Reply(_("Rolls have checked for ignores %llu times, %llu (%u%%) of them without a lookup."), static_cast<unsigned long long>(checks),
+			static_cast<unsigned long long>(skipped), checks ? static_cast<unsigned>(skipped * 100 / checks) : 0);
+		if (timeSaved < 0)
+			source.Reply(_("No lookup has been timed yet, so the time saved can't be\nestimated."));
+		else
+			source.Reply(_("The skipped lookups saved about %.3f ms, going by the lookups that were timed."), timeSaved);
+	}
+
+public:
+	DSStatusCommand(Module *creator) : Command(creator, "diceserv/status", 0, 1), maxTargets(10)
+	{
+		this->SetDesc(_("Shows allow status of channels or nicks"));
+		this->SetSyntax(_("{\037channel\037|\037nick\037} [{\037channel\037|\037nick\037}...]"));
+		this->SetSyntax("");
+	}
+
+	void SetMaxTargets(unsigned targets)
+	{
+		this->maxTargets = targets;
+	}
+
+	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
+	{
+		std::vector<Anope::string> targets;
+		if (!params.empty())
+			spacesepstream(params[0]).GetTokens(targets);
+		if (targets.empty())
+		{
+			this->ShowIgnoreChecks(source);
+			return;
+		}
+		if (targets.size() > this->maxTargets)
+		{
+			source.Reply(_("You can only view the status of up to %u channels or nicks at once."), this->maxTargets);
+			return;
+		}
+		for (size_t i = 0, len = targets.size(); i < len; ++i)
+			this->ShowStatus(source, targets[i]);
+	}
+
 	bool OnHelp(CommandSource &source, const Anope::string &) anope_override
 	{
 		this->SendSyntax(source);
@@ -92,23 +129,35 @@ public:
 		source.Reply(_("This will give you the allowed or ignored status of a\n"
 			"channel or a nick, depending on which one you give. It will\n"
 			"also tell you if that status is on an online nick/channel,\n"
-			"or set in services due to the nick not being online."));
+			"or set in services due to the nick not being online.\n"
+			" \n"
+			"Up to %u channels and nicks can be given at once, separated\n"
+			"by spaces. To look for channels or nicks by a mask, use\n"
+			"\002%s%s HELP LIST\002.\n"
+			" \n"
+			"Without a channel or nick, this will tell you how many times\n"
+			"rolls have checked for ignores and how many of those checks\n"
+			"needed no lookup, because nothing of that kind was ignored,\n"
+			"along with about how much time that saved. The time is\n"
+			"estimated from timing a sample of the lookups that were\n"
+			"made, so it is only shown once something has been ignored."), this->maxTargets, Config->StrictPrivmsg.c_str(), source.service->nick.c_str());
 		return true;
 	}
 };
 
-class DSStatus : public Module
+class DSStatus : public DiceServModule
 {
 	DSStatusCommand cmd;
 
 public:
-	DSStatus(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, THIRD), cmd(this)
+	DSStatus(const Anope::string &modname, const Anope::string &creator) : DiceServModule(modname, creator), cmd(this)
 	{
-		this->SetAuthor(DiceServService::Author());
-		this->SetVersion(DiceServService::Version());
+		this->Require(DiceServ, "DiceServ");
+	}
 
-		if (!DiceServ)
-			throw ModuleException("No interface for DiceServ");
+	void OnReload(Configuration::Conf *conf) anope_override
+	{
+		this->cmd.SetMaxTargets(conf->GetModule(this)->Get<unsigned>("maxtargets", "10"));
 	}
 };
 
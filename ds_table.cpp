@@ -0,0 +1,571 @@
+/* ----------------------------------------------------------------------------
+ * Name    : ds_table.cpp
+ * Author  : Naram Qashat (CyberBotX)
+ * ----------------------------------------------------------------------------
+ * Description:
+ *
+ * The TABLE and SET TABLE commands of DiceServ. See diceserv.cpp for more
+ * information about DiceServ, including version and license.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "diceserv.h"
+
+static DiceServServiceHandle<DiceServService> DiceServ("DiceServService", "DiceServ");
+static DiceServServiceHandle<DiceServDataHandlerService> DiceServDataHandler("DiceServDataHandlerService", "DiceServ");
+
+/** The most times a single TABLE can draw from its table, the same as the most sets a dice roll can have */
+static const int TABLE_MAX_TIMES = 25;
+
+struct DiceServTable;
+
+/** The tables set on channels, keyed by TableKey */
+static std::map<Anope::string, DiceServTable *> ChannelTables;
+/** The entries of the tables from the configuration, keyed by TableKey with no channel */
+static std::map<Anope::string, Anope::string> ConfigTables;
+
+/** Get the key that a table is stored under.
+ * @param chan The channel the table is on, or an empty string for a table from the configuration
+ * @param name The name of the table
+ * @return The key
+ */
+static Anope::string TableKey(const Anope::string &chan, const Anope::string &name)
+{
+	return chan.lower() + " " + name.lower();
+}
+
+/** A table set on a channel by its founder, stored in the database. */
+struct DiceServTable : Serializable
+{
+	Anope::string chan, name, entries;
+
+	DiceServTable(const Anope::string &c, const Anope::string &n, const Anope::string &e) : Serializable("DiceServTable"), chan(c), name(n), entries(e)
+	{
+		ChannelTables[TableKey(c, n)] = this;
+	}
+
+	~DiceServTable()
+	{
+		ChannelTables.erase(TableKey(this->chan, this->name));
+	}
+
+	void Serialize(Serialize::Data &data) const anope_override
+	{
+		data["chan"] << this->chan;
+		data["name"] << this->name;
+		data["entries"] << this->entries;
+	}
+
+	static Serializable *Unserialize(Serializable *obj, Serialize::Data &data);
+};
+
+/** A table that is ready to be drawn from, with any references to other tables flattened into it. */
+struct CompiledTable
+{
+	/** The chance of each result, adding up to 1 */
+	std::vector<double> chances;
+	std::vector<Anope::string> results;
+	DiceServAliasTable alias;
+};
+
+/** The tables that have been compiled so far, keyed by TableKey. This is cleared whenever any table changes, as a table can refer to others. */
+static std::map<Anope::string, CompiledTable> CompiledTables;
+
+Serializable *DiceServTable::Unserialize(Serializable *obj, Serialize::Data &data)
+{
+	Anope::string chan, name, entries;
+	data["chan"] >> chan;
+	data["name"] >> name;
+	data["entries"] >> entries;
+
+	if (!ChannelInfo::Find(chan))
+		return NULL;
+
+	CompiledTables.clear();
+	if (obj)
+	{
+		DiceServTable *table = anope_dynamic_static_cast<DiceServTable *>(obj);
+		ChannelTables.erase(TableKey(table->chan, table->name));
+		table->chan = chan;
+		table->name = name;
+		table->entries = entries;
+		ChannelTables[TableKey(chan, name)] = table;
+		return table;
+	}
+	return new DiceServTable(chan, name, entries);
+}
+
+/** Check if a name can be used for a table.
+ * @param name The name to check
+ * @return true if the name only has letters, numbers, dashes and underscores and is at most 32 characters long, false otherwise
+ */
+static bool IsValidTableName(const Anope::string &name)
+{
+	if (name.empty() || name.length() > 32)
+		return false;
+	for (size_t x = 0, len = name.length(); x < len; ++x)
+		if (!isalnum(static_cast<unsigned char>(name[x])) && name[x] != '-' && name[x] != '_')
+			return false;
+	return true;
+}
+
+/** Split the entries of a table into their weights and results.
+ * @param entries The entries, separated by |, each optionally starting with its weight and a :
+ * @param parsed The list to store the weight and result of each entry in
+ * @return An empty string if the entries were valid, otherwise the reason they weren't
+ */
+static Anope::string ParseEntries(const Anope::string &entries, std::vector<std::pair<double, Anope::string> > &parsed)
+{
+	sepstream sep(entries, '|');
+	Anope::string entry;
+	while (sep.GetToken(entry))
+	{
+		entry.trim();
+		double weight = 1;
+		size_t colon = entry.find(':');
+		if (colon != Anope::string::npos && colon && entry.substr(0, colon).is_pos_number_only())
+		{
+			if (colon > 6)
+				return "weights must be at most 999999";
+			weight = convertTo<unsigned>(entry.substr(0, colon));
+			if (!weight)
+				return "weights must be above 0";
+			entry = entry.substr(colon + 1);
+			entry.trim();
+		}
+		if (entry.empty())
+			return "entries can't be empty";
+		if (entry[0] == '@' && !IsValidTableName(entry.substr(1)))
+			return "\"" + entry + "\" is not a valid table name";
+		parsed.push_back(std::make_pair(weight, entry));
+	}
+	if (parsed.empty())
+		return "there are no entries";
+	return "";
+}
+
+/** Compile a table so it can be drawn from, using the cached copy if it has already been compiled.
+ * @param chan The channel to look for the table on first, or an empty string to only look in the configuration
+ * @param name The name of the table
+ * @param maxEntries The most results the table can have once references to other tables are flattened
+ * @param visiting The tables that are being compiled further up, to find tables that refer back to themselves
+ * @param compiled Reference to store the compiled table in
+ * @return An empty string if the table was compiled, otherwise the reason it couldn't be
+ *
+ * An entry of @name refers to another table, which is flattened into this one with each of its results taking its share of the entry's
+ * weight, so drawing from a table never has to draw again from the tables it refers to.
+ */
+static Anope::string CompileTable(const Anope::string &chan, const Anope::string &name, unsigned maxEntries, std::set<Anope::string> &visiting,
+	const CompiledTable *&compiled)
+{
+	// A channel's own table takes the place of one from the configuration with the same name
+	Anope::string key = TableKey(chan, name);
+	const Anope::string *entries = NULL;
+	std::map<Anope::string, DiceServTable *>::const_iterator chanTable = chan.empty() ? ChannelTables.end() : ChannelTables.find(key);
+	if (chanTable != ChannelTables.end())
+		entries = &chanTable->second->entries;
+	else
+	{
+		key = TableKey("", name);
+		std::map<Anope::string, Anope::string>::const_iterator configTable = ConfigTables.find(key);
+		if (configTable == ConfigTables.end())
+			return "there is no table named " + name;
+		entries = &configTable->second;
+	}
+
+	std::map<Anope::string, CompiledTable>::const_iterator cached = CompiledTables.find(key);
+	if (cached != CompiledTables.end())
+	{
+		compiled = &cached->second;
+		return "";
+	}
+	if (visiting.count(key))
+		return "table " + name + " refers back to itself";
+
+	std::vector<std::pair<double, Anope::string> > parsed;
+	Anope::string error = ParseEntries(*entries, parsed);
+	if (!error.empty())
+		return "table " + name + " is invalid, " + error;
+
+	visiting.insert(key);
+	CompiledTable table;
+	double total = 0;
+	for (size_t x = 0, len = parsed.size(); x < len; ++x)
+		total += parsed[x].first;
+	for (size_t x = 0, len = parsed.size(); x < len; ++x)
+	{
+		double chance = parsed[x].first / total;
+		const Anope::string &result = parsed[x].second;
+		if (result[0] != '@')
+		{
+			table.chances.push_back(chance);
+			table.results.push_back(result);
+		}
+		else
+		{
+			// Tables from the configuration can only refer to other tables from the configuration
+			const CompiledTable *inner;
+			error = CompileTable(chanTable != ChannelTables.end() ? chan : "", result.substr(1), maxEntries, visiting, inner);
+			if (!error.empty())
+			{
+				visiting.erase(key);
+				return error;
+			}
+			for (size_t y = 0, innerLen = inner->results.size(); y < innerLen; ++y)
+			{
+				table.chances.push_back(chance * inner->chances[y]);
+				table.results.push_back(inner->results[y]);
+			}
+		}
+		if (table.results.size() > maxEntries)
+		{
+			visiting.erase(key);
+			return "table " + name + " would have more than " + stringify(maxEntries) + " entries";
+		}
+	}
+	visiting.erase(key);
+
+	table.alias.Build(table.chances);
+	CompiledTable &stored = CompiledTables[key];
+	stored.chances.swap(table.chances);
+	stored.results.swap(table.results);
+	stored.alias = table.alias;
+	compiled = &stored;
+	return "";
+}
+
+/** Same as above, but for a table on its own.
+ */
+static Anope::string CompileTable(const Anope::string &chan, const Anope::string &name, unsigned maxEntries, const CompiledTable *&compiled)
+{
+	std::set<Anope::string> visiting;
+	return CompileTable(chan, name, maxEntries, visiting, compiled);
+}
+
+/** TABLE command
+ *
+ * Handles drawing a result from a weighted table, either one set on the channel or one from the configuration.
+ */
+class DSTableCommand : public Command
+{
+	unsigned maxEntries;
+
+	/** Get the names of the tables that can be drawn from.
+	 * @param chan The channel to include the tables of, or an empty string for only the tables from the configuration
+	 * @return The names, separated by commas
+	 */
+	static Anope::string TableNames(const Anope::string &chan)
+	{
+		std::set<Anope::string> names;
+		for (std::map<Anope::string, Anope::string>::const_iterator it = ConfigTables.begin(), it_end = ConfigTables.end(); it != it_end; ++it)
+			names.insert(it->first.substr(1));
+		if (!chan.empty())
+		{
+			Anope::string prefix = TableKey(chan, "");
+			for (std::map<Anope::string, DiceServTable *>::const_iterator it = ChannelTables.lower_bound(prefix), it_end = ChannelTables.end();
+				it != it_end && it->first.find(prefix) == 0; ++it)
+				names.insert(it->second->name.lower());
+		}
+		Anope::string list;
+		for (std::set<Anope::string>::const_iterator it = names.begin(), it_end = names.end(); it != it_end; ++it)
+			list += (list.empty() ? "" : ", ") + *it;
+		return list;
+	}
+
+public:
+	DSTableCommand(Module *creator) : Command(creator, "diceserv/table", 1, 3), maxEntries(10000)
+	{
+		this->AllowUnregistered(true);
+		this->RequireUser(true);
+		this->SetDesc(_("Draws a result from a table"));
+		this->SetSyntax(_("\037table\037 [[\037channel\037] \037comment\037]"));
+	}
+
+	void SetMaxEntries(unsigned entries)
+	{
+		this->maxEntries = entries;
+	}
+
+	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
+	{
+		DiceServData data;
+		data.rollPrefix = "Table";
+
+		// The channel is kept aside, as PreParse drops it if the results can't be sent there, but its tables should still be usable
+		Anope::string chan = source.c ? source.c->name : (params.size() > 1 && params[1][0] == '#' ? params[1] : "");
+		if (!DiceServDataHandler->PreParse(data, source, params, 1))
+			return;
+
+		int times = 1;
+		if (!data.timesPart.empty())
+		{
+			times = convertTo<int>(data.timesPart, false);
+			if (data.timesPart != stringify(times) || times < 1 || times > TABLE_MAX_TIMES)
+			{
+				source.Reply(_("The number of times to draw from a table must be a number\nbetween 1 and %d."), TABLE_MAX_TIMES);
+				return;
+			}
+		}
+
+		const CompiledTable *table;
+		Anope::string error = CompileTable(chan, data.dicePart, this->maxEntries, table);
+		if (!error.empty())
+		{
+			if (ConfigTables.count(TableKey("", data.dicePart)) || (!chan.empty() && ChannelTables.count(TableKey(chan, data.dicePart))))
+				source.Reply(_("The table \002%s\002 can't be used, %s."), data.dicePart.c_str(), error.c_str());
+			else
+			{
+				Anope::string names = TableNames(chan);
+				if (names.empty())
+					source.Reply(_("There are no tables to draw from."));
+				else
+					source.Reply(_("There is no table named \002%s\002. The tables you can draw\nfrom are: %s"), data.dicePart.c_str(), names.c_str());
+			}
+			return;
+		}
+
+		if (!DiceServDataHandler->CheckMessageLengthPreProcess(data, source))
+			return;
+
+		// Each draw only takes a single random number, however large the table is
+		std::ostringstream output;
+		output << "<" << data.rollPrefix << " [" << data.diceStr << "]: ";
+		for (int i = 0; i < times; ++i)
+			output << (i ? ", " : "") << table->results[table->alias.Draw(DiceServ->Random())];
+		output << ">";
+		if (!data.commentStr.empty())
+			output << " " << data.commentStr;
+
+		if (!DiceServDataHandler->CheckMessageLengthPostProcess(data, source, output.str()))
+			return;
+		DiceServDataHandler->SendReply(data, source, output.str());
+	}
+
+	bool OnHelp(CommandSource &source, const Anope::string &) anope_override
+	{
+		this->SendSyntax(source);
+		source.Reply(" ");
+		source.Reply(_("Draws a result from the given table, where some results can\n"
+			"be more likely than others. The tables are either set by a\n"
+			"channel's founder (see \002%s%s HELP SET TABLE\002) or\n"
+			"are in %s's configuration. A channel's tables can be\n"
+			"drawn from by giving the channel or by using this command in\n"
+			"the channel. Giving a table that doesn't exist lists the\n"
+			"tables that do."), Config->StrictPrivmsg.c_str(), source.service->nick.c_str(), source.service->nick.c_str());
+		source.Reply(" ");
+		source.Reply(_("To draw more than once, put the number of times and a ~\n"
+			"before the table, up to %d times."), TABLE_MAX_TIMES);
+		source.Reply(" ");
+		source.Reply(_("Examples:\n"
+			"  %s%s TABLE loot #dnd\n"
+			"    Draws a result from the loot table of #dnd.\n"
+			"  %s%s TABLE 3~wildmagic\n"
+			"    Draws 3 results from the wildmagic table."), Config->StrictPrivmsg.c_str(), source.service->nick.c_str(), Config->StrictPrivmsg.c_str(),
+			source.service->nick.c_str());
+		const Anope::string &fantasycharacters = Config->GetModule("fantasy")->Get<const Anope::string>("fantasycharacter", "!");
+		if (!fantasycharacters.empty())
+			source.Reply(_(" \n"
+				"Additionally, if fantasy is enabled, this command can be triggered by using:\n"
+				" \n"
+				"!table \037table\037 [\037comment\037]\n"
+				" \n"
+				"where ! is one of the following characters: %s"), fantasycharacters.c_str());
+		return true;
+	}
+};
+
+/** SET TABLE command
+ *
+ * Sets or removes a table on a registered channel.
+ */
+class DSSetTableCommand : public Command
+{
+	unsigned maxEntries, maxTables;
+
+public:
+	DSSetTableCommand(Module *creator) : Command(creator, "diceserv/set/table", 3, 3), maxEntries(10000), maxTables(20)
+	{
+		this->SetDesc(_("Set or remove a channel's table"));
+		this->SetSyntax(_("\037channel\037 \037table\037 {\037entries\037|OFF}"));
+	}
+
+	void SetLimits(unsigned entries, unsigned tables)
+	{
+		this->maxEntries = entries;
+		this->maxTables = tables;
+	}
+
+	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
+	{
+		if (Anope::ReadOnly)
+		{
+			source.Reply(_("Sorry, dice table setting is temporarily disabled."));
+			return;
+		}
+		const Anope::string &chan = params[0], &name = params[1], &entries = params[2];
+		// Tables are kept in the database, so they can only be set on registered channels
+		ChannelInfo *ci = ChannelInfo::Find(chan);
+		if (!ci)
+		{
+			source.Reply(CHAN_X_NOT_REGISTERED, chan.c_str());
+			return;
+		}
+		if (!source.HasCommand("diceserv/set") && !(ci->HasExt("SECUREFOUNDER") ? source.IsFounder(ci) : source.AccessFor(ci).HasPriv("FOUNDER")))
+		{
+			source.Reply(ACCESS_DENIED);
+			return;
+		}
+		if (!IsValidTableName(name))
+		{
+			source.Reply(_("Table names can only have letters, numbers, dashes and\nunderscores, and can be at most 32 characters long."));
+			return;
+		}
+
+		std::map<Anope::string, DiceServTable *>::iterator it = ChannelTables.find(TableKey(ci->name, name));
+		DiceServTable *table = it != ChannelTables.end() ? it->second : NULL;
+		if (entries.equals_ci("OFF"))
+		{
+			if (!table)
+			{
+				source.Reply(_("\037%s\037 has no table named \002%s\002."), ci->name.c_str(), name.c_str());
+				return;
+			}
+			delete table;
+			CompiledTables.clear();
+			source.Reply(_("The table \002%s\002 has been removed from \037%s\037."), name.c_str(), ci->name.c_str());
+			return;
+		}
+
+		if (!table)
+		{
+			Anope::string prefix = TableKey(ci->name, "");
+			unsigned count = 0;
+			for (it = ChannelTables.lower_bound(prefix); it != ChannelTables.end() && it->first.find(prefix) == 0; ++it)
+				++count;
+			if (count >= this->maxTables)
+			{
+				source.Reply(_("\037%s\037 already has the most tables it can have (%u)."), ci->name.c_str(), this->maxTables);
+				return;
+			}
+		}
+
+		// The table is compiled right away, so a table that refers to a missing table or back to itself is never kept
+		Anope::string oldEntries = table ? table->entries : "";
+		if (table)
+			table->entries = entries;
+		else
+			table = new DiceServTable(ci->name, name, entries);
+		CompiledTables.clear();
+		const CompiledTable *compiled;
+		Anope::string error = CompileTable(ci->name, name, this->maxEntries, compiled);
+		if (!error.empty())
+		{
+			if (oldEntries.empty())
+				delete table;
+			else
+				table->entries = oldEntries;
+			CompiledTables.clear();
+			source.Reply(_("The table couldn't be set, %s."), error.c_str());
+			return;
+		}
+		table->QueueUpdate();
+		source.Reply(_("The table \002%s\002 has been set on \037%s\037 with %u results."), name.c_str(), ci->name.c_str(),
+			static_cast<unsigned>(compiled->results.size()));
+	}
+
+	bool OnHelp(CommandSource &source, const Anope::string &) anope_override
+	{
+		this->SendSyntax(source);
+		source.Reply(" ");
+		source.Reply(_("Sets a table on a channel that can be drawn from with\n"
+			"\002%s%s HELP TABLE\002, or removes it if OFF is given.\n"
+			"Only the channel's founder (or someone with founder-level\n"
+			"access) can use this option, and the channel must be\n"
+			"registered. A channel can have up to %u tables."), Config->StrictPrivmsg.c_str(), source.service->nick.c_str(), this->maxTables);
+		source.Reply(" ");
+		source.Reply(_("The entries are separated by |, and each can start with a\n"
+			"weight and a : to make it more likely, the weight being 1 if\n"
+			"left off. An entry of @\037table\037 draws from another table,\n"
+			"either one of the channel's or one from the configuration.\n"
+			"Including any other tables, a table can have up to %u\n"
+			"results."), this->maxEntries);
+		source.Reply(" ");
+		source.Reply(_("Example:\n"
+			"  %s%s SET TABLE #dnd loot 10:Gold coins|3:A gem|1:@magicitems\n"
+			"    Sets a loot table on #dnd that gives gold coins 10 times as\n"
+			"    often as it draws from the magicitems table."), Config->StrictPrivmsg.c_str(), source.service->nick.c_str());
+		return true;
+	}
+};
+
+class DSTable : public DiceServModule
+{
+	/** Deletes the channels' tables when the module is unloaded. This has to happen after the type below is gone, so that the tables are
+	 * only taken out of memory and not out of the database.
+	 */
+	struct TableDeleter
+	{
+		~TableDeleter()
+		{
+			while (!ChannelTables.empty())
+				delete ChannelTables.begin()->second;
+			CompiledTables.clear();
+			ConfigTables.clear();
+		}
+	} table_deleter;
+	DSTableCommand table_cmd;
+	DSSetTableCommand set_table_cmd;
+	Serialize::Type table_type;
+
+public:
+	DSTable(const Anope::string &modname, const Anope::string &creator) : DiceServModule(modname, creator), table_deleter(), table_cmd(this), set_table_cmd(this),
+		table_type("DiceServTable", DiceServTable::Unserialize)
+	{
+		this->Require(DiceServ, "DiceServ");
+		this->Require(DiceServDataHandler, "DiceServ's data handler");
+	}
+
+	void OnReload(Configuration::Conf *conf) anope_override
+	{
+		Configuration::Block *block = conf->GetModule(this);
+		unsigned maxEntries = block->Get<unsigned>("maxentries", "10000");
+		this->table_cmd.SetMaxEntries(maxEntries);
+		this->set_table_cmd.SetLimits(maxEntries, block->Get<unsigned>("maxtables", "20"));
+
+		std::map<Anope::string, Anope::string> tables;
+		for (int i = 0, count = block->CountBlock("table"); i < count; ++i)
+		{
+			Configuration::Block *table = block->GetBlock("table", i);
+			const Anope::string &name = table->Get<const Anope::string>("name");
+			if (!IsValidTableName(name))
+				throw ConfigException(this->name + ": table name \"" + name + "\" is invalid");
+			tables[TableKey("", name)] = table->Get<const Anope::string>("entries");
+		}
+
+		// Every table from the configuration is compiled now, both to catch mistakes and so they don't have to be compiled on their first use
+		ConfigTables.swap(tables);
+		CompiledTables.clear();
+		for (std::map<Anope::string, Anope::string>::const_iterator it = ConfigTables.begin(), it_end = ConfigTables.end(); it != it_end; ++it)
+		{
+			const CompiledTable *compiled;
+			Anope::string error = CompileTable("", it->first.substr(1), maxEntries, compiled);
+			if (!error.empty())
+			{
+				ConfigTables.swap(tables);
+				CompiledTables.clear();
+				throw ConfigException(this->name + ": " + error);
+			}
+		}
+	}
+
+	void OnDelChan(ChannelInfo *ci) anope_override
+	{
+		Anope::string prefix = TableKey(ci->name, "");
+		std::map<Anope::string, DiceServTable *>::iterator it;
+		while ((it = ChannelTables.lower_bound(prefix)) != ChannelTables.end() && it->first.find(prefix) == 0)
+			delete it->second;
+		CompiledTables.clear();
+	}
+};
+
+MODULE_INIT(DSTable)